@@ -72,7 +72,7 @@ int main(int argc, char* argv[])
         ("gain", po::value<double>(&gain), "gain for the RF chain")
         ("lo-offset", po::value<double>(&lo_offset),"Offset for frontend LO in Hz (optional)")
         // ("continue", "don't abort on a bad packet")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("port", po::value<uint16_t>(&port)->default_value(50300), "VRT ZMQ port")
         // ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
@@ -103,9 +103,8 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_PUB);
     // int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    int rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
     // zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // Sleep setup time
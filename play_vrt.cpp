@@ -258,9 +258,8 @@ int main(int argc, char* argv[])
     // ZMQ
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_PUB);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    int rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
 
     // stdin binary
     if (read_stdin)
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include <sys/time.h>
 
@@ -114,10 +115,10 @@ bool transaction(const unsigned char *cmd, size_t size, std::vector<unsigned cha
 int main(int argc, char* argv[])
 {
     // variables to be set by po
-    std::string udp_forward, ref, sdrhost;
+    std::string udp_forward, ref, sdrhost, bind_address;
     size_t total_num_samps;
     uint16_t port;
-    uint32_t stream_id;
+    uint32_t stream_id, samples_per_packet;
     int hwm;
     int16_t gain;
     double rate, freq, bw, total_time, setup_time, lo_offset;
@@ -149,7 +150,10 @@ int main(int argc, char* argv[])
         ("sdr", po::value<std::string>(&sdrhost)->default_value("cloudsdr"), "RFSPACE SDR hostname")
         // ("stream-id", po::value<uint32_t>(&stream_id), "VRT Stream ID")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
+        ("shm", "also publish the stream in shared memory for clients on this host")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("samples-per-packet", po::value<uint32_t>(&samples_per_packet)->default_value(VRT_SAMPLES_PER_PACKET), "samples per VRT data packet")
     ;
     // clang-format on
     po::variables_map vm;
@@ -170,10 +174,14 @@ int main(int argc, char* argv[])
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
     bool continue_on_bad_packet = vm.count("continue") > 0;
+    bool shm                    = vm.count("shm") > 0;
     // bool vrt                    = vm.count("vrt") > 0;
     // bool zmq                    = vm.count("zmq") > 0;
     bool enable_udp             = vm.count("udp") > 0;
 
+    if (not vrt_check_samples_per_packet(samples_per_packet))
+        return EXIT_FAILURE;
+
     // SETUP
     #define HEADER_SIZE 2
     #define SEQNUM_SIZE 2
@@ -338,13 +346,13 @@ int main(int argc, char* argv[])
 
  	// Receive
 
-	size_t samps_per_buff = 10000; // spb
+	size_t samps_per_buff = samples_per_packet; // spb
 
 	unsigned long long num_requested_samples = total_num_samps;
     double time_requested = total_time;
     bool int_second             = (bool)vm.count("int-second");
 
-    uint32_t buffer[VRT_DATA_PACKET_SIZE];
+    uint32_t buffer[ZMQ_BUFFER_SIZE];
    
     bool first_frame = true;
 
@@ -357,7 +365,7 @@ int main(int argc, char* argv[])
     }
 
     /* VRT init */
-    vrt_init_data_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
     
     // Only 1 channel
     p.fields.stream_id = 1;
@@ -372,15 +380,18 @@ int main(int argc, char* argv[])
     int rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
     assert(rc == 0);
 
-    std::string connect_string = "tcp://*:" + std::to_string(port);
-    rc = zmq_bind(responder, connect_string.c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, port))
+        return 1;
     zmq_server = responder;
 
+    vrt_shm_writer_type* shm_writer = NULL;
+    if (shm and (shm_writer = vrt_shm_create(port, samples_per_packet)) == NULL)
+        return EXIT_FAILURE;
+
     // Control
     responder = zmq_socket(context, ZMQ_SUB);
-    rc = zmq_bind(responder, "tcp://*:50300");
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, 50300))
+        return 1;
     zmq_control = responder;
     zmq_setsockopt(zmq_control, ZMQ_SUBSCRIBE, "", 0);
 
@@ -444,12 +455,14 @@ int main(int argc, char* argv[])
     uint32_t num_words_read=0;
     uint32_t last_num_rx = 0;
 
-    int16_t bodydata[samps_per_buff*2];
-
-    // Create a circular buffer with a capacity for tbd.
-	boost::circular_buffer<int16_t> cb(samps_per_buff*4*2);
+    vrt_tx_pool_type* tx_pool = vrt_tx_pool_create(samples_per_packet);
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
 
     unsigned char data[1024*2];
+
+    // Create a circular buffer with a capacity for a UDP packet on top of a pending VRT packet
+	boost::circular_buffer<int16_t> cb(std::max<size_t>(samps_per_buff*4*2, samps_per_buff*2+sizeof(data)));
     uint16_t prev_sequence = 0;
 
     // Trigger
@@ -564,13 +577,15 @@ int main(int argc, char* argv[])
 
             pc.if_context.state_and_event_indicators.calibrated_time = (bool)(vm.count("pps")) ? true : false;
 
-            int32_t rv = vrt_write_packet(&pc, buffer, VRT_DATA_PACKET_SIZE, true);
+            int32_t rv = vrt_write_packet(&pc, buffer, ZMQ_BUFFER_SIZE, true);
             if (rv < 0) {
                 fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
             }
 
             // ZMQ
             zmq_send (zmq_server, buffer, rv*4, 0);
+            if (shm_writer)
+                vrt_shm_publish(shm_writer, buffer, rv*4);
 
             if (enable_udp) {
                 if (sendto(vrt_sockfd, buffer, rv*4, 0,
@@ -611,6 +626,10 @@ int main(int argc, char* argv[])
 
             timeradd(&time_first_sample, &interval_time, &vrt_time);
 
+	        // samples go straight into the outgoing packet
+	        vrt_tx_begin(tx_pool, &tx);
+	        int16_t* bodydata = reinterpret_cast<int16_t*>(tx.samples);
+
 	        for (uint32_t i = 0; i < 2*samps_per_buff; i++) {
     			bodydata[i] = (int16_t)cb.front();
                 cb.pop_front();
@@ -618,33 +637,67 @@ int main(int argc, char* argv[])
    
 	        num_total_samps += num_words_read;
 
-	        p.body = bodydata;
+	        if (bw_summary) {
+	            last_update_samps += num_words_read;
+	            const auto time_since_last_update = now - last_update;
+	            if (time_since_last_update > std::chrono::seconds(1)) {
+
+	                const double time_since_last_update_s =
+	                    std::chrono::duration<double>(time_since_last_update).count();
+	                const double rate = double(last_update_samps) / time_since_last_update_s;
+	                std::cout << "\t" << (rate / 1e6) << " Msps, ";
+	                
+	                last_update_samps = 0;
+	                last_update       = now;
+
+	                float sum_i = 0;
+	                uint32_t clip_i = 0;
+
+	                double datatype_max = 32768.;
+
+	                for (int i=0; i<samps_per_buff; i++ ) {
+	                    auto sample_i = get_abs_val(bodydata[2*i]);
+	                    sum_i += sample_i;
+	                    if (sample_i > datatype_max*0.99)
+	                        clip_i++;
+	                }
+	                sum_i = sum_i/samps_per_buff;
+	                std::cout << boost::format("%.0f") % (100.0*log2(sum_i)/log2(datatype_max)) << "% I (";
+	                std::cout << boost::format("%.0f") % ceil(log2(sum_i)+1) << " of ";
+	                std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
+	                std::cout << "" << boost::format("%.0f") % (100.0*clip_i/samps_per_buff) << "% I clip.";
+	                std::cout << std::endl;
+
+	            }
+	        }
+
 	        p.header.packet_count = (uint8_t)frame_count%16;
 	        p.fields.integer_seconds_timestamp = vrt_time.tv_sec;
 	        p.fields.fractional_seconds_timestamp = 1e6*vrt_time.tv_usec;
-	
-	        zmq_msg_t msg;
-	        int rc = zmq_msg_init_size (&msg, VRT_DATA_PACKET_SIZE*4);
 
-	        int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE, true);
-
-	        // UDP
-	        if (enable_udp) {
-	            if (sendto(sockfd, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE*4, 0,
-	                         (struct sockaddr *)&vrt_servaddr, sizeof(vrt_servaddr)) < 0)
-	            {
-	               printf("UDP fail\n");
+	        zmq_msg_t msg;
+	        if (vrt_tx_finish(&p, &tx, samps_per_buff, &msg)) {
+
+	            // UDP
+	            if (enable_udp) {
+	                if (sendto(sockfd, zmq_msg_data(&msg), zmq_msg_size(&msg), 0,
+	                             (struct sockaddr *)&vrt_servaddr, sizeof(vrt_servaddr)) < 0)
+	                {
+	                   printf("UDP fail\n");
+	                }
 	            }
-	        }
 
-	        zmq_msg_send(&msg, zmq_server, 0);
+	            if (shm_writer)
+	                vrt_shm_publish(shm_writer, &msg);
+	            zmq_msg_send(&msg, zmq_server, 0);
 
-	        zmq_msg_close(&msg);
+	            zmq_msg_close(&msg);
+	        }
 
             frame_count++;
 
             // Control 
-            int len = zmq_recv(zmq_control, buffer, 100000, ZMQ_NOBLOCK);
+            int len = zmq_recv(zmq_control, buffer, sizeof(buffer), ZMQ_NOBLOCK);
             if (len > 0) {
                 printf("-> Control context received\n");
 
@@ -757,40 +810,6 @@ int main(int argc, char* argv[])
                 transaction( status_pkt, sizeof(status_pkt), response );
                 last_keepalive = now;
             }
-        
-	        if (bw_summary) {
-	            last_update_samps += num_words_read;
-	            const auto time_since_last_update = now - last_update;
-	            if (time_since_last_update > std::chrono::seconds(1)) {
-
-	                const double time_since_last_update_s =
-	                    std::chrono::duration<double>(time_since_last_update).count();
-	                const double rate = double(last_update_samps) / time_since_last_update_s;
-	                std::cout << "\t" << (rate / 1e6) << " Msps, ";
-	                
-	                last_update_samps = 0;
-	                last_update       = now;
-
-	                float sum_i = 0;
-	                uint32_t clip_i = 0;
-
-	                double datatype_max = 32768.;
-
-	                for (int i=0; i<10000; i++ ) {
-	                    auto sample_i = get_abs_val(bodydata[2*i]);
-	                    sum_i += sample_i;
-	                    if (sample_i > datatype_max*0.99)
-	                        clip_i++;
-	                }
-	                sum_i = sum_i/10000;
-	                std::cout << boost::format("%.0f") % (100.0*log2(sum_i)/log2(datatype_max)) << "% I (";
-	                std::cout << boost::format("%.0f") % ceil(log2(sum_i)+1) << " of ";
-	                std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
-	                std::cout << "" << boost::format("%.0f") % (100.0*clip_i/10000) << "% I clip.";
-	                std::cout << std::endl;
-
-	            }
-	        }
 	    }
 
     }
@@ -813,6 +832,10 @@ int main(int argc, char* argv[])
     }
   
     /* clean up */
+    vrt_tx_abort(&tx);
+    vrt_tx_pool_destroy(tx_pool);
+    vrt_shm_destroy(shm_writer);
+
     // close the socket
     close(sockfd);
 
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include <assert.h>
@@ -83,10 +84,10 @@ inline float get_abs_val(std::complex<int8_t> t)
 int main(int argc, char* argv[])
 {
     // variables to be set by po
-    std::string merge_address, dev_given;
+    std::string merge_address, bind_address, dev_given;
     size_t total_num_samps = 0;
     uint16_t instance, port, merge_port;
-    uint32_t stream_id;
+    uint32_t stream_id, samples_per_packet;
     int hwm, gain;
     double rate, freq, total_time, setup_time, if_freq;
     bool merge;
@@ -110,11 +111,14 @@ int main(int argc, char* argv[])
         ("bias-tee", "Enable Bias Tee power")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
+        ("shm", "also publish the stream in shared memory for clients on this host")
         ("merge", po::value<bool>(&merge)->default_value(true), "Merge another VRT ZMQ stream (SUB connect)")
         ("merge-port", po::value<uint16_t>(&merge_port)->default_value(50011), "VRT ZMQ merge port")
         ("merge-address", po::value<std::string>(&merge_address)->default_value("localhost"), "VRT ZMQ merg address")
 
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("samples-per-packet", po::value<uint32_t>(&samples_per_packet)->default_value(VRT_SAMPLES_PER_PACKET), "samples per VRT data packet")
     ;
     // clang-format on
     po::variables_map vm;
@@ -135,12 +139,16 @@ int main(int argc, char* argv[])
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
     bool continue_on_bad_packet = vm.count("continue") > 0;
+    bool shm                    = vm.count("shm") > 0;
     bool bias_tee               = vm.count("bias-tee") > 0;
 
+    if (not vrt_check_samples_per_packet(samples_per_packet))
+        return EXIT_FAILURE;
+
     /* VRT init */
     struct vrt_packet p;
     vrt_init_packet(&p);
-    vrt_init_data_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
     
     p.fields.stream_id = 1;
 
@@ -160,17 +168,19 @@ int main(int argc, char* argv[])
     int rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
     assert(rc == 0);
 
-    std::string connect_string = "tcp://*:" + std::to_string(main_port);
-    rc = zmq_bind(responder, connect_string.c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, main_port))
+        return 1;
     zmq_server = responder;
 
+    vrt_shm_writer_type* shm_writer = NULL;
+    if (shm and (shm_writer = vrt_shm_create(main_port, samples_per_packet)) == NULL)
+        return EXIT_FAILURE;
+
     // Merge
     void *merge_zmq = zmq_socket(context, ZMQ_SUB);
     if (merge) {
-        connect_string = "tcp://" + merge_address + ":" + std::to_string(merge_port);
-        rc = zmq_connect(merge_zmq, connect_string.c_str());
-        assert(rc == 0);
+        if (not vrt_connect(merge_zmq, merge_address, merge_port))
+            return 1;
         zmq_setsockopt(merge_zmq, ZMQ_SUBSCRIBE, "", 0);
     }
 
@@ -253,13 +263,13 @@ int main(int argc, char* argv[])
         std::cout << "Press Ctrl + C to stop streaming..." << std::endl;
     }
 
-	size_t samps_per_buff = VRT_SAMPLES_PER_PACKET;
+	size_t samps_per_buff = samples_per_packet;
 
 	unsigned long long num_requested_samples = total_num_samps;
     double time_requested = total_time;
     bool int_second             = (bool)vm.count("int-second");
 
-    uint32_t buffer[SIZE];
+    uint32_t buffer[ZMQ_BUFFER_SIZE];
    
     bool first_frame = true;
 
@@ -297,14 +307,16 @@ int main(int argc, char* argv[])
     int32_t status=0;
     uint32_t num_words_read=0;
 
-    int16_t bodydata[samps_per_buff*2];
+    vrt_tx_pool_type* tx_pool = vrt_tx_pool_create(samples_per_packet);
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
 
-    // Create a circular buffer with a capacity for xxx.
-	boost::circular_buffer<int8_t> cb(samps_per_buff*3*2);
+    // Create a circular buffer with a capacity for a full read on top of a pending packet
+	boost::circular_buffer<int8_t> cb(std::max<size_t>(samps_per_buff*3*2, samps_per_buff*2+out_block_size));
 
     // flush merge queue
     if (merge)
-        while ( zmq_recv(merge_zmq, buffer, 100000, ZMQ_NOBLOCK) > 0 ) { }
+        while ( zmq_recv(merge_zmq, buffer, sizeof(buffer), ZMQ_NOBLOCK) > 0 ) { }
 
     while (not stop_signal_called) {
  
@@ -336,6 +348,10 @@ int main(int argc, char* argv[])
 		            first_frame = false;
 		        }
 
+	        	// samples go straight into the outgoing packet
+	        	vrt_tx_begin(tx_pool, &tx);
+	        	int16_t* bodydata = reinterpret_cast<int16_t*>(tx.samples);
+
 	        	int8_t this_sample;
 		        for (uint32_t i = 0; i < 2*samps_per_buff; i++) {
 		        	this_sample = cb.front();
@@ -345,21 +361,48 @@ int main(int argc, char* argv[])
 	   
 		        num_total_samps += num_words_read;
 
-		        p.body = bodydata;
+		        if (bw_summary) {
+		            last_update_samps += num_words_read;
+		            const auto time_since_last_update = now - last_update;
+		            if (time_since_last_update > std::chrono::seconds(1)) {
+
+		                const double time_since_last_update_s =
+		                    std::chrono::duration<double>(time_since_last_update).count();
+		                const double rate = double(last_update_samps) / time_since_last_update_s;
+		                std::cout << "\t" << (rate / 1e6) << " Msps, ";
+		                
+		                last_update_samps = 0;
+		                last_update       = now;
+
+		                float sum_i = 0;
+		                uint32_t clip_i = 0;
+
+		                double datatype_max = 128.;
+
+		                for (int i=0; i<samps_per_buff; i++ ) {
+		                    auto sample_i = get_abs_val(bodydata[2*i]);
+		                    sum_i += sample_i;
+		                    if (sample_i > datatype_max*0.99)
+		                        clip_i++;
+		                }
+		                sum_i = sum_i/samps_per_buff;
+		                std::cout << boost::format("%.0f") % (100.0*log2(sum_i)/log2(datatype_max)) << "% I (";
+		                std::cout << boost::format("%.0f") % ceil(log2(sum_i)+1) << " of ";
+		                std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
+		                std::cout << "" << boost::format("%.0f") % (100.0*clip_i/samps_per_buff) << "% I clip.";
+		                std::cout << std::endl;
+
+		            }
+		        }
+
 		        p.header.packet_count = (uint8_t)frame_count%16;
 		        p.fields.integer_seconds_timestamp = time_now.tv_sec;
 		        p.fields.fractional_seconds_timestamp = 1e6*time_now.tv_usec;
-		
-		        zmq_msg_t msg;
-		        int rc = zmq_msg_init_size (&msg, SIZE*4);
-
-		        int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), SIZE, true);
 
 		        frame_count++;
 
 		        // VRT
-		        zmq_msg_send(&msg, zmq_server, 0);
-		        zmq_msg_close(&msg);
+		        vrt_tx_send(&p, &tx, samps_per_buff, zmq_server, shm_writer);
 
 		        const auto time_since_last_context = now - last_context;
 		        if (time_since_last_context > std::chrono::milliseconds(200)) {
@@ -392,63 +435,32 @@ int main(int argc, char* argv[])
 
 		            pc.if_context.state_and_event_indicators.calibrated_time = false;
 
-		            int32_t rv = vrt_write_packet(&pc, buffer, SIZE, true);
+		            int32_t rv = vrt_write_packet(&pc, buffer, ZMQ_BUFFER_SIZE, true);
 		            if (rv < 0) {
 		                fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
 		            }
 
 		            // ZMQ
                     zmq_send (zmq_server, buffer, rv*4, 0);
+                    if (shm_writer)
+                        vrt_shm_publish(shm_writer, buffer, rv*4);
 
 		        }
-	        
-		        if (bw_summary) {
-		            last_update_samps += num_words_read;
-		            const auto time_since_last_update = now - last_update;
-		            if (time_since_last_update > std::chrono::seconds(1)) {
-
-		                const double time_since_last_update_s =
-		                    std::chrono::duration<double>(time_since_last_update).count();
-		                const double rate = double(last_update_samps) / time_since_last_update_s;
-		                std::cout << "\t" << (rate / 1e6) << " Msps, ";
-		                
-		                last_update_samps = 0;
-		                last_update       = now;
-
-		                float sum_i = 0;
-		                uint32_t clip_i = 0;
-
-		                double datatype_max = 128.;
-
-		                for (int i=0; i<10000; i++ ) {
-		                    auto sample_i = get_abs_val(bodydata[2*i]);
-		                    sum_i += sample_i;
-		                    if (sample_i > datatype_max*0.99)
-		                        clip_i++;
-		                }
-		                sum_i = sum_i/10000;
-		                std::cout << boost::format("%.0f") % (100.0*log2(sum_i)/log2(datatype_max)) << "% I (";
-		                std::cout << boost::format("%.0f") % ceil(log2(sum_i)+1) << " of ";
-		                std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
-		                std::cout << "" << boost::format("%.0f") % (100.0*clip_i/10000) << "% I clip.";
-		                std::cout << std::endl;
-
-		            }
-		        }
 		    }
 		}
 
         // Merge
         if (merge) {
             int mergelen;
-            while ( (mergelen = zmq_recv(merge_zmq, buffer, 100000, ZMQ_NOBLOCK)) > 0  ) {
-                // zmq_send (zmq_server, buffer, mergelen, 0);
-                zmq_msg_t msg;
-                zmq_msg_init_size (&msg, mergelen);
-                memcpy (zmq_msg_data(&msg), buffer, mergelen);
+            zmq_msg_t msg;
+            zmq_msg_init (&msg);
+            // forward the received message as is
+            while ( (mergelen = zmq_msg_recv(&msg, merge_zmq, ZMQ_NOBLOCK)) > 0  ) {
+                if (shm_writer)
+                    vrt_shm_publish(shm_writer, &msg);
                 zmq_msg_send(&msg, zmq_server, 0);
-                zmq_msg_close(&msg);
             }
+            zmq_msg_close(&msg);
         }
 
     }
@@ -468,6 +480,9 @@ int main(int argc, char* argv[])
     }
   
      /* clean up */
+    vrt_tx_abort(&tx);
+    vrt_tx_pool_destroy(tx_pool);
+    vrt_shm_destroy(shm_writer);
     rtlsdr_set_bias_tee(dev, false);
     rtlsdr_close(dev);
 
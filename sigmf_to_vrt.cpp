@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include <sys/time.h>
 
@@ -82,9 +83,9 @@ inline float get_abs_val(std::complex<int8_t> t)
 int main(int argc, char* argv[])
 {
     // variables to be set by po
-    std::string udp_forward, ref, file, time_cal, type, start_time_str;
+    std::string udp_forward, ref, file, time_cal, type, start_time_str, bind_address;
     uint16_t port;
-    uint32_t stream_id;
+    uint32_t stream_id, samples_per_packet;
     int hwm;
     int16_t gain;
     double datarate;
@@ -109,7 +110,10 @@ int main(int argc, char* argv[])
         ("vrt", "read VRT stream from file")
         ("repeat", "repeat the input file")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
+        ("shm", "also publish the stream in shared memory for clients on this host")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("samples-per-packet", po::value<uint32_t>(&samples_per_packet)->default_value(VRT_SAMPLES_PER_PACKET), "samples per VRT data packet")
     ;
 
     // clang-format on
@@ -134,10 +138,14 @@ int main(int argc, char* argv[])
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
     bool continue_on_bad_packet = vm.count("continue") > 0;
+    bool shm                    = vm.count("shm") > 0;
     bool dual_chan              = vm.count("dual-chan") > 0;
     bool repeat                 = vm.count("repeat") > 0;
     bool vrt                    = vm.count("vrt") > 0;
 
+    if (not vrt_check_samples_per_packet(samples_per_packet))
+        return EXIT_FAILURE;
+
     struct timeval time_now{};
     gettimeofday(&time_now, nullptr);
 
@@ -212,7 +220,7 @@ int main(int argc, char* argv[])
         read_ptr_2 = fopen(data_filename_2.c_str(),"rb");  // r for read, b for binary
     }
 
-    size_t samps_per_buff = VRT_SAMPLES_PER_PACKET;
+    size_t samps_per_buff = samples_per_packet;
 
     double time_requested = total_time;
 
@@ -229,7 +237,7 @@ int main(int argc, char* argv[])
     }
 
     /* VRT init */
-    vrt_init_data_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
 
     // p.fields.stream_id = stream_id;
 
@@ -241,11 +249,14 @@ int main(int argc, char* argv[])
     int rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
     assert(rc == 0);
 
-    std::string connect_string = "tcp://*:" + std::to_string(port);
-    rc = zmq_bind(responder, connect_string.c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, port))
+        return 1;
     zmq_server = responder;
 
+    vrt_shm_writer_type* shm_writer = NULL;
+    if (shm and (shm_writer = vrt_shm_create(port, samples_per_packet)) == NULL)
+        return EXIT_FAILURE;
+
     // Sleep setup time
     std::this_thread::sleep_for(std::chrono::milliseconds(int64_t(1000 * setup_time)));
 
@@ -268,7 +279,12 @@ int main(int argc, char* argv[])
     uint32_t num_words_read=0;
 
     uint32_t first_word;
-    std::complex<short> samples[samps_per_buff];
+    // VRT files are copied packet by packet, up to the largest packet size.
+    // Otherwise samples are read straight into the outgoing packets.
+    std::vector<uint32_t> vrt_buffer(vrt ? VRT_DATA_PACKET_SIZE_FOR(VRT_MAX_SAMPLES_PER_PACKET) : 0);
+    vrt_tx_pool_type* tx_pool = vrt_tx_pool_create(samples_per_packet);
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
 
     timeval time_first_sample;
 
@@ -334,6 +350,8 @@ int main(int argc, char* argv[])
                 fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
             }
             zmq_send (zmq_server, buffer, rv*4, 0);
+            if (shm_writer)
+                vrt_shm_publish(shm_writer, buffer, rv*4);
 
             if (dual_chan) {
                 // duplicate context of channel 0 on channel 1
@@ -343,13 +361,18 @@ int main(int argc, char* argv[])
                     fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
                 }
                 zmq_send (zmq_server, buffer, rv*4, 0);
+                if (shm_writer)
+                    vrt_shm_publish(shm_writer, buffer, rv*4);
             }
 
         }
 
         // Read
 
-        if (not vrt and fread(samples, sizeof(samples), 1, read_ptr) == 1) {
+        if (not vrt)
+            vrt_tx_begin(tx_pool, &tx);
+
+        if (not vrt and fread(tx.samples, samps_per_buff*sizeof(std::complex<short>), 1, read_ptr) == 1) {
 
             num_words_read = samps_per_buff;
 
@@ -371,45 +394,6 @@ int main(int argc, char* argv[])
                 first_frame = false;
             }
 
-            p.fields.stream_id = 1;
-            p.body = samples;
-            p.header.packet_count = (uint8_t)frame_count%16;
-            p.fields.integer_seconds_timestamp = vrt_time.tv_sec;
-            p.fields.fractional_seconds_timestamp = 1e6*vrt_time.tv_usec;
-
-            zmq_msg_t msg;
-            int rc = zmq_msg_init_size (&msg, VRT_DATA_PACKET_SIZE*4);
-
-            int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE, true);
-
-            zmq_msg_send(&msg, zmq_server, 0);
-            zmq_msg_close(&msg);
-
-            if (dual_chan) {
-                if (fread(samples, sizeof(samples), 1, read_ptr_2) == 1) {
-                    p.fields.stream_id = 2;
-                    p.body = samples;
-                    p.header.packet_count = (uint8_t)frame_count%16;
-                    p.fields.integer_seconds_timestamp = vrt_time.tv_sec;
-                    p.fields.fractional_seconds_timestamp = 1e6*vrt_time.tv_usec;
-
-                    zmq_msg_t msg;
-                    int rc = zmq_msg_init_size (&msg, VRT_DATA_PACKET_SIZE*4);
-
-                    int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE, true);
-
-                    zmq_msg_send(&msg, zmq_server, 0);
-                    zmq_msg_close(&msg);
-                } else {
-                    if (repeat)
-                        rewind(read_ptr_2);
-                    else
-                        break;
-                }
-            }
-
-            frame_count++;
-
             if (bw_summary) {
                 last_update_samps += num_words_read;
                 const auto time_since_last_update = now - last_update;
@@ -429,28 +413,56 @@ int main(int argc, char* argv[])
                     double datatype_max = 32768.;
 
                     for (int i=0; i<samps_per_buff; i++ ) {
-                        auto sample_i = get_abs_val(samples[i]);
+                        auto sample_i = get_abs_val(tx.samples[i]);
                         sum_i += sample_i;
                         if (sample_i > datatype_max*0.99)
                             clip_i++;
                     }
-                    sum_i = sum_i/10000;
+                    sum_i = sum_i/samps_per_buff;
                     std::cout << boost::format("%.0f") % (100.0*log2(sum_i)/log2(datatype_max)) << "% I (";
                     std::cout << boost::format("%.0f") % ceil(log2(sum_i)+1) << " of ";
                     std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
-                    std::cout << "" << boost::format("%.0f") % (100.0*clip_i/10000) << "% I clip.";
+                    std::cout << "" << boost::format("%.0f") % (100.0*clip_i/samps_per_buff) << "% I clip.";
                     std::cout << std::endl;
 
                 }
             }
+
+            p.fields.stream_id = 1;
+            p.header.packet_count = (uint8_t)frame_count%16;
+            p.fields.integer_seconds_timestamp = vrt_time.tv_sec;
+            p.fields.fractional_seconds_timestamp = 1e6*vrt_time.tv_usec;
+
+            vrt_tx_send(&p, &tx, samps_per_buff, zmq_server, shm_writer);
+
+            if (dual_chan) {
+                vrt_tx_begin(tx_pool, &tx);
+                if (fread(tx.samples, samps_per_buff*sizeof(std::complex<short>), 1, read_ptr_2) == 1) {
+                    p.fields.stream_id = 2;
+                    p.header.packet_count = (uint8_t)frame_count%16;
+                    p.fields.integer_seconds_timestamp = vrt_time.tv_sec;
+                    p.fields.fractional_seconds_timestamp = 1e6*vrt_time.tv_usec;
+
+                    vrt_tx_send(&p, &tx, samps_per_buff, zmq_server, shm_writer);
+                } else {
+                    if (repeat)
+                        rewind(read_ptr_2);
+                    else
+                        break;
+                }
+            }
+
+            frame_count++;
         } else if (vrt and fread(&first_word, sizeof(first_word), 1, read_ptr) == 1) {
             uint16_t words = ntohl(first_word);
             uint32_t type = ntohl(first_word)>>28;
             if (type == 1)
                 frame_count++;
             fseek(read_ptr, -sizeof(uint32_t), SEEK_CUR );
-            fread(samples, words*sizeof(uint32_t), 1, read_ptr);
-            zmq_send (zmq_server, samples, words*sizeof(uint32_t), 0);
+            fread(vrt_buffer.data(), words*sizeof(uint32_t), 1, read_ptr);
+            zmq_send (zmq_server, vrt_buffer.data(), words*sizeof(uint32_t), 0);
+            if (shm_writer)
+                vrt_shm_publish(shm_writer, vrt_buffer.data(), words*sizeof(uint32_t));
         } else {
             printf("no more samples in data file\n");
             if (repeat)
@@ -476,6 +488,9 @@ int main(int argc, char* argv[])
     }
 
     /* clean up */
+    vrt_tx_abort(&tx);
+    vrt_tx_pool_destroy(tx_pool);
+    vrt_shm_destroy(shm_writer);
     fclose(read_ptr);
 
     // Sleep setup time
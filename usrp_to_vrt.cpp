@@ -119,7 +119,7 @@ void transmit_worker(uhd::usrp::multi_usrp::sptr usrp,
     std::vector<std::complex<short>*> buffs(1, &buff.front());
 
     size_t samps_per_buff = VRT_SAMPLES_PER_PACKET; // spb
-    uint32_t tx_zmq_buffer[VRT_DATA_PACKET_SIZE];
+    uint32_t tx_zmq_buffer[ZMQ_BUFFER_SIZE];
 
     uhd::tx_metadata_t metadata;
     metadata.start_of_burst = true;
@@ -155,7 +155,7 @@ void transmit_worker(uhd::usrp::multi_usrp::sptr usrp,
     while (not stop_signal_called) {
 
         // Receive data
-        int len = zmq_recv(zmq_transmit, tx_zmq_buffer, 100000, ZMQ_NOBLOCK);
+        int len = zmq_recv(zmq_transmit, tx_zmq_buffer, sizeof(tx_zmq_buffer), ZMQ_NOBLOCK);
 
         if (len > 0) {
 
@@ -335,7 +335,7 @@ void transmit_worker(uhd::usrp::multi_usrp::sptr usrp,
 int UHD_SAFE_MAIN(int argc, char* argv[])
 {
     // variables to be set by po
-    std::string file, type, ant_list, subdev, ref, channel_list, gain_list, freq_list, udp_forward, merge_address_list, merge_port_list;
+    std::string file, type, ant_list, subdev, ref, channel_list, gain_list, freq_list, udp_forward, merge_address_list, merge_port_list, bind_address;
     size_t total_num_samps, spb;
     uint16_t instance, port;
     uint16_t tx_gain;
@@ -372,6 +372,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         ("subdev", po::value<std::string>(&subdev), "subdevice specification")
         ("usrp-channel", po::value<std::string>(&channel_list)->default_value("0"), "which usrp channel(s) to use (specify \"0\", \"1\", \"0,1\", etc)")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
+        ("shm", "also publish the stream(s) in shared memory for clients on this host")
         ("bw", po::value<double>(&bw), "analog frontend filter bandwidth in Hz")
         ("ref", po::value<std::string>(&ref)->default_value("internal"), "reference source (internal, external, mimo, gpsdo)")
         ("tx", "enable tx")
@@ -392,6 +393,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
         ("skip-lo", "skip checking LO lock status")
         ("int-n", "tune USRP with integer-N tuning")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("merge", po::value<bool>(&merge)->default_value(true), "Merge another VRT ZMQ stream (SUB connect)")
         ("merge-port", po::value<std::string>(&merge_port_list)->default_value("50011"), "VRT ZMQ merge port")
@@ -424,6 +426,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     bool enable_tx              = vm.count("tx") > 0;
     bool enable_gpio            = vm.count("gpio") > 0;
     bool split                  = vm.count("zmq-split") > 0;
+    bool shm                    = vm.count("shm") > 0;
     bool set_master_clock       = vm.count("master-clock-rate") > 0;
 
     struct vrt_packet p;
@@ -446,6 +449,7 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
     // ZMQ
     void *zmq_server[MAX_CHANNELS];
+    vrt_shm_writer_type* shm_writer[MAX_CHANNELS] = {};
     void *zmq_control;
     void *zmq_transmit;
 
@@ -468,33 +472,33 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
             responder = zmq_socket(context, ZMQ_PUB);
             rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
             assert(rc == 0);
-            std::string connect_string = "tcp://*:" + std::to_string(main_port+ch);
-            rc = zmq_bind(responder, connect_string.c_str());
-            assert (rc == 0);
+            if (not vrt_bind(responder, bind_address, main_port+ch))
+                return 1;
             zmq_server[ch] = responder;
+            if (shm and (shm_writer[ch] = vrt_shm_create(main_port+ch)) == NULL)
+                return EXIT_FAILURE;
         }
     } else {
         responder = zmq_socket(context, ZMQ_PUB);
         rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
         assert(rc == 0);
-        std::string connect_string = "tcp://*:" + std::to_string(main_port);
-        rc = zmq_bind(responder, connect_string.c_str());
-        assert (rc == 0);
+        if (not vrt_bind(responder, bind_address, main_port))
+            return 1;
         zmq_server[0] = responder;
+        if (shm and (shm_writer[0] = vrt_shm_create(main_port)) == NULL)
+            return EXIT_FAILURE;
     }
 
     responder = zmq_socket(context, ZMQ_SUB);
-    std::string control_string = "tcp://*:" + std::to_string(main_port+200);
-    rc = zmq_bind(responder, control_string.c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, main_port+200))
+        return 1;
     zmq_control = responder;
     zmq_setsockopt(zmq_control, ZMQ_SUBSCRIBE, "", 0);
 
     if (enable_tx) {
         responder = zmq_socket(context, ZMQ_SUB);
-        std::string tx_string = "tcp://*:" + std::to_string(main_port+400);
-        rc = zmq_bind(responder, tx_string.c_str());
-        assert (rc == 0);
+        if (not vrt_bind(responder, bind_address, main_port+400))
+            return 1;
         zmq_transmit = responder;
         zmq_setsockopt(zmq_transmit, ZMQ_SUBSCRIBE, "", 0);
     }
@@ -526,9 +530,8 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
 
             merge_zmq.push_back(zmq_socket(context, ZMQ_SUB));
 
-            std::string connect_string = "tcp://" + merge_address + ":" + std::to_string(merge_port);
-            rc = zmq_connect(merge_zmq[i], connect_string.c_str());
-            assert(rc == 0);
+            if (not vrt_connect(merge_zmq[i], merge_address, merge_port))
+                return 1;
             zmq_setsockopt(merge_zmq[i], ZMQ_SUBSCRIBE, "", 0);
         }
     }
@@ -907,17 +910,15 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // fixed buffer size
     size_t samps_per_buff = VRT_SAMPLES_PER_PACKET; // spb
 
-    uint32_t buffer[VRT_DATA_PACKET_SIZE];
+    uint32_t buffer[ZMQ_BUFFER_SIZE];
 
     uhd::rx_metadata_t md;
-    std::vector<std::vector<std::complex<short>>> buffs(
-        channel_nums.size(), std::vector<std::complex<short>>(samps_per_buff));
-    // create a vector of pointers to point to each of the channel buffers
-    std::vector<std::complex<short>*> buff_ptrs;
-    for (size_t i = 0; i < buffs.size(); i++) {
-        buff_ptrs.push_back(&buffs[i].front());
-    }
-    UHD_ASSERT_THROW(buffs.size() == channel_nums.size());
+    // one packet per channel, UHD receives straight into the packet payloads
+    vrt_tx_pool_type* tx_pool = vrt_tx_pool_create(samps_per_buff);
+    std::vector<vrt_tx_packet_type> tx(channel_nums.size());
+    std::vector<std::complex<short>*> buff_ptrs(channel_nums.size());
+    for (size_t i = 0; i < tx.size(); i++)
+        init_tx_packet(&tx[i]);
 
     bool overflow_message = true;
     bool first_frame = true;
@@ -968,13 +969,18 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // flush merge queue
     if (merge)
         for (size_t m = 0; m < merge_zmq.size(); m++)
-            while ( zmq_recv(merge_zmq[m], buffer, 100000, ZMQ_NOBLOCK) > 0 ) { }
+            while ( zmq_recv(merge_zmq[m], buffer, sizeof(buffer), ZMQ_NOBLOCK) > 0 ) { }
 
     while (not stop_signal_called
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)) {
            // and (time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
         const auto now = std::chrono::steady_clock::now();
 
+        for (size_t i = 0; i < tx.size(); i++) {
+            vrt_tx_begin(tx_pool, &tx[i]);
+            buff_ptrs[i] = tx[i].samples;
+        }
+
         size_t num_rx_samps =
             rx_stream->recv(buff_ptrs, samps_per_buff, md, 3.0, false);
 
@@ -1088,6 +1094,8 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
                     zmq_send (zmq_server[ch], buffer, rv*4, 0);
                 else
                     zmq_send (zmq_server[0], buffer, rv*4, 0);
+                if (shm)
+                    vrt_shm_publish(shm_writer[split ? ch : 0], buffer, rv*4);
 
                 if (enable_udp) {
                     if (sendto(sockfd, buffer, rv*4, 0,
@@ -1100,69 +1108,108 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
             context_changed = false;
         }
 
+        if (bw_summary) {
+            last_update_samps += num_rx_samps;
+            const auto time_since_last_update = now - last_update;
+            if (time_since_last_update > std::chrono::seconds(1)) {
+
+                const double time_since_last_update_s =
+                    std::chrono::duration<double>(time_since_last_update).count();
+                const double rate = double(last_update_samps) / time_since_last_update_s;
+
+                last_update_samps = 0;
+                last_update       = now;
+
+                std::cout << "\t" << boost::format("%.6f") % (rate / 1e6) << " Msps, ";
+
+                for (size_t j = 0; j < buff_ptrs.size(); j++) {
+                    size_t channel = channel_nums[j];
+
+                    double max_iq = 0;
+                    uint32_t clip_iq = 0;
+
+                    double datatype_max = 32767.;
+
+                    for (int i=0; i < num_rx_samps; i++ ) {
+                        std::complex<int16_t> sample = buff_ptrs[j][i];
+                        max_iq = fmax(max_iq, fmax(fabs(sample.real()), fabs(sample.imag())));
+                        if (fabs(sample.real()) > datatype_max*0.99 || fabs(sample.imag()) > datatype_max*0.99)
+                            clip_iq++;
+                    }
+
+                    std::cout << "CH" << boost::format("%u") % channel << ": ";
+                    std::cout << boost::format("%3.0f") % (20*log10(max_iq/datatype_max)) << " dBFS (";
+                    std::cout << boost::format("%2.0f") % ceil(log2(max_iq)+1) << "/";
+                    std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
+                    std::cout << "" << boost::format("%2.0f") % (100.0*clip_iq/num_rx_samps) << "% clip. ";
+                }
+                std::cout << std::endl;
+
+            }
+        }
+
         num_total_samps += num_rx_samps;
 
         p.fields.integer_seconds_timestamp = md.time_spec.get_full_secs();
         p.fields.fractional_seconds_timestamp = (uint64_t)1e12 * md.time_spec.get_frac_secs();
         p.header.packet_count = (uint8_t)frame_count%16;
 
-        for (size_t i = 0; i < buffs.size(); i++) {
-            size_t channel = channel_nums[i];
-            p.body = (char*)buff_ptrs[i];
+        for (size_t i = 0; i < tx.size(); i++) {
             if (split)
                 p.fields.stream_id = 1;
                 else
                 p.fields.stream_id = 1<<i;
             zmq_msg_t msg;
-            int rc = zmq_msg_init_size (&msg, VRT_DATA_PACKET_SIZE*4);
-            int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE, true);
-
-            // VRT
-            if (split)
-                zmq_msg_send(&msg, zmq_server[i], 0);
-            else
-                zmq_msg_send(&msg, zmq_server[0], 0);
-            zmq_msg_close(&msg);
+            if (not vrt_tx_finish(&p, &tx[i], num_rx_samps, &msg))
+                continue;
 
             // UDP
             if (enable_udp) {
-                if (sendto(sockfd, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE*4, 0,
+                if (sendto(sockfd, zmq_msg_data(&msg), zmq_msg_size(&msg), 0,
                              (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
                 {
                    printf("UDP fail\n");
                 }
             }
+
+            // VRT
+            if (shm)
+                vrt_shm_publish(shm_writer[split ? i : 0], &msg);
+            if (split)
+                zmq_msg_send(&msg, zmq_server[i], 0);
+            else
+                zmq_msg_send(&msg, zmq_server[0], 0);
+            zmq_msg_close(&msg);
         }
 
         // Merge
         if (merge) {
             int mergelen;
+            zmq_msg_t msg;
+            zmq_msg_init (&msg);
             for (size_t m = 0; m < merge_zmq.size(); m++) {
-                while ( (mergelen = zmq_recv(merge_zmq[m], buffer, 100000, ZMQ_NOBLOCK)) > 0  ) {
+                while ( (mergelen = zmq_msg_recv(&msg, merge_zmq[m], ZMQ_NOBLOCK)) > 0  ) {
 
+                    if (shm) {
+                        for (size_t ch = 0; ch < (split ? channel_nums.size() : 1); ch++)
+                            vrt_shm_publish(shm_writer[ch], &msg);
+                    }
                     if (split) {
-                        for (size_t ch = 0; ch < channel_nums.size(); ch++) {
-                            zmq_msg_t msg;
-                            zmq_msg_init_size (&msg, mergelen);
-                            memcpy (zmq_msg_data(&msg), buffer, mergelen);
-                            zmq_msg_send(&msg, zmq_server[ch], 0);
-                            zmq_msg_close(&msg);
-                        }
+                        // every channel gets a reference to the same message
+                        for (size_t ch = 0; ch < channel_nums.size(); ch++)
+                            vrt_msg_send_copy(&msg, zmq_server[ch]);
                     } else {
-                        zmq_msg_t msg;
-                        zmq_msg_init_size (&msg, mergelen);
-                        memcpy (zmq_msg_data(&msg), buffer, mergelen);
                         zmq_msg_send(&msg, zmq_server[0], 0);
-                        zmq_msg_close(&msg);
                     }
                 }
             }
+            zmq_msg_close(&msg);
         }
 
         frame_count++;
 
         // Control
-        int len = zmq_recv(zmq_control, buffer, 100000, ZMQ_NOBLOCK);
+        int len = zmq_recv(zmq_control, buffer, sizeof(buffer), ZMQ_NOBLOCK);
         if (len > 0) {
             printf("-> Control context received\n");
 
@@ -1242,45 +1289,6 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
             }
         }
 
-        if (bw_summary) {
-            last_update_samps += num_rx_samps;
-            const auto time_since_last_update = now - last_update;
-            if (time_since_last_update > std::chrono::seconds(1)) {
-
-                const double time_since_last_update_s =
-                    std::chrono::duration<double>(time_since_last_update).count();
-                const double rate = double(last_update_samps) / time_since_last_update_s;
-
-                last_update_samps = 0;
-                last_update       = now;
-
-                std::cout << "\t" << boost::format("%.6f") % (rate / 1e6) << " Msps, ";
-
-                for (size_t j = 0; j < buffs.size(); j++) {
-                    size_t channel = channel_nums[j];
-
-                    double max_iq = 0;
-                    uint32_t clip_iq = 0;
-
-                    double datatype_max = 32767.;
-
-                    for (int i=0; i < num_rx_samps; i++ ) {
-                        std::complex<int16_t> sample = buff_ptrs[j][i];
-                        max_iq = fmax(max_iq, fmax(fabs(sample.real()), fabs(sample.imag())));
-                        if (fabs(sample.real()) > datatype_max*0.99 || fabs(sample.imag()) > datatype_max*0.99)
-                            clip_iq++;
-                    }
-
-                    std::cout << "CH" << boost::format("%u") % channel << ": ";
-                    std::cout << boost::format("%3.0f") % (20*log10(max_iq/datatype_max)) << " dBFS (";
-                    std::cout << boost::format("%2.0f") % ceil(log2(max_iq)+1) << "/";
-                    std::cout << (int)ceil(log2(datatype_max)+1) << " bits), ";
-                    std::cout << "" << boost::format("%2.0f") % (100.0*clip_iq/num_rx_samps) << "% clip. ";
-                }
-                std::cout << std::endl;
-
-            }
-        }
     }
 
     const auto actual_stop_time = std::chrono::steady_clock::now();
@@ -1289,6 +1297,12 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     rx_stream->issue_stream_cmd(stream_cmd);
     rx_stream.reset();
 
+    for (size_t i = 0; i < tx.size(); i++)
+        vrt_tx_abort(&tx[i]);
+    vrt_tx_pool_destroy(tx_pool);
+    for (size_t ch = 0; ch < MAX_CHANNELS; ch++)
+        vrt_shm_destroy(shm_writer[ch]);
+
     // clean up transmit worker
     stop_signal_called = true;
     if (enable_tx) {
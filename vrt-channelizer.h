@@ -0,0 +1,113 @@
+#ifndef _VRTCHANNELIZER_H
+#define _VRTCHANNELIZER_H
+
+// Polyphase filterbank (PFB) channelizer: the band is split into
+// num_channels sub-channels, channel k centered at k*fs/num_channels (bin k
+// of an FFT of num_channels points). For each output the last
+// partitions*num_channels input samples are weighted with a prototype
+// low-pass and summed into num_channels samples (the polyphase FIR, see
+// vrt_pfb_sum_cf32()), and one FFT of these gives one sample of every
+// sub-channel.
+//
+// Critically sampled, the input advances by num_channels samples per
+// output and each sub-channel is sampled at fs/num_channels. Oversampled by
+// two it advances by half of that and the sub-channels are sampled at twice
+// the rate, so the transition band of the prototype no longer aliases onto
+// the channel edges. The FFT references the phase to the start of the
+// window, which then moves by half a period of the odd bins per output:
+// their sign is flipped on odd outputs, so every channel is continuous.
+//
+// The prototype is cut off at half the channel spacing with a DC gain of
+// one, a tone at the center of a channel keeps its amplitude. The input is
+// buffered by a decimating FIR (vrt_fir_type), whose taps, each repeated
+// for the real and the imaginary part, are the rows of the filterbank.
+
+#include <complex>
+#include <vector>
+#include <stdint.h>
+
+#include "vrt-dsp.h"
+#include "vrt-fft.h"
+#include "vrt-kernels.h"
+#include "vrt-tools.h"
+
+struct vrt_channelizer_type {
+    uint32_t num_channels;
+    uint32_t partitions;
+    bool oversample;
+    // input and prototype, decimation is the advance per output
+    vrt_fir_type fir;
+    // windows of the output, partitions rows of num_channels samples
+    const std::complex<float>** rows;
+    // outputs so far, for the sign of the odd bins when oversampled
+    uint64_t outputs;
+    // single precision FFT of num_channels points
+    vrt_fft_type fft;
+};
+
+// Set up num_channels channels from a prototype of partitions*num_channels
+// taps, with room for block_size input samples per call. Oversampled,
+// num_channels has to be even.
+void vrt_channelizer_init(vrt_channelizer_type* ch, uint32_t num_channels, uint32_t partitions, bool oversample,
+    uint32_t block_size, const vrt_rt_type* rt = NULL) {
+    uint32_t num_taps = partitions*num_channels;
+    std::vector<float> taps(num_taps);
+    vrt_fir_lowpass(taps.data(), num_taps, 0.5/num_channels, 1);
+
+    ch->num_channels = num_channels;
+    ch->partitions = partitions;
+    ch->oversample = oversample;
+    vrt_fir_init(&ch->fir, oversample ? num_channels/2 : num_channels, num_taps, taps.data(), block_size);
+    vrt_fir_prefault(&ch->fir, rt);
+    ch->rows = new const std::complex<float>*[partitions];
+    ch->outputs = 0;
+    vrt_fft_init(&ch->fft, num_channels, true, rt);
+}
+
+// Room for n more input samples, to be written by the caller
+inline std::complex<float>* vrt_channelizer_input(vrt_channelizer_type* ch, uint32_t n) {
+    return vrt_fir_input(&ch->fir, n);
+}
+
+// Outputs the buffered input is enough for
+inline uint32_t vrt_channelizer_outputs(const vrt_channelizer_type* ch) {
+    return vrt_fir_outputs(&ch->fir);
+}
+
+// Index in the buffered input of the sample at the center of the window of
+// output i, see vrt_channelizer_outputs()
+inline int64_t vrt_channelizer_center(const vrt_channelizer_type* ch, uint32_t i) {
+    return (int64_t)ch->fir.pos + (int64_t)i*ch->fir.decimation + ch->fir.num_taps/2;
+}
+
+// Output i of the buffered input, one sample of every channel by bin. The
+// outputs have to be taken in order, the result is valid until the next call.
+const std::complex<float>* vrt_channelizer_output(vrt_channelizer_type* ch, uint32_t i) {
+    uint32_t M = ch->num_channels;
+    const std::complex<float>* window = &ch->fir.x[ch->fir.pos + i*ch->fir.decimation];
+    for (uint32_t p = 0; p < ch->partitions; p++)
+        ch->rows[p] = window + p*M;
+    vrt_pfb_sum_cf32(ch->rows, ch->fir.taps, ch->partitions, M, (std::complex<float>*)ch->fft.inf);
+    vrt_fft_execute_dft(ch->fft.plan, ch->fft.inf, ch->fft.outf);
+
+    std::complex<float>* out = (std::complex<float>*)ch->fft.outf;
+    if (ch->oversample and (ch->outputs & 1)) {
+        for (uint32_t k = 1; k < M; k += 2)
+            out[k] = -out[k];
+    }
+    ch->outputs++;
+    return out;
+}
+
+// The outputs are done: drop the input no longer needed
+inline void vrt_channelizer_consume(vrt_channelizer_type* ch, uint32_t outputs) {
+    vrt_fir_consume(&ch->fir, outputs);
+}
+
+void vrt_channelizer_free(vrt_channelizer_type* ch) {
+    vrt_fir_free(&ch->fir);
+    delete[] ch->rows;
+    vrt_fft_destroy(&ch->fft);
+}
+
+#endif
@@ -0,0 +1,1014 @@
+#ifndef _VRTDSP_H
+#define _VRTDSP_H
+
+// Narrow-band building blocks: a numerically controlled oscillator (NCO)
+// mixing a frequency to DC, a decimating FIR low-pass and, built from both,
+// the zoom band of the FFT tools.
+//
+// Zoom: instead of transforming the whole band at full resolution and
+// keeping the bins of a narrow span, the span is mixed to DC, filtered,
+// decimated by D and transformed in num_bins/D bins of the same size, so
+// the FFT and its buffers scale with the span and not with the band. D is
+// the largest divisor of num_bins that keeps at least VRT_ZOOM_GUARD times
+// the span. The low-pass is cut off at half the decimated rate, it passes
+// the span and stops what would alias into it. Its DC gain is D, so the
+// power of a zoomed bin is that of the same bin of the full-band FFT.
+//
+// The FIR runs in polyphase form up to VRT_FIR_POLYPHASE decimations: the
+// input of the outputs of a call is de-interleaved into the decimation
+// branches once, and the kernel computes a block of outputs per SIMD lane
+// with each tap broadcast, see vrt_polyfir_cf32(). That is faster than one
+// dot product per output while the decimation is small; with larger
+// decimations there are fewer outputs per call and the long dot products
+// of the direct form (vrt_fir_cf32()) are faster. Both add in a different
+// order, so their outputs differ in the last bits. A half-band low-pass
+// decimating by two, every other tap zero but the center one, evaluates
+// only the even branch and the center tap.
+//
+// Large decimations are split into a cascade (vrt_decimator_type) instead
+// of one FIR of taps_per_decimation taps per unit of decimation: an
+// optional CIC decimator (integrators and combs in integer arithmetic, no
+// multiplies) and a FIR compensating its droop, then half-band stages while
+// the decimation left is even, and a last FIR of the usual design
+// (vrt_fir_channel_taps()) for the rest. Each stage only has to keep what
+// would alias into the final band, so the early stages at the high rates
+// are short. The CIC takes the largest decimation that still leaves
+// VRT_CIC_REST for the FIR stages, where its aliases are below -90 dB.
+//
+// Rates that are not the input rate over an integer decimation end the
+// cascade with a rational resampler (vrt_resampler_type): interpolation L,
+// decimation M, output n at input time n*M/L, kept exactly as an input
+// index and a phase of 1/L. The filter is a low-pass prototype of L phases
+// at L times the input rate, phase p holding the taps for the time p/L
+// after an input sample. Too many phases for a table, the Farrow stage
+// keeps VRT_RESAMPLER_FARROW_PHASES of them and interpolates between them
+// with a cubic polynomial in the fraction: four dot products per output,
+// the coefficients of the polynomial, evaluated in Horner form. The
+// decimation ahead of the resampler (vrt_resample_plan()) leaves at most
+// twice the output rate and the ratio with the fewest phases.
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vrt-kernels.h"
+#include "vrt-tools.h"
+
+// Zoom band at least this many times the span
+#define VRT_ZOOM_GUARD 2
+// Taps of the zoom low-pass per unit of decimation
+#define VRT_ZOOM_TAPS_PER_DECIMATION 16
+// Samples the NCO mixes from one double precision phasor
+#define VRT_NCO_BLOCK 64
+// Largest decimation of the FIR in polyphase form
+#define VRT_FIR_POLYPHASE 12
+// Stages of a decimator at most
+#define VRT_DECIMATOR_STAGES 24
+// Transition width (of the sample rate) times the taps of the half-band
+// and compensation filters, for their Blackman-Harris window
+#define VRT_DECIMATOR_TRANSITION 8.0
+// CIC order, decimation range and the decimation it leaves at least
+#define VRT_CIC_ORDER 4
+#define VRT_CIC_MIN_DECIMATION 4
+#define VRT_CIC_MAX_DECIMATION 2048
+#define VRT_CIC_REST 8
+// Phases of the resampler at most, more take the Farrow stage of this many phases
+#define VRT_RESAMPLER_MAX_PHASES 512
+#define VRT_RESAMPLER_FARROW_PHASES 64
+
+// The phasor of each block is kept in double precision, the samples of a
+// block are mixed in float with a table of the phase steps from its start.
+struct vrt_nco_type {
+    double phase_step;
+    std::complex<double> phasor;
+    std::complex<double> block_step;
+    std::complex<float> steps[VRT_NCO_BLOCK];
+};
+
+// Decimating FIR of real taps over complex samples, see vrt_fir_cf32().
+// x holds the input not consumed yet, the next output starts at x[pos].
+struct vrt_fir_type {
+    uint32_t decimation;
+    uint32_t num_taps;
+    // 2*num_taps weights, each repeated for the real and the imaginary part
+    float* taps;
+    std::complex<float>* x;
+    uint32_t size;
+    uint32_t fill;
+    uint32_t pos;
+    // polyphase form: taps by branch, NULL for the direct form, and the
+    // input of the outputs of a call by branch, branch_stride samples apart
+    uint32_t taps_per_branch;
+    float* branch_taps;
+    std::complex<float>* branches;
+    uint32_t branch_stride;
+    // half-band: row of the odd branch at the center tap, -1 otherwise
+    int32_t halfband_row;
+    float halfband_tap;
+    // prefaults the buffers when they grow, see vrt_fir_prefault()
+    const vrt_rt_type* rt;
+};
+
+// Decimating by decimation with VRT_CIC_ORDER integrators at the input rate
+// and as many combs at the output rate. The integrators wrap around, which
+// the combs undo exactly.
+struct vrt_cic_type {
+    uint32_t decimation;
+    // input samples since the last output
+    uint32_t phase;
+    uint64_t integrators[VRT_CIC_ORDER][2];
+    // previous input of each comb
+    uint64_t combs[VRT_CIC_ORDER][2];
+    // 1/decimation^VRT_CIC_ORDER, the gain of the CIC
+    float scale;
+};
+
+// Resampling by interpolation/decimation
+struct vrt_resampler_type {
+    uint64_t interpolation;
+    uint64_t decimation;
+    uint32_t phases;
+    bool farrow;
+    uint32_t taps_per_phase;
+    // a row per phase (Farrow: 4 rows, the coefficients of 1, mu, mu^2 and
+    // mu^3), each tap repeated for the real and the imaginary part, in the
+    // order of the input
+    float* taps;
+    std::complex<float>* x;
+    uint32_t size;
+    uint32_t fill;
+    // samples dropped from x, input a is at x[a + taps_per_phase - 1 - dropped]
+    uint64_t dropped;
+    // next output: newest input and phase, at input + phase/interpolation
+    uint64_t input;
+    uint64_t phase;
+    // the same for the first output of the last run
+    uint64_t run_input;
+    uint64_t run_phase;
+    // prefaults the input when it grows, see vrt_resampler_prefault()
+    const vrt_rt_type* rt;
+};
+
+enum vrt_stage_kind_type {
+    VRT_STAGE_CIC,
+    VRT_STAGE_COMPENSATION,
+    VRT_STAGE_HALFBAND,
+    VRT_STAGE_CHANNEL,
+    VRT_STAGE_RESAMPLER,
+    VRT_STAGE_FARROW
+};
+
+struct vrt_stage_type {
+    vrt_stage_kind_type kind;
+    uint32_t decimation;
+    // 1 but for a resampler
+    uint32_t interpolation;
+    // taps, the order of a CIC, taps per phase of a resampler
+    uint32_t num_taps;
+    // per input sample of the decimator: complex by real multiply-adds and
+    // complex additions
+    double multiply_adds;
+    double additions;
+};
+
+// Cascade of decimating stages, the CIC if any first, then the FIRs and
+// the resampler if any. Without resampler the newest input of output i is
+// input i*decimation, as for a single FIR, see vrt_decimator_time().
+struct vrt_decimator_type {
+    uint32_t decimation;
+    uint32_t num_stages;
+    vrt_stage_type stages[VRT_DECIMATOR_STAGES];
+    uint32_t num_firs;
+    vrt_fir_type firs[VRT_DECIMATOR_STAGES];
+    // CIC, decimation 0 if there is none, and its input
+    vrt_cic_type cic;
+    std::complex<float>* in;
+    uint32_t in_size;
+    uint32_t in_fill;
+    // resampler after the FIRs
+    bool resample;
+    vrt_resampler_type resampler;
+    // samples in and out so far, outputs before the last run
+    uint64_t inputs;
+    uint64_t outputs;
+    uint64_t run_outputs;
+    // prefaults the CIC input when it grows, see vrt_decimator_prefault()
+    const vrt_rt_type* rt;
+};
+
+struct vrt_zoom_type {
+    // decimation and bins of the zoom FFT
+    uint32_t decimation;
+    uint32_t num_bins;
+    // bin of the full-band FFT at zoom bin 0
+    int32_t first_bin;
+    // offset (Hz) of the zoom band center, bin num_bins/2, and its sample rate
+    double center;
+    double sample_rate;
+    vrt_nco_type nco;
+    vrt_fir_type fir;
+    // decimated samples of the last vrt_zoom_process()
+    std::complex<float>* out;
+    uint32_t out_size;
+};
+
+// Mix by -frequency at sample_rate: frequency ends up at DC
+void vrt_nco_init(vrt_nco_type* nco, double frequency, double sample_rate) {
+    nco->phase_step = -2*M_PI*frequency/sample_rate;
+    nco->phasor = 1;
+    nco->block_step = std::polar(1.0, VRT_NCO_BLOCK*nco->phase_step);
+    for (uint32_t k = 0; k < VRT_NCO_BLOCK; k++)
+        nco->steps[k] = (std::complex<float>)std::polar(1.0, k*nco->phase_step);
+}
+
+void vrt_nco_mix(vrt_nco_type* nco, std::complex<float>* x, uint32_t n) {
+    for (uint32_t i = 0; i < n; i += VRT_NCO_BLOCK) {
+        uint32_t m = std::min(n - i, (uint32_t)VRT_NCO_BLOCK);
+        vrt_mix_cf32(&x[i], m, nco->steps, (std::complex<float>)nco->phasor);
+        if (m == VRT_NCO_BLOCK)
+            nco->phasor *= nco->block_step;
+        else
+            nco->phasor *= std::polar(1.0, m*nco->phase_step);
+    }
+    // keep the amplitude from drifting
+    nco->phasor /= std::abs(nco->phasor);
+}
+
+// Blackman-Harris windowed sinc low-pass, cut off at cutoff times the
+// sample rate, with a DC gain of gain
+void vrt_fir_lowpass(float* taps, uint32_t num_taps, double cutoff, double gain) {
+    double a0 = 0.35875;
+    double a1 = 0.48829;
+    double a2 = 0.14128;
+    double a3 = 0.01168;
+
+    std::vector<double> h(num_taps);
+    double sum = 0;
+    for (uint32_t i = 0; i < num_taps; i++) {
+        double w = 2*M_PI*(double)i/(double)(num_taps > 1 ? num_taps-1 : 1);
+        double blackman_harris = a0 - a1*cos(w) + a2*cos(2*w) - a3*cos(3*w);
+        double x = 2*M_PI*cutoff*((double)i - (double)(num_taps-1)/2);
+        h[i] = blackman_harris*((x != 0) ? sin(x)/x : 1);
+        sum += h[i];
+    }
+    for (uint32_t i = 0; i < num_taps; i++)
+        taps[i] = gain*h[i]/sum;
+}
+
+// Low-pass of vrt_channelizer, taps_per_decimation*decimation taps of a
+// Blackman-Harris windowed Dirichlet kernel cut off at the decimated sample
+// rate, the last tap zero
+void vrt_fir_channel_taps(double* taps, uint32_t decimation, uint32_t taps_per_decimation) {
+    uint32_t fir_order = taps_per_decimation*decimation-1;
+
+    double K = 0.97*(fir_order/decimation);
+
+    // Blackman window
+    // double a0 = 0.42;
+    // double a1 = 0.50;
+    // double a2 = 0.08;
+    // double a3 = 0.00;
+
+    // Blackman-Harris window
+    double a0 = 0.35875;
+    double a1 = 0.48829;
+    double a2 = 0.14128;
+    double a3 = 0.01168;
+
+    for (int i=0;i<(int)fir_order;i++) {
+        int j = -(i - (int)fir_order/2);
+        double blackman_window = a0 - a1*cos(2*M_PI*(double)i/((double)fir_order-1)) +
+                                    a2*cos(4*M_PI*(double)i/((double)fir_order-1)) +
+                                    a3*cos(6*M_PI*(double)i/((double)fir_order-1));
+        if (j==0) {
+            taps[i] = blackman_window*((double)K/(double)fir_order);
+        } else {
+            taps[i] = blackman_window*(1.0/(double)fir_order)*sin(M_PI*(double)j*(double)K/(double)fir_order)/sin(M_PI*(double)j/(double)fir_order);
+        }
+    }
+    taps[fir_order] = 0;
+}
+
+// Half-band low-pass of num_taps = 4k+3 taps, cut off at a quarter of the
+// sample rate with every other tap but the center one exactly zero
+void vrt_fir_halfband(float* taps, uint32_t num_taps) {
+    vrt_fir_lowpass(taps, num_taps, 0.25, 1);
+    int32_t center = (num_taps - 1)/2;
+    for (int32_t i = 0; i < (int32_t)num_taps; i++) {
+        if (i != center and (i - center) % 2 == 0)
+            taps[i] = 0;
+    }
+}
+
+// Response of a CIC decimating by decimation at frequency f of its output rate
+double vrt_cic_response(uint32_t decimation, double f) {
+    if (f == 0)
+        return 1;
+    return pow(fabs(sin(M_PI*f)/(decimation*sin(M_PI*f/decimation))), VRT_CIC_ORDER);
+}
+
+// FIR at the output rate of a CIC decimating by cic_decimation, to be
+// decimated by two: the inverse response of the CIC up to a quarter of the
+// rate and zero above, Blackman-Harris windowed, with a DC gain of one
+void vrt_fir_cic_compensation(float* taps, uint32_t num_taps, uint32_t cic_decimation) {
+    double a0 = 0.35875;
+    double a1 = 0.48829;
+    double a2 = 0.14128;
+    double a3 = 0.01168;
+    const uint32_t grid = 1024;
+
+    std::vector<double> h(num_taps);
+    double sum = 0;
+    for (uint32_t i = 0; i < num_taps; i++) {
+        double w = 2*M_PI*(double)i/(double)(num_taps > 1 ? num_taps-1 : 1);
+        double blackman_harris = a0 - a1*cos(w) + a2*cos(2*w) - a3*cos(3*w);
+        double m = (double)i - (double)(num_taps-1)/2;
+        double response = 0;
+        for (uint32_t g = 0; g < grid; g++) {
+            double f = 0.25*(g + 0.5)/grid;
+            response += cos(2*M_PI*f*m)/vrt_cic_response(cic_decimation, f);
+        }
+        h[i] = blackman_harris*response;
+        sum += h[i];
+    }
+    for (uint32_t i = 0; i < num_taps; i++)
+        taps[i] = h[i]/sum;
+}
+
+// Run the FIR in polyphase form: the taps transposed into the branches,
+// padded with zeros to taps_per_branch each
+void vrt_fir_polyphase(vrt_fir_type* fir, const float* taps) {
+    uint32_t M = fir->decimation;
+    fir->taps_per_branch = (fir->num_taps + M - 1)/M;
+    fir->branch_taps = (float*)vrt_alloc(sizeof(float) * M * fir->taps_per_branch);
+    for (uint32_t i = 0; i < M; i++) {
+        for (uint32_t j = 0; j < fir->taps_per_branch; j++) {
+            uint32_t t = j*M + i;
+            fir->branch_taps[i*fir->taps_per_branch + j] = t < fir->num_taps ? taps[t] : 0;
+        }
+    }
+
+    if (M == 2 and fir->num_taps % 4 == 3) {
+        uint32_t center = (fir->num_taps - 1)/2;
+        bool halfband = true;
+        for (uint32_t t = 1; t < fir->num_taps; t += 2)
+            halfband = halfband and (t == center or taps[t] == 0);
+        if (halfband) {
+            fir->halfband_row = center/2;
+            fir->halfband_tap = taps[center];
+        }
+    }
+}
+
+// Set up a FIR of num_taps taps (copied) decimating by decimation, with room
+// for block_size input samples per call
+void vrt_fir_init(vrt_fir_type* fir, uint32_t decimation, uint32_t num_taps, const float* taps,
+    uint32_t block_size) {
+    fir->decimation = decimation;
+    fir->num_taps = num_taps;
+    fir->taps = (float*)vrt_alloc(sizeof(float) * 2 * num_taps);
+    for (uint32_t t = 0; t < num_taps; t++) {
+        fir->taps[2*t] = taps[t];
+        fir->taps[2*t+1] = taps[t];
+    }
+    fir->size = num_taps + decimation + block_size;
+    fir->x = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * fir->size);
+    // start on a history of zeros
+    fir->fill = num_taps - 1;
+    fir->pos = 0;
+    for (uint32_t i = 0; i < fir->fill; i++)
+        fir->x[i] = 0;
+
+    fir->taps_per_branch = 0;
+    fir->branch_taps = NULL;
+    fir->branches = NULL;
+    fir->branch_stride = 0;
+    fir->halfband_row = -1;
+    fir->halfband_tap = 0;
+    fir->rt = NULL;
+    if (decimation > 1 and decimation <= VRT_FIR_POLYPHASE)
+        vrt_fir_polyphase(fir, taps);
+}
+
+// Room for n more input samples, to be written by the caller
+std::complex<float>* vrt_fir_input(vrt_fir_type* fir, uint32_t n) {
+    if (fir->fill + n > fir->size) {
+        uint32_t size = fir->fill + n;
+        std::complex<float>* x = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * size);
+        memcpy(x, fir->x, sizeof(std::complex<float>) * fir->fill);
+        vrt_free(fir->x);
+        fir->x = x;
+        fir->size = size;
+        vrt_rt_prefault(fir->rt, fir->x, sizeof(std::complex<float>) * size);
+    }
+    std::complex<float>* in = &fir->x[fir->fill];
+    fir->fill += n;
+    return in;
+}
+
+// Touch the buffers, and again whenever they grow, see vrt_rt_prefault()
+void vrt_fir_prefault(vrt_fir_type* fir, const vrt_rt_type* rt) {
+    fir->rt = rt;
+    vrt_rt_prefault(rt, fir->x, sizeof(std::complex<float>) * fir->size);
+    vrt_rt_prefault(rt, fir->branches, sizeof(std::complex<float>) * fir->decimation * fir->branch_stride);
+}
+
+// Outputs the buffered input is enough for
+inline uint32_t vrt_fir_outputs(const vrt_fir_type* fir) {
+    if (fir->pos + fir->num_taps > fir->fill)
+        return 0;
+    return (fir->fill - fir->pos - fir->num_taps)/fir->decimation + 1;
+}
+
+// De-interleave the input of k outputs into the branches, with the rows the
+// SIMD kernels read past the last output, zero beyond the buffered input
+void vrt_fir_branches(vrt_fir_type* fir, uint32_t k) {
+    uint32_t M = fir->decimation;
+    uint32_t rows = (k + VRT_POLYFIR_BLOCK - 1)/VRT_POLYFIR_BLOCK*VRT_POLYFIR_BLOCK + fir->taps_per_branch - 1;
+    if (rows > fir->branch_stride) {
+        vrt_free(fir->branches);
+        fir->branches = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * M * rows);
+        fir->branch_stride = rows;
+        vrt_rt_prefault(fir->rt, fir->branches, sizeof(std::complex<float>) * M * rows);
+    }
+    const std::complex<float>* x = &fir->x[fir->pos];
+    uint32_t buffered = fir->fill - fir->pos;
+    for (uint32_t i = 0; i < M; i++) {
+        std::complex<float>* b = &fir->branches[i*fir->branch_stride];
+        uint32_t available = buffered > i ? std::min(rows, (buffered - i + M - 1)/M) : 0;
+        for (uint32_t m = 0; m < available; m++)
+            b[m] = x[m*M + i];
+        for (uint32_t m = available; m < rows; m++)
+            b[m] = 0;
+    }
+}
+
+// k outputs are done: drop the input no longer needed
+void vrt_fir_consume(vrt_fir_type* fir, uint32_t k) {
+    fir->pos += k*fir->decimation;
+    uint32_t consumed = std::min(fir->pos, fir->fill);
+    memmove(fir->x, &fir->x[consumed], sizeof(std::complex<float>) * (fir->fill - consumed));
+    fir->fill -= consumed;
+    fir->pos -= consumed;
+}
+
+// Filter the buffered input into out, vrt_fir_outputs() samples, and drop
+// the input no longer needed. Returns the number of outputs.
+uint32_t vrt_fir_run(vrt_fir_type* fir, std::complex<float>* out) {
+    uint32_t k = vrt_fir_outputs(fir);
+    if (fir->halfband_row >= 0 and k > 0) {
+        // the even branch, then the center tap in the odd one
+        vrt_fir_branches(fir, k);
+        vrt_polyfir_cf32(fir->branches, fir->branch_stride, fir->branch_taps, 1, fir->taps_per_branch, k, out);
+        const std::complex<float>* odd = &fir->branches[fir->branch_stride + fir->halfband_row];
+        for (uint32_t i = 0; i < k; i++)
+            out[i] += fir->halfband_tap*odd[i];
+    } else if (fir->branch_taps != NULL and k > 0) {
+        vrt_fir_branches(fir, k);
+        vrt_polyfir_cf32(fir->branches, fir->branch_stride, fir->branch_taps, fir->decimation,
+            fir->taps_per_branch, k, out);
+    } else {
+        vrt_fir_cf32(&fir->x[fir->pos], fir->taps, fir->num_taps, fir->decimation, k, out);
+    }
+    vrt_fir_consume(fir, k);
+    return k;
+}
+
+void vrt_fir_free(vrt_fir_type* fir) {
+    vrt_free(fir->taps);
+    vrt_free(fir->x);
+    vrt_free(fir->branch_taps);
+    vrt_free(fir->branches);
+}
+
+void vrt_cic_init(vrt_cic_type* cic, uint32_t decimation) {
+    cic->decimation = decimation;
+    cic->phase = 0;
+    memset(cic->integrators, 0, sizeof(cic->integrators));
+    memset(cic->combs, 0, sizeof(cic->combs));
+    cic->scale = 1/pow((double)decimation, VRT_CIC_ORDER);
+}
+
+// Outputs of the next n input samples
+inline uint32_t vrt_cic_outputs(const vrt_cic_type* cic, uint32_t n) {
+    uint32_t R = cic->decimation;
+    return (n + R - 1 - (R - cic->phase) % R)/R;
+}
+
+// Decimate n samples, rounded to (32 bit) integers, into out, vrt_cic_outputs() samples.
+// The output is taken at every decimation-th input, starting with the first.
+void vrt_cic_run(vrt_cic_type* cic, const std::complex<float>* x, uint32_t n, std::complex<float>* out) {
+    const uint32_t R = cic->decimation;
+    uint64_t integrators[VRT_CIC_ORDER][2];
+    memcpy(integrators, cic->integrators, sizeof(integrators));
+    uint32_t i = 0;
+    uint32_t k = 0;
+    while (i < n) {
+        // integrate up to the next output, then comb it
+        uint32_t count = (R - cic->phase) % R + 1;
+        uint32_t end = std::min(n, i + count);
+        bool output = end - i == count;
+        cic->phase = (cic->phase + end - i) % R;
+        for (; i < end; i++) {
+            // rounded half away from zero, inline unlike lrintf()
+            float r = x[i].real();
+            float j = x[i].imag();
+            uint64_t re = (uint64_t)(int64_t)(int32_t)(r + (r < 0 ? -0.5f : 0.5f));
+            uint64_t im = (uint64_t)(int64_t)(int32_t)(j + (j < 0 ? -0.5f : 0.5f));
+            for (uint32_t o = 0; o < VRT_CIC_ORDER; o++) {
+                re = integrators[o][0] += re;
+                im = integrators[o][1] += im;
+            }
+        }
+        if (not output)
+            break;
+        uint64_t v[2] = {integrators[VRT_CIC_ORDER-1][0], integrators[VRT_CIC_ORDER-1][1]};
+        for (uint32_t o = 0; o < VRT_CIC_ORDER; o++) {
+            uint64_t re = v[0] - cic->combs[o][0];
+            uint64_t im = v[1] - cic->combs[o][1];
+            cic->combs[o][0] = v[0];
+            cic->combs[o][1] = v[1];
+            v[0] = re;
+            v[1] = im;
+        }
+        out[k++] = std::complex<float>((float)(int64_t)v[0]*cic->scale, (float)(int64_t)v[1]*cic->scale);
+    }
+    memcpy(cic->integrators, integrators, sizeof(integrators));
+}
+
+uint64_t vrt_gcd(uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// Set up resampling by interpolation/decimation (in lowest terms) with
+// taps_per_decimation taps per phase and unit of decimation, cut off at the
+// lower of the two rates, with room for block_size input samples per call
+void vrt_resampler_init(vrt_resampler_type* rs, uint64_t interpolation, uint64_t decimation,
+    uint32_t taps_per_decimation, bool farrow, uint32_t block_size) {
+    rs->interpolation = interpolation;
+    rs->decimation = decimation;
+    rs->farrow = farrow or interpolation > VRT_RESAMPLER_MAX_PHASES;
+    rs->phases = rs->farrow ? VRT_RESAMPLER_FARROW_PHASES : (uint32_t)interpolation;
+    rs->taps_per_phase = taps_per_decimation*(uint32_t)std::max<uint64_t>(1, (decimation + interpolation - 1)/interpolation);
+
+    uint32_t P = rs->phases;
+    uint32_t T = rs->taps_per_phase;
+    uint32_t num_taps = P*T;
+    std::vector<float> h(num_taps);
+    vrt_fir_lowpass(h.data(), num_taps, 0.5*std::min(1.0, (double)interpolation/decimation)/P, P);
+
+    // tap u of phase p weighs input T-1-u samples before the newest one
+    uint32_t rows = rs->farrow ? 4*P : P;
+    rs->taps = (float*)vrt_alloc(sizeof(float) * 2 * T * rows);
+    for (uint32_t p = 0; p < P; p++) {
+        for (uint32_t u = 0; u < T; u++) {
+            int64_t q = (int64_t)(T-1-u)*P + p;
+            if (not rs->farrow) {
+                rs->taps[2*(p*T + u)] = rs->taps[2*(p*T + u) + 1] = h[q];
+                continue;
+            }
+            // cubic Lagrange through the phases p-1 to p+2, mu from p to p+1
+            float c[4];
+            float y[4];
+            for (int32_t i = 0; i < 4; i++)
+                y[i] = q + i - 1 >= 0 and q + i - 1 < (int64_t)num_taps ? h[q + i - 1] : 0;
+            c[0] = y[1];
+            c[1] = -y[0]/3 - y[1]/2 + y[2] - y[3]/6;
+            c[2] = y[0]/2 - y[1] + y[2]/2;
+            c[3] = -y[0]/6 + y[1]/2 - y[2]/2 + y[3]/6;
+            for (uint32_t i = 0; i < 4; i++)
+                rs->taps[2*((4*p + i)*T + u)] = rs->taps[2*((4*p + i)*T + u) + 1] = c[i];
+        }
+    }
+
+    rs->size = T - 1 + block_size;
+    rs->x = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * rs->size);
+    for (uint32_t i = 0; i < T - 1; i++)
+        rs->x[i] = 0;
+    rs->fill = T - 1;
+    rs->dropped = 0;
+    rs->input = 0;
+    rs->phase = 0;
+    rs->run_input = 0;
+    rs->run_phase = 0;
+    rs->rt = NULL;
+}
+
+// Room for n more input samples, to be written by the caller
+std::complex<float>* vrt_resampler_input(vrt_resampler_type* rs, uint32_t n) {
+    if (rs->fill + n > rs->size) {
+        uint32_t size = rs->fill + n;
+        std::complex<float>* x = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * size);
+        memcpy(x, rs->x, sizeof(std::complex<float>) * rs->fill);
+        vrt_free(rs->x);
+        rs->x = x;
+        rs->size = size;
+        vrt_rt_prefault(rs->rt, rs->x, sizeof(std::complex<float>) * size);
+    }
+    std::complex<float>* in = &rs->x[rs->fill];
+    rs->fill += n;
+    return in;
+}
+
+// Touch the input, and again whenever it grows, see vrt_rt_prefault()
+void vrt_resampler_prefault(vrt_resampler_type* rs, const vrt_rt_type* rt) {
+    rs->rt = rt;
+    vrt_rt_prefault(rt, rs->x, sizeof(std::complex<float>) * rs->size);
+}
+
+// Outputs the buffered input is enough for
+uint32_t vrt_resampler_outputs(const vrt_resampler_type* rs) {
+    uint64_t input = rs->input;
+    uint64_t phase = rs->phase;
+    uint32_t k = 0;
+    while (input + rs->taps_per_phase - 1 < rs->fill + rs->dropped) {
+        phase += rs->decimation;
+        input += phase/rs->interpolation;
+        phase %= rs->interpolation;
+        k++;
+    }
+    return k;
+}
+
+// Resample the buffered input into out, vrt_resampler_outputs() samples.
+// Returns the number of outputs.
+uint32_t vrt_resampler_run(vrt_resampler_type* rs, std::complex<float>* out) {
+    const uint32_t T = rs->taps_per_phase;
+    rs->run_input = rs->input;
+    rs->run_phase = rs->phase;
+    uint32_t k = 0;
+    while (rs->input + T - 1 < rs->fill + rs->dropped) {
+        const std::complex<float>* window = &rs->x[rs->input - rs->dropped];
+        if (not rs->farrow) {
+            vrt_fir_cf32(window, &rs->taps[2*T*rs->phase], T, 1, 1, &out[k]);
+        } else {
+            uint64_t q = rs->phase*rs->phases;
+            uint64_t p = q/rs->interpolation;
+            float mu = (float)((double)(q % rs->interpolation)/rs->interpolation);
+            std::complex<float> c[4];
+            for (uint32_t i = 0; i < 4; i++)
+                vrt_fir_cf32(window, &rs->taps[2*T*(4*p + i)], T, 1, 1, &c[i]);
+            out[k] = c[0] + mu*(c[1] + mu*(c[2] + mu*c[3]));
+        }
+        rs->phase += rs->decimation;
+        rs->input += rs->phase/rs->interpolation;
+        rs->phase %= rs->interpolation;
+        k++;
+    }
+
+    // drop the input before the window of the next output
+    uint32_t drop = (uint32_t)std::min<uint64_t>(rs->input - rs->dropped, rs->fill);
+    memmove(rs->x, rs->x + drop, sizeof(std::complex<float>) * (rs->fill - drop));
+    rs->fill -= drop;
+    rs->dropped += drop;
+    return k;
+}
+
+// Newest input and phase (of interpolation) of output k of the last run,
+// k may be past its end
+inline void vrt_resampler_time(const vrt_resampler_type* rs, uint32_t k, uint64_t* input, uint64_t* phase) {
+    uint64_t q = rs->run_phase + (uint64_t)k*rs->decimation;
+    *input = rs->run_input + q/rs->interpolation;
+    *phase = q % rs->interpolation;
+}
+
+void vrt_resampler_free(vrt_resampler_type* rs) {
+    vrt_free(rs->taps);
+    vrt_free(rs->x);
+}
+
+// Decimation ahead of a resampler from sample_rate to rate, and the ratio
+// interpolation/decimation left for the resampler, 1/1 if rate is
+// sample_rate over an integer decimation. Of the decimations leaving up to
+// twice the rate, the one with the fewest phases.
+void vrt_resample_plan(uint32_t sample_rate, uint32_t rate, uint32_t* decimation, uint64_t* interpolation,
+    uint64_t* resample_decimation) {
+    uint32_t most = std::max<uint32_t>(1, sample_rate/rate);
+    *interpolation = 0;
+    for (uint32_t D = most; D >= std::max<uint32_t>(1, most/2); D--) {
+        uint64_t L = (uint64_t)rate*D;
+        uint64_t M = sample_rate;
+        uint64_t g = vrt_gcd(L, M);
+        if (*interpolation == 0 or L/g < *interpolation) {
+            *decimation = D;
+            *interpolation = L/g;
+            *resample_decimation = M/g;
+        }
+    }
+}
+
+// Taps of a half-band or compensation filter for a transition band of width
+// (of its sample rate), odd, 4k+3 for a half-band
+uint32_t vrt_decimator_taps(double width, bool halfband) {
+    uint32_t num_taps = (uint32_t)ceil(VRT_DECIMATOR_TRANSITION/width);
+    if (halfband)
+        return (num_taps + 3)/4*4 + 3;
+    return num_taps | 1;
+}
+
+// Add a FIR stage, taps in the order of the input (the newest sample of a
+// window last), at rate (input samples of the decimator per input sample)
+void vrt_decimator_add(vrt_decimator_type* d, vrt_stage_kind_type kind, uint32_t decimation, const float* taps,
+    uint32_t num_taps, uint32_t rate, uint32_t block_size) {
+    vrt_fir_type* fir = &d->firs[d->num_firs++];
+    vrt_fir_init(fir, decimation, num_taps, taps, block_size/rate + 1);
+    vrt_stage_type* stage = &d->stages[d->num_stages++];
+    stage->kind = kind;
+    stage->decimation = decimation;
+    stage->interpolation = 1;
+    stage->num_taps = num_taps;
+    // taps evaluated per output
+    double evaluated = fir->halfband_row >= 0 ? fir->taps_per_branch + 1 : num_taps;
+    stage->multiply_adds = evaluated/((double)decimation*rate);
+    stage->additions = 0;
+}
+
+// Set up decimating by decimation, with room for block_size input samples
+// per call. Single stage, the FIR has taps_per_decimation*decimation taps;
+// multistage, half-band stages (after a CIC and its compensation if cic)
+// leave the last FIR a smaller decimation.
+void vrt_decimator_init(vrt_decimator_type* d, uint32_t decimation, uint32_t taps_per_decimation, bool multistage,
+    bool cic, uint32_t block_size) {
+    d->decimation = decimation;
+    d->num_stages = 0;
+    d->num_firs = 0;
+    d->cic.decimation = 0;
+    d->in = NULL;
+    d->in_size = 0;
+    d->in_fill = 0;
+    d->resample = false;
+    d->inputs = 0;
+    d->outputs = 0;
+    d->run_outputs = 0;
+    d->rt = NULL;
+
+    uint32_t rest = decimation;
+    uint32_t rate = 1;
+    if (multistage and cic) {
+        // the largest decimation leaving an even one of at least VRT_CIC_REST
+        uint32_t cic_decimation = 0;
+        for (uint32_t r = std::min(rest/VRT_CIC_REST, (uint32_t)VRT_CIC_MAX_DECIMATION); r >= VRT_CIC_MIN_DECIMATION; r--) {
+            if (rest % r == 0 and (rest/r) % 2 == 0) {
+                cic_decimation = r;
+                break;
+            }
+        }
+        if (cic_decimation > 0) {
+            vrt_cic_init(&d->cic, cic_decimation);
+            d->in = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * block_size);
+            d->in_size = block_size;
+            vrt_stage_type* stage = &d->stages[d->num_stages++];
+            stage->kind = VRT_STAGE_CIC;
+            stage->decimation = cic_decimation;
+            stage->interpolation = 1;
+            stage->num_taps = VRT_CIC_ORDER;
+            stage->multiply_adds = 0;
+            stage->additions = VRT_CIC_ORDER*(1 + 1.0/cic_decimation);
+            rest /= cic_decimation;
+            rate *= cic_decimation;
+
+            // pass the final band, a 1/(2*rest) of the rate, stop what aliases into it
+            uint32_t num_taps = vrt_decimator_taps(0.5 - 1.0/rest, false);
+            std::vector<float> taps(num_taps);
+            vrt_fir_cic_compensation(taps.data(), num_taps, cic_decimation);
+            vrt_decimator_add(d, VRT_STAGE_COMPENSATION, 2, taps.data(), num_taps, rate, block_size);
+            rest /= 2;
+            rate *= 2;
+        }
+    }
+    while (multistage and rest % 2 == 0 and rest >= 4 and d->num_stages < VRT_DECIMATOR_STAGES - 1) {
+        uint32_t num_taps = vrt_decimator_taps(0.5 - 1.0/rest, true);
+        std::vector<float> taps(num_taps);
+        vrt_fir_halfband(taps.data(), num_taps);
+        vrt_decimator_add(d, VRT_STAGE_HALFBAND, 2, taps.data(), num_taps, rate, block_size);
+        rest /= 2;
+        rate *= 2;
+    }
+
+    uint32_t num_taps = taps_per_decimation*rest;
+    std::vector<double> taps(num_taps);
+    vrt_fir_channel_taps(taps.data(), rest, taps_per_decimation);
+    std::vector<float> reversed(num_taps);
+    for (uint32_t i = 0; i < num_taps; i++)
+        reversed[i] = (float)taps[num_taps-1-i];
+    vrt_decimator_add(d, VRT_STAGE_CHANNEL, rest, reversed.data(), num_taps, rate, block_size);
+}
+
+// End the cascade with resampling by interpolation/decimation (in lowest
+// terms), see vrt_resampler_init()
+void vrt_decimator_resample(vrt_decimator_type* d, uint64_t interpolation, uint64_t decimation,
+    uint32_t taps_per_decimation, bool farrow, uint32_t block_size) {
+    vrt_resampler_type* rs = &d->resampler;
+    vrt_resampler_init(rs, interpolation, decimation, taps_per_decimation, farrow, block_size/d->decimation + 1);
+    d->resample = true;
+    if (d->decimation == 1) {
+        // nothing to decimate ahead of it
+        vrt_fir_free(&d->firs[0]);
+        d->num_firs = 0;
+        d->num_stages = 0;
+    }
+    vrt_stage_type* stage = &d->stages[d->num_stages++];
+    stage->kind = rs->farrow ? VRT_STAGE_FARROW : VRT_STAGE_RESAMPLER;
+    stage->decimation = (uint32_t)decimation;
+    stage->interpolation = (uint32_t)interpolation;
+    stage->num_taps = rs->taps_per_phase;
+    stage->multiply_adds = (rs->farrow ? 4.0 : 1.0)*rs->taps_per_phase*interpolation/((double)decimation*d->decimation);
+    stage->additions = 0;
+}
+
+// Room for n more input samples, to be written by the caller
+std::complex<float>* vrt_decimator_input(vrt_decimator_type* d, uint32_t n) {
+    d->inputs += n;
+    if (d->num_firs == 0)
+        return vrt_resampler_input(&d->resampler, n);
+    if (d->cic.decimation == 0)
+        return vrt_fir_input(&d->firs[0], n);
+    if (d->in_fill + n > d->in_size) {
+        std::complex<float>* in = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * (d->in_fill + n));
+        if (d->in != NULL) {
+            memcpy(in, d->in, sizeof(std::complex<float>) * d->in_fill);
+            vrt_free(d->in);
+        }
+        d->in = in;
+        d->in_size = d->in_fill + n;
+        vrt_rt_prefault(d->rt, d->in, sizeof(std::complex<float>) * d->in_size);
+    }
+    std::complex<float>* in = &d->in[d->in_fill];
+    d->in_fill += n;
+    return in;
+}
+
+// Run all stages but the last on the input so far. Returns the number of
+// outputs vrt_decimator_run() gives.
+uint32_t vrt_decimator_prepare(vrt_decimator_type* d) {
+    if (d->cic.decimation > 0) {
+        uint32_t k = vrt_cic_outputs(&d->cic, d->in_fill);
+        vrt_cic_run(&d->cic, d->in, d->in_fill, vrt_fir_input(&d->firs[0], k));
+        d->in_fill = 0;
+    }
+    for (uint32_t s = 0; s + 1 < d->num_firs; s++) {
+        uint32_t k = vrt_fir_outputs(&d->firs[s]);
+        vrt_fir_run(&d->firs[s], vrt_fir_input(&d->firs[s+1], k));
+    }
+    if (d->resample) {
+        if (d->num_firs > 0) {
+            vrt_fir_type* last = &d->firs[d->num_firs-1];
+            uint32_t k = vrt_fir_outputs(last);
+            vrt_fir_run(last, vrt_resampler_input(&d->resampler, k));
+        }
+        return vrt_resampler_outputs(&d->resampler);
+    }
+    return vrt_fir_outputs(&d->firs[d->num_firs-1]);
+}
+
+// Run the last stage into out, vrt_decimator_prepare() samples. Returns the number of outputs.
+uint32_t vrt_decimator_run(vrt_decimator_type* d, std::complex<float>* out) {
+    uint32_t k;
+    if (d->resample)
+        k = vrt_resampler_run(&d->resampler, out);
+    else
+        k = vrt_fir_run(&d->firs[d->num_firs-1], out);
+    d->run_outputs = d->outputs;
+    d->outputs += k;
+    return k;
+}
+
+// Input sample time (index and fraction) of output k of the last run, the
+// newest input of its filter or, resampled, its time between two inputs.
+// k may be past the end of the run.
+void vrt_decimator_time(const vrt_decimator_type* d, uint32_t k, uint64_t* index, double* fraction) {
+    if (not d->resample) {
+        *index = (d->run_outputs + k)*d->decimation;
+        *fraction = 0;
+        return;
+    }
+    uint64_t input, phase;
+    vrt_resampler_time(&d->resampler, k, &input, &phase);
+    uint64_t q = phase*d->decimation;
+    *index = input*d->decimation + q/d->resampler.interpolation;
+    *fraction = (double)(q % d->resampler.interpolation)/d->resampler.interpolation;
+}
+
+// Touch the buffers of all stages, and again whenever one grows, see
+// vrt_rt_prefault()
+void vrt_decimator_prefault(vrt_decimator_type* d, const vrt_rt_type* rt) {
+    d->rt = rt;
+    vrt_rt_prefault(rt, d->in, sizeof(std::complex<float>) * d->in_size);
+    for (uint32_t s = 0; s < d->num_firs; s++)
+        vrt_fir_prefault(&d->firs[s], rt);
+    if (d->resample)
+        vrt_resampler_prefault(&d->resampler, rt);
+}
+
+// Output sample rate at sample_rate in
+inline double vrt_decimator_rate(const vrt_decimator_type* d, uint32_t sample_rate) {
+    double rate = (double)sample_rate/d->decimation;
+    if (d->resample)
+        rate = rate*d->resampler.interpolation/d->resampler.decimation;
+    return rate;
+}
+
+const char* vrt_stage_name(vrt_stage_kind_type kind) {
+    switch (kind) {
+    case VRT_STAGE_CIC:
+        return "CIC";
+    case VRT_STAGE_COMPENSATION:
+        return "CIC compensation FIR";
+    case VRT_STAGE_HALFBAND:
+        return "half-band FIR";
+    case VRT_STAGE_RESAMPLER:
+        return "resampler";
+    case VRT_STAGE_FARROW:
+        return "Farrow resampler";
+    default:
+        return "channel FIR";
+    }
+}
+
+void vrt_decimator_free(vrt_decimator_type* d) {
+    for (uint32_t s = 0; s < d->num_firs; s++)
+        vrt_fir_free(&d->firs[s]);
+    vrt_free(d->in);
+    if (d->resample)
+        vrt_resampler_free(&d->resampler);
+}
+
+// Zoom into the bins [min_bin, max_bin] of an FFT of num_bins bins at
+// sample_rate, with blocks of up to block_size samples. Returns false if
+// the span is too wide for any decimation.
+bool vrt_zoom_init(vrt_zoom_type* zoom, uint32_t num_bins, int32_t min_bin, int32_t max_bin,
+    double sample_rate, uint32_t block_size) {
+    uint32_t span = max_bin - min_bin + 1;
+    uint32_t decimation = 1;
+    for (uint32_t d = num_bins/(VRT_ZOOM_GUARD*span); d > 1; d--) {
+        if (num_bins % d == 0 and (num_bins/d) % 2 == 0) {
+            decimation = d;
+            break;
+        }
+    }
+    if (decimation == 1)
+        return false;
+
+    zoom->decimation = decimation;
+    zoom->num_bins = num_bins/decimation;
+    int32_t center_bin = (min_bin + max_bin)/2;
+    zoom->first_bin = center_bin - zoom->num_bins/2;
+    zoom->center = ((double)center_bin - (double)(num_bins/2))*sample_rate/(double)num_bins;
+    zoom->sample_rate = sample_rate/decimation;
+
+    vrt_nco_init(&zoom->nco, zoom->center, sample_rate);
+
+    uint32_t num_taps = VRT_ZOOM_TAPS_PER_DECIMATION*decimation;
+    std::vector<float> taps(num_taps);
+    vrt_fir_lowpass(taps.data(), num_taps, 0.5/decimation, decimation);
+    vrt_fir_init(&zoom->fir, decimation, num_taps, taps.data(), block_size);
+
+    zoom->out_size = block_size/decimation + 1;
+    zoom->out = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * zoom->out_size);
+    return true;
+}
+
+// Convert, mix and decimate n samples into zoom->out. Returns the number
+// of decimated samples; the newest input of the first one is
+// samples[*newest], that of the next ones decimation samples later.
+uint32_t vrt_zoom_process(vrt_zoom_type* zoom, const std::complex<int16_t>* samples, uint32_t n, int64_t* newest) {
+    vrt_fir_type* fir = &zoom->fir;
+    *newest = (int64_t)fir->pos + fir->num_taps - 1 - fir->fill;
+    std::complex<float>* in = vrt_fir_input(fir, n);
+    vrt_convert_cf32(samples, in, n);
+    vrt_nco_mix(&zoom->nco, in, n);
+    uint32_t outputs = vrt_fir_outputs(fir);
+    if (outputs > zoom->out_size) {
+        vrt_free(zoom->out);
+        zoom->out_size = outputs;
+        zoom->out = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * outputs);
+    }
+    return vrt_fir_run(fir, zoom->out);
+}
+
+// Copy the decimated samples [i, i+n) into a frame at offset, alternating
+// the sign per frame sample (fftshift, zoom->num_bins is even)
+template <typename T> void vrt_zoom_frame(const vrt_zoom_type* zoom, uint32_t i, uint32_t n, T (*frame)[2],
+    uint32_t offset) {
+    T sign = (offset & 1) ? -1 : 1;
+    for (uint32_t k = 0; k < n; k++) {
+        frame[offset+k][0] = sign*zoom->out[i+k].real();
+        frame[offset+k][1] = sign*zoom->out[i+k].imag();
+        sign = -sign;
+    }
+}
+
+void vrt_zoom_free(vrt_zoom_type* zoom) {
+    vrt_fir_free(&zoom->fir);
+    vrt_free(zoom->out);
+}
+
+#endif
@@ -0,0 +1,762 @@
+#ifndef _VRTFFT_H
+#define _VRTFFT_H
+
+// Batched FFT engine: the main loop fills frames of num_bins samples, which
+// are collected in batches and transformed by a pool of worker threads. The
+// power of each frame is added to the accumulator in frame order, one batch
+// after the other, so the accumulated spectrum is bit-identical to
+// transforming and accumulating every frame in turn on the main loop.
+//
+// All frames are transformed with one single-frame plan (fftw_execute_dft).
+// A plan over the whole batch (fftw_plan_many_dft) may pick other codelets
+// and round differently. Frames are padded to 64 bytes so that each has the
+// alignment the plan was made for.
+//
+// Without workers the engine transforms each frame as soon as it is filled.
+//
+// In single precision (fftwf) the frames, the FFT and the power are float.
+// The power is summed in float over up to VRT_FFT_FLOAT_FRAMES frames and
+// these sums are added to the double accumulator, so long integrations do
+// not lose the small contributions of late frames.
+//
+// vrt_fft_type is the plain single-frame transform of the tools that look
+// at every frame on the processing thread, in either precision.
+//
+// Plans are first looked up in the FFTW wisdom of the --wisdom file, which
+// takes no measurable time. Sizes without wisdom start on an FFTW_ESTIMATE
+// plan; once the tool has made its plans, vrt_fft_planner_start() measures
+// the missing ones on a background thread, swaps them in as they are ready
+// and saves them to the wisdom file. vrt_fft_wisdom measures the usual
+// sizes in advance. A plan swapped in during an integration changes the
+// rounding of the frames after it.
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fftw3.h>
+
+#include "vrt-kernels.h"
+#include "vrt-tools.h"
+
+// Samples per batch when the batch size is automatic, and maximum frames
+#define VRT_FFT_BATCH_SAMPLES 65536
+#define VRT_FFT_MAX_BATCH 64
+// Frames summed in float before the sum is added in double
+#define VRT_FFT_FLOAT_FRAMES 1024
+// The power of a strong carrier squared twice overflows a float: in single
+// precision such frames are scaled by 2^-32 and their power back by 2^64
+#define VRT_FFT_SQUARE4_SCALE (1.0/4294967296.0)
+// Seconds a background plan may take at most
+#define VRT_FFT_PLAN_TIME 30.0
+
+// Forward transform of num_bins samples, out of place, for any arrays with
+// the alignment of vrt_alloc()
+struct vrt_fft_plan_type {
+    uint32_t num_bins;
+    bool single;
+    std::atomic<fftw_plan> plan;     // current plan, replaced once measured
+    std::atomic<fftwf_plan> planf;
+    fftw_plan estimate;              // estimated first plan, may still run after the swap
+    fftwf_plan estimatef;
+};
+
+struct vrt_fft_planner_type {
+    std::string wisdom;              // wisdom file, single precision in <wisdom>f, empty: none
+    std::string rigor_name;          // estimate, measure, patient or exhaustive
+    unsigned rigor;
+    std::mutex fftw;                 // FFTW planner calls, which are not thread safe
+    std::mutex mutex;                // everything below, never held while planning
+    std::condition_variable changed;
+    std::deque<vrt_fft_plan_type*> pending;
+    vrt_fft_plan_type* measuring;    // popped from pending, being measured
+    std::vector<vrt_fft_plan_type*> retired; // destroyed while FFTW was busy, freed by the planner
+    bool started;                    // planner thread running
+    std::thread thread;
+};
+
+// Single-frame transform, double or single precision
+struct vrt_fft_type {
+    uint32_t num_bins;
+    bool single;
+    fftw_complex *in, *out;
+    fftwf_complex *inf, *outf;
+    vrt_fft_plan_type* plan;
+    double scale;                    // of the power, see VRT_FFT_SQUARE4_SCALE
+};
+
+// Power summed in float over up to VRT_FFT_FLOAT_FRAMES frames, then in double
+struct vrt_fft_sum_type {
+    uint32_t num_bins;
+    float* partial;                  // sum of the frames since the last fold
+    uint32_t frames;                 // frames in partial
+    double scale;                    // of partial in total
+    double* total;                   // owned by the caller
+};
+
+struct vrt_fft_batch_type {
+    fftw_complex* in;                // frames, stride apart
+    double* power;                   // power per frame, num_bins apart
+    fftwf_complex* inf;              // in single precision, instead of in and power
+    float* powerf;
+    uint64_t* fft_ns;                // FFT time per frame, for the metrics
+    uint32_t frames;
+    uint64_t seq;                    // submission order
+};
+
+struct vrt_fft_engine_type {
+    uint32_t num_bins;
+    uint32_t stride;                 // frame stride in samples, 64 byte multiple
+    uint32_t batch_size;             // frames per batch
+    int square;                      // square (2) or square twice (4) before the FFT, 0: off
+    bool single;                     // fftwf frames, float power
+    double* magnitudes;              // accumulated power, owned by the caller
+    vrt_fft_sum_type sum;            // float sums into magnitudes, single precision
+    vrt_fft_plan_type* plan;
+    fftw_complex* out;               // output of the inline path
+    fftwf_complex* outf;
+    std::vector<vrt_fft_batch_type> batches;
+    vrt_fft_batch_type* filling;     // batch filled by the main loop
+    std::vector<std::thread> workers;
+    std::mutex mutex;                // everything below
+    std::condition_variable changed;
+    std::deque<vrt_fft_batch_type*> free;
+    std::deque<vrt_fft_batch_type*> queued;
+    uint64_t submitted;
+    uint64_t reduced;
+    bool stop;
+    const vrt_rt_type* rt;
+    vrt_metrics_type* metrics;
+};
+
+// Square the signal (two) or square it twice (four), alternating the sign
+// per sample, to bring out BPSK and QPSK carriers. Squared twice, the
+// signal is multiplied by scale.
+template <typename T> void vrt_fft_square(T (*signal)[2], uint32_t num_bins, int square, T scale = 1) {
+    int mult = 1;
+    for (uint32_t i = 0; i < num_bins; i++) {
+
+        T real = signal[i][0];
+        T imag = signal[i][1];
+
+        T real2 = real * real - imag * imag;
+        T imag2 = 2 * real * imag;
+
+        if (square == 4) {
+            signal[i][0] = mult*(real2 * real2 - imag2 * imag2)*scale;
+            signal[i][1] = mult*(2 * real2 * imag2)*scale;
+        } else {
+            signal[i][0] = mult*real2;
+            signal[i][1] = mult*imag2;
+        }
+        mult *= -1;
+    }
+}
+
+// Never destroyed, so tools exiting while a plan is measured do not trip
+// over the joinable planner thread.
+vrt_fft_planner_type& vrt_fft_planner() {
+    static vrt_fft_planner_type* planner = NULL;
+    if (planner == NULL) {
+        planner = new vrt_fft_planner_type();
+        planner->rigor_name = "estimate";
+        planner->rigor = FFTW_ESTIMATE;
+        planner->measuring = NULL;
+        planner->started = false;
+    }
+    return *planner;
+}
+
+std::string vrt_fft_wisdom_default() {
+    const char* file = getenv("VRT_FFTW_WISDOM");
+    if (file != NULL)
+        return file;
+    const char* home = getenv("HOME");
+    return home != NULL ? std::string(home) + "/.vrt_fftw_wisdom" : "";
+}
+
+void vrt_fft_options(boost::program_options::options_description& desc) {
+    namespace po = boost::program_options;
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    // clang-format off
+    desc.add_options()
+        ("wisdom", po::value<std::string>(&planner.wisdom)->default_value(vrt_fft_wisdom_default()), "FFTW wisdom file, see vrt_fft_wisdom (default $VRT_FFTW_WISDOM or ~/.vrt_fftw_wisdom)")
+        ("fft-plan", po::value<std::string>(&planner.rigor_name)->default_value("measure"), "FFTW planning: estimate, measure, patient or exhaustive, measured in the background without wisdom")
+    ;
+    // clang-format on
+}
+
+bool vrt_fft_rigor(const std::string& name, unsigned* rigor) {
+    if (name == "estimate")
+        *rigor = FFTW_ESTIMATE;
+    else if (name == "measure")
+        *rigor = FFTW_MEASURE;
+    else if (name == "patient")
+        *rigor = FFTW_PATIENT;
+    else if (name == "exhaustive")
+        *rigor = FFTW_EXHAUSTIVE;
+    else
+        return false;
+    return true;
+}
+
+bool vrt_fft_file_exists(const std::string& file) {
+    return access(file.c_str(), R_OK) == 0;
+}
+
+// Parse the options and load the wisdom file. Call before making plans.
+bool vrt_fft_planner_init() {
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    if (not vrt_fft_rigor(planner.rigor_name, &planner.rigor)) {
+        fprintf(stderr, "Invalid FFT planning \"%s\", use estimate, measure, patient or exhaustive.\n",
+            planner.rigor_name.c_str());
+        return false;
+    }
+    if (planner.rigor == FFTW_ESTIMATE or planner.wisdom.empty())
+        return true;
+
+    std::lock_guard<std::mutex> lock(planner.fftw);
+    std::string wisdomf = planner.wisdom + "f";
+    if (vrt_fft_file_exists(planner.wisdom) and not fftw_import_wisdom_from_filename(planner.wisdom.c_str()))
+        fprintf(stderr, "Failed to read FFTW wisdom from %s.\n", planner.wisdom.c_str());
+    if (vrt_fft_file_exists(wisdomf) and not fftwf_import_wisdom_from_filename(wisdomf.c_str()))
+        fprintf(stderr, "Failed to read FFTW wisdom from %s.\n", wisdomf.c_str());
+    return true;
+}
+
+// Write the wisdom of both precisions, replacing the files. Call with the
+// planner's fftw mutex held.
+bool vrt_fft_save_wisdom(const std::string& wisdom) {
+    if (wisdom.empty())
+        return true;
+    std::string tmp = wisdom + ".tmp" + std::to_string(getpid());
+    std::string wisdomf = wisdom + "f";
+    if (not fftw_export_wisdom_to_filename(tmp.c_str()) or rename(tmp.c_str(), wisdom.c_str()) != 0 or
+        not fftwf_export_wisdom_to_filename(tmp.c_str()) or rename(tmp.c_str(), wisdomf.c_str()) != 0) {
+        fprintf(stderr, "Failed to write FFTW wisdom to %s.\n", wisdom.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Free the FFTW plans and the plan. Call with the planner's fftw mutex held.
+void vrt_fft_plan_free(vrt_fft_plan_type* p) {
+    fftw_plan plan = p->plan.load();
+    fftwf_plan planf = p->planf.load();
+    if (plan != NULL)
+        fftw_destroy_plan(plan);
+    if (planf != NULL)
+        fftwf_destroy_plan(planf);
+    if (p->estimate != NULL and p->estimate != plan)
+        fftw_destroy_plan(p->estimate);
+    if (p->estimatef != NULL and p->estimatef != planf)
+        fftwf_destroy_plan(p->estimatef);
+    delete p;
+}
+
+// Measure the pending plans, one at a time, on scratch arrays: FFTW
+// overwrites the arrays it measures on. The planner mutex is only taken to
+// pop a plan and to swap the measured one in, never while measuring; the
+// FFTW calls take turns on the fftw mutex. Plans destroyed meanwhile are
+// freed here.
+void vrt_fft_planner_loop() {
+    VRT_TRACE_THREAD("fft planner");
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    while (true) {
+        vrt_fft_plan_type* p = NULL;
+        std::vector<vrt_fft_plan_type*> retired;
+        {
+            std::unique_lock<std::mutex> lock(planner.mutex);
+            planner.changed.wait(lock, [&planner] {
+                return not planner.pending.empty() or not planner.retired.empty(); });
+            retired.swap(planner.retired);
+            if (not planner.pending.empty()) {
+                p = planner.pending.front();
+                planner.pending.pop_front();
+                planner.measuring = p;
+            }
+        }
+        if (not retired.empty()) {
+            std::lock_guard<std::mutex> lock(planner.fftw);
+            for (vrt_fft_plan_type* r : retired)
+                vrt_fft_plan_free(r);
+        }
+        if (p == NULL)
+            continue;
+
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes = (p->single ? sizeof(fftwf_complex) : sizeof(fftw_complex)) * p->num_bins;
+        void* in = vrt_alloc(bytes);
+        void* out = vrt_alloc(bytes);
+        fftw_plan plan = NULL;
+        fftwf_plan planf = NULL;
+        bool saved;
+        {
+            std::lock_guard<std::mutex> lock(planner.fftw);
+            if (p->single) {
+                fftwf_set_timelimit(VRT_FFT_PLAN_TIME);
+                planf = fftwf_plan_dft_1d(p->num_bins, (fftwf_complex*)in, (fftwf_complex*)out,
+                    FFTW_FORWARD, planner.rigor);
+                fftwf_set_timelimit(FFTW_NO_TIMELIMIT);
+            } else {
+                fftw_set_timelimit(VRT_FFT_PLAN_TIME);
+                plan = fftw_plan_dft_1d(p->num_bins, (fftw_complex*)in, (fftw_complex*)out,
+                    FFTW_FORWARD, planner.rigor);
+                fftw_set_timelimit(FFTW_NO_TIMELIMIT);
+            }
+            saved = vrt_fft_save_wisdom(planner.wisdom);
+        }
+        vrt_free(in);
+        vrt_free(out);
+
+        fprintf(stderr, "# FFT plan for %u bins (%s, %s) made in %.1f s%s\n", p->num_bins,
+            p->single ? "float" : "double", planner.rigor_name.c_str(),
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+            (saved and not planner.wisdom.empty()) ? (", saved to " + planner.wisdom).c_str() : "");
+
+        {
+            // a plan destroyed while measured is in retired, freed next round
+            std::lock_guard<std::mutex> lock(planner.mutex);
+            if (planf != NULL)
+                p->planf.store(planf);
+            if (plan != NULL)
+                p->plan.store(plan);
+            planner.measuring = NULL;
+        }
+    }
+}
+
+// Plan, from wisdom if there is some. Without, the plan is estimated and
+// queued to be measured once vrt_fft_planner_start() is called. FFTW plans
+// one at a time, so this waits for a plan being measured in the background.
+vrt_fft_plan_type* vrt_fft_plan(uint32_t num_bins, bool single, void* in, void* out) {
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    std::unique_lock<std::mutex> fftw_lock(planner.fftw);
+
+    vrt_fft_plan_type* p = new vrt_fft_plan_type();
+    p->num_bins = num_bins;
+    p->single = single;
+    p->plan = NULL;
+    p->planf = NULL;
+    p->estimate = NULL;
+    p->estimatef = NULL;
+
+    bool wisdom = planner.rigor != FFTW_ESTIMATE;
+    if (single) {
+        fftwf_complex* inf = (fftwf_complex*)in;
+        fftwf_complex* outf = (fftwf_complex*)out;
+        if (wisdom)
+            p->planf = fftwf_plan_dft_1d(num_bins, inf, outf, FFTW_FORWARD, planner.rigor | FFTW_WISDOM_ONLY);
+        if (p->planf == NULL)
+            p->planf = p->estimatef = fftwf_plan_dft_1d(num_bins, inf, outf, FFTW_FORWARD, FFTW_ESTIMATE);
+    } else {
+        fftw_complex* ind = (fftw_complex*)in;
+        fftw_complex* outd = (fftw_complex*)out;
+        if (wisdom)
+            p->plan = fftw_plan_dft_1d(num_bins, ind, outd, FFTW_FORWARD, planner.rigor | FFTW_WISDOM_ONLY);
+        if (p->plan == NULL)
+            p->plan = p->estimate = fftw_plan_dft_1d(num_bins, ind, outd, FFTW_FORWARD, FFTW_ESTIMATE);
+    }
+    fftw_lock.unlock();
+
+    if (wisdom and (p->estimate != NULL or p->estimatef != NULL)) {
+        std::lock_guard<std::mutex> lock(planner.mutex);
+        planner.pending.push_back(p);
+        planner.changed.notify_all();
+    }
+    return p;
+}
+
+// Start measuring the plans without wisdom. Call after making the plans of
+// the stream, plans made later wait for the one being measured.
+void vrt_fft_planner_start() {
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    std::lock_guard<std::mutex> lock(planner.mutex);
+    if (planner.pending.empty() or planner.started)
+        return;
+    fprintf(stderr, "# Measuring %zu FFT plan(s) in the background, run vrt_fft_wisdom to have them at startup\n",
+        planner.pending.size());
+    planner.started = true;
+    planner.thread = std::thread(vrt_fft_planner_loop);
+}
+
+inline void vrt_fft_execute_dft(vrt_fft_plan_type* p, fftw_complex* in, fftw_complex* out) {
+    fftw_execute_dft(p->plan.load(std::memory_order_acquire), in, out);
+}
+
+inline void vrt_fft_execute_dft(vrt_fft_plan_type* p, fftwf_complex* in, fftwf_complex* out) {
+    fftwf_execute_dft(p->planf.load(std::memory_order_acquire), in, out);
+}
+
+// Destroy the plan. Never waits: while the planner measures, this plan or
+// another one, the plan is left to the planner thread to free.
+void vrt_fft_plan_destroy(vrt_fft_plan_type* p) {
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    std::unique_lock<std::mutex> lock(planner.mutex);
+    for (auto it = planner.pending.begin(); it != planner.pending.end(); ++it) {
+        if (*it == p) {
+            planner.pending.erase(it);
+            break;
+        }
+    }
+    std::unique_lock<std::mutex> fftw_lock(planner.fftw, std::defer_lock);
+    if (not planner.started) {
+        fftw_lock.lock();    // only held while making a plan
+    } else if (planner.measuring == p or not fftw_lock.try_lock()) {
+        planner.retired.push_back(p);
+        planner.changed.notify_all();
+        return;
+    }
+    lock.unlock();
+    vrt_fft_plan_free(p);
+}
+
+void vrt_fft_init(vrt_fft_type* fft, uint32_t num_bins, bool single, const vrt_rt_type* rt = NULL) {
+    fft->num_bins = num_bins;
+    fft->single = single;
+    fft->in = fft->out = NULL;
+    fft->inf = fft->outf = NULL;
+    fft->scale = 1;
+    if (single) {
+        fft->inf = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * num_bins);
+        fft->outf = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * num_bins);
+        vrt_rt_prefault(rt, fft->inf, sizeof(fftwf_complex) * num_bins);
+        vrt_rt_prefault(rt, fft->outf, sizeof(fftwf_complex) * num_bins);
+        fft->plan = vrt_fft_plan(num_bins, true, fft->inf, fft->outf);
+    } else {
+        fft->in = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * num_bins);
+        fft->out = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * num_bins);
+        vrt_rt_prefault(rt, fft->in, sizeof(fftw_complex) * num_bins);
+        vrt_rt_prefault(rt, fft->out, sizeof(fftw_complex) * num_bins);
+        fft->plan = vrt_fft_plan(num_bins, false, fft->in, fft->out);
+    }
+}
+
+// Convert n samples into the input at offset, see vrt_convert_cf32()
+inline void vrt_fft_convert(vrt_fft_type* fft, uint32_t offset, const std::complex<int16_t>* samples, uint32_t n,
+    int* mult = NULL, const std::complex<double>* gain = NULL) {
+    if (fft->single) {
+        std::complex<float> gainf = gain ? std::complex<float>(*gain) : std::complex<float>(1, 0);
+        vrt_convert_cf32(samples, (std::complex<float>*)&fft->inf[offset], n, mult, NULL, gain ? &gainf : NULL);
+    } else {
+        vrt_convert_cf64(samples, (std::complex<double>*)&fft->in[offset], n, mult, NULL, gain);
+    }
+}
+
+// Square (2, 4) the input if asked and transform it
+void vrt_fft_execute(vrt_fft_type* fft, int square = 0) {
+    if (fft->single) {
+        fft->scale = square == 4 ? 1/(VRT_FFT_SQUARE4_SCALE*VRT_FFT_SQUARE4_SCALE) : 1;
+        if (square)
+            vrt_fft_square(fft->inf, fft->num_bins, square, (float)(square == 4 ? VRT_FFT_SQUARE4_SCALE : 1));
+        vrt_fft_execute_dft(fft->plan, fft->inf, fft->outf);
+    } else {
+        if (square)
+            vrt_fft_square(fft->in, fft->num_bins, square);
+        vrt_fft_execute_dft(fft->plan, fft->in, fft->out);
+    }
+}
+
+// Power of the output, computed in T. With a float power, squaring twice
+// is only safe for weak signals.
+template <typename T> void vrt_fft_power(const vrt_fft_type* fft, T* power) {
+    if (fft->single) {
+        for (uint32_t i = 0; i < fft->num_bins; ++i) {
+            T real = fft->outf[i][0];
+            T imag = fft->outf[i][1];
+            power[i] = real * real + imag * imag;
+        }
+        if (fft->scale != 1)
+            for (uint32_t i = 0; i < fft->num_bins; ++i)
+                power[i] *= fft->scale;
+    } else {
+        for (uint32_t i = 0; i < fft->num_bins; ++i)
+            power[i] = fft->out[i][0] * fft->out[i][0] + fft->out[i][1] * fft->out[i][1];
+    }
+}
+
+void vrt_fft_destroy(vrt_fft_type* fft) {
+    vrt_fft_plan_destroy(fft->plan);
+    vrt_free(fft->in);
+    vrt_free(fft->out);
+    vrt_free(fft->inf);
+    vrt_free(fft->outf);
+}
+
+void vrt_fft_sum_init(vrt_fft_sum_type* sum, uint32_t num_bins, double* total, double scale = 1) {
+    sum->num_bins = num_bins;
+    sum->scale = scale;
+    sum->partial = (float*)vrt_alloc(sizeof(float) * num_bins);
+    memset(sum->partial, 0, sizeof(float) * num_bins);
+    sum->frames = 0;
+    sum->total = total;
+}
+
+// Add the float sum to the total and start over
+void vrt_fft_sum_fold(vrt_fft_sum_type* sum) {
+    if (sum->frames == 0)
+        return;
+    for (uint32_t i = 0; i < sum->num_bins; ++i) {
+        sum->total[i] += sum->scale * sum->partial[i];
+        sum->partial[i] = 0;
+    }
+    sum->frames = 0;
+}
+
+inline void vrt_fft_sum_add(vrt_fft_sum_type* sum, const float* power) {
+    for (uint32_t i = 0; i < sum->num_bins; ++i)
+        sum->partial[i] += power[i];
+    if (++sum->frames == VRT_FFT_FLOAT_FRAMES)
+        vrt_fft_sum_fold(sum);
+}
+
+void vrt_fft_sum_free(vrt_fft_sum_type* sum) {
+    vrt_free(sum->partial);
+    sum->partial = NULL;
+}
+
+// Square, transform and take the power of one frame. Returns the FFT time.
+template <typename T>
+uint64_t vrt_fft_frame_power(vrt_fft_engine_type* e, T (*in)[2], T (*out)[2], T* power) {
+    if (e->square)
+        vrt_fft_square(in, e->num_bins, e->square, (T)(e->single and e->square == 4 ? VRT_FFT_SQUARE4_SCALE : 1));
+
+    if (e->num_bins == 1) {
+        power[0] = in[0][0] * in[0][0] + in[0][1] * in[0][1];
+        return 0;
+    }
+
+    auto fft_start = std::chrono::steady_clock::now();
+    {
+        VRT_TRACE_SCOPE("fftw_execute");
+        vrt_fft_execute_dft(e->plan, in, out);
+    }
+    uint64_t fft_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - fft_start).count();
+
+    VRT_TRACE_SCOPE("power");
+    for (uint32_t i = 0; i < e->num_bins; ++i)
+        power[i] = out[i][0] * out[i][0] + out[i][1] * out[i][1];
+    return fft_ns;
+}
+
+// Frame f of the batch, out and outf are the scratch output of the caller
+inline void vrt_fft_batch_frame(vrt_fft_engine_type* e, vrt_fft_batch_type* batch, uint32_t f,
+    fftw_complex* out, fftwf_complex* outf) {
+    if (e->single)
+        batch->fft_ns[f] = vrt_fft_frame_power(e, batch->inf + (size_t)f*e->stride, outf,
+            batch->powerf + (size_t)f*e->num_bins);
+    else
+        batch->fft_ns[f] = vrt_fft_frame_power(e, batch->in + (size_t)f*e->stride, out,
+            batch->power + (size_t)f*e->num_bins);
+}
+
+void vrt_fft_accumulate(vrt_fft_engine_type* e, vrt_fft_batch_type* batch, uint32_t f) {
+    if (e->single) {
+        vrt_fft_sum_add(&e->sum, batch->powerf + (size_t)f*e->num_bins);
+    } else {
+        const double* power = batch->power + (size_t)f*e->num_bins;
+        for (uint32_t i = 0; i < e->num_bins; ++i)
+            e->magnitudes[i] += power[i];
+    }
+    if (e->metrics and e->num_bins > 1)
+        vrt_metrics_observe(&e->metrics->fft, batch->fft_ns[f]);
+}
+
+void vrt_fft_worker(vrt_fft_engine_type* e) {
+
+    VRT_TRACE_THREAD("fft worker");
+    vrt_rt_thread(e->rt, VRT_RT_DSP);
+
+    fftw_complex* out = NULL;
+    fftwf_complex* outf = NULL;
+    if (e->single) {
+        outf = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * e->stride);
+        vrt_rt_prefault(e->rt, outf, sizeof(fftwf_complex) * e->stride);
+    } else {
+        out = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * e->stride);
+        vrt_rt_prefault(e->rt, out, sizeof(fftw_complex) * e->stride);
+    }
+
+    std::unique_lock<std::mutex> lock(e->mutex);
+    while (true) {
+        e->changed.wait(lock, [e] { return e->stop or not e->queued.empty(); });
+        if (e->queued.empty())
+            break;
+        vrt_fft_batch_type* batch = e->queued.front();
+        e->queued.pop_front();
+        lock.unlock();
+
+        for (uint32_t f = 0; f < batch->frames; f++)
+            vrt_fft_batch_frame(e, batch, f, out, outf);
+
+        // accumulate in submission order: until reduced is bumped, no other
+        // worker touches the sums, so the mutex is not held meanwhile
+        lock.lock();
+        e->changed.wait(lock, [e, batch] { return e->reduced == batch->seq; });
+        lock.unlock();
+        {
+            VRT_TRACE_SCOPE("accumulate");
+            for (uint32_t f = 0; f < batch->frames; f++)
+                vrt_fft_accumulate(e, batch, f);
+        }
+        lock.lock();
+        e->reduced++;
+        batch->frames = 0;
+        e->free.push_back(batch);
+        e->changed.notify_all();
+    }
+
+    vrt_free(out);
+    vrt_free(outf);
+}
+
+// Set up the engine for frames of num_bins samples, accumulated into
+// magnitudes, in single precision if single. batch_size 0 picks about VRT_FFT_BATCH_SAMPLES samples per
+// batch. With workers > 0 frames are transformed on that many threads,
+// pinned to the DSP CPUs of rt. Call from the processing thread, the plan
+// is made here.
+void vrt_fft_start(vrt_fft_engine_type* e, uint32_t num_bins, double* magnitudes, int square, bool single,
+    uint32_t workers, uint32_t batch_size, const vrt_rt_type* rt = NULL, vrt_metrics_type* metrics = NULL) {
+
+    e->num_bins = num_bins;
+    e->stride = single ? (num_bins + 7) & ~7u : (num_bins + 3) & ~3u;
+    e->square = square;
+    e->single = single;
+    e->magnitudes = magnitudes;
+    e->rt = rt;
+    e->metrics = (metrics and metrics->enabled) ? metrics : NULL;
+    e->submitted = 0;
+    e->reduced = 0;
+    e->stop = false;
+
+    if (workers == 0)
+        batch_size = 1;
+    else if (batch_size == 0)
+        batch_size = std::max(1u, std::min((uint32_t)VRT_FFT_MAX_BATCH, VRT_FFT_BATCH_SAMPLES/num_bins));
+    e->batch_size = batch_size;
+
+    // one batch filled, one transformed per worker, one waiting per worker
+    uint32_t num_batches = workers == 0 ? 1 : 2*workers + 1;
+    e->batches.resize(num_batches);
+    for (uint32_t b = 0; b < num_batches; b++) {
+        vrt_fft_batch_type& batch = e->batches[b];
+        batch.in = NULL;
+        batch.power = NULL;
+        batch.inf = NULL;
+        batch.powerf = NULL;
+        if (single) {
+            batch.inf = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * e->stride * batch_size);
+            batch.powerf = (float*)vrt_alloc(sizeof(float) * num_bins * batch_size);
+            vrt_rt_prefault(rt, batch.inf, sizeof(fftwf_complex) * e->stride * batch_size);
+            vrt_rt_prefault(rt, batch.powerf, sizeof(float) * num_bins * batch_size);
+        } else {
+            batch.in = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * e->stride * batch_size);
+            batch.power = (double*)vrt_alloc(sizeof(double) * num_bins * batch_size);
+            vrt_rt_prefault(rt, batch.in, sizeof(fftw_complex) * e->stride * batch_size);
+            vrt_rt_prefault(rt, batch.power, sizeof(double) * num_bins * batch_size);
+        }
+        batch.fft_ns = (uint64_t*)vrt_alloc(sizeof(uint64_t) * batch_size);
+        batch.frames = 0;
+        batch.seq = 0;
+        if (b > 0)
+            e->free.push_back(&batch);
+    }
+    e->filling = &e->batches[0];
+
+    e->out = NULL;
+    e->outf = NULL;
+    if (single) {
+        vrt_fft_sum_init(&e->sum, num_bins, magnitudes,
+            square == 4 ? 1/(VRT_FFT_SQUARE4_SCALE*VRT_FFT_SQUARE4_SCALE) : 1);
+        e->outf = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * e->stride);
+        e->plan = vrt_fft_plan(num_bins, true, e->batches[0].inf, e->outf);
+    } else {
+        e->out = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * e->stride);
+        e->plan = vrt_fft_plan(num_bins, false, e->batches[0].in, e->out);
+    }
+
+    for (uint32_t w = 0; w < workers; w++)
+        e->workers.push_back(std::thread(vrt_fft_worker, e));
+}
+
+// Next frame to fill, num_bins samples
+inline fftw_complex* vrt_fft_frame(vrt_fft_engine_type* e) {
+    return e->filling->in + (size_t)e->filling->frames*e->stride;
+}
+
+// Next frame to fill in single precision
+inline fftwf_complex* vrt_fft_framef(vrt_fft_engine_type* e) {
+    return e->filling->inf + (size_t)e->filling->frames*e->stride;
+}
+
+void vrt_fft_submit(vrt_fft_engine_type* e) {
+    if (e->filling->frames == 0)
+        return;
+    std::unique_lock<std::mutex> lock(e->mutex);
+    e->filling->seq = e->submitted++;
+    e->queued.push_back(e->filling);
+    e->changed.notify_all();
+    {
+        VRT_TRACE_SCOPE("fft_wait");
+        e->changed.wait(lock, [e] { return not e->free.empty(); });
+    }
+    e->filling = e->free.front();
+    e->free.pop_front();
+}
+
+// The frame returned by vrt_fft_frame() or vrt_fft_framef() is filled
+void vrt_fft_frame_done(vrt_fft_engine_type* e) {
+    if (e->workers.empty()) {
+        vrt_fft_batch_frame(e, e->filling, 0, e->out, e->outf);
+        vrt_fft_accumulate(e, e->filling, 0);
+        return;
+    }
+    if (++e->filling->frames == e->batch_size)
+        vrt_fft_submit(e);
+}
+
+// Wait until all frames filled so far are accumulated
+void vrt_fft_flush(vrt_fft_engine_type* e) {
+    if (not e->workers.empty()) {
+        VRT_TRACE_SCOPE("fft_flush");
+        vrt_fft_submit(e);
+        std::unique_lock<std::mutex> lock(e->mutex);
+        e->changed.wait(lock, [e] { return e->reduced == e->submitted; });
+    }
+    if (e->single)
+        vrt_fft_sum_fold(&e->sum);
+}
+
+void vrt_fft_stop(vrt_fft_engine_type* e) {
+    {
+        std::lock_guard<std::mutex> lock(e->mutex);
+        e->stop = true;
+        e->queued.clear();
+    }
+    e->changed.notify_all();
+    for (std::thread& worker : e->workers)
+        worker.join();
+    e->workers.clear();
+    vrt_fft_plan_destroy(e->plan);
+    if (e->single)
+        vrt_fft_sum_free(&e->sum);
+    vrt_free(e->out);
+    vrt_free(e->outf);
+    for (vrt_fft_batch_type& batch : e->batches) {
+        vrt_free(batch.in);
+        vrt_free(batch.power);
+        vrt_free(batch.inf);
+        vrt_free(batch.powerf);
+        vrt_free(batch.fft_ns);
+    }
+    e->batches.clear();
+    e->free.clear();
+}
+
+#endif
@@ -0,0 +1,1090 @@
+#ifndef _VRTKERNELS_H
+#define _VRTKERNELS_H
+
+// Sample conversion kernels: ci16 (VRT payload) to cf32/cf64 with optional
+// fftshift sign alternation, window and complex gain, and the weighted sum
+// of the polyphase filterbank front end (vrt-pfb.h), and the mixer and the
+// decimating FIR, direct and in polyphase form, of the zoom band and the
+// channelizer (vrt-dsp.h).
+//
+// All paths produce bit-identical results: the sign is applied in the integer
+// domain, the window and gain use the same multiplies and adds in the same
+// order as the scalar path and nothing is fused into FMA.
+//
+// The SIMD path is selected at runtime (AVX2, SSE4.1 on x86, NEON on ARM);
+// set VRT_SIMD=scalar|sse4|avx2|neon to override.
+
+#include <complex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VRT_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define VRT_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Keeps a product in a register so the compiler cannot fuse it with the
+// following add into an FMA (fp-contract=off is not honoured by all patterns).
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VRT_KERNEL_KEEP(x) __asm__("" : "+x"(x))
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define VRT_KERNEL_KEEP(x) __asm__("" : "+w"(x))
+#elif defined(__GNUC__)
+#define VRT_KERNEL_KEEP(x) __asm__("" : "+m"(x))
+#else
+#define VRT_KERNEL_KEEP(x)
+#endif
+
+typedef void (*vrt_convert_cf32_fn)(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                                    int sign, const float* window, const std::complex<float>* gain);
+typedef void (*vrt_convert_cf64_fn)(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                                    int sign, const float* window, const std::complex<double>* gain);
+
+typedef void (*vrt_pfb_sum_cf32_fn)(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                                    size_t n, std::complex<float>* out);
+typedef void (*vrt_pfb_sum_cf64_fn)(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                                    size_t n, std::complex<double>* out);
+
+typedef void (*vrt_mix_cf32_fn)(std::complex<float>* x, size_t n, const std::complex<float>* steps,
+                                std::complex<float> phasor);
+typedef void (*vrt_fir_cf32_fn)(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                                uint32_t decimation, size_t n, std::complex<float>* out);
+typedef void (*vrt_polyfir_cf32_fn)(const std::complex<float>* branches, size_t stride, const float* taps,
+                                    uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out);
+
+struct vrt_kernels_type {
+    const char* name;
+    vrt_convert_cf32_fn convert_cf32;
+    vrt_convert_cf64_fn convert_cf64;
+    vrt_pfb_sum_cf32_fn pfb_sum_cf32;
+    vrt_pfb_sum_cf64_fn pfb_sum_cf64;
+    vrt_mix_cf32_fn mix_cf32;
+    vrt_fir_cf32_fn fir_cf32;
+    vrt_polyfir_cf32_fn polyfir_cf32;
+};
+
+// Scalar path, also used for the tails of the SIMD paths.
+// sign is 0 (no alternation) or the sign (+1/-1) of the first sample.
+
+template <bool ALT, bool WIN, bool GAIN>
+void vrt_convert_cf32_scalar_t(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                               int sign, const float* window, const std::complex<float>* gain) {
+    for (size_t i = 0; i < n; i++) {
+        int32_t re = in[i].real();
+        int32_t im = in[i].imag();
+        if (ALT) {
+            re *= sign;
+            im *= sign;
+            sign = -sign;
+        }
+        float r = (float)re;
+        float j = (float)im;
+        if (WIN) {
+            r = r*window[i];
+            j = j*window[i];
+        }
+        if (GAIN) {
+            float gr = gain->real();
+            float gi = gain->imag();
+            float t1r = r*gr;
+            float t1j = j*gr;
+            float t2r = j*gi;
+            float t2j = r*gi;
+            VRT_KERNEL_KEEP(t1r);
+            VRT_KERNEL_KEEP(t1j);
+            VRT_KERNEL_KEEP(t2r);
+            VRT_KERNEL_KEEP(t2j);
+            r = t1r - t2r;
+            j = t1j + t2j;
+        }
+        out[i] = std::complex<float>(r, j);
+    }
+}
+
+template <bool ALT, bool WIN, bool GAIN>
+void vrt_convert_cf64_scalar_t(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                               int sign, const float* window, const std::complex<double>* gain) {
+    for (size_t i = 0; i < n; i++) {
+        int32_t re = in[i].real();
+        int32_t im = in[i].imag();
+        if (ALT) {
+            re *= sign;
+            im *= sign;
+            sign = -sign;
+        }
+        double r = (double)re;
+        double j = (double)im;
+        if (WIN) {
+            r = r*(double)window[i];
+            j = j*(double)window[i];
+        }
+        if (GAIN) {
+            double gr = gain->real();
+            double gi = gain->imag();
+            double t1r = r*gr;
+            double t1j = j*gr;
+            double t2r = j*gi;
+            double t2j = r*gi;
+            VRT_KERNEL_KEEP(t1r);
+            VRT_KERNEL_KEEP(t1j);
+            VRT_KERNEL_KEEP(t2r);
+            VRT_KERNEL_KEEP(t2j);
+            r = t1r - t2r;
+            j = t1j + t2j;
+        }
+        out[i] = std::complex<double>(r, j);
+    }
+}
+
+// Expands to a function taking runtime options that calls the matching
+// instantiation of a <ALT, WIN, GAIN> kernel template.
+#define VRT_KERNEL_DISPATCH(NAME, KERNEL, OUT_TYPE, GAIN_TYPE, ATTR)                                   \
+    ATTR void NAME(const std::complex<int16_t>* in, OUT_TYPE* out, size_t n,                           \
+                   int sign, const float* window, const GAIN_TYPE* gain) {                             \
+        int mode = (sign != 0 ? 4 : 0) | (window != NULL ? 2 : 0) | (gain != NULL ? 1 : 0);            \
+        switch (mode) {                                                                                \
+            case 0: KERNEL<false, false, false>(in, out, n, sign, window, gain); break;                \
+            case 1: KERNEL<false, false, true>(in, out, n, sign, window, gain); break;                 \
+            case 2: KERNEL<false, true, false>(in, out, n, sign, window, gain); break;                 \
+            case 3: KERNEL<false, true, true>(in, out, n, sign, window, gain); break;                  \
+            case 4: KERNEL<true, false, false>(in, out, n, sign, window, gain); break;                 \
+            case 5: KERNEL<true, false, true>(in, out, n, sign, window, gain); break;                  \
+            case 6: KERNEL<true, true, false>(in, out, n, sign, window, gain); break;                  \
+            default: KERNEL<true, true, true>(in, out, n, sign, window, gain); break;                  \
+        }                                                                                              \
+    }
+
+VRT_KERNEL_DISPATCH(vrt_convert_cf32_scalar, vrt_convert_cf32_scalar_t, std::complex<float>, std::complex<float>, )
+VRT_KERNEL_DISPATCH(vrt_convert_cf64_scalar, vrt_convert_cf64_scalar_t, std::complex<double>, std::complex<double>, )
+
+// Polyphase filterbank sum: out[i] = sum over p of taps[p][i] * rows[p][i],
+// p = 0 (oldest row) first. Each row of taps has 2n weights, one for the
+// real and one for the imaginary part of each sample, so the sum runs over
+// plain float arrays. The float products are added in the precision of out.
+// The scalar path starts at sample begin, for the tails of the SIMD paths.
+
+template <typename T>
+void vrt_pfb_sum_scalar_t(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                          size_t n, std::complex<T>* out, size_t begin = 0) {
+    T* o = (T*)out;
+    for (size_t k = 2*begin; k < 2*n; k++)
+        o[k] = 0;
+    for (uint32_t p = 0; p < partitions; p++) {
+        const float* t = taps + p*2*n;
+        const float* h = (const float*)rows[p];
+        for (size_t k = 2*begin; k < 2*n; k++) {
+            float v = t[k]*h[k];
+            VRT_KERNEL_KEEP(v);
+            o[k] += v;
+        }
+    }
+}
+
+void vrt_pfb_sum_cf32_scalar(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                             size_t n, std::complex<float>* out) {
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out);
+}
+
+void vrt_pfb_sum_cf64_scalar(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                             size_t n, std::complex<double>* out) {
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out);
+}
+
+// Mixer: x[i] *= phasor*steps[i]. Complex products round as
+// vrt_cmul_scalar(), (ar*br - ai*bi, ai*br + ar*bi), products not fused.
+
+inline std::complex<float> vrt_cmul_scalar(std::complex<float> a, std::complex<float> b) {
+    float t1r = a.real()*b.real();
+    float t2r = a.imag()*b.imag();
+    float t1i = a.imag()*b.real();
+    float t2i = a.real()*b.imag();
+    VRT_KERNEL_KEEP(t1r);
+    VRT_KERNEL_KEEP(t2r);
+    VRT_KERNEL_KEEP(t1i);
+    VRT_KERNEL_KEEP(t2i);
+    return std::complex<float>(t1r - t2r, t1i + t2i);
+}
+
+void vrt_mix_cf32_scalar(std::complex<float>* x, size_t n, const std::complex<float>* steps,
+                         std::complex<float> phasor) {
+    for (size_t i = 0; i < n; i++)
+        x[i] = vrt_cmul_scalar(x[i], vrt_cmul_scalar(steps[i], phasor));
+}
+
+// Decimating FIR: out[k] = sum over t of taps[t] * x[k*decimation + t], for
+// n outputs. taps has 2*num_taps weights, each repeated for the real and the
+// imaginary part, so each output is a dot product of float arrays. Its
+// products are summed in VRT_FIR_LANES partial sums, float f into sum
+// f % VRT_FIR_LANES, which are then added by vrt_fir_reduce(): the SIMD
+// paths keep the partial sums in registers and round the same way.
+
+#define VRT_FIR_LANES 32
+
+inline std::complex<float> vrt_fir_reduce(const float* acc) {
+    float s16[16], s8[8], s4[4];
+    for (int i = 0; i < 16; i++)
+        s16[i] = acc[i] + acc[i + 16];
+    for (int i = 0; i < 8; i++)
+        s8[i] = s16[i] + s16[i + 8];
+    for (int i = 0; i < 4; i++)
+        s4[i] = s8[i] + s8[i + 4];
+    return std::complex<float>(s4[0] + s4[2], s4[1] + s4[3]);
+}
+
+// Products from float f on, added to the partial sums acc, and the result
+inline std::complex<float> vrt_fir_tail(const float* h, const float* taps, uint32_t num_taps, uint32_t f, float* acc) {
+    for (; f < 2*num_taps; f++) {
+        float v = taps[f]*h[f];
+        VRT_KERNEL_KEEP(v);
+        acc[f % VRT_FIR_LANES] += v;
+    }
+    return vrt_fir_reduce(acc);
+}
+
+void vrt_fir_cf32_scalar(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                         uint32_t decimation, size_t n, std::complex<float>* out) {
+    for (size_t k = 0; k < n; k++) {
+        float acc[VRT_FIR_LANES] = {0};
+        out[k] = vrt_fir_tail((const float*)(x + k*decimation), taps, num_taps, 0, acc);
+    }
+}
+
+// Decimating FIR in polyphase form: the input de-interleaved into its
+// decimation branches, branch i holding the samples i, i + decimation, ...,
+// the branches stride samples apart, and the taps transposed, branch i
+// holding the taps i, i + decimation, ... (taps_per_branch each, no
+// repetition). out[k] = sum over branches i and taps j of
+// taps[i*taps_per_branch + j] * branches[i*stride + k + j], added branch by
+// branch and tap by tap. The SIMD paths compute VRT_POLYFIR_BLOCK outputs at
+// once, one per lane, so they round the same way; they read the branches up
+// to the next multiple of VRT_POLYFIR_BLOCK outputs. The outputs are done in
+// chunks of VRT_POLYFIR_CHUNK, a tile of branches at a time, so that the
+// taps and samples of a tile stay in VRT_POLYFIR_CACHE bytes of L1 cache.
+
+#define VRT_POLYFIR_BLOCK 16
+#define VRT_POLYFIR_CHUNK 256
+#define VRT_POLYFIR_CACHE 32768
+
+// Branches per tile
+inline uint32_t vrt_polyfir_tile(uint32_t taps_per_branch) {
+    uint32_t bytes = sizeof(float)*taps_per_branch + sizeof(std::complex<float>)*(VRT_POLYFIR_CHUNK + taps_per_branch);
+    return bytes < VRT_POLYFIR_CACHE ? VRT_POLYFIR_CACHE/bytes : 1;
+}
+
+void vrt_polyfir_cf32_scalar(const std::complex<float>* branches, size_t stride, const float* taps,
+                             uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out) {
+    for (size_t k = 0; k < n; k++) {
+        float re = 0;
+        float im = 0;
+        for (uint32_t i = 0; i < decimation; i++) {
+            const std::complex<float>* b = branches + i*stride + k;
+            const float* t = taps + i*taps_per_branch;
+            for (uint32_t j = 0; j < taps_per_branch; j++) {
+                float pr = t[j]*b[j].real();
+                float pi = t[j]*b[j].imag();
+                VRT_KERNEL_KEEP(pr);
+                VRT_KERNEL_KEEP(pi);
+                re += pr;
+                im += pi;
+            }
+        }
+        out[k] = std::complex<float>(re, im);
+    }
+}
+
+#ifdef VRT_KERNELS_X86
+
+// AVX2: 8 samples per iteration (cf32), 4 samples per iteration (cf64)
+
+template <bool ALT, bool WIN, bool GAIN>
+__attribute__((target("avx2")))
+void vrt_convert_cf32_avx2_t(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                             int sign, const float* window, const std::complex<float>* gain) {
+    // sign pattern of 4 samples (re, im pairs), the same for every block of an even number of samples
+    const __m256i s = _mm256_setr_epi32(sign, sign, -sign, -sign, sign, sign, -sign, -sign);
+    const __m256 gr = _mm256_set1_ps(GAIN ? gain->real() : 0);
+    const __m256 gi = _mm256_set1_ps(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i x0 = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x));
+        __m256i x1 = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1));
+        if (ALT) {
+            x0 = _mm256_sign_epi32(x0, s);
+            x1 = _mm256_sign_epi32(x1, s);
+        }
+        __m256 v0 = _mm256_cvtepi32_ps(x0);
+        __m256 v1 = _mm256_cvtepi32_ps(x1);
+        if (WIN) {
+            __m128 w0 = _mm_loadu_ps(window + i);
+            __m128 w1 = _mm_loadu_ps(window + i + 4);
+            v0 = _mm256_mul_ps(v0, _mm256_set_m128(_mm_unpackhi_ps(w0, w0), _mm_unpacklo_ps(w0, w0)));
+            v1 = _mm256_mul_ps(v1, _mm256_set_m128(_mm_unpackhi_ps(w1, w1), _mm_unpacklo_ps(w1, w1)));
+        }
+        if (GAIN) {
+            // (r*gr - j*gi, j*gr + r*gi)
+            __m256 p0 = _mm256_mul_ps(v0, gr);
+            __m256 q0 = _mm256_mul_ps(_mm256_permute_ps(v0, 0xB1), gi);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = _mm256_addsub_ps(p0, q0);
+            __m256 p1 = _mm256_mul_ps(v1, gr);
+            __m256 q1 = _mm256_mul_ps(_mm256_permute_ps(v1, 0xB1), gi);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = _mm256_addsub_ps(p1, q1);
+        }
+        _mm256_storeu_ps((float*)(out + i), v0);
+        _mm256_storeu_ps((float*)(out + i + 4), v1);
+    }
+    vrt_convert_cf32_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+}
+
+template <bool ALT, bool WIN, bool GAIN>
+__attribute__((target("avx2")))
+void vrt_convert_cf64_avx2_t(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                             int sign, const float* window, const std::complex<double>* gain) {
+    const __m256i s = _mm256_setr_epi32(sign, sign, -sign, -sign, sign, sign, -sign, -sign);
+    const __m256d gr = _mm256_set1_pd(GAIN ? gain->real() : 0);
+    const __m256d gi = _mm256_set1_pd(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        if (ALT)
+            x = _mm256_sign_epi32(x, s);
+        __m256d v0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(x));
+        __m256d v1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1));
+        if (WIN) {
+            __m128 w = _mm_loadu_ps(window + i);
+            v0 = _mm256_mul_pd(v0, _mm256_cvtps_pd(_mm_unpacklo_ps(w, w)));
+            v1 = _mm256_mul_pd(v1, _mm256_cvtps_pd(_mm_unpackhi_ps(w, w)));
+        }
+        if (GAIN) {
+            __m256d p0 = _mm256_mul_pd(v0, gr);
+            __m256d q0 = _mm256_mul_pd(_mm256_permute_pd(v0, 0x5), gi);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = _mm256_addsub_pd(p0, q0);
+            __m256d p1 = _mm256_mul_pd(v1, gr);
+            __m256d q1 = _mm256_mul_pd(_mm256_permute_pd(v1, 0x5), gi);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = _mm256_addsub_pd(p1, q1);
+        }
+        _mm256_storeu_pd((double*)(out + i), v0);
+        _mm256_storeu_pd((double*)(out + i + 2), v1);
+    }
+    vrt_convert_cf64_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+}
+
+// SSE4.1: 4 samples per iteration (cf32), 2 samples per iteration (cf64)
+
+template <bool ALT, bool WIN, bool GAIN>
+__attribute__((target("sse4.1")))
+void vrt_convert_cf32_sse4_t(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                             int sign, const float* window, const std::complex<float>* gain) {
+    const __m128i s = _mm_setr_epi32(sign, sign, -sign, -sign);
+    const __m128 gr = _mm_set1_ps(GAIN ? gain->real() : 0);
+    const __m128 gi = _mm_set1_ps(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i x0 = _mm_cvtepi16_epi32(x);
+        __m128i x1 = _mm_cvtepi16_epi32(_mm_srli_si128(x, 8));
+        if (ALT) {
+            x0 = _mm_sign_epi32(x0, s);
+            x1 = _mm_sign_epi32(x1, s);
+        }
+        __m128 v0 = _mm_cvtepi32_ps(x0);
+        __m128 v1 = _mm_cvtepi32_ps(x1);
+        if (WIN) {
+            __m128 w = _mm_loadu_ps(window + i);
+            v0 = _mm_mul_ps(v0, _mm_unpacklo_ps(w, w));
+            v1 = _mm_mul_ps(v1, _mm_unpackhi_ps(w, w));
+        }
+        if (GAIN) {
+            __m128 p0 = _mm_mul_ps(v0, gr);
+            __m128 q0 = _mm_mul_ps(_mm_shuffle_ps(v0, v0, 0xB1), gi);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = _mm_addsub_ps(p0, q0);
+            __m128 p1 = _mm_mul_ps(v1, gr);
+            __m128 q1 = _mm_mul_ps(_mm_shuffle_ps(v1, v1, 0xB1), gi);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = _mm_addsub_ps(p1, q1);
+        }
+        _mm_storeu_ps((float*)(out + i), v0);
+        _mm_storeu_ps((float*)(out + i + 2), v1);
+    }
+    vrt_convert_cf32_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+}
+
+template <bool ALT, bool WIN, bool GAIN>
+__attribute__((target("sse4.1")))
+void vrt_convert_cf64_sse4_t(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                             int sign, const float* window, const std::complex<double>* gain) {
+    const __m128i s = _mm_setr_epi32(sign, sign, -sign, -sign);
+    const __m128d gr = _mm_set1_pd(GAIN ? gain->real() : 0);
+    const __m128d gi = _mm_set1_pd(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+        if (ALT)
+            x = _mm_sign_epi32(x, s);
+        __m128d v0 = _mm_cvtepi32_pd(x);
+        __m128d v1 = _mm_cvtepi32_pd(_mm_srli_si128(x, 8));
+        if (WIN) {
+            v0 = _mm_mul_pd(v0, _mm_set1_pd((double)window[i]));
+            v1 = _mm_mul_pd(v1, _mm_set1_pd((double)window[i + 1]));
+        }
+        if (GAIN) {
+            __m128d p0 = _mm_mul_pd(v0, gr);
+            __m128d q0 = _mm_mul_pd(_mm_shuffle_pd(v0, v0, 0x1), gi);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = _mm_addsub_pd(p0, q0);
+            __m128d p1 = _mm_mul_pd(v1, gr);
+            __m128d q1 = _mm_mul_pd(_mm_shuffle_pd(v1, v1, 0x1), gi);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = _mm_addsub_pd(p1, q1);
+        }
+        _mm_storeu_pd((double*)(out + i), v0);
+        _mm_storeu_pd((double*)(out + i + 1), v1);
+    }
+    vrt_convert_cf64_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+}
+
+VRT_KERNEL_DISPATCH(vrt_convert_cf32_avx2, vrt_convert_cf32_avx2_t, std::complex<float>, std::complex<float>, __attribute__((target("avx2"))))
+VRT_KERNEL_DISPATCH(vrt_convert_cf64_avx2, vrt_convert_cf64_avx2_t, std::complex<double>, std::complex<double>, __attribute__((target("avx2"))))
+VRT_KERNEL_DISPATCH(vrt_convert_cf32_sse4, vrt_convert_cf32_sse4_t, std::complex<float>, std::complex<float>, __attribute__((target("sse4.1"))))
+VRT_KERNEL_DISPATCH(vrt_convert_cf64_sse4, vrt_convert_cf64_sse4_t, std::complex<double>, std::complex<double>, __attribute__((target("sse4.1"))))
+
+// Polyphase filterbank sum, AVX2: 8 samples per iteration (cf32), 4 (cf64),
+// each summed over all rows in registers and stored once
+
+__attribute__((target("avx2")))
+void vrt_pfb_sum_cf32_avx2(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<float>* out) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a0 = _mm256_setzero_ps();
+        __m256 a1 = _mm256_setzero_ps();
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            __m256 p0 = _mm256_mul_ps(_mm256_loadu_ps(t), _mm256_loadu_ps(h));
+            __m256 p1 = _mm256_mul_ps(_mm256_loadu_ps(t + 8), _mm256_loadu_ps(h + 8));
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(p1);
+            a0 = _mm256_add_ps(a0, p0);
+            a1 = _mm256_add_ps(a1, p1);
+        }
+        _mm256_storeu_ps((float*)(out + i), a0);
+        _mm256_storeu_ps((float*)(out + i + 4), a1);
+    }
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+__attribute__((target("avx2")))
+void vrt_pfb_sum_cf64_avx2(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<double>* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d a0 = _mm256_setzero_pd();
+        __m256d a1 = _mm256_setzero_pd();
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            __m256 v = _mm256_mul_ps(_mm256_loadu_ps(t), _mm256_loadu_ps(h));
+            a0 = _mm256_add_pd(a0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+            a1 = _mm256_add_pd(a1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+        }
+        _mm256_storeu_pd((double*)(out + i), a0);
+        _mm256_storeu_pd((double*)(out + i + 2), a1);
+    }
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+// Mixer, AVX2: 4 samples per iteration
+
+__attribute__((target("avx2")))
+inline __m256 vrt_cmul_avx2(__m256 a, __m256 br, __m256 bi) {
+    // br, bi: real and imaginary parts of b, repeated
+    __m256 p = _mm256_mul_ps(a, br);
+    __m256 q = _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), bi);
+    VRT_KERNEL_KEEP(p);
+    VRT_KERNEL_KEEP(q);
+    return _mm256_addsub_ps(p, q);
+}
+
+__attribute__((target("avx2")))
+void vrt_mix_cf32_avx2(std::complex<float>* x, size_t n, const std::complex<float>* steps,
+                       std::complex<float> phasor) {
+    const __m256 pr = _mm256_set1_ps(phasor.real());
+    const __m256 pi = _mm256_set1_ps(phasor.imag());
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256 c = vrt_cmul_avx2(_mm256_loadu_ps((const float*)(steps + i)), pr, pi);
+        __m256 y = vrt_cmul_avx2(_mm256_loadu_ps((const float*)(x + i)), _mm256_moveldup_ps(c), _mm256_movehdup_ps(c));
+        _mm256_storeu_ps((float*)(x + i), y);
+    }
+    for (; i < n; i++)
+        x[i] = vrt_cmul_scalar(x[i], vrt_cmul_scalar(steps[i], phasor));
+}
+
+// Decimating FIR, AVX2: the 32 partial sums in four registers
+
+__attribute__((target("avx2")))
+void vrt_fir_cf32_avx2(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                       uint32_t decimation, size_t n, std::complex<float>* out) {
+    for (size_t k = 0; k < n; k++) {
+        const float* h = (const float*)(x + k*decimation);
+        __m256 a[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        uint32_t f = 0;
+        for (; f + VRT_FIR_LANES <= 2*num_taps; f += VRT_FIR_LANES) {
+            for (int j = 0; j < 4; j++) {
+                __m256 p = _mm256_mul_ps(_mm256_loadu_ps(taps + f + 8*j), _mm256_loadu_ps(h + f + 8*j));
+                VRT_KERNEL_KEEP(p);
+                a[j] = _mm256_add_ps(a[j], p);
+            }
+        }
+        float acc[VRT_FIR_LANES];
+        for (int j = 0; j < 4; j++)
+            _mm256_storeu_ps(acc + 8*j, a[j]);
+        out[k] = vrt_fir_tail(h, taps, num_taps, f, acc);
+    }
+}
+
+// Polyphase FIR, AVX2: a block of 16 outputs in four registers, each tap
+// broadcast to all lanes
+
+__attribute__((target("avx2")))
+void vrt_polyfir_cf32_avx2(const std::complex<float>* branches, size_t stride, const float* taps,
+                           uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out) {
+    uint32_t tile = vrt_polyfir_tile(taps_per_branch);
+    alignas(32) float acc[2*VRT_POLYFIR_CHUNK];
+    for (size_t k0 = 0; k0 < n; k0 += VRT_POLYFIR_CHUNK) {
+        size_t c = (n - k0 < VRT_POLYFIR_CHUNK) ? n - k0 : VRT_POLYFIR_CHUNK;
+        for (uint32_t i0 = 0; i0 < decimation; i0 += tile) {
+            uint32_t i1 = (decimation - i0 < tile) ? decimation : i0 + tile;
+            for (size_t kb = 0; kb < c; kb += VRT_POLYFIR_BLOCK) {
+                __m256 a[4];
+                for (int r = 0; r < 4; r++)
+                    a[r] = i0 ? _mm256_load_ps(acc + 2*kb + 8*r) : _mm256_setzero_ps();
+                for (uint32_t i = i0; i < i1; i++) {
+                    const float* t = taps + i*taps_per_branch;
+                    const float* b = (const float*)(branches + i*stride + k0 + kb);
+                    for (uint32_t j = 0; j < taps_per_branch; j++) {
+                        __m256 h = _mm256_broadcast_ss(t + j);
+                        for (int r = 0; r < 4; r++) {
+                            __m256 p = _mm256_mul_ps(h, _mm256_loadu_ps(b + 2*j + 8*r));
+                            VRT_KERNEL_KEEP(p);
+                            a[r] = _mm256_add_ps(a[r], p);
+                        }
+                    }
+                }
+                for (int r = 0; r < 4; r++)
+                    _mm256_store_ps(acc + 2*kb + 8*r, a[r]);
+            }
+        }
+        memcpy(out + k0, acc, c*sizeof(std::complex<float>));
+    }
+}
+
+// Polyphase filterbank sum, SSE4.1: 4 samples per iteration (cf32), 2 (cf64)
+
+__attribute__((target("sse4.1")))
+void vrt_pfb_sum_cf32_sse4(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<float>* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a0 = _mm_setzero_ps();
+        __m128 a1 = _mm_setzero_ps();
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            __m128 p0 = _mm_mul_ps(_mm_loadu_ps(t), _mm_loadu_ps(h));
+            __m128 p1 = _mm_mul_ps(_mm_loadu_ps(t + 4), _mm_loadu_ps(h + 4));
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(p1);
+            a0 = _mm_add_ps(a0, p0);
+            a1 = _mm_add_ps(a1, p1);
+        }
+        _mm_storeu_ps((float*)(out + i), a0);
+        _mm_storeu_ps((float*)(out + i + 2), a1);
+    }
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+__attribute__((target("sse4.1")))
+void vrt_pfb_sum_cf64_sse4(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<double>* out) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d a0 = _mm_setzero_pd();
+        __m128d a1 = _mm_setzero_pd();
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(t), _mm_loadu_ps(h));
+            a0 = _mm_add_pd(a0, _mm_cvtps_pd(v));
+            a1 = _mm_add_pd(a1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+        }
+        _mm_storeu_pd((double*)(out + i), a0);
+        _mm_storeu_pd((double*)(out + i + 1), a1);
+    }
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+// Mixer, SSE4.1: 2 samples per iteration
+
+__attribute__((target("sse4.1")))
+inline __m128 vrt_cmul_sse4(__m128 a, __m128 br, __m128 bi) {
+    __m128 p = _mm_mul_ps(a, br);
+    __m128 q = _mm_mul_ps(_mm_shuffle_ps(a, a, 0xB1), bi);
+    VRT_KERNEL_KEEP(p);
+    VRT_KERNEL_KEEP(q);
+    return _mm_addsub_ps(p, q);
+}
+
+__attribute__((target("sse4.1")))
+void vrt_mix_cf32_sse4(std::complex<float>* x, size_t n, const std::complex<float>* steps,
+                       std::complex<float> phasor) {
+    const __m128 pr = _mm_set1_ps(phasor.real());
+    const __m128 pi = _mm_set1_ps(phasor.imag());
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128 c = vrt_cmul_sse4(_mm_loadu_ps((const float*)(steps + i)), pr, pi);
+        __m128 y = vrt_cmul_sse4(_mm_loadu_ps((const float*)(x + i)), _mm_moveldup_ps(c), _mm_movehdup_ps(c));
+        _mm_storeu_ps((float*)(x + i), y);
+    }
+    for (; i < n; i++)
+        x[i] = vrt_cmul_scalar(x[i], vrt_cmul_scalar(steps[i], phasor));
+}
+
+// Decimating FIR, SSE4.1: the 32 partial sums in eight registers
+
+__attribute__((target("sse4.1")))
+void vrt_fir_cf32_sse4(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                       uint32_t decimation, size_t n, std::complex<float>* out) {
+    for (size_t k = 0; k < n; k++) {
+        const float* h = (const float*)(x + k*decimation);
+        __m128 a[8];
+        for (int j = 0; j < 8; j++)
+            a[j] = _mm_setzero_ps();
+        uint32_t f = 0;
+        for (; f + VRT_FIR_LANES <= 2*num_taps; f += VRT_FIR_LANES) {
+            for (int j = 0; j < 8; j++) {
+                __m128 p = _mm_mul_ps(_mm_loadu_ps(taps + f + 4*j), _mm_loadu_ps(h + f + 4*j));
+                VRT_KERNEL_KEEP(p);
+                a[j] = _mm_add_ps(a[j], p);
+            }
+        }
+        float acc[VRT_FIR_LANES];
+        for (int j = 0; j < 8; j++)
+            _mm_storeu_ps(acc + 4*j, a[j]);
+        out[k] = vrt_fir_tail(h, taps, num_taps, f, acc);
+    }
+}
+
+// Polyphase FIR, SSE4.1: a block of 16 outputs in eight registers
+
+__attribute__((target("sse4.1")))
+void vrt_polyfir_cf32_sse4(const std::complex<float>* branches, size_t stride, const float* taps,
+                           uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out) {
+    uint32_t tile = vrt_polyfir_tile(taps_per_branch);
+    alignas(16) float acc[2*VRT_POLYFIR_CHUNK];
+    for (size_t k0 = 0; k0 < n; k0 += VRT_POLYFIR_CHUNK) {
+        size_t c = (n - k0 < VRT_POLYFIR_CHUNK) ? n - k0 : VRT_POLYFIR_CHUNK;
+        for (uint32_t i0 = 0; i0 < decimation; i0 += tile) {
+            uint32_t i1 = (decimation - i0 < tile) ? decimation : i0 + tile;
+            for (size_t kb = 0; kb < c; kb += VRT_POLYFIR_BLOCK) {
+                __m128 a[8];
+                for (int r = 0; r < 8; r++)
+                    a[r] = i0 ? _mm_load_ps(acc + 2*kb + 4*r) : _mm_setzero_ps();
+                for (uint32_t i = i0; i < i1; i++) {
+                    const float* t = taps + i*taps_per_branch;
+                    const float* b = (const float*)(branches + i*stride + k0 + kb);
+                    for (uint32_t j = 0; j < taps_per_branch; j++) {
+                        __m128 h = _mm_load1_ps(t + j);
+                        for (int r = 0; r < 8; r++) {
+                            __m128 p = _mm_mul_ps(h, _mm_loadu_ps(b + 2*j + 4*r));
+                            VRT_KERNEL_KEEP(p);
+                            a[r] = _mm_add_ps(a[r], p);
+                        }
+                    }
+                }
+                for (int r = 0; r < 8; r++)
+                    _mm_store_ps(acc + 2*kb + 4*r, a[r]);
+            }
+        }
+        memcpy(out + k0, acc, c*sizeof(std::complex<float>));
+    }
+}
+
+#endif
+
+#ifdef VRT_KERNELS_NEON
+
+// NEON: 4 samples per iteration (cf32), 2 samples per iteration (cf64)
+
+template <bool ALT, bool WIN, bool GAIN>
+void vrt_convert_cf32_neon_t(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                             int sign, const float* window, const std::complex<float>* gain) {
+    const int32_t s_init[4] = {sign, sign, -sign, -sign};
+    const float c_init[4] = {-1.0f, 1.0f, -1.0f, 1.0f};
+    const int32x4_t s = vld1q_s32(s_init);
+    const float32x4_t c = vld1q_f32(c_init);
+    const float32x4_t gr = vdupq_n_f32(GAIN ? gain->real() : 0);
+    const float32x4_t gi = vdupq_n_f32(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int16x8_t x = vld1q_s16((const int16_t*)(in + i));
+        int32x4_t x0 = vmovl_s16(vget_low_s16(x));
+        int32x4_t x1 = vmovl_s16(vget_high_s16(x));
+        if (ALT) {
+            x0 = vmulq_s32(x0, s);
+            x1 = vmulq_s32(x1, s);
+        }
+        float32x4_t v0 = vcvtq_f32_s32(x0);
+        float32x4_t v1 = vcvtq_f32_s32(x1);
+        if (WIN) {
+            float32x4_t w = vld1q_f32(window + i);
+            float32x4x2_t wz = vzipq_f32(w, w);
+            v0 = vmulq_f32(v0, wz.val[0]);
+            v1 = vmulq_f32(v1, wz.val[1]);
+        }
+        if (GAIN) {
+            // adding (-j*gi) is bit-identical to subtracting (j*gi)
+            float32x4_t p0 = vmulq_f32(v0, gr);
+            float32x4_t q0 = vmulq_f32(vmulq_f32(vrev64q_f32(v0), gi), c);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = vaddq_f32(p0, q0);
+            float32x4_t p1 = vmulq_f32(v1, gr);
+            float32x4_t q1 = vmulq_f32(vmulq_f32(vrev64q_f32(v1), gi), c);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = vaddq_f32(p1, q1);
+        }
+        vst1q_f32((float*)(out + i), v0);
+        vst1q_f32((float*)(out + i + 2), v1);
+    }
+    vrt_convert_cf32_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+}
+
+template <bool ALT, bool WIN, bool GAIN>
+void vrt_convert_cf64_neon_t(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                             int sign, const float* window, const std::complex<double>* gain) {
+#ifdef __aarch64__
+    const int32_t s_init[4] = {sign, sign, -sign, -sign};
+    const double c_init[2] = {-1.0, 1.0};
+    const int32x4_t s = vld1q_s32(s_init);
+    const float64x2_t c = vld1q_f64(c_init);
+    const float64x2_t gr = vdupq_n_f64(GAIN ? gain->real() : 0);
+    const float64x2_t gi = vdupq_n_f64(GAIN ? gain->imag() : 0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        int32x4_t x = vmovl_s16(vld1_s16((const int16_t*)(in + i)));
+        if (ALT)
+            x = vmulq_s32(x, s);
+        float64x2_t v0 = vcvtq_f64_s64(vmovl_s32(vget_low_s32(x)));
+        float64x2_t v1 = vcvtq_f64_s64(vmovl_s32(vget_high_s32(x)));
+        if (WIN) {
+            v0 = vmulq_f64(v0, vdupq_n_f64((double)window[i]));
+            v1 = vmulq_f64(v1, vdupq_n_f64((double)window[i + 1]));
+        }
+        if (GAIN) {
+            float64x2_t p0 = vmulq_f64(v0, gr);
+            float64x2_t q0 = vmulq_f64(vmulq_f64(vextq_f64(v0, v0, 1), gi), c);
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(q0);
+            v0 = vaddq_f64(p0, q0);
+            float64x2_t p1 = vmulq_f64(v1, gr);
+            float64x2_t q1 = vmulq_f64(vmulq_f64(vextq_f64(v1, v1, 1), gi), c);
+            VRT_KERNEL_KEEP(p1);
+            VRT_KERNEL_KEEP(q1);
+            v1 = vaddq_f64(p1, q1);
+        }
+        vst1q_f64((double*)(out + i), v0);
+        vst1q_f64((double*)(out + i + 1), v1);
+    }
+    vrt_convert_cf64_scalar_t<ALT, WIN, GAIN>(in + i, out + i, n - i, sign, WIN ? window + i : window, gain);
+#else
+    vrt_convert_cf64_scalar_t<ALT, WIN, GAIN>(in, out, n, sign, window, gain);
+#endif
+}
+
+VRT_KERNEL_DISPATCH(vrt_convert_cf32_neon, vrt_convert_cf32_neon_t, std::complex<float>, std::complex<float>, )
+VRT_KERNEL_DISPATCH(vrt_convert_cf64_neon, vrt_convert_cf64_neon_t, std::complex<double>, std::complex<double>, )
+
+// Mixer, NEON: 2 samples per iteration
+
+inline float32x4_t vrt_cmul_neon(float32x4_t a, float32x4_t br, float32x4_t bi, float32x4_t c) {
+    // c = (-1, 1, -1, 1): adding (-ai*bi) is bit-identical to subtracting (ai*bi)
+    float32x4_t p = vmulq_f32(a, br);
+    float32x4_t q = vmulq_f32(vmulq_f32(vrev64q_f32(a), bi), c);
+    VRT_KERNEL_KEEP(p);
+    VRT_KERNEL_KEEP(q);
+    return vaddq_f32(p, q);
+}
+
+void vrt_mix_cf32_neon(std::complex<float>* x, size_t n, const std::complex<float>* steps,
+                       std::complex<float> phasor) {
+    const float c_init[4] = {-1.0f, 1.0f, -1.0f, 1.0f};
+    const float32x4_t c = vld1q_f32(c_init);
+    const float32x4_t pr = vdupq_n_f32(phasor.real());
+    const float32x4_t pi = vdupq_n_f32(phasor.imag());
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float32x4_t s = vrt_cmul_neon(vld1q_f32((const float*)(steps + i)), pr, pi, c);
+        float32x4x2_t sd = vtrnq_f32(s, s);
+        float32x4_t y = vrt_cmul_neon(vld1q_f32((const float*)(x + i)), sd.val[0], sd.val[1], c);
+        vst1q_f32((float*)(x + i), y);
+    }
+    for (; i < n; i++)
+        x[i] = vrt_cmul_scalar(x[i], vrt_cmul_scalar(steps[i], phasor));
+}
+
+// Decimating FIR, NEON: the 32 partial sums in eight registers
+
+void vrt_fir_cf32_neon(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                       uint32_t decimation, size_t n, std::complex<float>* out) {
+    for (size_t k = 0; k < n; k++) {
+        const float* h = (const float*)(x + k*decimation);
+        float32x4_t a[8];
+        for (int j = 0; j < 8; j++)
+            a[j] = vdupq_n_f32(0);
+        uint32_t f = 0;
+        for (; f + VRT_FIR_LANES <= 2*num_taps; f += VRT_FIR_LANES) {
+            for (int j = 0; j < 8; j++) {
+                float32x4_t p = vmulq_f32(vld1q_f32(taps + f + 4*j), vld1q_f32(h + f + 4*j));
+                VRT_KERNEL_KEEP(p);
+                a[j] = vaddq_f32(a[j], p);
+            }
+        }
+        float acc[VRT_FIR_LANES];
+        for (int j = 0; j < 8; j++)
+            vst1q_f32(acc + 4*j, a[j]);
+        out[k] = vrt_fir_tail(h, taps, num_taps, f, acc);
+    }
+}
+
+// Polyphase FIR, NEON: a block of 16 outputs in eight registers
+
+void vrt_polyfir_cf32_neon(const std::complex<float>* branches, size_t stride, const float* taps,
+                           uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out) {
+    uint32_t tile = vrt_polyfir_tile(taps_per_branch);
+    float acc[2*VRT_POLYFIR_CHUNK];
+    for (size_t k0 = 0; k0 < n; k0 += VRT_POLYFIR_CHUNK) {
+        size_t c = (n - k0 < VRT_POLYFIR_CHUNK) ? n - k0 : VRT_POLYFIR_CHUNK;
+        for (uint32_t i0 = 0; i0 < decimation; i0 += tile) {
+            uint32_t i1 = (decimation - i0 < tile) ? decimation : i0 + tile;
+            for (size_t kb = 0; kb < c; kb += VRT_POLYFIR_BLOCK) {
+                float32x4_t a[8];
+                for (int r = 0; r < 8; r++)
+                    a[r] = i0 ? vld1q_f32(acc + 2*kb + 4*r) : vdupq_n_f32(0);
+                for (uint32_t i = i0; i < i1; i++) {
+                    const float* t = taps + i*taps_per_branch;
+                    const float* b = (const float*)(branches + i*stride + k0 + kb);
+                    for (uint32_t j = 0; j < taps_per_branch; j++) {
+                        float32x4_t h = vld1q_dup_f32(t + j);
+                        for (int r = 0; r < 8; r++) {
+                            float32x4_t p = vmulq_f32(h, vld1q_f32(b + 2*j + 4*r));
+                            VRT_KERNEL_KEEP(p);
+                            a[r] = vaddq_f32(a[r], p);
+                        }
+                    }
+                }
+                for (int r = 0; r < 8; r++)
+                    vst1q_f32(acc + 2*kb + 4*r, a[r]);
+            }
+        }
+        memcpy(out + k0, acc, c*sizeof(std::complex<float>));
+    }
+}
+
+// Polyphase filterbank sum, NEON: 4 samples per iteration (cf32), 2 (cf64)
+
+void vrt_pfb_sum_cf32_neon(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<float>* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t a0 = vdupq_n_f32(0);
+        float32x4_t a1 = vdupq_n_f32(0);
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            float32x4_t p0 = vmulq_f32(vld1q_f32(t), vld1q_f32(h));
+            float32x4_t p1 = vmulq_f32(vld1q_f32(t + 4), vld1q_f32(h + 4));
+            VRT_KERNEL_KEEP(p0);
+            VRT_KERNEL_KEEP(p1);
+            a0 = vaddq_f32(a0, p0);
+            a1 = vaddq_f32(a1, p1);
+        }
+        vst1q_f32((float*)(out + i), a0);
+        vst1q_f32((float*)(out + i + 2), a1);
+    }
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+void vrt_pfb_sum_cf64_neon(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                           size_t n, std::complex<double>* out) {
+    size_t i = 0;
+#ifdef __aarch64__
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t a0 = vdupq_n_f64(0);
+        float64x2_t a1 = vdupq_n_f64(0);
+        for (uint32_t p = 0; p < partitions; p++) {
+            const float* t = taps + p*2*n + 2*i;
+            const float* h = (const float*)(rows[p] + i);
+            float32x4_t v = vmulq_f32(vld1q_f32(t), vld1q_f32(h));
+            a0 = vaddq_f64(a0, vcvt_f64_f32(vget_low_f32(v)));
+            a1 = vaddq_f64(a1, vcvt_high_f64_f32(v));
+        }
+        vst1q_f64((double*)(out + i), a0);
+        vst1q_f64((double*)(out + i + 1), a1);
+    }
+#endif
+    vrt_pfb_sum_scalar_t(rows, taps, partitions, n, out, i);
+}
+
+#endif
+
+// Returns the kernels for the named instruction set ("scalar", "sse4",
+// "avx2", "neon"), or for the best one this CPU supports if name is NULL.
+// Returns a kernel set with name NULL if the named one is not available.
+vrt_kernels_type vrt_kernels_select(const char* name) {
+    vrt_kernels_type k = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    bool any = (name == NULL);
+#ifdef VRT_KERNELS_X86
+    __builtin_cpu_init();
+    if ((any or strcmp(name, "avx2") == 0) and __builtin_cpu_supports("avx2")) {
+        k.name = "avx2"; k.convert_cf32 = vrt_convert_cf32_avx2; k.convert_cf64 = vrt_convert_cf64_avx2;
+        k.pfb_sum_cf32 = vrt_pfb_sum_cf32_avx2; k.pfb_sum_cf64 = vrt_pfb_sum_cf64_avx2;
+        k.mix_cf32 = vrt_mix_cf32_avx2; k.fir_cf32 = vrt_fir_cf32_avx2;
+        k.polyfir_cf32 = vrt_polyfir_cf32_avx2;
+        return k;
+    }
+    if ((any or strcmp(name, "sse4") == 0) and __builtin_cpu_supports("sse4.1")) {
+        k.name = "sse4"; k.convert_cf32 = vrt_convert_cf32_sse4; k.convert_cf64 = vrt_convert_cf64_sse4;
+        k.pfb_sum_cf32 = vrt_pfb_sum_cf32_sse4; k.pfb_sum_cf64 = vrt_pfb_sum_cf64_sse4;
+        k.mix_cf32 = vrt_mix_cf32_sse4; k.fir_cf32 = vrt_fir_cf32_sse4;
+        k.polyfir_cf32 = vrt_polyfir_cf32_sse4;
+        return k;
+    }
+#endif
+#ifdef VRT_KERNELS_NEON
+    if (any or strcmp(name, "neon") == 0) {
+        k.name = "neon"; k.convert_cf32 = vrt_convert_cf32_neon; k.convert_cf64 = vrt_convert_cf64_neon;
+        k.pfb_sum_cf32 = vrt_pfb_sum_cf32_neon; k.pfb_sum_cf64 = vrt_pfb_sum_cf64_neon;
+        k.mix_cf32 = vrt_mix_cf32_neon; k.fir_cf32 = vrt_fir_cf32_neon;
+        k.polyfir_cf32 = vrt_polyfir_cf32_neon;
+        return k;
+    }
+#endif
+    if (any or strcmp(name, "scalar") == 0) {
+        k.name = "scalar"; k.convert_cf32 = vrt_convert_cf32_scalar; k.convert_cf64 = vrt_convert_cf64_scalar;
+        k.pfb_sum_cf32 = vrt_pfb_sum_cf32_scalar; k.pfb_sum_cf64 = vrt_pfb_sum_cf64_scalar;
+        k.mix_cf32 = vrt_mix_cf32_scalar; k.fir_cf32 = vrt_fir_cf32_scalar;
+        k.polyfir_cf32 = vrt_polyfir_cf32_scalar;
+    }
+    return k;
+}
+
+// Best kernels for this CPU, VRT_SIMD overrides the CPU check
+vrt_kernels_type vrt_kernels_default() {
+    vrt_kernels_type kernels = vrt_kernels_select(NULL);
+    const char* env = getenv("VRT_SIMD");
+    if (env != NULL) {
+        vrt_kernels_type k = vrt_kernels_select(env);
+        if (k.name != NULL)
+            kernels = k;
+        else
+            fprintf(stderr, "VRT_SIMD=%s not supported, using %s.\n", env, kernels.name);
+    }
+    return kernels;
+}
+
+// Active kernels, selected on first use
+vrt_kernels_type& vrt_kernels() {
+    static vrt_kernels_type kernels = vrt_kernels_default();
+    return kernels;
+}
+
+// Force the named kernel set, returns false if it is not available
+bool vrt_kernels_set(const char* name) {
+    vrt_kernels_type k = vrt_kernels_select(name);
+    if (k.name == NULL)
+        return false;
+    vrt_kernels() = k;
+    return true;
+}
+
+// Convert n ci16 samples to cf32/cf64.
+// alternate: if not NULL, multiply by the running sign *alternate (+1/-1) that flips
+//            every sample (fftshift), updated for the next call.
+// window:    if not NULL, one real weight per sample.
+// gain:      if not NULL, complex gain applied last.
+
+void vrt_convert_cf32(const std::complex<int16_t>* in, std::complex<float>* out, size_t n,
+                      int* alternate = NULL, const float* window = NULL, const std::complex<float>* gain = NULL) {
+    int sign = (alternate != NULL) ? *alternate : 0;
+    vrt_kernels().convert_cf32(in, out, n, sign, window, gain);
+    if (alternate != NULL and (n & 1))
+        *alternate = -*alternate;
+}
+
+void vrt_convert_cf64(const std::complex<int16_t>* in, std::complex<double>* out, size_t n,
+                      int* alternate = NULL, const float* window = NULL, const std::complex<double>* gain = NULL) {
+    int sign = (alternate != NULL) ? *alternate : 0;
+    vrt_kernels().convert_cf64(in, out, n, sign, window, gain);
+    if (alternate != NULL and (n & 1))
+        *alternate = -*alternate;
+}
+
+// Weighted sum of the rows of a polyphase filterbank into one frame of n
+// samples, see vrt_pfb_sum_scalar_t(). rows are the history frames, oldest
+// first; taps has 2n weights per row.
+
+void vrt_pfb_sum_cf32(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                      size_t n, std::complex<float>* out) {
+    vrt_kernels().pfb_sum_cf32(rows, taps, partitions, n, out);
+}
+
+void vrt_pfb_sum_cf64(const std::complex<float>* const* rows, const float* taps, uint32_t partitions,
+                      size_t n, std::complex<double>* out) {
+    vrt_kernels().pfb_sum_cf64(rows, taps, partitions, n, out);
+}
+
+// Mix n samples: x[i] *= phasor*steps[i], see vrt_mix_cf32_scalar()
+
+void vrt_mix_cf32(std::complex<float>* x, size_t n, const std::complex<float>* steps, std::complex<float> phasor) {
+    vrt_kernels().mix_cf32(x, n, steps, phasor);
+}
+
+// n outputs of a FIR decimating by decimation, see vrt_fir_cf32_scalar().
+// x holds (n-1)*decimation + num_taps samples, taps 2*num_taps weights.
+
+void vrt_fir_cf32(const std::complex<float>* x, const float* taps, uint32_t num_taps,
+                  uint32_t decimation, size_t n, std::complex<float>* out) {
+    vrt_kernels().fir_cf32(x, taps, num_taps, decimation, n, out);
+}
+
+// n outputs of a FIR in polyphase form, see vrt_polyfir_cf32_scalar(). The
+// branches are readable up to the next multiple of VRT_POLYFIR_BLOCK outputs
+// plus taps_per_branch - 1 samples.
+
+void vrt_polyfir_cf32(const std::complex<float>* branches, size_t stride, const float* taps,
+                      uint32_t decimation, uint32_t taps_per_branch, size_t n, std::complex<float>* out) {
+    vrt_kernels().polyfir_cf32(branches, stride, taps, decimation, taps_per_branch, n, out);
+}
+
+#endif
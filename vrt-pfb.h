@@ -0,0 +1,108 @@
+#ifndef _VRTPFB_H
+#define _VRTPFB_H
+
+// Polyphase filterbank (WOLA, weighted overlap-add) front end of the FFT
+// tools. The last `partitions` frames of num_bins samples are weighted with
+// a prototype low-pass filter of partitions*num_bins taps (Blackman-Harris
+// windowed sinc) and summed into one frame of num_bins samples, which is
+// then transformed as usual. Each bin then has a flat top and steep skirts
+// instead of the sinc response of a plain FFT.
+//
+// The frames are kept in a circular history of `partitions` slots: the
+// next frame is converted into the slot of the oldest one and the history
+// advances by one slot per frame, so no samples are moved. The taps are
+// precomputed in float, each repeated for the real and the imaginary part
+// (see vrt_pfb_sum_cf32()), in the order of the rows, oldest first.
+
+#include <complex>
+#include <math.h>
+#include <stdint.h>
+
+#include "vrt-kernels.h"
+#include "vrt-tools.h"
+
+struct vrt_pfb_type {
+    uint32_t num_bins;
+    uint32_t partitions;
+    // slot of the oldest frame, the next frame is converted into the slot before it
+    uint32_t oldest;
+    std::complex<float>* history;
+    // partitions rows of 2*num_bins weights
+    float* taps;
+    // slots of the history, oldest first
+    const std::complex<float>** rows;
+};
+
+// Set up a filterbank of partitions frames of num_bins samples. The taps
+// are multiplied by scale, e.g. to normalise the ci16 samples.
+void vrt_pfb_init(vrt_pfb_type* pfb, uint32_t num_bins, uint32_t partitions, double scale = 1,
+    const vrt_rt_type* rt = NULL) {
+    uint32_t len = partitions*num_bins;
+    pfb->num_bins = num_bins;
+    pfb->partitions = partitions;
+    pfb->oldest = 0;
+    pfb->history = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * len);
+    pfb->taps = (float*)vrt_alloc(sizeof(float) * 2 * len);
+    pfb->rows = new const std::complex<float>*[partitions];
+    vrt_rt_prefault(rt, pfb->history, sizeof(std::complex<float>) * len);
+
+    for (uint32_t i = 0; i < len; i++)
+        pfb->history[i] = std::complex<float>(0, 0);
+
+    // Blackman-Harris window
+    double a0 = 0.35875;
+    double a1 = 0.48829;
+    double a2 = 0.14128;
+    double a3 = 0.01168;
+
+    for (uint32_t i = 0; i < len; i++) {
+        int32_t j = (int32_t)i - (int32_t)(len/2);
+
+        double blackman_window = a0 - a1*cos(2*M_PI*(double)i/((double)len-1)) +
+                                    a2*cos(4*M_PI*(double)i/((double)len-1)) +
+                                    a3*cos(6*M_PI*(double)i/((double)len-1));
+
+        double x = ((double)partitions*M_PI)*((double)j/(double)len);
+        float tap = scale*((x != 0) ? blackman_window*sin(x)/x : blackman_window);
+        pfb->taps[2*i] = tap;
+        pfb->taps[2*i+1] = tap;
+    }
+}
+
+// Frame the next samples are converted into
+inline std::complex<float>* vrt_pfb_input(vrt_pfb_type* pfb) {
+    return &pfb->history[pfb->oldest*pfb->num_bins];
+}
+
+// Convert n samples into the next frame at offset, see vrt_convert_cf32()
+inline void vrt_pfb_convert(vrt_pfb_type* pfb, uint32_t offset, const std::complex<int16_t>* samples, uint32_t n,
+    int* mult = NULL) {
+    vrt_convert_cf32(samples, vrt_pfb_input(pfb) + offset, n, mult);
+}
+
+// The next frame is filled, it becomes the newest row
+inline void vrt_pfb_advance(vrt_pfb_type* pfb) {
+    pfb->oldest = (pfb->oldest + 1) % pfb->partitions;
+    for (uint32_t p = 0; p < pfb->partitions; p++)
+        pfb->rows[p] = &pfb->history[((pfb->oldest + p) % pfb->partitions)*pfb->num_bins];
+}
+
+// The next frame is filled: weight and sum the history into out, a frame
+// of num_bins samples in the precision of the FFT
+void vrt_pfb_frame(vrt_pfb_type* pfb, double (*out)[2]) {
+    vrt_pfb_advance(pfb);
+    vrt_pfb_sum_cf64(pfb->rows, pfb->taps, pfb->partitions, pfb->num_bins, (std::complex<double>*)out);
+}
+
+void vrt_pfb_frame(vrt_pfb_type* pfb, float (*out)[2]) {
+    vrt_pfb_advance(pfb);
+    vrt_pfb_sum_cf32(pfb->rows, pfb->taps, pfb->partitions, pfb->num_bins, (std::complex<float>*)out);
+}
+
+void vrt_pfb_free(vrt_pfb_type* pfb) {
+    vrt_free(pfb->history);
+    vrt_free(pfb->taps);
+    delete[] pfb->rows;
+}
+
+#endif
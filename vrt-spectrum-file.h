@@ -0,0 +1,342 @@
+#ifndef _VRTSPECTRUMFILE_H
+#define _VRTSPECTRUMFILE_H
+
+// Compact binary spectrum files (vrt_spectrum --spectrum-file), read back
+// by vrt_spectrum_to_ecsv. Little endian:
+//
+//   header, VRT_SPECFILE_ALIGN byte multiple
+//     char magic[8]                 "VRTSPEC" and '\0'
+//     uint32 version                VRT_SPECFILE_VERSION
+//     uint32 header_size            bytes up to the first record
+//     uint32 format                 VRT_SPECFILE_FLOAT32 or VRT_SPECFILE_FLOAT16
+//     uint32 num_bins               values per record
+//     uint32 num_columns            float64 columns before the values
+//     uint32 record_size            bytes per record
+//     uint32 decimals[num_columns + 1]  printed decimals of each column and of the values
+//     char meta[]                   the ECSV header and column names, '\0' terminated
+//   records, record_size bytes each
+//     uint64 seconds, uint64 picoseconds   timestamp
+//     float64 columns[num_columns]
+//     float32 or float16 values[num_bins]  one per bin, padded to 8 bytes
+//
+// Records are collected in two large blocks. The processing thread fills
+// one while a writer thread writes the other, so the processing thread
+// neither formats nor waits on the disk. A block is handed to the writer
+// when it is full, or after VRT_SPECFILE_FLUSH seconds so that slow
+// spectra still reach the file.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vrt-tools.h"
+
+#define VRT_SPECFILE_MAGIC "VRTSPEC"
+#define VRT_SPECFILE_VERSION 1
+#define VRT_SPECFILE_FLOAT32 0
+#define VRT_SPECFILE_FLOAT16 1
+// Header and block size multiple, block size and seconds before a partial block is written
+#define VRT_SPECFILE_ALIGN 4096
+#define VRT_SPECFILE_BLOCK (4u<<20)
+#define VRT_SPECFILE_FLUSH 1.0
+
+struct vrt_specfile_header_type {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t format;
+    uint32_t num_bins;
+    uint32_t num_columns;
+    uint32_t record_size;
+};
+
+struct vrt_specfile_type {
+    int fd;
+    uint32_t format;
+    uint32_t num_bins;
+    uint32_t num_columns;
+    uint32_t record_size;
+    uint8_t* record;                 // record being assembled
+    uint8_t* blocks[2];
+    size_t block_size;
+    uint32_t filling;                // block filled by the processing thread
+    size_t fill;
+    std::chrono::steady_clock::time_point started;  // first record of the filling block
+    std::thread thread;
+    std::mutex mutex;                // everything below
+    std::condition_variable changed;
+    size_t pending;                  // bytes of the other block to write, 0: writer idle
+    bool stop;
+    bool failed;
+    uint64_t bytes;                  // written
+    const vrt_rt_type* rt;
+};
+
+// IEEE 754 half precision, rounded to nearest even
+inline uint16_t vrt_float_to_half(float value) {
+    uint32_t f;
+    memcpy(&f, &value, 4);
+    uint16_t sign = (f >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((f >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = f & 0x7FFFFF;
+    if (((f >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7C00;
+    if (exponent <= 0) {
+        // subnormal or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway or (rest == halfway and (half & 1)))
+            half++;
+        return sign | half;
+    }
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFF;
+    // a carry into the exponent is still correct, up to infinity
+    if (rest > 0x1000 or (rest == 0x1000 and (half & 1)))
+        half++;
+    return sign | half;
+}
+
+inline float vrt_half_to_float(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t f;
+    if (exponent == 0x1F) {
+        f = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent == 0) {
+        if (mantissa == 0) {
+            f = sign;
+        } else {
+            // subnormal: normalize
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            f = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+        }
+    } else {
+        f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &f, 4);
+    return value;
+}
+
+inline uint32_t vrt_specfile_record_size(uint32_t format, uint32_t num_bins, uint32_t num_columns) {
+    uint32_t bytes = 16 + 8*num_columns + num_bins*(format == VRT_SPECFILE_FLOAT16 ? 2 : 4);
+    return (bytes + 7) & ~7u;
+}
+
+// Write all of a buffer, false on an error
+bool vrt_specfile_write_all(int fd, const uint8_t* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t n = write(fd, data, bytes);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+void vrt_specfile_writer(vrt_specfile_type* f) {
+    vrt_rt_thread(f->rt, VRT_RT_WRITER);
+    std::unique_lock<std::mutex> lock(f->mutex);
+    while (true) {
+        f->changed.wait(lock, [f] { return f->pending > 0 or f->stop; });
+        if (f->pending == 0)
+            break;
+        // the other block is ours until pending is cleared
+        const uint8_t* block = f->blocks[1 - f->filling];
+        size_t bytes = f->pending;
+        lock.unlock();
+        bool ok = vrt_specfile_write_all(f->fd, block, bytes);
+        lock.lock();
+        if (not ok and not f->failed) {
+            fprintf(stderr, "Failed to write the spectrum file: %s.\n", strerror(errno));
+            f->failed = true;
+        }
+        f->bytes += bytes;
+        f->pending = 0;
+        f->changed.notify_all();
+    }
+}
+
+// Create the file at path with the given ECSV metadata and start the
+// writer, pinned to the writer CPUs of rt. decimals has num_columns + 1
+// entries. Returns false if the file can not be written.
+bool vrt_specfile_open(vrt_specfile_type* f, const std::string& path, uint32_t format, uint32_t num_bins,
+    uint32_t num_columns, const uint32_t* decimals, const std::string& meta, const vrt_rt_type* rt = NULL) {
+
+    f->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f->fd < 0) {
+        fprintf(stderr, "Failed to create %s: %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    f->format = format;
+    f->num_bins = num_bins;
+    f->num_columns = num_columns;
+    f->record_size = vrt_specfile_record_size(format, num_bins, num_columns);
+
+    vrt_specfile_header_type header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VRT_SPECFILE_MAGIC, sizeof(VRT_SPECFILE_MAGIC));
+    size_t bytes = sizeof(header) + 4*(num_columns + 1) + meta.size() + 1;
+    header.version = VRT_SPECFILE_VERSION;
+    header.header_size = (bytes + VRT_SPECFILE_ALIGN - 1) & ~(size_t)(VRT_SPECFILE_ALIGN - 1);
+    header.format = format;
+    header.num_bins = num_bins;
+    header.num_columns = num_columns;
+    header.record_size = f->record_size;
+
+    std::vector<uint8_t> head(header.header_size, 0);
+    memcpy(head.data(), &header, sizeof(header));
+    memcpy(head.data() + sizeof(header), decimals, 4*(num_columns + 1));
+    memcpy(head.data() + sizeof(header) + 4*(num_columns + 1), meta.c_str(), meta.size());
+    if (not vrt_specfile_write_all(f->fd, head.data(), head.size())) {
+        fprintf(stderr, "Failed to write %s: %s.\n", path.c_str(), strerror(errno));
+        close(f->fd);
+        return false;
+    }
+
+    // at least a few records per block
+    f->block_size = std::max((size_t)VRT_SPECFILE_BLOCK,
+        ((size_t)4*f->record_size + VRT_SPECFILE_ALIGN - 1) & ~(size_t)(VRT_SPECFILE_ALIGN - 1));
+    f->record = (uint8_t*)vrt_alloc(f->record_size);
+    memset(f->record, 0, f->record_size);
+    for (int b = 0; b < 2; b++) {
+        f->blocks[b] = (uint8_t*)vrt_alloc(f->block_size);
+        vrt_rt_prefault(rt, f->blocks[b], f->block_size);
+    }
+    f->filling = 0;
+    f->fill = 0;
+    f->pending = 0;
+    f->stop = false;
+    f->failed = false;
+    f->bytes = header.header_size;
+    f->rt = rt;
+    f->thread = std::thread(vrt_specfile_writer, f);
+    return true;
+}
+
+// Hand the filling block to the writer, waiting for it to finish the other
+// one if wait, and start on the other block. Returns false if the writer is
+// busy and wait is false.
+bool vrt_specfile_submit(vrt_specfile_type* f, bool wait) {
+    std::unique_lock<std::mutex> lock(f->mutex);
+    if (f->pending > 0) {
+        if (not wait)
+            return false;
+        VRT_TRACE_SCOPE("specfile_wait");
+        f->changed.wait(lock, [f] { return f->pending == 0; });
+    }
+    f->pending = f->fill;
+    f->filling = 1 - f->filling;
+    f->fill = 0;
+    f->changed.notify_all();
+    return true;
+}
+
+// Append a record of num_columns columns and num_bins values. Returns false
+// once writing has failed.
+bool vrt_specfile_write(vrt_specfile_type* f, uint64_t seconds, uint64_t picoseconds, const double* columns,
+    const float* values) {
+
+    uint8_t* r = f->record;
+    memcpy(r, &seconds, 8);
+    memcpy(r + 8, &picoseconds, 8);
+    memcpy(r + 16, columns, 8*f->num_columns);
+    uint8_t* v = r + 16 + 8*f->num_columns;
+    if (f->format == VRT_SPECFILE_FLOAT16) {
+        uint16_t* h = (uint16_t*)v;
+        for (uint32_t i = 0; i < f->num_bins; i++)
+            h[i] = vrt_float_to_half(values[i]);
+    } else {
+        memcpy(v, values, 4*f->num_bins);
+    }
+
+    // records run on across blocks
+    const auto now = std::chrono::steady_clock::now();
+    if (f->fill == 0)
+        f->started = now;
+    size_t done = 0;
+    while (done < f->record_size) {
+        size_t n = std::min((size_t)f->record_size - done, f->block_size - f->fill);
+        memcpy(f->blocks[f->filling] + f->fill, r + done, n);
+        f->fill += n;
+        done += n;
+        if (f->fill == f->block_size) {
+            vrt_specfile_submit(f, true);
+            f->started = now;
+        }
+    }
+    if (f->fill > 0 and std::chrono::duration<double>(now - f->started).count() >= VRT_SPECFILE_FLUSH)
+        vrt_specfile_submit(f, false);
+
+    std::lock_guard<std::mutex> lock(f->mutex);
+    return not f->failed;
+}
+
+// Write what is left, stop the writer and close the file
+bool vrt_specfile_close(vrt_specfile_type* f) {
+    if (f->fill > 0)
+        vrt_specfile_submit(f, true);
+    {
+        std::unique_lock<std::mutex> lock(f->mutex);
+        f->changed.wait(lock, [f] { return f->pending == 0; });
+        f->stop = true;
+    }
+    f->changed.notify_all();
+    f->thread.join();
+    bool ok = not f->failed;
+    if (close(f->fd) != 0)
+        ok = false;
+    vrt_free(f->record);
+    vrt_free(f->blocks[0]);
+    vrt_free(f->blocks[1]);
+    return ok;
+}
+
+// Read the header of a spectrum file, with the decimals and the metadata.
+// Returns false if it is not one.
+bool vrt_specfile_read_header(FILE* file, vrt_specfile_header_type* header, std::vector<uint32_t>& decimals,
+    std::string& meta) {
+    if (fread(header, sizeof(*header), 1, file) != 1 or
+        memcmp(header->magic, VRT_SPECFILE_MAGIC, sizeof(VRT_SPECFILE_MAGIC)) != 0 or
+        header->version != VRT_SPECFILE_VERSION or
+        (header->format != VRT_SPECFILE_FLOAT32 and header->format != VRT_SPECFILE_FLOAT16) or
+        header->record_size != vrt_specfile_record_size(header->format, header->num_bins, header->num_columns) or
+        header->header_size < sizeof(*header) + 4*(header->num_columns + 1))
+        return false;
+    std::vector<char> rest(header->header_size - sizeof(*header));
+    if (fread(rest.data(), 1, rest.size(), file) != rest.size())
+        return false;
+    decimals.resize(header->num_columns + 1);
+    memcpy(decimals.data(), rest.data(), 4*decimals.size());
+    const char* text = rest.data() + 4*decimals.size();
+    meta.assign(text, strnlen(text, rest.size() - 4*decimals.size()));
+    return true;
+}
+
+#endif
@@ -0,0 +1,480 @@
+#ifndef _VRTTARGETS_H
+#define _VRTTARGETS_H
+
+// Multi-target channelizer (vrt_channelizer --target): narrow channels cut
+// out of one stream, each with its own frequency, bandwidth, Doppler rate or
+// tracked object and output port. The processing thread converts a data
+// packet once into a block of cf32 samples, and every target mixes the
+// block to DC with its own phasor into its own decimator
+// (vrt_decimator_type) and sends its own packets.
+//
+// The targets are spread over a pool of worker threads, target t on worker
+// t % workers. The blocks form a ring: the processing thread fills the next
+// block once every worker is done with it, so it only waits when the
+// workers fall behind by the whole ring. Context packets and extended
+// context (tracking data) pass through the same ring, so each target sees
+// them in stream order and only its worker uses its socket. Without
+// workers the processing thread runs the targets itself.
+
+#include <algorithm>
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include "vrt-dsp.h"
+#include "vrt-tools.h"
+#include "tracker-extended-context.h"
+
+// Blocks in the ring
+#define VRT_TARGET_BLOCKS 8
+
+struct vrt_target_type {
+    // from the command line, see vrt_target_parse()
+    double frequency;            // RF frequency, 0: the stream center (or the tracked object)
+    double offset;               // from the frequency
+    double bandwidth;            // 0: the stream sample rate over the default decimation
+    double doppler_rate;         // Hz/s, updated from the tracking data when tracking
+    bool tracking;
+    std::string object;          // tracked object, empty: any
+    uint16_t port;               // 0: the default port of the target
+    // set up at the first context, see vrt_target_setup() and vrt_target_start()
+    uint32_t decimation;
+    uint64_t interpolation;      // resampled by interpolation/resample_decimation if they differ
+    uint64_t resample_decimation;
+    double freq_offset;          // from the stream center
+    bool lsr;                    // tracking source LSR, the context keeps the stream frequency
+    vrt_decimator_type decimator;
+    std::vector<std::complex<float>> y;
+    // fixed offset: the NCO, Doppler: a phasor stepping by a changing step per sample
+    vrt_nco_type nco;
+    std::complex<double> phasor;
+    std::complex<double> step;
+    std::complex<double> step_dop;
+    double total_phase;
+    bool context_sent;
+    void* responder;
+    struct vrt_packet p;
+    vrt_tx_packet_type tx;
+    uint32_t iq_counter;
+    uint32_t frame_count;
+};
+
+enum vrt_target_event_type {
+    VRT_TARGET_DATA,
+    VRT_TARGET_CONTEXT,
+    VRT_TARGET_EXTENDED
+};
+
+struct vrt_target_block_type {
+    vrt_target_event_type event;
+    // data: the converted samples and the time of the first one
+    std::complex<float>* samples;
+    uint32_t num_samples;
+    uint32_t size;
+    uint64_t integer_seconds_timestamp;
+    uint64_t fractional_seconds_timestamp;
+    // context
+    context_type context;
+    // extended context: the tracking data if any, and a reference to the
+    // message for each target to forward
+    bool tracker_valid;
+    tracker_ext_context_type tracker;
+    std::vector<zmq_msg_t> forward;
+    // workers still processing the block
+    uint32_t pending;
+};
+
+struct vrt_target_pool_type {
+    std::vector<vrt_target_type>* targets;
+    uint32_t sample_rate;
+    uint32_t samples_per_packet;
+    vrt_tx_pool_type* tx_pool;
+    const vrt_rt_type* rt;
+    vrt_target_block_type blocks[VRT_TARGET_BLOCKS];
+    uint64_t published;          // blocks handed to the workers
+    std::atomic<uint64_t> output_bytes;
+    std::vector<std::thread> workers;
+    std::mutex mutex;            // published, pending of the blocks and stop
+    std::condition_variable changed;
+    bool stop;
+};
+
+// Parse a target, comma separated key=value pairs: frequency, offset,
+// bandwidth, doppler (Hz/s), tracking (an object name, or nothing for any
+// object) and port, e.g. "frequency=437.8e6,bandwidth=25e3,port=50201".
+bool vrt_target_parse(const std::string& spec, vrt_target_type* t) {
+    t->frequency = 0;
+    t->offset = 0;
+    t->bandwidth = 0;
+    t->doppler_rate = 0;
+    t->tracking = false;
+    t->object.clear();
+    t->port = 0;
+
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","));
+    for (const std::string& item : items) {
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+        if (key == "tracking") {
+            t->tracking = true;
+            t->object = value;
+            continue;
+        }
+        char* end;
+        double number = strtod(value.c_str(), &end);
+        if (value.empty() or *end != '\0') {
+            fprintf(stderr, "Invalid value \"%s\" of \"%s\" in target \"%s\".\n", value.c_str(), key.c_str(), spec.c_str());
+            return false;
+        }
+        if (key == "frequency") {
+            t->frequency = number;
+        } else if (key == "offset") {
+            t->offset = number;
+        } else if (key == "bandwidth" and number > 0) {
+            t->bandwidth = number;
+        } else if (key == "doppler") {
+            t->doppler_rate = number;
+        } else if (key == "port" and number > 0 and number < 65536) {
+            t->port = number;
+        } else {
+            fprintf(stderr, "Invalid \"%s\" in target \"%s\", keys are frequency, offset, bandwidth, doppler, tracking and port.\n",
+                item.c_str(), spec.c_str());
+            return false;
+        }
+    }
+    if (t->tracking and t->doppler_rate != 0) {
+        fprintf(stderr, "Target \"%s\" has both a Doppler rate and tracking.\n", spec.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Tracking data of an object t follows
+inline bool vrt_target_tracks(const vrt_target_type* t, const tracker_ext_context_type* tracker) {
+    return t->tracking and tracker->tracker_ext_context_received and
+        (t->object.empty() or strncmp(tracker->object_name, t->object.c_str(), sizeof(tracker->object_name)) == 0);
+}
+
+// Offset and decimation of target number index at the stream of the first
+// context, decimation if it has no bandwidth. A bandwidth that does not
+// divide the sample rate is resampled to. Returns false if the target does
+// not fit the stream.
+bool vrt_target_setup(vrt_target_type* t, uint32_t index, const context_type* c,
+    const tracker_ext_context_type* tracker, uint32_t decimation) {
+    double frequency = t->frequency;
+    t->lsr = false;
+    if (t->tracking) {
+        if (tracker->frequency == 0) {
+            double scale_freq = (double)c->rf_freq/1e9;
+            frequency = (double)c->rf_freq+tracker->doppler*scale_freq;
+        } else {
+            frequency = tracker->frequency+tracker->doppler;
+        }
+        t->doppler_rate = std::isnan(tracker->doppler_rate) ? 0 : tracker->doppler_rate;
+        t->lsr = strncmp(tracker->tracking_source, "LSR", sizeof(tracker->tracking_source)) == 0;
+    }
+    t->freq_offset = (frequency > 0 ? frequency - (double)c->rf_freq : 0) + t->offset;
+
+    t->interpolation = 1;
+    t->resample_decimation = 1;
+    if (t->bandwidth > 0 and fmod((double)c->sample_rate, t->bandwidth) != 0)
+        vrt_resample_plan(c->sample_rate, (uint32_t)llround(t->bandwidth), &t->decimation, &t->interpolation,
+            &t->resample_decimation);
+    else
+        t->decimation = t->bandwidth > 0 ? c->sample_rate/t->bandwidth : decimation;
+    if (t->decimation == 0) {
+        fprintf(stderr, "Target %u: decimation needs to be at least 1.\n", index);
+        return false;
+    }
+    if (fabs(t->freq_offset) > c->sample_rate/2) {
+        fprintf(stderr, "Target %u: frequency outside of the stream.\n", index);
+        return false;
+    }
+    return true;
+}
+
+// Set up the decimator and the resampler if any (see vrt_decimator_init()
+// and vrt_decimator_resample()), the mixer and the output packets on responder
+void vrt_target_start(vrt_target_type* t, uint32_t taps_per_decimation, bool multistage, bool cic, bool farrow,
+    uint32_t sample_rate, uint32_t samples_per_packet, void* responder, const vrt_rt_type* rt = NULL) {
+    vrt_decimator_init(&t->decimator, t->decimation, taps_per_decimation, multistage, cic, VRT_SAMPLES_PER_PACKET);
+    if (t->interpolation != t->resample_decimation)
+        vrt_decimator_resample(&t->decimator, t->interpolation, t->resample_decimation, taps_per_decimation, farrow,
+            VRT_SAMPLES_PER_PACKET);
+    vrt_decimator_prefault(&t->decimator, rt);
+    const std::complex<double> i(0.0, 1.0);
+    vrt_nco_init(&t->nco, t->freq_offset, sample_rate);
+    t->phasor = 1;
+    t->step = std::exp(-i*2.0*M_PI*t->freq_offset/(double)sample_rate);
+    t->step_dop = std::exp(-i*2.0*M_PI*t->doppler_rate/pow((double)sample_rate, 2));
+    t->total_phase = 0;
+    t->context_sent = false;
+    t->responder = responder;
+    vrt_init_packet(&t->p);
+    vrt_init_data_packet(&t->p, samples_per_packet);
+    t->p.fields.stream_id = 1;
+    init_tx_packet(&t->tx);
+    t->iq_counter = 0;
+    t->frame_count = 0;
+}
+
+// Mix, filter and send the samples of a data block
+void vrt_target_data(vrt_target_pool_type* pool, vrt_target_type* t, const vrt_target_block_type* block) {
+    uint32_t n = block->num_samples;
+    const std::complex<float>* x = block->samples;
+    uint64_t first_sample = t->decimator.inputs;
+    std::complex<float>* in = vrt_decimator_input(&t->decimator, n);
+
+    if (t->tracking or t->doppler_rate != 0) {
+        t->phasor = t->phasor/std::abs(t->phasor);
+        t->step = t->step/std::abs(t->step);
+        for (uint32_t i = 0; i < n; i++) {
+            t->total_phase -= t->doppler_rate;
+            t->step = t->step * t->step_dop;
+            t->phasor = t->phasor * t->step;
+            in[i] = x[i] * (std::complex<float>)t->phasor;
+        }
+    } else {
+        memcpy(in, x, sizeof(std::complex<float>) * n);
+        if (t->freq_offset != 0)
+            vrt_nco_mix(&t->nco, in, n);
+    }
+
+    uint32_t K = vrt_decimator_prepare(&t->decimator);
+    if (K > t->y.size())
+        t->y.resize(K);
+    vrt_decimator_run(&t->decimator, t->y.data());
+
+    for (uint32_t k = 0; k < K; k++) {
+        if (t->iq_counter == 0) {
+            // one output after the newest input sample of the filter, as vrt_channelizer
+            uint64_t index;
+            double fraction;
+            vrt_decimator_time(&t->decimator, k + 1, &index, &fraction);
+            double offset = (double)((int64_t)index - (int64_t)first_sample) + fraction;
+            int64_t frac_seconds = block->fractional_seconds_timestamp + offset*1e12/pool->sample_rate;
+            uint64_t int_seconds = block->integer_seconds_timestamp;
+            if (frac_seconds < 0) {
+                frac_seconds += 1e12;
+                int_seconds--;
+            } else if (frac_seconds >= 1e12) {
+                frac_seconds -= 1e12;
+                int_seconds++;
+            }
+            t->p.fields.integer_seconds_timestamp = int_seconds;
+            t->p.fields.fractional_seconds_timestamp = frac_seconds;
+            vrt_tx_begin(pool->tx_pool, &t->tx);
+        }
+        t->tx.samples[t->iq_counter] = t->y[k];
+        t->iq_counter++;
+
+        if (t->iq_counter == pool->samples_per_packet) {
+            t->iq_counter = 0;
+            t->p.header.packet_count = (uint8_t)t->frame_count%16;
+            t->frame_count++;
+            vrt_tx_send(&t->p, &t->tx, pool->samples_per_packet, t->responder);
+            pool->output_bytes += VRT_DATA_PACKET_SIZE_FOR(pool->samples_per_packet)*sizeof(uint32_t);
+        }
+    }
+}
+
+// Send the context of the target, from the context of the stream
+void vrt_target_context(vrt_target_pool_type* pool, vrt_target_type* t, const context_type* c) {
+    struct vrt_packet pc;
+    vrt_init_packet(&pc);
+    vrt_init_context_packet(&pc);
+
+    pc.fields.stream_id = 1;
+    pc.fields.integer_seconds_timestamp = c->integer_seconds_timestamp;
+    pc.fields.fractional_seconds_timestamp = c->fractional_seconds_timestamp;
+
+    double doppler_offset = t->total_phase/(double)pool->sample_rate;
+    if (t->lsr)
+        pc.if_context.rf_reference_frequency = (double)c->rf_freq;
+    else
+        pc.if_context.rf_reference_frequency = (double)c->rf_freq+t->freq_offset-doppler_offset;
+    pc.if_context.context_field_change_indicator = t->doppler_rate != 0 or not t->context_sent;
+    t->context_sent = true;
+
+    pc.if_context.bandwidth = vrt_decimator_rate(&t->decimator, pool->sample_rate);
+    pc.if_context.sample_rate = vrt_decimator_rate(&t->decimator, pool->sample_rate);
+    pc.if_context.rf_reference_frequency_offset = 0;
+    pc.if_context.if_reference_frequency = 0;
+    pc.if_context.if_band_offset = 0;
+    pc.if_context.gain.stage1 = c->gain;
+    pc.if_context.gain.stage2 = 0;
+
+    pc.if_context.state_and_event_indicators.has.reference_lock = true;
+    pc.if_context.state_and_event_indicators.reference_lock = c->reflock;
+    pc.if_context.state_and_event_indicators.has.calibrated_time = true;
+    pc.if_context.state_and_event_indicators.calibrated_time = c->time_cal;
+
+    pc.if_context.has.temperature = true;
+    pc.if_context.temperature = c->temperature;
+    pc.if_context.has.timestamp_calibration_time = true;
+    pc.if_context.timestamp_calibration_time = c->timestamp_calibration_time;
+
+    uint32_t buffer[VRT_DATA_PACKET_SIZE];
+    int32_t rv = vrt_write_packet(&pc, buffer, VRT_DATA_PACKET_SIZE, true);
+    if (rv < 0) {
+        fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
+        return;
+    }
+    zmq_send(t->responder, buffer, rv*4, 0);
+}
+
+// Block of target number index
+void vrt_target_process(vrt_target_pool_type* pool, uint32_t index, vrt_target_block_type* block) {
+    vrt_target_type* t = &(*pool->targets)[index];
+    switch (block->event) {
+    case VRT_TARGET_DATA:
+        vrt_target_data(pool, t, block);
+        break;
+    case VRT_TARGET_CONTEXT:
+        vrt_target_context(pool, t, &block->context);
+        break;
+    case VRT_TARGET_EXTENDED:
+        if (block->tracker_valid and vrt_target_tracks(t, &block->tracker)
+            and not std::isnan(block->tracker.doppler_rate)) {
+            t->doppler_rate = block->tracker.doppler_rate;
+            const std::complex<double> i(0.0, 1.0);
+            t->step_dop = std::exp(-i*2.0*M_PI*t->doppler_rate/pow((double)pool->sample_rate, 2));
+        }
+        // forward the reference to the received message
+        zmq_msg_send(&block->forward[index], t->responder, 0);
+        break;
+    }
+}
+
+void vrt_target_worker(vrt_target_pool_type* pool, uint32_t worker) {
+
+    VRT_TRACE_THREAD("target worker");
+    vrt_rt_thread(pool->rt, VRT_RT_DSP);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    uint32_t workers = pool->workers.size();
+    uint32_t num_targets = pool->targets->size();
+    uint64_t seq = 0;
+    while (true) {
+        pool->changed.wait(lock, [pool, seq] { return pool->stop or pool->published > seq; });
+        if (pool->published == seq)
+            break;
+        vrt_target_block_type* block = &pool->blocks[seq % VRT_TARGET_BLOCKS];
+        lock.unlock();
+
+        for (uint32_t t = worker; t < num_targets; t += workers)
+            vrt_target_process(pool, t, block);
+
+        lock.lock();
+        if (--block->pending == 0)
+            pool->changed.notify_all();
+        seq++;
+    }
+}
+
+// Run the targets, set up by vrt_target_start(), on workers threads (0: on
+// the calling thread), pinned to the DSP CPUs of rt
+void vrt_targets_start(vrt_target_pool_type* pool, std::vector<vrt_target_type>* targets, uint32_t workers,
+    uint32_t sample_rate, uint32_t samples_per_packet, vrt_tx_pool_type* tx_pool, const vrt_rt_type* rt = NULL) {
+    pool->targets = targets;
+    pool->sample_rate = sample_rate;
+    pool->samples_per_packet = samples_per_packet;
+    pool->tx_pool = tx_pool;
+    pool->rt = rt;
+    pool->published = 0;
+    pool->output_bytes = 0;
+    pool->stop = false;
+    for (vrt_target_block_type& block : pool->blocks) {
+        block.samples = NULL;
+        block.num_samples = 0;
+        block.size = 0;
+        block.tracker_valid = false;
+        block.forward.resize(targets->size());
+        for (zmq_msg_t& msg : block.forward)
+            zmq_msg_init(&msg);
+        block.pending = 0;
+    }
+    workers = std::min(workers, (uint32_t)targets->size());
+    // all workers are there before the first one runs
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    for (uint32_t w = 0; w < workers; w++)
+        pool->workers.push_back(std::thread(vrt_target_worker, pool, w));
+}
+
+// Next block to fill, once every worker is done with it
+vrt_target_block_type* vrt_targets_next(vrt_target_pool_type* pool) {
+    vrt_target_block_type* block = &pool->blocks[pool->published % VRT_TARGET_BLOCKS];
+    VRT_TRACE_SCOPE("target_wait");
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->changed.wait(lock, [block] { return block->pending == 0; });
+    return block;
+}
+
+// Room for n samples in a data block, prefaulted when it grows
+std::complex<float>* vrt_targets_samples(vrt_target_pool_type* pool, vrt_target_block_type* block, uint32_t n) {
+    if (n > block->size) {
+        vrt_free(block->samples);
+        block->samples = (std::complex<float>*)vrt_alloc(sizeof(std::complex<float>) * n);
+        block->size = n;
+        vrt_rt_prefault(pool->rt, block->samples, sizeof(std::complex<float>) * n);
+    }
+    block->num_samples = n;
+    return block->samples;
+}
+
+// The block returned by vrt_targets_next() is filled: hand it to the
+// workers, or run the targets on it
+void vrt_targets_publish(vrt_target_pool_type* pool, vrt_target_block_type* block) {
+    if (pool->workers.empty()) {
+        for (uint32_t t = 0; t < pool->targets->size(); t++)
+            vrt_target_process(pool, t, block);
+        pool->published++;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    block->pending = pool->workers.size();
+    pool->published++;
+    pool->changed.notify_all();
+}
+
+// Bytes sent since the last call, for vrt_metrics_output()
+inline uint64_t vrt_targets_output_bytes(vrt_target_pool_type* pool) {
+    return pool->output_bytes.exchange(0);
+}
+
+// Process the blocks published so far and stop the workers. The packets
+// the targets were building are dropped, their sockets are left open.
+void vrt_targets_stop(vrt_target_pool_type* pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stop = true;
+    }
+    pool->changed.notify_all();
+    for (std::thread& worker : pool->workers)
+        worker.join();
+    pool->workers.clear();
+    for (vrt_target_block_type& block : pool->blocks) {
+        vrt_free(block.samples);
+        for (zmq_msg_t& msg : block.forward)
+            zmq_msg_close(&msg);
+        block.forward.clear();
+    }
+    for (vrt_target_type& t : *pool->targets) {
+        vrt_tx_abort(&t.tx);
+        vrt_decimator_free(&t.decimator);
+    }
+}
+
+#endif
@@ -3,10 +3,14 @@
 #ifndef _VRTTOOLS_H
 #define _VRTTOOLS_H
 
+// Default samples per data packet, producers can override it at runtime
 #define VRT_SAMPLES_PER_PACKET 10000
+// The VRT packet_size field is 16 bits, minus 7 words of header and fields
+#define VRT_MAX_SAMPLES_PER_PACKET (65535-7)
 
 #define SIZE (VRT_SAMPLES_PER_PACKET+7)
 #define VRT_DATA_PACKET_SIZE (VRT_SAMPLES_PER_PACKET+7)
+#define VRT_DATA_PACKET_SIZE_FOR(samples) ((samples)+7)
 
 #define ZMQ_BUFFER_SIZE 100000
 
@@ -20,6 +24,39 @@
 // Context update interval in ms
 #define VRT_CONTEXT_INTERVAL 200
 
+// Receive ring size in packets (power of two) and consumer wait timeout in ms
+#define VRT_RING_SLOTS 256
+#define VRT_RING_TIMEOUT 100
+
+// Free packet buffers kept for reuse by a transmit pool
+#define VRT_TX_POOL_SIZE 256
+
+// Streams tracked per client, one per stream ID (channel)
+#define VRT_MAX_STREAMS 32
+
+// Large buffer allocation: huge page size, smallest buffer served from huge
+// pages, and alignment of all buffers
+#define VRT_HUGE_PAGE_SIZE (2u<<20)
+#define VRT_HUGE_ALLOC_MIN (1u<<20)
+#define VRT_ALLOC_ALIGN 64
+
+// Thread roles of the thread layout options
+#define VRT_RT_RX     0
+#define VRT_RT_DSP    1
+#define VRT_RT_WRITER 2
+#define VRT_RT_IO     3
+#define VRT_RT_ROLES  4
+
+// Shared memory ring: packets kept, and minimum slot size (context packets)
+#define VRT_SHM_SLOTS 1024
+#define VRT_SHM_MIN_SLOT_WORDS 512
+#define VRT_SHM_MAGIC 0x56525453
+#define VRT_SHM_VERSION 3
+
+// Metrics histogram buckets: 1 us to ~1 s in powers of two, plus +Inf
+#define VRT_METRICS_BUCKETS 21
+#define VRT_METRICS_TIMEOUT 100
+
 // VRT
 #include <vrt/vrt_init.h>
 #include <vrt/vrt_string.h>
@@ -28,6 +65,41 @@
 #include <vrt/vrt_write.h>
 #include <vrt/vrt_read.h>
 
+// ZMQ
+#include <zmq.h>
+
+#include "vrt-trace.h"
+
+#include <arpa/inet.h>
+
+// Receiver thread, transmit pool
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+// Metrics
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+// Shared memory transport
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// Thread layout options
+#include <boost/program_options.hpp>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
 struct context_type {
     bool context_received;
     bool context_changed;
@@ -64,6 +136,16 @@ struct packet_type {
     uint64_t integer_seconds_timestamp;
 };
 
+// Received VRT packet, kept in the ZMQ message it arrived in (no copy).
+// buffer points into the message and is valid until the next vrt_recv()
+// or vrt_msg_close() on the same vrt_msg_type.
+struct vrt_msg_type {
+    zmq_msg_t msg;
+    uint32_t* buffer;
+    uint32_t words;
+    int len;
+};
+
 void init_context(context_type* context) {
     context->context_received = false;
     context->context_changed = false;
@@ -112,7 +194,7 @@ void vrt_print_context(context_type* vrt_context) {
 
 }
 
-bool vrt_process(uint32_t* buffer, uint32_t size, context_type* vrt_context, packet_type* vrt_packet) {
+bool vrt_process_generic(uint32_t* buffer, uint32_t size, context_type* vrt_context, packet_type* vrt_packet) {
 
     struct vrt_header h;
     struct vrt_fields f;
@@ -146,7 +228,7 @@ bool vrt_process(uint32_t* buffer, uint32_t size, context_type* vrt_context, pac
 
         if (f.stream_id & vrt_packet->channel_filt) {
             struct vrt_if_context c;
-            rv = vrt_read_if_context(buffer + offset, ZMQ_BUFFER_SIZE - offset, &c, true);
+            rv = vrt_read_if_context(buffer + offset, size - offset, &c, true);
             if (rv < 0) {
                 fprintf(stderr, "Failed to parse IF context section: %s\n", vrt_string_error(rv));
                 return false;
@@ -191,7 +273,7 @@ bool vrt_process(uint32_t* buffer, uint32_t size, context_type* vrt_context, pac
     } else if (h.packet_type == VRT_PT_IF_DATA_WITH_STREAM_ID) {
         // Data
         /* Parse fields */
-        rv = vrt_read_fields(&h, buffer + offset, ZMQ_BUFFER_SIZE - offset, &f, true);
+        rv = vrt_read_fields(&h, buffer + offset, size - offset, &f, true);
         if (rv < 0) {
             fprintf(stderr, "Failed to parse fields section: %s\n", vrt_string_error(rv));
             return false;
@@ -247,19 +329,1449 @@ bool vrt_process(uint32_t* buffer, uint32_t size, context_type* vrt_context, pac
     return true;
 }
 
-void vrt_init_data_packet(struct vrt_packet* p) {
+// Fixed packet layout, resolved at compile time. Word positions follow from
+// the header flags, so a packet whose first header word matches header_value
+// under header_mask can be decoded without libvrt.
+template <vrt_packet_type TYPE, bool CLASS_ID, bool TRAILER, vrt_tsi TSI, vrt_tsf TSF, vrt_tsm TSM>
+struct vrt_fixed_layout {
+    // packet type, C, T, TSM, TSI and TSF; packet count and size are free
+    static constexpr uint32_t header_mask = 0xFFF00000;
+    static constexpr uint32_t header_value = ((uint32_t)TYPE << 28) | ((uint32_t)CLASS_ID << 27) |
+        ((uint32_t)TRAILER << 26) | ((uint32_t)TSM << 24) | ((uint32_t)TSI << 22) | ((uint32_t)TSF << 20);
+    static constexpr uint32_t stream_id_word = 1;
+    static constexpr uint32_t class_id_word = 2;
+    static constexpr uint32_t integer_seconds_word = CLASS_ID ? 4 : 2;
+    static constexpr uint32_t fractional_seconds_word = integer_seconds_word + (TSI != VRT_TSI_NONE ? 1 : 0);
+    static constexpr uint32_t payload_offset = fractional_seconds_word + (TSF != VRT_TSF_NONE ? 2 : 0);
+    static constexpr uint32_t trailer_words = TRAILER ? 1 : 0;
+};
+
+// Layout written by vrt_init_data_packet()
+typedef vrt_fixed_layout<VRT_PT_IF_DATA_WITH_STREAM_ID, true, false, VRT_TSI_OTHER, VRT_TSF_REAL_TIME, VRT_TSM_FINE> vrt_data_layout;
+
+#define VRT_TOOLS_OUI 0xFF5454
+
+// Decode a data packet with a fixed layout. Returns false (without touching
+// vrt_context or vrt_packet) if the packet does not match, so the caller can
+// fall back to vrt_process_generic().
+template <typename layout>
+inline bool vrt_process_fixed(const uint32_t* buffer, uint32_t size, context_type* vrt_context, packet_type* vrt_packet) {
+
+    if (size <= layout::payload_offset)
+        return false;
+
+    const uint32_t header = ntohl(buffer[0]);
+    if ((header & layout::header_mask) != layout::header_value)
+        return false;
+
+    const uint32_t packet_size = header & 0xFFFF;
+    if (packet_size > size or packet_size < layout::payload_offset + layout::trailer_words)
+        return false;
+
+    const uint32_t oui = ntohl(buffer[layout::class_id_word]);
+    if (oui != VRT_TOOLS_OUI)
+        return false;
+
+    vrt_packet->context = false;
+    vrt_packet->data = false;
+    vrt_packet->extended_context = false;
+
+    const uint32_t stream_id = ntohl(buffer[layout::stream_id_word]);
+    if (not (stream_id & vrt_packet->channel_filt))
+        return true;
+
+    const uint32_t class_codes = ntohl(buffer[layout::class_id_word+1]);
+    const uint64_t integer_seconds_timestamp = ntohl(buffer[layout::integer_seconds_word]);
+    const uint64_t fractional_seconds_timestamp = ((uint64_t)ntohl(buffer[layout::fractional_seconds_word]) << 32)
+        | ntohl(buffer[layout::fractional_seconds_word+1]);
+
+    vrt_packet->lost_frame = not check_packet_count((header >> 16) & 0xF, vrt_context);
+
+    vrt_packet->integer_seconds_timestamp = integer_seconds_timestamp;
+    vrt_packet->fractional_seconds_timestamp = fractional_seconds_timestamp;
+    vrt_packet->num_rx_samps = packet_size - layout::payload_offset - layout::trailer_words;
+    vrt_packet->offset = layout::payload_offset;
+    vrt_packet->stream_id = stream_id;
+    vrt_packet->data = true;
+
+    vrt_packet->oui = oui;
+    vrt_packet->information_class_code = class_codes >> 16;
+    vrt_packet->packet_class_code = class_codes & 0xFFFF;
+
+    if (vrt_packet->first_frame) {
+        vrt_context->starttime_integer = integer_seconds_timestamp;
+        vrt_context->starttime_fractional = fractional_seconds_timestamp;
+        vrt_packet->first_frame = false;
+    }
+
+    return true;
+}
+
+bool vrt_process(uint32_t* buffer, uint32_t size, context_type* vrt_context, packet_type* vrt_packet) {
+    if (vrt_process_fixed<vrt_data_layout>(buffer, size, vrt_context, vrt_packet))
+        return true;
+    return vrt_process_generic(buffer, size, vrt_context, vrt_packet);
+}
+
+// Per stream state. A client subscribed to several channels sees their
+// packets interleaved; each stream ID keeps its own context, packet counter,
+// start time and loss statistics, so the 4-bit packet counts of one channel
+// are never checked against another.
+struct vrt_stream_type;
+
+typedef void (*vrt_stream_handler_fn)(vrt_stream_type* stream, uint32_t* buffer, packet_type* vrt_packet, void* arg);
+
+struct vrt_stream_type {
+    uint32_t stream_id;
+    int32_t index;                   // position in the channels added by the client, -1 if not added
+    context_type context;
+    bool first_frame;
+    uint64_t packets;
+    uint64_t samples;
+    uint64_t lost_frames;
+    vrt_stream_handler_fn handler;
+    void* arg;
+};
+
+struct vrt_streams_type {
+    vrt_stream_type streams[VRT_MAX_STREAMS];
+    uint32_t count;
+    uint32_t last;                   // stream found by the previous lookup
+    int32_t channels;                // streams added by the client
+    context_type other;              // context of packets without a tracked stream
+};
+
+void init_stream(vrt_stream_type* stream, uint32_t stream_id) {
+    stream->stream_id = stream_id;
+    stream->index = -1;
+    init_context(&stream->context);
+    stream->first_frame = true;
+    stream->packets = 0;
+    stream->samples = 0;
+    stream->lost_frames = 0;
+    stream->handler = NULL;
+    stream->arg = NULL;
+}
+
+void init_streams(vrt_streams_type* streams) {
+    streams->count = 0;
+    streams->last = 0;
+    streams->channels = 0;
+    init_context(&streams->other);
+}
+
+// Find the stream, adding it on first sight. Returns NULL if the table is full.
+vrt_stream_type* vrt_stream_lookup(vrt_streams_type* streams, uint32_t stream_id) {
+    if (streams->count > 0 and streams->streams[streams->last].stream_id == stream_id)
+        return &streams->streams[streams->last];
+    for (uint32_t i = 0; i < streams->count; i++) {
+        if (streams->streams[i].stream_id == stream_id) {
+            streams->last = i;
+            return &streams->streams[i];
+        }
+    }
+    if (streams->count == VRT_MAX_STREAMS)
+        return NULL;
+    vrt_stream_type* stream = &streams->streams[streams->count];
+    init_stream(stream, stream_id);
+    streams->last = streams->count++;
+    return stream;
+}
+
+// Add a channel of the client, optionally with a handler for vrt_dispatch().
+// The stream's index is its position among the channels added.
+vrt_stream_type* vrt_stream_add(vrt_streams_type* streams, uint32_t stream_id,
+    vrt_stream_handler_fn handler = NULL, void* arg = NULL) {
+    vrt_stream_type* stream = vrt_stream_lookup(streams, stream_id);
+    if (stream == NULL)
+        return NULL;
+    if (stream->index < 0)
+        stream->index = streams->channels++;
+    stream->handler = handler;
+    stream->arg = arg;
+    return stream;
+}
+
+// Stream ID of a packet, false for packet types without one
+inline bool vrt_peek_stream_id(const uint32_t* buffer, uint32_t size, uint32_t* stream_id) {
+    if (size < 2)
+        return false;
+    uint32_t packet_type = ntohl(buffer[0]) >> 28;
+    if (packet_type != VRT_PT_IF_DATA_WITH_STREAM_ID and packet_type != VRT_PT_EXT_DATA_WITH_STREAM_ID and
+        packet_type != VRT_PT_IF_CONTEXT and packet_type != VRT_PT_EXT_CONTEXT)
+        return false;
+    *stream_id = ntohl(buffer[1]);
+    return true;
+}
+
+// vrt_process() with the context of the packet's stream. Streams outside
+// vrt_packet->channel_filt are not tracked and share one context. *stream
+// is set to the packet's stream, or NULL if it is not tracked.
+bool vrt_process_stream(uint32_t* buffer, uint32_t size, vrt_streams_type* streams, packet_type* vrt_packet,
+    vrt_stream_type** stream) {
+
+    uint32_t stream_id;
+    *stream = NULL;
+    if (vrt_peek_stream_id(buffer, size, &stream_id) and (stream_id & vrt_packet->channel_filt))
+        *stream = vrt_stream_lookup(streams, stream_id);
+
+    if (*stream == NULL)
+        return vrt_process(buffer, size, &streams->other, vrt_packet);
+
+    vrt_packet->first_frame = (*stream)->first_frame;
+    if (not vrt_process(buffer, size, &(*stream)->context, vrt_packet))
+        return false;
+    (*stream)->first_frame = vrt_packet->first_frame;
+
+    (*stream)->packets++;
+    if (vrt_packet->data) {
+        (*stream)->samples += vrt_packet->num_rx_samps;
+        if (vrt_packet->lost_frame)
+            (*stream)->lost_frames++;
+    }
+    return true;
+}
+
+// Process a packet and hand it to its stream's handler. Packets of streams
+// without a handler are parsed but not handed on. Returns false if the
+// packet could not be parsed.
+bool vrt_dispatch(uint32_t* buffer, uint32_t size, vrt_streams_type* streams, packet_type* vrt_packet) {
+    vrt_stream_type* stream;
+    if (not vrt_process_stream(buffer, size, streams, vrt_packet, &stream))
+        return false;
+    if (stream != NULL and stream->handler != NULL)
+        stream->handler(stream, buffer, vrt_packet, stream->arg);
+    return true;
+}
+
+void vrt_print_stream_stats(vrt_streams_type* streams) {
+    for (uint32_t i = 0; i < streams->count; i++) {
+        vrt_stream_type* stream = &streams->streams[i];
+        printf("# Stream %u: %lu packets, %lu samples, %lu lost frames\n", stream->stream_id,
+            (unsigned long)stream->packets, (unsigned long)stream->samples, (unsigned long)stream->lost_frames);
+    }
+}
+
+void init_msg(vrt_msg_type* vrt_msg) {
+    zmq_msg_init(&vrt_msg->msg);
+    vrt_msg->buffer = NULL;
+    vrt_msg->words = 0;
+    vrt_msg->len = 0;
+}
+
+// Receive the next packet in place. The previous message held by vrt_msg
+// is released by zmq_msg_recv, so views into it must not outlive this call.
+int vrt_recv(void* socket, vrt_msg_type* vrt_msg, int flags = 0) {
+    int len = zmq_msg_recv(&vrt_msg->msg, socket, flags);
+    if (len < 0) {
+        vrt_msg->buffer = NULL;
+        vrt_msg->words = 0;
+        vrt_msg->len = len;
+        return len;
+    }
+    vrt_msg->buffer = (uint32_t*)zmq_msg_data(&vrt_msg->msg);
+    vrt_msg->words = len/sizeof(uint32_t);
+    vrt_msg->len = len;
+    return len;
+}
+
+void vrt_msg_close(vrt_msg_type* vrt_msg) {
+    zmq_msg_close(&vrt_msg->msg);
+    vrt_msg->buffer = NULL;
+    vrt_msg->words = 0;
+    vrt_msg->len = 0;
+}
+
+// Typed view of the ci16 payload of a data packet, valid as long as the
+// buffer (or message) it was parsed from.
+inline const std::complex<int16_t>* vrt_samples(const uint32_t* buffer, const packet_type* vrt_packet) {
+    return reinterpret_cast<const std::complex<int16_t>*>(buffer + vrt_packet->offset);
+}
+
+// ZMQ endpoints. An address is a host name or interface (tcp, as before), a
+// full ZMQ URI (tcp://, ipc://, inproc://, pgm://, epgm://) or a comma
+// separated list of them, so a producer can bind e.g. "*,ipc" for remote
+// and local clients at once. The port is appended unless the URI already
+// has one: ":port" for tcp and multicast, "-port" for ipc and inproc paths.
+// "ipc" alone stands for ipc:///tmp/vrt-<port>. Producer and clients build
+// the same endpoint from the same address and port.
+std::vector<std::string> vrt_endpoints(const std::string& address, uint16_t port, bool bind) {
+
+    std::vector<std::string> endpoints;
+    std::string p = std::to_string(port);
+
+    size_t start = 0;
+    while (start <= address.size()) {
+        size_t end = address.find(',', start);
+        if (end == std::string::npos)
+            end = address.size();
+        std::string a = address.substr(start, end - start);
+        start = end + 1;
+
+        if (a.empty())
+            a = bind ? "*" : "localhost";
+
+        size_t scheme_end = a.find("://");
+        if (a == "ipc") {
+            endpoints.push_back("ipc:///tmp/vrt-" + p);
+        } else if (scheme_end == std::string::npos) {
+            endpoints.push_back("tcp://" + a + ":" + p);
+        } else {
+            std::string scheme = a.substr(0, scheme_end);
+            if (scheme == "ipc" or scheme == "inproc") {
+                endpoints.push_back(a + "-" + p);
+            } else {
+                // host[:port], [ipv6][:port] or iface;group[:port]
+                size_t host = a.rfind(']');
+                host = (host == std::string::npos) ? scheme_end + 3 : host;
+                size_t colon = a.find(':', host);
+                bool has_port = colon != std::string::npos and colon + 1 < a.size() and
+                    (a.compare(colon + 1, std::string::npos, "*") == 0 or
+                     a.find_first_not_of("0123456789", colon + 1) == std::string::npos);
+                endpoints.push_back(has_port ? a : a + ":" + p);
+            }
+        }
+    }
+    return endpoints;
+}
+
+// Check the transport of an endpoint is built into libzmq, and give
+// multicast a usable rate (the ZMQ default is 100 kbit/s).
+bool vrt_endpoint_setup(void* socket, const std::string& endpoint) {
+    std::string scheme = endpoint.substr(0, endpoint.find("://"));
+    if ((scheme == "pgm" or scheme == "epgm" or scheme == "ipc") and not zmq_has(scheme.c_str())) {
+        fprintf(stderr, "ZMQ was built without %s support, cannot use %s.\n", scheme.c_str(), endpoint.c_str());
+        return false;
+    }
+    if (scheme == "pgm" or scheme == "epgm") {
+        int rate = 1000000;      // kbit/s
+        zmq_setsockopt(socket, ZMQ_RATE, &rate, sizeof rate);
+    }
+    return true;
+}
+
+// Bind socket to all endpoints of address on port, print why if one fails
+bool vrt_bind(void* socket, const std::string& address, uint16_t port) {
+    std::vector<std::string> endpoints = vrt_endpoints(address, port, true);
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        if (not vrt_endpoint_setup(socket, endpoints[i]))
+            return false;
+        if (zmq_bind(socket, endpoints[i].c_str()) != 0) {
+            fprintf(stderr, "Failed to bind %s: %s\n", endpoints[i].c_str(), zmq_strerror(zmq_errno()));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Connect socket to all endpoints of address on port
+bool vrt_connect(void* socket, const std::string& address, uint16_t port) {
+    std::vector<std::string> endpoints = vrt_endpoints(address, port, false);
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        if (not vrt_endpoint_setup(socket, endpoints[i]))
+            return false;
+        if (zmq_connect(socket, endpoints[i].c_str()) != 0) {
+            fprintf(stderr, "Failed to connect to %s: %s\n", endpoints[i].c_str(), zmq_strerror(zmq_errno()));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shared memory transport for clients on the same host as the producer. The
+// producer publishes every packet it sends into a ring in POSIX shared memory
+// named after its port (/vrt-<port>), next to its ZMQ PUB socket. Clients
+// map the ring read-only and keep their own cursor, so no client can slow
+// down the producer or the other clients: one that falls more than the ring
+// behind skips ahead and reports the packets lost as overruns. Each slot is
+// a seqlock, its sequence is odd while the producer writes it and readers
+// check it is unchanged after copying the packet out. Readers wait on a
+// futex on Linux and poll elsewhere. As readers never write the segment, the
+// producer can not tell whether any of them sleeps and wakes the futex on
+// every packet.
+struct vrt_shm_header_type {
+    std::atomic<uint32_t> magic;     // written last by the producer
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_words;             // largest packet a slot holds
+    uint64_t slot_bytes;             // slot stride
+    int32_t pid;                     // producer
+    std::atomic<uint32_t> closed;
+    std::atomic<uint64_t> head;      // packets published
+    std::atomic<uint32_t> futex;     // low 32 bits of head
+};
+
+struct vrt_shm_slot_type {
+    std::atomic<uint64_t> seq;       // 2n+1 while packet n is written, 2n+2 once complete
+    uint32_t words;
+    uint32_t reserved;
+};
+
+// Producer side
+struct vrt_shm_writer_type {
+    std::string name;
+    vrt_shm_header_type* header;
+    size_t size;
+    uint64_t oversized;              // packets too large for a slot, not published
+};
+
+// Client side
+struct vrt_shm_reader_type {
+    uint16_t port;
+    std::string name;
+    const vrt_shm_header_type* header;
+    size_t size;
+    uint32_t slots;
+    std::atomic<uint64_t> cursor;    // next packet to read
+    std::atomic<uint64_t> head;      // producer's head when last read
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> overruns;  // packets lost
+    std::vector<uint32_t> buffer;
+};
+
+std::string vrt_shm_name(uint16_t port) {
+    return "/vrt-" + std::to_string(port);
+}
+
+inline size_t vrt_shm_slots_offset() {
+    return (sizeof(vrt_shm_header_type) + 63) & ~(size_t)63;
+}
+
+inline vrt_shm_slot_type* vrt_shm_slot(const vrt_shm_header_type* header, uint64_t n) {
+    return (vrt_shm_slot_type*)((char*)header + vrt_shm_slots_offset() + (n % header->slots)*header->slot_bytes);
+}
+
+// Packet words following the slot's header
+inline uint32_t* vrt_shm_payload(const vrt_shm_slot_type* slot) {
+    return (uint32_t*)((char*)slot + sizeof(vrt_shm_slot_type));
+}
+
+inline bool vrt_shm_producer_alive(const vrt_shm_header_type* header) {
+    return header->closed.load(std::memory_order_acquire) == 0 and
+        (kill(header->pid, 0) == 0 or errno != ESRCH);
+}
+
+// Create the ring for the stream on port, with slots for packets of up to
+// samples_per_packet samples. Returns NULL (and prints why) if the segment
+// cannot be created or another running producer owns it.
+vrt_shm_writer_type* vrt_shm_create(uint16_t port, uint32_t samples_per_packet = VRT_SAMPLES_PER_PACKET,
+    uint32_t slots = VRT_SHM_SLOTS) {
+
+    std::string name = vrt_shm_name(port);
+
+    // a segment left by a producer that is no longer running is replaced
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd >= 0) {
+        struct stat st;
+        bool in_use = false;
+        if (fstat(fd, &st) == 0 and (size_t)st.st_size >= sizeof(vrt_shm_header_type)) {
+            void* old = mmap(NULL, sizeof(vrt_shm_header_type), PROT_READ, MAP_SHARED, fd, 0);
+            if (old != MAP_FAILED) {
+                const vrt_shm_header_type* header = (const vrt_shm_header_type*)old;
+                in_use = header->magic.load() == VRT_SHM_MAGIC and vrt_shm_producer_alive(header);
+                if (in_use)
+                    fprintf(stderr, "Shared memory stream %s is in use by process %i.\n", name.c_str(), header->pid);
+                munmap(old, sizeof(vrt_shm_header_type));
+            }
+        }
+        close(fd);
+        if (in_use)
+            return NULL;
+        shm_unlink(name.c_str());
+    }
+
+    uint32_t slot_words = VRT_DATA_PACKET_SIZE_FOR(samples_per_packet);
+    if (slot_words < VRT_SHM_MIN_SLOT_WORDS)
+        slot_words = VRT_SHM_MIN_SLOT_WORDS;
+    uint64_t slot_bytes = (sizeof(vrt_shm_slot_type) + slot_words*sizeof(uint32_t) + 63) & ~(uint64_t)63;
+    size_t size = vrt_shm_slots_offset() + slots*slot_bytes;
+
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create shared memory stream %s: %s\n", name.c_str(), strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "Failed to size shared memory stream %s: %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return NULL;
+    }
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shared memory stream %s: %s\n", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return NULL;
+    }
+
+    // the segment is zero filled: all slots are empty
+    vrt_shm_header_type* header = (vrt_shm_header_type*)mem;
+    header->version = VRT_SHM_VERSION;
+    header->slots = slots;
+    header->slot_words = slot_words;
+    header->slot_bytes = slot_bytes;
+    header->pid = getpid();
+    header->closed = 0;
+    header->head = 0;
+    header->futex = 0;
+    header->magic.store(VRT_SHM_MAGIC, std::memory_order_release);
+
+    vrt_shm_writer_type* shm = new vrt_shm_writer_type;
+    shm->name = name;
+    shm->header = header;
+    shm->size = size;
+    shm->oversized = 0;
+
+    printf("# Shared memory stream %s: %u slots of %u words\n", name.c_str(), slots, slot_words);
+    return shm;
+}
+
+// Publish a packet. Never waits for clients.
+bool vrt_shm_publish(vrt_shm_writer_type* shm, const void* data, size_t bytes) {
+
+    vrt_shm_header_type* header = shm->header;
+    uint32_t words = bytes/sizeof(uint32_t);
+    if (words > header->slot_words) {
+        if (shm->oversized++ == 0)
+            fprintf(stderr, "Packet of %u words does not fit the shared memory slots, not published.\n", words);
+        return false;
+    }
+
+    uint64_t n = header->head.load(std::memory_order_relaxed);
+    vrt_shm_slot_type* slot = vrt_shm_slot(header, n);
+    slot->seq.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->words = words;
+    memcpy(vrt_shm_payload(slot), data, words*sizeof(uint32_t));
+    slot->seq.store(2*n + 2, std::memory_order_release);
+
+    header->head.store(n + 1, std::memory_order_release);
+    header->futex.store((uint32_t)(n + 1), std::memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+    return true;
+}
+
+// Publish a ZMQ message
+inline bool vrt_shm_publish(vrt_shm_writer_type* shm, zmq_msg_t* msg) {
+    return vrt_shm_publish(shm, zmq_msg_data(msg), zmq_msg_size(msg));
+}
+
+// Mark the stream closed for its clients and remove it
+void vrt_shm_destroy(vrt_shm_writer_type* shm) {
+    if (shm == NULL)
+        return;
+    shm->header->closed.store(1, std::memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, &shm->header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+    shm_unlink(shm->name.c_str());
+    munmap(shm->header, shm->size);
+    delete shm;
+}
+
+// Map the producer's segment read-only, starting at its newest packet
+bool vrt_shm_map(vrt_shm_reader_type* shm) {
+
+    int fd = shm_open(shm->name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 or (size_t)st.st_size < sizeof(vrt_shm_header_type)) {
+        close(fd);
+        return false;
+    }
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    const vrt_shm_header_type* header = (const vrt_shm_header_type*)mem;
+    if (header->magic.load(std::memory_order_acquire) != VRT_SHM_MAGIC or header->version != VRT_SHM_VERSION or
+        vrt_shm_slots_offset() + header->slots*header->slot_bytes > (size_t)st.st_size or
+        not vrt_shm_producer_alive(header)) {
+        munmap(mem, st.st_size);
+        return false;
+    }
+
+    shm->header = header;
+    shm->size = st.st_size;
+    shm->slots = header->slots;
+    shm->head = header->head.load(std::memory_order_acquire);
+    shm->cursor = shm->head.load();
+    shm->buffer.resize(header->slot_words);
+    return true;
+}
+
+void vrt_shm_unmap(vrt_shm_reader_type* shm) {
+    if (shm->header)
+        munmap((void*)shm->header, shm->size);
+    shm->header = NULL;
+}
+
+// Attach to the stream a producer on this host publishes for port. Returns
+// NULL (and prints why) if there is none.
+vrt_shm_reader_type* vrt_shm_attach(uint16_t port) {
+    vrt_shm_reader_type* shm = new vrt_shm_reader_type;
+    shm->port = port;
+    shm->name = vrt_shm_name(port);
+    shm->header = NULL;
+    shm->size = 0;
+    shm->slots = 0;
+    shm->received = 0;
+    shm->overruns = 0;
+    if (not vrt_shm_map(shm)) {
+        fprintf(stderr, "No shared memory stream %s, is the producer running with --shm on this host?\n",
+            shm->name.c_str());
+        delete shm;
+        return NULL;
+    }
+    printf("# Shared memory stream %s: %u slots of %u words\n", shm->name.c_str(),
+        shm->header->slots, shm->header->slot_words);
+    return shm;
+}
+
+void vrt_shm_detach(vrt_shm_reader_type* shm) {
+    if (shm == NULL)
+        return;
+    vrt_shm_unmap(shm);
+    delete shm;
+}
+
+// Packets published but not read yet, as of the last read
+inline uint64_t vrt_shm_occupancy(vrt_shm_reader_type* shm) {
+    uint64_t cursor = shm->cursor.load(std::memory_order_relaxed);
+    uint64_t head = shm->head.load(std::memory_order_relaxed);
+    return head > cursor ? head - cursor : 0;
+}
+
+void vrt_shm_wait(vrt_shm_reader_type* shm, uint32_t seen, int timeout_ms) {
+#ifdef __linux__
+    struct timespec timeout = { timeout_ms/1000, (timeout_ms % 1000)*1000000L };
+    syscall(SYS_futex, (uint32_t*)&shm->header->futex, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+}
+
+// Copy the next packet out of the ring into vrt_msg, waiting up to
+// timeout_ms. A producer that restarted is attached to again. Like
+// vrt_recv(), views into the previous packet do not outlive this call.
+// Returns the packet length, or -1 on timeout.
+int vrt_shm_recv(vrt_shm_reader_type* shm, vrt_msg_type* vrt_msg, int timeout_ms) {
+
+    vrt_msg->buffer = NULL;
+    vrt_msg->words = 0;
+    vrt_msg->len = -1;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (true) {
+        const vrt_shm_header_type* header = shm->header;
+
+        if (header == NULL or header->closed.load(std::memory_order_acquire)) {
+            vrt_shm_unmap(shm);
+            if (vrt_shm_map(shm)) {
+                printf("# Attached to shared memory stream %s\n", shm->name.c_str());
+                continue;
+            }
+            if (std::chrono::steady_clock::now() > deadline)
+                return -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        uint32_t seen = header->futex.load(std::memory_order_acquire);
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        uint64_t n = shm->cursor.load(std::memory_order_relaxed);
+        shm->head.store(head, std::memory_order_relaxed);
+
+        if (n == head) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                // a producer that died without closing the stream
+                if (not vrt_shm_producer_alive(header))
+                    vrt_shm_unmap(shm);
+                return -1;
+            }
+            vrt_shm_wait(shm, seen, timeout_ms);
+            continue;
+        }
+
+        // fallen behind by more than the ring: continue half a ring back
+        if (head - n >= header->slots) {
+            uint64_t next = head - header->slots/2;
+            shm->overruns.fetch_add(next - n, std::memory_order_relaxed);
+            fprintf(stderr, "Shared memory overrun on %s: %lu packets lost.\n",
+                shm->name.c_str(), (unsigned long)(next - n));
+            shm->cursor.store(next, std::memory_order_relaxed);
+            continue;
+        }
+
+        const vrt_shm_slot_type* slot = vrt_shm_slot(header, n);
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        uint32_t words = slot->words;
+        if (seq == 2*n + 2 and words <= header->slot_words) {
+            memcpy(shm->buffer.data(), vrt_shm_payload(slot), words*sizeof(uint32_t));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == seq) {
+                shm->cursor.store(n + 1, std::memory_order_relaxed);
+                shm->received.fetch_add(1, std::memory_order_relaxed);
+                vrt_msg->buffer = shm->buffer.data();
+                vrt_msg->words = words;
+                vrt_msg->len = words*sizeof(uint32_t);
+                return vrt_msg->len;
+            }
+        }
+
+        // overwritten while reading
+        shm->overruns.fetch_add(1, std::memory_order_relaxed);
+        fprintf(stderr, "Shared memory overrun on %s: 1 packet lost.\n", shm->name.c_str());
+        shm->cursor.store(n + 1, std::memory_order_relaxed);
+    }
+}
+
+void vrt_print_shm_stats(vrt_shm_reader_type* shm) {
+    printf("# Shared memory %s: %lu packets, %lu lost to overruns\n", shm->name.c_str(),
+        (unsigned long)shm->received.load(), (unsigned long)shm->overruns.load());
+}
+
+// Metrics: counters updated by the processing loop of a client and served
+// in the Prometheus text format on an HTTP port by a thread of their own
+// (see vrt_metrics_start()). Every counter has a single writer, so updates
+// are relaxed stores rather than atomic read-modify-writes.
+struct vrt_histogram_type {
+    std::atomic<uint64_t> buckets[VRT_METRICS_BUCKETS+1];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+};
+
+struct vrt_receiver_type;
+
+struct vrt_metrics_type {
+    bool enabled;
+    std::string tool;
+    int hwm;
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> lost_frames;
+    std::atomic<uint64_t> output_bytes;
+    std::atomic<uint64_t> sample_rate;
+    std::atomic<uint64_t> stream_ns;     // stream time covered by the data received
+    std::atomic<uint64_t> busy_ns;       // time spent processing packets
+    vrt_histogram_type processing;       // per packet, from hand out to release
+    vrt_histogram_type fft;
+    std::atomic<vrt_receiver_type*> receiver;
+    void* socket;
+    std::atomic<bool> stop;
+    std::thread thread;
+    uint64_t last_busy_ns;               // server thread only
+    uint64_t last_stream_ns;
+    double realtime_ratio;
+};
+
+void init_histogram(vrt_histogram_type* h) {
+    for (uint32_t i = 0; i <= VRT_METRICS_BUCKETS; i++)
+        h->buckets[i] = 0;
+    h->count = 0;
+    h->sum_ns = 0;
+}
+
+void init_metrics(vrt_metrics_type* m) {
+    m->enabled = false;
+    m->hwm = 0;
+    m->packets = 0;
+    m->samples = 0;
+    m->lost_frames = 0;
+    m->output_bytes = 0;
+    m->sample_rate = 0;
+    m->stream_ns = 0;
+    m->busy_ns = 0;
+    init_histogram(&m->processing);
+    init_histogram(&m->fft);
+    m->receiver = NULL;
+    m->socket = NULL;
+    m->stop = false;
+    m->last_busy_ns = 0;
+    m->last_stream_ns = 0;
+    m->realtime_ratio = 0;
+}
+
+inline void vrt_metrics_add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void vrt_metrics_observe(vrt_histogram_type* h, uint64_t ns) {
+    uint32_t bucket = 0;
+    while (bucket < VRT_METRICS_BUCKETS and ns > (1000ull << bucket))
+        bucket++;
+    vrt_metrics_add(h->buckets[bucket], 1);
+    vrt_metrics_add(h->count, 1);
+    vrt_metrics_add(h->sum_ns, ns);
+}
+
+// Observe the time since start, e.g. around fftw_execute()
+void vrt_metrics_observe_since(vrt_metrics_type* m, vrt_histogram_type* h,
+    std::chrono::steady_clock::time_point start) {
+    if (not m->enabled)
+        return;
+    vrt_metrics_observe(h, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+// Count a packet parsed by vrt_process()
+void vrt_metrics_packet(vrt_metrics_type* m, const packet_type* vrt_packet, const context_type* vrt_context) {
+    if (not m->enabled)
+        return;
+    vrt_metrics_add(m->packets, 1);
+    if (not vrt_packet->data)
+        return;
+    vrt_metrics_add(m->samples, vrt_packet->num_rx_samps);
+    if (vrt_packet->lost_frame)
+        vrt_metrics_add(m->lost_frames, 1);
+    if (vrt_context->sample_rate > 0) {
+        m->sample_rate.store(vrt_context->sample_rate, std::memory_order_relaxed);
+        vrt_metrics_add(m->stream_ns, (uint64_t)vrt_packet->num_rx_samps*1000000000ull/vrt_context->sample_rate);
+    }
+}
+
+void vrt_metrics_output(vrt_metrics_type* m, uint64_t bytes) {
+    if (m->enabled)
+        vrt_metrics_add(m->output_bytes, bytes);
+}
+
+// Thread layout: CPU affinity and SCHED_FIFO priority per thread role,
+// memory locking and buffer prefaulting. A tool adds the options for the
+// roles it has with vrt_rt_options(), applies them with vrt_rt_apply() before
+// creating its sockets, and calls vrt_rt_thread() at the start of each thread.
+struct vrt_rt_type {
+    std::string cpus[VRT_RT_ROLES];  // CPU list per role, e.g. "3", "2,3" or "4-7"
+    int priority;                    // SCHED_FIFO priority, 0: normal scheduling
+    bool mlock;
+    bool prefault;
+    uint32_t roles;                  // roles with options, 1<<VRT_RT_RX | ...
+#ifdef __linux__
+    cpu_set_t cpuset[VRT_RT_ROLES];
+#endif
+};
+
+const char* vrt_rt_role_names[VRT_RT_ROLES] = { "receiver", "DSP", "writer", "ZMQ IO" };
+
+void init_rt(vrt_rt_type* rt) {
+    for (int role = 0; role < VRT_RT_ROLES; role++)
+        rt->cpus[role].clear();
+    rt->priority = 0;
+    rt->mlock = false;
+    rt->prefault = false;
+    rt->roles = 0;
+}
+
+// Add the options of the roles in the mask (1<<VRT_RT_RX | ...)
+void vrt_rt_options(boost::program_options::options_description& desc, vrt_rt_type* rt, uint32_t roles) {
+    namespace po = boost::program_options;
+    rt->roles = roles;
+    // clang-format off
+    if (roles & (1<<VRT_RT_RX))
+        desc.add_options()("rx-cpu", po::value<std::string>(&rt->cpus[VRT_RT_RX]), "pin the receiver thread to these CPUs (e.g. 2 or 2,3 or 2-3)");
+    if (roles & (1<<VRT_RT_DSP))
+        desc.add_options()("dsp-cpu", po::value<std::string>(&rt->cpus[VRT_RT_DSP]), "pin the processing thread to these CPUs");
+    if (roles & (1<<VRT_RT_WRITER))
+        desc.add_options()("writer-cpu", po::value<std::string>(&rt->cpus[VRT_RT_WRITER]), "pin the writing thread to these CPUs");
+    if (roles & (1<<VRT_RT_IO))
+        desc.add_options()("io-cpu", po::value<std::string>(&rt->cpus[VRT_RT_IO]), "pin the ZMQ IO thread to these CPUs");
+    desc.add_options()
+        ("rt-priority", po::value<int>(&rt->priority)->default_value(0), "run the pinned threads with this SCHED_FIFO priority (1-99, 0: off)")
+        ("mlock", po::bool_switch(&rt->mlock), "lock all memory, current and future, into RAM")
+        ("prefault", po::bool_switch(&rt->prefault), "touch buffers when they are allocated, so the stream does not page fault on them")
+    ;
+    // clang-format on
+}
+
+#ifdef __linux__
+// Parse a CPU list such as "0,2,4-7"
+bool vrt_parse_cpus(const std::string& list, cpu_set_t* cpuset) {
+    CPU_ZERO(cpuset);
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string item = list.substr(pos, end - pos);
+        pos = end + 1;
+        char* rest;
+        long first = strtol(item.c_str(), &rest, 10);
+        long last = first;
+        if (*rest == '-')
+            last = strtol(rest + 1, &rest, 10);
+        if (item.empty() or *rest != '\0' or first < 0 or last < first or last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, cpuset);
+    }
+    return CPU_COUNT(cpuset) > 0;
+}
+#endif
+
+// Check the CPU lists, lock memory and configure the ZMQ IO threads of
+// context (NULL if none), then print the layout. Call before the first
+// socket is created, ZMQ starts its IO threads with it. Returns false on
+// an invalid CPU list.
+bool vrt_rt_apply(vrt_rt_type* rt, void* context) {
+    bool layout = rt->mlock or rt->prefault or rt->priority != 0;
+    for (int role = 0; role < VRT_RT_ROLES; role++)
+        layout |= not rt->cpus[role].empty();
+    if (not layout)
+        return true;
+
+    if (rt->priority < 0 or rt->priority > 99) {
+        fprintf(stderr, "Invalid SCHED_FIFO priority %i, use 1 to 99.\n", rt->priority);
+        return false;
+    }
+
+#ifdef __linux__
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &available) != 0)
+        CPU_ZERO(&available);
+    for (int role = 0; role < VRT_RT_ROLES; role++) {
+        if (rt->cpus[role].empty())
+            continue;
+        if (not vrt_parse_cpus(rt->cpus[role], &rt->cpuset[role])) {
+            fprintf(stderr, "Invalid %s CPU list \"%s\".\n", vrt_rt_role_names[role], rt->cpus[role].c_str());
+            return false;
+        }
+        cpu_set_t usable;
+        CPU_AND(&usable, &rt->cpuset[role], &available);
+        if (not CPU_EQUAL(&usable, &rt->cpuset[role])) {
+            fprintf(stderr, "The %s CPU list \"%s\" includes CPUs not available to this process.\n",
+                vrt_rt_role_names[role], rt->cpus[role].c_str());
+            return false;
+        }
+    }
+
+    if (rt->mlock and mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(stderr, "Failed to lock memory: %s (raise RLIMIT_MEMLOCK or run with CAP_IPC_LOCK).\n", strerror(errno));
+        rt->mlock = false;
+    }
+
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+    if (context != NULL) {
+        if (not rt->cpus[VRT_RT_IO].empty())
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &rt->cpuset[VRT_RT_IO]))
+                    zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, cpu);
+        if (rt->priority > 0 and not rt->cpus[VRT_RT_IO].empty()) {
+            zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, SCHED_FIFO);
+            zmq_ctx_set(context, ZMQ_THREAD_PRIORITY, rt->priority);
+        }
+    }
+#else
+    if (context != NULL and not rt->cpus[VRT_RT_IO].empty())
+        fprintf(stderr, "ZMQ IO thread pinning needs libzmq 4.3 or later.\n");
+#endif
+
+    const char* separator = "";
+    printf("# Threads:");
+    for (int role = 0; role < VRT_RT_ROLES; role++) {
+        if (not (rt->roles & (1<<role)))
+            continue;
+        printf("%s %s on %s", separator, vrt_rt_role_names[role],
+            rt->cpus[role].empty() ? "any CPU" : ("CPU " + rt->cpus[role]).c_str());
+        separator = ",";
+    }
+    printf("\n");
+    printf("# Scheduling: %s, memory %slocked, buffers %sprefaulted\n",
+        rt->priority > 0 ? ("SCHED_FIFO priority " + std::to_string(rt->priority) + " for pinned threads").c_str() : "normal",
+        rt->mlock ? "" : "not ", rt->prefault ? "" : "not ");
+#else
+    fprintf(stderr, "CPU pinning, real-time scheduling and memory locking are only supported on Linux.\n");
+#endif
+    return true;
+}
+
+// Pin the calling thread and raise its priority according to its role.
+// rt may be NULL.
+void vrt_rt_thread(const vrt_rt_type* rt, int role) {
+#ifdef __linux__
+    if (rt == NULL or rt->cpus[role].empty())
+        return;
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &rt->cpuset[role]) != 0)
+        fprintf(stderr, "Failed to pin %s thread to CPU %s.\n", vrt_rt_role_names[role], rt->cpus[role].c_str());
+    if (rt->priority > 0) {
+        struct sched_param param;
+        param.sched_priority = rt->priority;
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0)
+            fprintf(stderr, "Failed to set SCHED_FIFO priority %i on %s thread: %s.\n",
+                rt->priority, vrt_rt_role_names[role], strerror(rc));
+    }
+#endif
+}
+
+// Touch every page of a freshly allocated buffer, keeping its contents, so
+// the page faults happen now instead of on the first packets. rt may be NULL.
+void vrt_rt_prefault(const vrt_rt_type* rt, void* buffer, size_t bytes) {
+    if (rt == NULL or not rt->prefault or buffer == NULL)
+        return;
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    volatile char* p = (volatile char*)buffer;
+    for (size_t i = 0; i < bytes; i += page)
+        p[i] = p[i];
+    if (bytes > 0)
+        p[bytes - 1] = p[bytes - 1];
+}
+
+// Large DSP buffers. vrt_alloc() serves buffers of VRT_HUGE_ALLOC_MIN bytes
+// and more from 2 MB pages: explicit huge pages (MAP_HUGETLB, needs
+// vm.nr_hugepages) if available, otherwise a 2 MB aligned mapping marked
+// for transparent huge pages. These pages are bound to the NUMA node of the
+// calling thread, so allocate from the processing thread after
+// vrt_rt_thread(). Smaller buffers come from the heap. All buffers are
+// aligned for SIMD and FFTW and must be released with vrt_free().
+struct vrt_alloc_header_type {
+    void* base;                      // start of the mapping or heap block
+    size_t mapped;                   // bytes mapped, 0: heap block
+};
+
+#ifdef __linux__
+// Prefer the NUMA node of the calling thread for the pages of a mapping
+void vrt_alloc_bind_node(void* base, size_t bytes) {
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 or node >= 64)
+        return;
+    unsigned long nodemask = 1ul << node;
+    syscall(SYS_mbind, base, bytes, MPOL_PREFERRED, &nodemask, 64, 0);
+}
+#endif
+
+void* vrt_alloc(size_t bytes) {
+    uint8_t* base = NULL;
+    size_t mapped = 0;
+
+#ifdef __linux__
+    if (bytes >= VRT_HUGE_ALLOC_MIN) {
+        mapped = (bytes + VRT_ALLOC_ALIGN + VRT_HUGE_PAGE_SIZE - 1) & ~(size_t)(VRT_HUGE_PAGE_SIZE - 1);
+        void* p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            base = (uint8_t*)p;
+        } else {
+            // transparent huge pages need a 2 MB aligned range: map one page
+            // more and trim both ends
+            p = mmap(NULL, mapped + VRT_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                uintptr_t start = (uintptr_t)p;
+                uintptr_t aligned = (start + VRT_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(VRT_HUGE_PAGE_SIZE - 1);
+                if (aligned > start)
+                    munmap(p, aligned - start);
+                if (start + VRT_HUGE_PAGE_SIZE > aligned)
+                    munmap((void*)(aligned + mapped), start + VRT_HUGE_PAGE_SIZE - aligned);
+                base = (uint8_t*)aligned;
+                madvise(base, mapped, MADV_HUGEPAGE);
+            }
+        }
+        if (base != NULL)
+            vrt_alloc_bind_node(base, mapped);
+        else
+            mapped = 0;
+    }
+#endif
+
+    if (base == NULL) {
+        void* p;
+        if (posix_memalign(&p, VRT_ALLOC_ALIGN, bytes + VRT_ALLOC_ALIGN) != 0)
+            return NULL;
+        base = (uint8_t*)p;
+    }
+
+    vrt_alloc_header_type* header = (vrt_alloc_header_type*)(base + VRT_ALLOC_ALIGN - sizeof(vrt_alloc_header_type));
+    header->base = base;
+    header->mapped = mapped;
+    return base + VRT_ALLOC_ALIGN;
+}
+
+void vrt_free(void* buffer) {
+    if (buffer == NULL)
+        return;
+    vrt_alloc_header_type* header = (vrt_alloc_header_type*)((uint8_t*)buffer - sizeof(vrt_alloc_header_type));
+    if (header->mapped > 0)
+        munmap(header->base, header->mapped);
+    else
+        free(header->base);
+}
+
+// Receive stage: a thread drains the socket into a ring of ZMQ messages so
+// that a stalled processing loop does not let the socket hit its HWM. The
+// ring is single producer (receiver thread), single consumer (main loop).
+// If the ring is full, packets are still received but dropped and counted
+// as overruns. A shared memory stream is a ring of its own and is read
+// directly, without the thread.
+struct vrt_receiver_type {
+    void* socket;
+    vrt_shm_reader_type* shm;        // NULL: read from socket
+    vrt_msg_type ring[VRT_RING_SLOTS];
+    vrt_msg_type overflow;
+    std::atomic<uint64_t> head;      // next slot written by the receiver thread
+    std::atomic<uint64_t> tail;      // next slot read by the consumer
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint32_t> peak_occupancy;
+    std::atomic<bool> stop;
+    bool holding;                    // consumer holds slot tail, released by advancing tail
+    const vrt_rt_type* rt;           // NULL: not pinned
+    std::thread thread;
+    vrt_metrics_type* metrics;       // NULL if disabled
+    std::chrono::steady_clock::time_point handed_out;
+};
+
+void vrt_receiver_loop(vrt_receiver_type* rx) {
+
+    VRT_TRACE_THREAD("receiver");
+
+    vrt_rt_thread(rx->rt, VRT_RT_RX);
+
+    zmq_pollitem_t items[] = { { rx->socket, 0, ZMQ_POLLIN, 0 } };
+
+    while (not rx->stop.load(std::memory_order_relaxed)) {
+
+        if (zmq_poll(items, 1, VRT_RING_TIMEOUT) <= 0)
+            continue;
+
+        VRT_TRACE_SCOPE("zmq_recv");
+
+        // drain everything queued on the socket
+        while (true) {
+            uint64_t head = rx->head.load(std::memory_order_relaxed);
+            uint64_t tail = rx->tail.load(std::memory_order_acquire);
+            bool full = (head - tail) >= VRT_RING_SLOTS;
+
+            vrt_msg_type* slot = full ? &rx->overflow : &rx->ring[head % VRT_RING_SLOTS];
+            if (vrt_recv(rx->socket, slot, ZMQ_DONTWAIT) < 0)
+                break;
+
+            rx->received.fetch_add(1, std::memory_order_relaxed);
+
+            if (full) {
+                rx->overruns.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            rx->head.store(head + 1, std::memory_order_release);
+
+            uint32_t occupancy = head + 1 - tail;
+            if (occupancy > rx->peak_occupancy.load(std::memory_order_relaxed))
+                rx->peak_occupancy.store(occupancy, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Start the receiver thread on socket, placed according to the receiver role
+// of rt (NULL: not pinned). The socket must not be used by the caller until
+// vrt_receiver_stop().
+// With metrics, the ring and the time spent on each packet are reported.
+// With shm, packets are read from the shared memory stream instead.
+void vrt_receiver_start(vrt_receiver_type* rx, void* socket, const vrt_rt_type* rt = NULL, vrt_metrics_type* metrics = NULL,
+    vrt_shm_reader_type* shm = NULL) {
+    rx->socket = socket;
+    rx->shm = shm;
+    for (uint32_t i = 0; i < VRT_RING_SLOTS; i++)
+        init_msg(&rx->ring[i]);
+    init_msg(&rx->overflow);
+    rx->head = 0;
+    rx->tail = 0;
+    rx->received = 0;
+    rx->overruns = 0;
+    rx->peak_occupancy = 0;
+    rx->stop = false;
+    rx->holding = false;
+    rx->rt = rt;
+    rx->metrics = (metrics and metrics->enabled) ? metrics : NULL;
+    if (rx->metrics)
+        rx->metrics->receiver = rx;
+    if (rx->shm == NULL)
+        rx->thread = std::thread(vrt_receiver_loop, rx);
+}
+
+int vrt_receiver_recv_shm(vrt_receiver_type* rx, vrt_msg_type** vrt_msg) {
+
+    VRT_TRACE_SCOPE("shm_wait");
+
+    int len = vrt_shm_recv(rx->shm, &rx->ring[0], VRT_RING_TIMEOUT);
+    rx->received.store(rx->shm->received.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    rx->overruns.store(rx->shm->overruns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if (len < 0) {
+        *vrt_msg = NULL;
+        return -1;
+    }
+
+    uint32_t occupancy = vrt_shm_occupancy(rx->shm);
+    if (occupancy > rx->peak_occupancy.load(std::memory_order_relaxed))
+        rx->peak_occupancy.store(occupancy, std::memory_order_relaxed);
+
+    *vrt_msg = &rx->ring[0];
+    rx->holding = true;
+    if (rx->metrics)
+        rx->handed_out = std::chrono::steady_clock::now();
+    return len;
+}
+
+// Get the next packet from the ring, waiting up to VRT_RING_TIMEOUT ms.
+// Like vrt_recv(), the packet returned by the previous call is released, so
+// views into it must not outlive this call. Returns the packet length, or -1
+// on timeout.
+int vrt_receiver_recv(vrt_receiver_type* rx, vrt_msg_type** vrt_msg) {
+
+    uint64_t tail = rx->tail.load(std::memory_order_relaxed);
+
+    // release the slot handed out last time
+    if (rx->holding) {
+        rx->holding = false;
+        if (rx->shm == NULL) {
+            tail++;
+            rx->tail.store(tail, std::memory_order_release);
+        }
+        if (rx->metrics) {
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - rx->handed_out).count();
+            vrt_metrics_add(rx->metrics->busy_ns, ns);
+            vrt_metrics_observe(&rx->metrics->processing, ns);
+        }
+    }
+
+    if (rx->shm)
+        return vrt_receiver_recv_shm(rx, vrt_msg);
+
+    VRT_TRACE_SCOPE("ring_wait");
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(VRT_RING_TIMEOUT);
+    uint32_t spins = 0;
+    while (rx->head.load(std::memory_order_acquire) == tail) {
+        if (spins < 1000) {
+            spins++;
+            std::this_thread::yield();
+            continue;
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            *vrt_msg = NULL;
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    // the slot stays owned by the consumer until the next call
+    *vrt_msg = &rx->ring[tail % VRT_RING_SLOTS];
+    rx->holding = true;
+    if (rx->metrics)
+        rx->handed_out = std::chrono::steady_clock::now();
+    return (*vrt_msg)->len;
+}
+
+// Packets currently queued in the ring
+uint32_t vrt_receiver_occupancy(vrt_receiver_type* rx) {
+    if (rx->shm)
+        return vrt_shm_occupancy(rx->shm);
+    return rx->head.load(std::memory_order_acquire) - rx->tail.load(std::memory_order_acquire);
+}
+
+uint32_t vrt_receiver_slots(vrt_receiver_type* rx) {
+    if (rx->shm)
+        return rx->shm->slots;
+    return VRT_RING_SLOTS;
+}
+
+void vrt_receiver_stop(vrt_receiver_type* rx) {
+    rx->stop = true;
+    if (rx->thread.joinable())
+        rx->thread.join();
+    for (uint32_t i = 0; i < VRT_RING_SLOTS; i++)
+        vrt_msg_close(&rx->ring[i]);
+    vrt_msg_close(&rx->overflow);
+}
+
+void vrt_print_receiver_stats(vrt_receiver_type* rx) {
+    printf("# Receiver: %lu packets, %lu overruns, peak ring occupancy %u/%u%s\n",
+        (unsigned long)rx->received.load(), (unsigned long)rx->overruns.load(),
+        rx->peak_occupancy.load(), vrt_receiver_slots(rx), rx->shm ? " (shared memory)" : "");
+}
+
+void vrt_metrics_write(std::string* out, const char* name, const char* type, const char* help,
+    const std::string& tool, double value) {
+    char line[512];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s{tool=\"%s\"} %.15g\n",
+        name, help, name, type, name, tool.c_str(), value);
+    *out += line;
+}
+
+void vrt_metrics_write_histogram(std::string* out, const char* name, const char* help,
+    const std::string& tool, vrt_histogram_type* h) {
+    char line[512];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    *out += line;
+    uint64_t cumulative = 0;
+    for (uint32_t i = 0; i <= VRT_METRICS_BUCKETS; i++) {
+        cumulative += h->buckets[i].load(std::memory_order_relaxed);
+        if (i < VRT_METRICS_BUCKETS)
+            snprintf(line, sizeof(line), "%s_bucket{tool=\"%s\",le=\"%g\"} %lu\n",
+                name, tool.c_str(), 1e-6*(1ull << i), (unsigned long)cumulative);
+        else
+            snprintf(line, sizeof(line), "%s_bucket{tool=\"%s\",le=\"+Inf\"} %lu\n",
+                name, tool.c_str(), (unsigned long)cumulative);
+        *out += line;
+    }
+    snprintf(line, sizeof(line), "%s_sum{tool=\"%s\"} %.9f\n%s_count{tool=\"%s\"} %lu\n",
+        name, tool.c_str(), 1e-9*h->sum_ns.load(std::memory_order_relaxed),
+        name, tool.c_str(), (unsigned long)cumulative);
+    *out += line;
+}
+
+// Prometheus text exposition of all metrics. The realtime ratio is the
+// processing time over the stream time received since the previous scrape:
+// above 1 the client is falling behind, long before the ring overruns.
+std::string vrt_metrics_text(vrt_metrics_type* m) {
+    std::string out;
+    const std::string& tool = m->tool;
+
+    uint64_t busy_ns = m->busy_ns.load(std::memory_order_relaxed);
+    uint64_t stream_ns = m->stream_ns.load(std::memory_order_relaxed);
+    if (stream_ns > m->last_stream_ns) {
+        m->realtime_ratio = (double)(busy_ns - m->last_busy_ns)/(double)(stream_ns - m->last_stream_ns);
+    } else {
+        m->realtime_ratio = 0;
+    }
+    m->last_busy_ns = busy_ns;
+    m->last_stream_ns = stream_ns;
+
+    vrt_metrics_write(&out, "vrt_packets_total", "counter", "VRT packets processed",
+        tool, m->packets.load(std::memory_order_relaxed));
+    vrt_metrics_write(&out, "vrt_samples_total", "counter", "Samples received in data packets",
+        tool, m->samples.load(std::memory_order_relaxed));
+    vrt_metrics_write(&out, "vrt_lost_frames_total", "counter", "Data packets following a gap in the packet count",
+        tool, m->lost_frames.load(std::memory_order_relaxed));
+    vrt_metrics_write(&out, "vrt_output_bytes_total", "counter", "Bytes written or sent",
+        tool, m->output_bytes.load(std::memory_order_relaxed));
+    vrt_metrics_write(&out, "vrt_sample_rate_hertz", "gauge", "Sample rate of the stream",
+        tool, m->sample_rate.load(std::memory_order_relaxed));
+    vrt_metrics_write(&out, "vrt_stream_seconds_total", "counter", "Stream time covered by the samples received",
+        tool, 1e-9*stream_ns);
+    vrt_metrics_write(&out, "vrt_processing_seconds_total", "counter", "Time spent processing packets",
+        tool, 1e-9*busy_ns);
+    vrt_metrics_write(&out, "vrt_realtime_ratio", "gauge", "Processing time over stream time since the last scrape",
+        tool, m->realtime_ratio);
+    vrt_metrics_write(&out, "vrt_zmq_rcvhwm", "gauge", "ZMQ receive high water mark in packets",
+        tool, m->hwm);
+
+    vrt_receiver_type* rx = m->receiver.load();
+    if (rx) {
+        vrt_metrics_write(&out, "vrt_receiver_packets_total", "counter", "Packets taken off the ZMQ socket",
+            tool, rx->received.load(std::memory_order_relaxed));
+        vrt_metrics_write(&out, "vrt_receiver_overruns_total", "counter", "Packets dropped on a full receive ring",
+            tool, rx->overruns.load(std::memory_order_relaxed));
+        vrt_metrics_write(&out, "vrt_receiver_ring_occupancy", "gauge", "Packets queued in the receive ring",
+            tool, vrt_receiver_occupancy(rx));
+        vrt_metrics_write(&out, "vrt_receiver_ring_peak_occupancy", "gauge", "Peak packets queued in the receive ring",
+            tool, rx->peak_occupancy.load(std::memory_order_relaxed));
+        vrt_metrics_write(&out, "vrt_receiver_ring_slots", "gauge", "Receive ring size in packets",
+            tool, vrt_receiver_slots(rx));
+    }
+
+    vrt_metrics_write_histogram(&out, "vrt_packet_processing_seconds", "Time spent on each packet",
+        tool, &m->processing);
+    vrt_metrics_write_histogram(&out, "vrt_fft_seconds", "FFT execution time",
+        tool, &m->fft);
+    return out;
+}
+
+// Serve HTTP on a ZMQ_STREAM socket: every request is answered with the
+// metrics and the connection is closed.
+void vrt_metrics_loop(vrt_metrics_type* m) {
+
+    zmq_pollitem_t items[] = { { m->socket, 0, ZMQ_POLLIN, 0 } };
+    uint8_t id[256];
+    char request[4096];
+
+    while (not m->stop.load(std::memory_order_relaxed)) {
+
+        if (zmq_poll(items, 1, VRT_METRICS_TIMEOUT) <= 0)
+            continue;
+
+        int id_size = zmq_recv(m->socket, id, sizeof(id), 0);
+        if (id_size <= 0)
+            continue;
+        // connects and disconnects arrive as empty frames
+        int len = zmq_recv(m->socket, request, sizeof(request), 0);
+        if (len < 4 or strncmp(request, "GET ", 4) != 0)
+            continue;
+
+        std::string body = vrt_metrics_text(m);
+        std::string response = "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+
+        zmq_send(m->socket, id, id_size, ZMQ_SNDMORE);
+        zmq_send(m->socket, response.data(), response.size(), ZMQ_SNDMORE);
+        // an empty frame closes the connection
+        zmq_send(m->socket, id, id_size, ZMQ_SNDMORE);
+        zmq_send(m->socket, NULL, 0, 0);
+    }
+}
+
+// Serve metrics on http://address:port/metrics, address being the local
+// interface to bind (127.0.0.1 for local scraping only, * for all). Call
+// before vrt_receiver_start() and pass the metrics to it. Returns false if
+// the port cannot be bound.
+bool vrt_metrics_start(vrt_metrics_type* m, void* context, const std::string& address, uint16_t port,
+    const char* tool, int hwm) {
+    m->tool = tool;
+    m->hwm = hwm;
+    m->socket = zmq_socket(context, ZMQ_STREAM);
+    int linger = 0;
+    zmq_setsockopt(m->socket, ZMQ_LINGER, &linger, sizeof linger);
+    std::string bind_string = "tcp://" + address + ":" + std::to_string(port);
+    if (zmq_bind(m->socket, bind_string.c_str()) != 0) {
+        fprintf(stderr, "Failed to bind metrics port %s:%u: %s\n", address.c_str(), port, zmq_strerror(zmq_errno()));
+        zmq_close(m->socket);
+        m->socket = NULL;
+        return false;
+    }
+    m->enabled = true;
+    m->stop = false;
+    m->thread = std::thread(vrt_metrics_loop, m);
+    return true;
+}
+
+void vrt_metrics_stop(vrt_metrics_type* m) {
+    if (not m->enabled)
+        return;
+    m->stop = true;
+    if (m->thread.joinable())
+        m->thread.join();
+    zmq_close(m->socket);
+    m->socket = NULL;
+    m->enabled = false;
+}
+
+// Check a samples per packet setting, prints the reason if it is invalid
+bool vrt_check_samples_per_packet(uint32_t samples_per_packet) {
+    if (samples_per_packet == 0 or samples_per_packet > VRT_MAX_SAMPLES_PER_PACKET) {
+        printf("Samples per packet needs to be between 1 and %u.\n", VRT_MAX_SAMPLES_PER_PACKET);
+        return false;
+    }
+    return true;
+}
+
+void vrt_init_data_packet(struct vrt_packet* p, uint32_t samples_per_packet = VRT_SAMPLES_PER_PACKET) {
 
     p->header.packet_type         = VRT_PT_IF_DATA_WITH_STREAM_ID;
 
-    p->header.packet_size         = SIZE;
+    p->header.packet_size         = VRT_DATA_PACKET_SIZE_FOR(samples_per_packet);
     p->header.tsm                 = VRT_TSM_FINE;
     p->header.tsi                 = VRT_TSI_OTHER; // unix time
     p->header.tsf                 = VRT_TSF_REAL_TIME;
     p->fields.stream_id           = 0;
-    p->words_body                 = VRT_SAMPLES_PER_PACKET;
+    p->words_body                 = samples_per_packet;
 
     p->header.has.class_id        = true;
-    p->fields.class_id.oui        = 0xFF5454;
+    p->fields.class_id.oui        = VRT_TOOLS_OUI;
     p->fields.class_id.information_class_code = 0;
     p->fields.class_id.packet_class_code = 0;
 
@@ -271,7 +1783,7 @@ void vrt_init_context_packet(struct vrt_packet* pc) {
     pc->header.packet_type = VRT_PT_IF_CONTEXT;
     pc->header.has.class_id = true;
 
-    pc->fields.class_id.oui        = 0xFF5454;
+    pc->fields.class_id.oui        = VRT_TOOLS_OUI;
     pc->fields.class_id.information_class_code = 0;
     pc->fields.class_id.packet_class_code = 0;
 
@@ -304,6 +1816,180 @@ void vrt_init_context_packet(struct vrt_packet* pc) {
 
 }
 
+// Transmit side: data packets are built in place in pooled buffers that are
+// handed to ZMQ without a copy (zmq_msg_init_data). ZMQ returns a buffer
+// through vrt_tx_free() when the last message referencing it is closed, which
+// may happen on a ZMQ I/O thread, hence the lock. The pool is deleted once it
+// has been destroyed and all its buffers have come back.
+struct vrt_tx_pool_type {
+    std::mutex lock;
+    std::vector<uint32_t*> free_buffers;
+    uint32_t words;          // buffer size in words
+    uint32_t outstanding;    // buffers being built or owned by ZMQ
+    uint64_t allocations;
+    bool closed;
+};
+
+// A data packet being built. Producers write up to the pool's samples per
+// packet into samples, then call vrt_tx_finish() or vrt_tx_send().
+struct vrt_tx_packet_type {
+    vrt_tx_pool_type* pool;
+    uint32_t* buffer;
+    std::complex<int16_t>* samples;
+};
+
+vrt_tx_pool_type* vrt_tx_pool_create(uint32_t samples_per_packet = VRT_SAMPLES_PER_PACKET) {
+    vrt_tx_pool_type* pool = new vrt_tx_pool_type;
+    pool->words = VRT_DATA_PACKET_SIZE_FOR(samples_per_packet);
+    pool->outstanding = 0;
+    pool->allocations = 0;
+    pool->closed = false;
+    return pool;
+}
+
+void vrt_tx_pool_put(vrt_tx_pool_type* pool, uint32_t* buffer) {
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->outstanding--;
+        if (not pool->closed and pool->free_buffers.size() < VRT_TX_POOL_SIZE) {
+            pool->free_buffers.push_back(buffer);
+            buffer = NULL;
+        }
+        last = pool->closed and pool->outstanding == 0;
+    }
+    free(buffer);
+    if (last)
+        delete pool;
+}
+
+// zmq_free_fn for messages created by vrt_tx_finish()
+void vrt_tx_free(void* data, void* hint) {
+    vrt_tx_pool_put((vrt_tx_pool_type*)hint, (uint32_t*)data);
+}
+
+// Release the pool. Buffers still owned by ZMQ are freed when their
+// messages are closed.
+void vrt_tx_pool_destroy(vrt_tx_pool_type* pool) {
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->closed = true;
+        for (size_t i = 0; i < pool->free_buffers.size(); i++)
+            free(pool->free_buffers[i]);
+        pool->free_buffers.clear();
+        last = pool->outstanding == 0;
+    }
+    if (last)
+        delete pool;
+}
+
+void init_tx_packet(vrt_tx_packet_type* tx) {
+    tx->pool = NULL;
+    tx->buffer = NULL;
+    tx->samples = NULL;
+}
+
+// Reserve a buffer for the next data packet. The header and fields words
+// are left free, samples points to the payload. A packet that was begun but
+// not finished is kept. Exits if no buffer can be allocated.
+void vrt_tx_begin(vrt_tx_pool_type* pool, vrt_tx_packet_type* tx) {
+    if (tx->buffer)
+        return;
+    uint32_t* buffer = NULL;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->outstanding++;
+        if (not pool->free_buffers.empty()) {
+            buffer = pool->free_buffers.back();
+            pool->free_buffers.pop_back();
+        } else {
+            pool->allocations++;
+        }
+    }
+    if (buffer == NULL) {
+        buffer = (uint32_t*)malloc(pool->words*sizeof(uint32_t));
+        if (buffer == NULL) {
+            // the producers write into the buffer right away
+            fprintf(stderr, "Failed to allocate a packet buffer of %lu bytes.\n",
+                (unsigned long)(pool->words*sizeof(uint32_t)));
+            exit(1);
+        }
+    }
+    tx->pool = pool;
+    tx->buffer = buffer;
+    tx->samples = reinterpret_cast<std::complex<int16_t>*>(buffer + vrt_data_layout::payload_offset);
+}
+
+// Return a packet that was begun but will not be sent
+void vrt_tx_abort(vrt_tx_packet_type* tx) {
+    if (tx->buffer)
+        vrt_tx_pool_put(tx->pool, tx->buffer);
+    tx->buffer = NULL;
+    tx->samples = NULL;
+}
+
+// Write the header and fields of p in front of the num_samples samples of
+// tx and hand the buffer to msg. p must be set up by vrt_init_data_packet().
+// tx can be begun again afterwards.
+bool vrt_tx_finish(struct vrt_packet* p, vrt_tx_packet_type* tx, uint32_t num_samples, zmq_msg_t* msg) {
+
+    uint32_t words = VRT_DATA_PACKET_SIZE_FOR(num_samples);
+    if (tx->buffer == NULL or words > tx->pool->words) {
+        fprintf(stderr, "Packet of %u samples does not fit the transmit buffer.\n", num_samples);
+        return false;
+    }
+
+    p->header.packet_size = words;
+    p->words_body = num_samples;
+
+    int32_t rv = vrt_write_header(&p->header, tx->buffer, words, true);
+    if (rv < 0) {
+        fprintf(stderr, "Failed to write header: %s\n", vrt_string_error(rv));
+        return false;
+    }
+    int32_t offset = rv;
+    rv = vrt_write_fields(&p->header, &p->fields, tx->buffer + offset, words - offset, true);
+    if (rv < 0) {
+        fprintf(stderr, "Failed to write fields section: %s\n", vrt_string_error(rv));
+        return false;
+    }
+    offset += rv;
+    if (offset != vrt_data_layout::payload_offset) {
+        fprintf(stderr, "Unexpected data packet layout (payload at word %i).\n", offset);
+        return false;
+    }
+
+    zmq_msg_init_data(msg, tx->buffer, words*sizeof(uint32_t), vrt_tx_free, tx->pool);
+    tx->buffer = NULL;
+    tx->samples = NULL;
+    return true;
+}
+
+// Send a message to one of several sockets. The payload is shared, only the
+// message is reference counted (zmq_msg_copy).
+int vrt_msg_send_copy(zmq_msg_t* msg, void* socket, int flags = 0) {
+    zmq_msg_t copy;
+    zmq_msg_init(&copy);
+    zmq_msg_copy(&copy, msg);
+    int rc = zmq_msg_send(&copy, socket, flags);
+    zmq_msg_close(&copy);
+    return rc;
+}
+
+// Finish the packet and send it to socket, and publish it to shm if given
+int vrt_tx_send(struct vrt_packet* p, vrt_tx_packet_type* tx, uint32_t num_samples, void* socket,
+    vrt_shm_writer_type* shm = NULL) {
+    zmq_msg_t msg;
+    if (not vrt_tx_finish(p, tx, num_samples, &msg))
+        return -1;
+    if (shm)
+        vrt_shm_publish(shm, &msg);
+    int rc = zmq_msg_send(&msg, socket, 0);
+    zmq_msg_close(&msg);
+    return rc;
+}
+
 void show_progress_stats(
     std::chrono::time_point<std::chrono::steady_clock> now,
     std::chrono::time_point<std::chrono::steady_clock> *last_update,
@@ -0,0 +1,239 @@
+#ifndef _VRTTRACE_H
+#define _VRTTRACE_H
+
+// Hot path tracing: VRT_TRACE_SCOPE("name") times the enclosing block into a
+// per-thread ring of events, dumped as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev) on SIGUSR1 and on exit by tools started with --trace.
+//
+// Tracing is compiled in with -DVRT_TRACE (cmake -DVRT_TRACE=ON, make
+// TRACE=1). Without it the macros expand to nothing. Each ring keeps the
+// last VRT_TRACE_EVENTS events of its thread, older events are overwritten.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define VRT_TRACE_EVENTS 65536
+#define VRT_TRACE_TIMEOUT 100
+
+#ifdef VRT_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct vrt_trace_event_type {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Single writer (the owning thread), read by the dump thread. An event is
+// published by advancing head after it is written.
+struct vrt_trace_buffer_type {
+    vrt_trace_event_type events[VRT_TRACE_EVENTS];
+    std::atomic<uint64_t> head;
+    uint32_t tid;
+    std::string thread_name;
+};
+
+struct vrt_trace_type {
+    std::atomic<bool> enabled;
+    std::atomic<bool> dump_requested;
+    std::atomic<bool> stop;
+    std::string file;
+    std::mutex mutex;                        // buffers
+    std::vector<vrt_trace_buffer_type*> buffers;
+    uint32_t next_tid;
+    uint64_t start_ticks;
+    std::chrono::steady_clock::time_point start_time;
+    std::thread thread;
+};
+
+// Never destroyed, so tools exiting without vrt_trace_stop() do not trip
+// over the joinable dump thread.
+vrt_trace_type& vrt_trace() {
+    static vrt_trace_type* trace = new vrt_trace_type();
+    return *trace;
+}
+
+// Timestamp in ticks: the TSC on x86, steady_clock ns elsewhere
+inline uint64_t vrt_trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+vrt_trace_buffer_type* vrt_trace_register(const char* thread_name) {
+    vrt_trace_type& trace = vrt_trace();
+    vrt_trace_buffer_type* buffer = new vrt_trace_buffer_type();
+    buffer->head = 0;
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    buffer->tid = trace.next_tid++;
+    buffer->thread_name = thread_name ? thread_name : "thread " + std::to_string(buffer->tid);
+    trace.buffers.push_back(buffer);
+    return buffer;
+}
+
+// Ring of the calling thread, registered on first use
+inline vrt_trace_buffer_type*& vrt_trace_local() {
+    static thread_local vrt_trace_buffer_type* buffer = NULL;
+    return buffer;
+}
+
+// Name the calling thread in the trace
+void vrt_trace_thread(const char* name) {
+    vrt_trace_buffer_type*& buffer = vrt_trace_local();
+    if (buffer == NULL) {
+        buffer = vrt_trace_register(name);
+    } else {
+        std::lock_guard<std::mutex> lock(vrt_trace().mutex);
+        buffer->thread_name = name;
+    }
+}
+
+inline void vrt_trace_event(const char* name, uint64_t start, uint64_t end) {
+    vrt_trace_buffer_type*& buffer = vrt_trace_local();
+    if (buffer == NULL)
+        buffer = vrt_trace_register(NULL);
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    vrt_trace_event_type& event = buffer->events[head % VRT_TRACE_EVENTS];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+struct vrt_trace_scope_type {
+    const char* name;
+    uint64_t start;
+    vrt_trace_scope_type(const char* name) : name(name),
+        start(vrt_trace().enabled.load(std::memory_order_relaxed) ? vrt_trace_ticks() : 0) {}
+    ~vrt_trace_scope_type() {
+        if (start != 0)
+            vrt_trace_event(name, start, vrt_trace_ticks());
+    }
+};
+
+#define VRT_TRACE_CONCAT2(a, b) a##b
+#define VRT_TRACE_CONCAT(a, b) VRT_TRACE_CONCAT2(a, b)
+#define VRT_TRACE_SCOPE(name) vrt_trace_scope_type VRT_TRACE_CONCAT(vrt_trace_scope_, __LINE__)(name)
+#define VRT_TRACE_THREAD(name) vrt_trace_thread(name)
+
+// Write all rings as Chrome trace JSON. Rings are copied while their threads
+// keep running; events that may have been overwritten during the copy are
+// dropped.
+bool vrt_trace_dump() {
+    vrt_trace_type& trace = vrt_trace();
+
+    // ticks per microsecond, over the whole run
+    uint64_t ticks = vrt_trace_ticks() - trace.start_ticks;
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace.start_time).count();
+    double ticks_per_us = (us > 0 and ticks > 0) ? (double)ticks/us : 1e3;
+
+    FILE* out = fopen(trace.file.c_str(), "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open trace file %s.\n", trace.file.c_str());
+        return false;
+    }
+
+    int pid = getpid();
+    uint64_t dumped = 0;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":0,\"args\":{\"name\":\"vrt\"}}", pid);
+
+    std::vector<vrt_trace_event_type> events(VRT_TRACE_EVENTS);
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    for (vrt_trace_buffer_type* buffer : trace.buffers) {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            pid, buffer->tid, buffer->thread_name.c_str());
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t first = head > VRT_TRACE_EVENTS ? head - VRT_TRACE_EVENTS : 0;
+        for (uint64_t i = first; i < head; i++)
+            events[i - first] = buffer->events[i % VRT_TRACE_EVENTS];
+        uint64_t after = buffer->head.load(std::memory_order_acquire);
+        uint64_t valid = after > VRT_TRACE_EVENTS ? after - VRT_TRACE_EVENTS : 0;
+
+        for (uint64_t i = std::max(first, valid); i < head; i++) {
+            const vrt_trace_event_type& event = events[i - first];
+            if (event.start < trace.start_ticks)
+                continue;
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, pid, buffer->tid,
+                (double)(event.start - trace.start_ticks)/ticks_per_us,
+                (double)(event.end - event.start)/ticks_per_us);
+            dumped++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+
+    fprintf(stderr, "# Trace: %lu events written to %s\n", (unsigned long)dumped, trace.file.c_str());
+    return true;
+}
+
+void vrt_trace_signal_handler(int) {
+    vrt_trace().dump_requested = true;
+}
+
+void vrt_trace_loop() {
+    vrt_trace_type& trace = vrt_trace();
+    while (not trace.stop.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(VRT_TRACE_TIMEOUT));
+        if (trace.dump_requested.exchange(false))
+            vrt_trace_dump();
+    }
+}
+
+// Start recording. The trace is written to file on SIGUSR1 and by
+// vrt_trace_stop().
+void vrt_trace_start(const std::string& file) {
+    vrt_trace_type& trace = vrt_trace();
+    trace.file = file;
+    trace.start_time = std::chrono::steady_clock::now();
+    trace.start_ticks = vrt_trace_ticks();
+    trace.dump_requested = false;
+    trace.stop = false;
+    trace.enabled = true;
+    signal(SIGUSR1, vrt_trace_signal_handler);
+    trace.thread = std::thread(vrt_trace_loop);
+}
+
+void vrt_trace_stop() {
+    vrt_trace_type& trace = vrt_trace();
+    if (not trace.enabled)
+        return;
+    trace.stop = true;
+    if (trace.thread.joinable())
+        trace.thread.join();
+    trace.enabled = false;
+    vrt_trace_dump();
+}
+
+#else
+
+#define VRT_TRACE_SCOPE(name)
+#define VRT_TRACE_THREAD(name)
+
+void vrt_trace_start(const std::string&) {
+    fprintf(stderr, "Tracing is not compiled in, rebuild with -DVRT_TRACE.\n");
+}
+
+void vrt_trace_stop() {
+}
+
+#endif
+
+#endif
@@ -0,0 +1,1104 @@
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <csignal>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// VRT
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vrt/vrt_init.h>
+#include <vrt/vrt_string.h>
+#include <vrt/vrt_types.h>
+#include <vrt/vrt_util.h>
+#include <vrt/vrt_write.h>
+
+#include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-dsp.h"
+
+namespace po = boost::program_options;
+
+// number of distinct packets, one full cycle of the 4-bit packet counter
+#define BENCH_PACKETS 16
+
+// send times kept for latency measurement, in packets
+#define BENCH_LATENCY_SLOTS 65536
+
+static bool stop_signal_called = false;
+void sig_int_handler(int)
+{
+    stop_signal_called = true;
+}
+
+// Fill packets with a tone, packet counts 0..15 so the sequence never
+// triggers a lost frame.
+void make_data_packets(std::vector<std::vector<uint32_t> >& packets, uint32_t samples_per_packet) {
+
+    std::vector<std::complex<int16_t> > samples(samples_per_packet);
+
+    struct vrt_packet p;
+    vrt_init_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
+    p.fields.stream_id = 1;
+
+    packets.resize(BENCH_PACKETS);
+    for (uint32_t n = 0; n < BENCH_PACKETS; n++) {
+        for (uint32_t i = 0; i < samples_per_packet; i++) {
+            double phase = 0.01*(double)(n*samples_per_packet+i);
+            samples[i] = std::complex<int16_t>(10000*cos(phase), 10000*sin(phase));
+        }
+        p.body = samples.data();
+        p.header.packet_count = n;
+        p.fields.integer_seconds_timestamp = 1700000000 + n;
+        p.fields.fractional_seconds_timestamp = 123456789012ULL + n;
+
+        packets[n].resize(VRT_DATA_PACKET_SIZE_FOR(samples_per_packet));
+        int32_t rv = vrt_write_packet(&p, packets[n].data(), packets[n].size(), true);
+        if (rv < 0) {
+            fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
+            exit(1);
+        }
+        packets[n].resize(rv);
+    }
+}
+
+// Compare the kernels of every instruction set available on this CPU
+// bit-exactly with the scalar path, for all option combinations and lengths,
+// then measure their throughput.
+bool bench_kernels(uint64_t iterations, uint32_t samples_per_packet) {
+
+    const char* isa[] = {"scalar", "sse4", "avx2", "neon"};
+
+    // odd lengths and offsets to exercise the tails and unaligned loads
+    size_t max_len = samples_per_packet + 7;
+    std::vector<std::complex<int16_t> > in(max_len + 8);
+    std::vector<float> window(max_len + 8);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = std::complex<int16_t>((int16_t)(rand() & 0xFFFF), (int16_t)(rand() & 0xFFFF));
+        window[i] = (float)rand()/RAND_MAX;
+    }
+    in[0] = std::complex<int16_t>(-32768, -32768);
+    std::complex<float> gain32(0.8137f, -1.2179f);
+    std::complex<double> gain64(0.8137, -1.2179);
+
+    std::vector<std::complex<float> > ref32(max_len), out32(max_len);
+    std::vector<std::complex<double> > ref64(max_len), out64(max_len);
+
+    bool ok = true;
+
+    for (uint32_t k = 1; k < sizeof(isa)/sizeof(isa[0]); k++) {
+        if (not vrt_kernels_set(isa[k]))
+            continue;
+        vrt_kernels_type simd = vrt_kernels();
+        vrt_kernels_type scalar = vrt_kernels_select("scalar");
+        uint64_t checked = 0;
+        bool exact = true;
+        for (int mode = 0; mode < 8; mode++) {
+            for (size_t len = 0; len <= 40; len++) {
+                for (size_t offset = 0; offset < 3; offset++) {
+                    size_t n = (len == 40) ? samples_per_packet + offset : len;
+                    for (int sign = -1; sign <= 1; sign += 2) {
+                        int s = (mode & 4) ? sign : 0;
+                        const float* w = (mode & 2) ? &window[offset] : NULL;
+                        scalar.convert_cf32(&in[offset], ref32.data(), n, s, w, (mode & 1) ? &gain32 : NULL);
+                        simd.convert_cf32(&in[offset], out32.data(), n, s, w, (mode & 1) ? &gain32 : NULL);
+                        scalar.convert_cf64(&in[offset], ref64.data(), n, s, w, (mode & 1) ? &gain64 : NULL);
+                        simd.convert_cf64(&in[offset], out64.data(), n, s, w, (mode & 1) ? &gain64 : NULL);
+                        if (memcmp(ref32.data(), out32.data(), n*sizeof(ref32[0])) != 0 or
+                            memcmp(ref64.data(), out64.data(), n*sizeof(ref64[0])) != 0) {
+                            printf("Error: %s kernel differs from scalar (mode %i, n %lu, offset %lu, sign %i).\n",
+                                isa[k], mode, (unsigned long)n, (unsigned long)offset, s);
+                            exact = false;
+                        }
+                        checked++;
+                    }
+                }
+            }
+        }
+        // polyphase filterbank sum over 1 to 5 rows
+        std::vector<std::complex<float> > history(5*max_len);
+        std::vector<float> taps(10*max_len);
+        for (size_t i = 0; i < history.size(); i++) {
+            history[i] = std::complex<float>(in[i % in.size()].real(), in[i % in.size()].imag());
+            taps[2*i] = taps[2*i+1] = window[i % window.size()] - 0.5f;
+        }
+        const std::complex<float>* rows[5];
+        for (uint32_t partitions = 1; partitions <= 5; partitions++) {
+            for (size_t len = 0; len <= 40; len++) {
+                size_t n = (len == 40) ? samples_per_packet : len;
+                // rows out of order, as in the circular history
+                for (uint32_t p = 0; p < partitions; p++)
+                    rows[p] = &history[((p + 2) % partitions)*n];
+                scalar.pfb_sum_cf32(rows, taps.data(), partitions, n, ref32.data());
+                simd.pfb_sum_cf32(rows, taps.data(), partitions, n, out32.data());
+                scalar.pfb_sum_cf64(rows, taps.data(), partitions, n, ref64.data());
+                simd.pfb_sum_cf64(rows, taps.data(), partitions, n, out64.data());
+                if (memcmp(ref32.data(), out32.data(), n*sizeof(ref32[0])) != 0 or
+                    memcmp(ref64.data(), out64.data(), n*sizeof(ref64[0])) != 0) {
+                    printf("Error: %s PFB kernel differs from scalar (partitions %u, n %lu).\n",
+                        isa[k], partitions, (unsigned long)n);
+                    exact = false;
+                }
+                checked++;
+            }
+        }
+        // mixer over blocks up to the NCO block, decimating FIR over tap counts
+        // around the multiples of the SIMD width
+        std::complex<float> phasor(0.6f, -0.8f);
+        for (size_t n = 0; n <= 64; n++) {
+            std::vector<std::complex<float> > ref(history.begin(), history.begin() + n), out(ref);
+            scalar.mix_cf32(ref.data(), n, &history[n + 1], phasor);
+            simd.mix_cf32(out.data(), n, &history[n + 1], phasor);
+            if (memcmp(ref.data(), out.data(), n*sizeof(ref[0])) != 0) {
+                printf("Error: %s mixer kernel differs from scalar (n %lu).\n", isa[k], (unsigned long)n);
+                exact = false;
+            }
+            checked++;
+        }
+        for (uint32_t num_taps = 1; num_taps <= 40; num_taps++) {
+            for (uint32_t decimation = 1; decimation <= 3; decimation++) {
+                size_t n = std::min((size_t)50, (history.size() - num_taps)/decimation);
+                scalar.fir_cf32(&history[1], taps.data(), num_taps, decimation, n, ref32.data());
+                simd.fir_cf32(&history[1], taps.data(), num_taps, decimation, n, out32.data());
+                if (memcmp(ref32.data(), out32.data(), n*sizeof(ref32[0])) != 0) {
+                    printf("Error: %s FIR kernel differs from scalar (taps %u, decimation %u).\n",
+                        isa[k], num_taps, decimation);
+                    exact = false;
+                }
+                checked++;
+            }
+        }
+        // polyphase FIR over branch and tap counts, past a chunk and over
+        // several tiles of branches
+        for (uint32_t decimation = 1; decimation <= 40; decimation += (decimation < 5) ? 1 : 35) {
+            for (uint32_t taps_per_branch = 1; taps_per_branch <= 20; taps_per_branch++) {
+                size_t lengths[] = {1, 15, 17, VRT_POLYFIR_CHUNK + 44};
+                size_t stride = VRT_POLYFIR_CHUNK + 48 + taps_per_branch;
+                std::vector<std::complex<float> > branches(decimation*stride);
+                for (size_t i = 0; i < branches.size(); i++)
+                    branches[i] = history[i % history.size()];
+                for (size_t n : lengths) {
+                    scalar.polyfir_cf32(branches.data(), stride, &taps[1], decimation, taps_per_branch, n, ref32.data());
+                    simd.polyfir_cf32(branches.data(), stride, &taps[1], decimation, taps_per_branch, n, out32.data());
+                    if (memcmp(ref32.data(), out32.data(), n*sizeof(ref32[0])) != 0) {
+                        printf("Error: %s polyphase FIR kernel differs from scalar (decimation %u, taps %u, n %lu).\n",
+                            isa[k], decimation, taps_per_branch, (unsigned long)n);
+                        exact = false;
+                    }
+                    checked++;
+                }
+            }
+        }
+        printf("# %s kernels bit-exact with scalar: %s (%lu cases)\n", isa[k], exact ? "yes" : "no", (unsigned long)checked);
+        ok = ok and exact;
+    }
+
+    uint64_t packets = iterations/100 + 1;
+
+    printf("# Kernel benchmark (%lu packets of %u samples)\n", (unsigned long)packets, samples_per_packet);
+    printf("%-8s %-22s %14s %10s\n", "isa", "kernel", "Msamples/s", "ns/packet");
+
+    // a polyphase filterbank of 4 partitions over frames of one packet
+    std::vector<std::complex<float> > pfb_history(4*samples_per_packet, std::complex<float>(0.5f, -0.25f));
+    std::vector<float> pfb_taps(8*samples_per_packet, 0.7f);
+    const std::complex<float>* pfb_rows[4];
+    for (uint32_t p = 0; p < 4; p++)
+        pfb_rows[p] = &pfb_history[((p + 1) % 4)*samples_per_packet];
+
+    // the zoom low-pass decimating by 16 (256 taps), the mixer in NCO blocks
+    const uint32_t fir_decimation = 16;
+    const uint32_t fir_taps = VRT_ZOOM_TAPS_PER_DECIMATION*fir_decimation;
+    std::vector<float> fir_taps_w(2*fir_taps, 0.01f);
+    std::vector<std::complex<float> > mix_steps(VRT_NCO_BLOCK, std::complex<float>(0.6f, 0.8f));
+
+    for (uint32_t k = 0; k < sizeof(isa)/sizeof(isa[0]); k++) {
+        if (not vrt_kernels_set(isa[k]))
+            continue;
+        for (int mode = 0; mode < 7; mode++) {
+            const char* label[] = {"cf32", "cf32 alt+window+gain", "cf64 alt", "pfb cf32 (4 rows)", "pfb cf64 (4 rows)",
+                                   "mix cf32", "fir cf32 (256 taps/16)"};
+            int mult = 1;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t p = 0; p < packets; p++) {
+                if (mode == 0)
+                    vrt_convert_cf32(in.data(), out32.data(), samples_per_packet);
+                else if (mode == 1)
+                    vrt_convert_cf32(in.data(), out32.data(), samples_per_packet, &mult, window.data(), &gain32);
+                else if (mode == 2)
+                    vrt_convert_cf64(in.data(), out64.data(), samples_per_packet, &mult);
+                else if (mode == 3)
+                    vrt_pfb_sum_cf32(pfb_rows, pfb_taps.data(), 4, samples_per_packet, out32.data());
+                else if (mode == 4)
+                    vrt_pfb_sum_cf64(pfb_rows, pfb_taps.data(), 4, samples_per_packet, out64.data());
+                else if (mode == 5) {
+                    for (uint32_t i = 0; i < samples_per_packet; i += VRT_NCO_BLOCK)
+                        vrt_mix_cf32(&pfb_history[i], std::min((uint32_t)VRT_NCO_BLOCK, samples_per_packet - i),
+                            mix_steps.data(), std::complex<float>(0.6f, -0.8f));
+                } else {
+                    // samples_per_packet inputs, through 3 frames of history
+                    vrt_fir_cf32(pfb_history.data(), fir_taps_w.data(), fir_taps, fir_decimation,
+                        samples_per_packet/fir_decimation, out32.data());
+                }
+            }
+            auto stop = std::chrono::steady_clock::now();
+            double t = std::chrono::duration<double>(stop - start).count();
+            printf("%-8s %-22s %14.1f %10.1f\n", isa[k], label[mode], 1e-6*packets*samples_per_packet/t, 1e9*t/packets);
+        }
+    }
+
+    // the channelizer low-pass, 20 taps per decimation, in both forms
+    const uint32_t taps_per_decimation = 20;
+    printf("# Decimating FIR, %u taps per decimation, packets of %u samples\n", taps_per_decimation, samples_per_packet);
+    printf("%-8s %10s %20s %20s\n", "isa", "decimation", "direct Mout/s", "polyphase Mout/s");
+    for (uint32_t k = 0; k < sizeof(isa)/sizeof(isa[0]); k++) {
+        if (not vrt_kernels_set(isa[k]))
+            continue;
+        for (uint32_t decimation : {2, 10, 100, 1000}) {
+            uint32_t num_taps = taps_per_decimation*decimation;
+            std::vector<float> lowpass(num_taps);
+            vrt_fir_lowpass(lowpass.data(), num_taps, 0.5/decimation, 1);
+            std::vector<std::complex<float> > fir_out(samples_per_packet/decimation + 1);
+            double rate[2];
+            for (int form = 0; form < 2; form++) {
+                vrt_fir_type fir;
+                vrt_fir_init(&fir, decimation, num_taps, lowpass.data(), samples_per_packet);
+                if (fir.branch_taps == NULL)
+                    vrt_fir_polyphase(&fir, lowpass.data());
+                uint64_t outputs = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (uint64_t p = 0; p < packets; p++) {
+                    memcpy(vrt_fir_input(&fir, samples_per_packet), pfb_history.data(),
+                        samples_per_packet*sizeof(std::complex<float>));
+                    uint32_t n = vrt_fir_outputs(&fir);
+                    if (form == 0) {
+                        vrt_fir_cf32(&fir.x[fir.pos], fir.taps, num_taps, decimation, n, fir_out.data());
+                    } else {
+                        vrt_fir_branches(&fir, n);
+                        vrt_polyfir_cf32(fir.branches, fir.branch_stride, fir.branch_taps, decimation,
+                            fir.taps_per_branch, n, fir_out.data());
+                    }
+                    vrt_fir_consume(&fir, n);
+                    outputs += n;
+                }
+                auto stop = std::chrono::steady_clock::now();
+                rate[form] = 1e-6*outputs/std::chrono::duration<double>(stop - start).count();
+                vrt_fir_free(&fir);
+            }
+            printf("%-8s %10u %20.2f %20.2f\n", isa[k], decimation, rate[0], rate[1]);
+        }
+    }
+
+    // vrt_channelizer as one FIR (polyphase up to VRT_FIR_POLYPHASE), --multistage and --multistage --cic
+    printf("# Decimator, %u taps per decimation, packets of %u samples\n", taps_per_decimation, samples_per_packet);
+    printf("%-8s %10s %16s %16s %16s\n", "isa", "decimation", "single Msps", "multistage Msps", "cic Msps");
+    for (uint32_t k = 0; k < sizeof(isa)/sizeof(isa[0]); k++) {
+        if (not vrt_kernels_set(isa[k]))
+            continue;
+        for (uint32_t decimation : {10, 100, 1000}) {
+            std::vector<std::complex<float> > out(samples_per_packet + 1);
+            double rate[3];
+            for (int design = 0; design < 3; design++) {
+                vrt_decimator_type decimator;
+                vrt_decimator_init(&decimator, decimation, taps_per_decimation, design > 0, design > 1, samples_per_packet);
+                auto start = std::chrono::steady_clock::now();
+                for (uint64_t p = 0; p < packets; p++) {
+                    memcpy(vrt_decimator_input(&decimator, samples_per_packet), pfb_history.data(),
+                        samples_per_packet*sizeof(std::complex<float>));
+                    vrt_decimator_prepare(&decimator);
+                    vrt_decimator_run(&decimator, out.data());
+                }
+                auto stop = std::chrono::steady_clock::now();
+                rate[design] = 1e-6*packets*samples_per_packet/std::chrono::duration<double>(stop - start).count();
+                vrt_decimator_free(&decimator);
+            }
+            printf("%-8s %10u %16.1f %16.1f %16.1f\n", isa[k], decimation, rate[0], rate[1], rate[2]);
+        }
+    }
+
+    vrt_kernels() = vrt_kernels_default();
+    return ok;
+}
+
+// Build data packets by copying a sample array into a new message
+// (vrt_write_packet) and in place in pooled buffers (vrt_tx_finish). Both
+// must produce the same bytes.
+bool bench_tx(uint64_t iterations, uint32_t samples_per_packet) {
+
+    std::vector<std::complex<int16_t> > source(samples_per_packet), samples(samples_per_packet);
+    for (uint32_t i = 0; i < samples_per_packet; i++)
+        source[i] = std::complex<int16_t>((int16_t)(rand() & 0xFFFF), (int16_t)(rand() & 0xFFFF));
+
+    uint32_t packet_size = VRT_DATA_PACKET_SIZE_FOR(samples_per_packet);
+
+    struct vrt_packet p;
+    vrt_init_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
+    p.fields.stream_id = 1;
+    p.fields.integer_seconds_timestamp = 1700000000;
+    p.fields.fractional_seconds_timestamp = 123456789012ULL;
+
+    vrt_tx_pool_type* pool = vrt_tx_pool_create(samples_per_packet);
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
+
+    // reference packet
+    std::vector<uint32_t> reference(packet_size);
+    p.body = source.data();
+    vrt_write_packet(&p, reference.data(), packet_size, true);
+
+    vrt_tx_begin(pool, &tx);
+    memcpy(tx.samples, source.data(), samples_per_packet*sizeof(source[0]));
+    zmq_msg_t msg;
+    bool ok = vrt_tx_finish(&p, &tx, samples_per_packet, &msg) and zmq_msg_size(&msg) == packet_size*4 and
+        memcmp(zmq_msg_data(&msg), reference.data(), packet_size*4) == 0;
+    zmq_msg_close(&msg);
+    printf("# Packet builder output identical to vrt_write_packet: %s\n", ok ? "yes" : "no");
+
+    uint64_t packets = iterations/10 + 1;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < packets; n++) {
+        p.header.packet_count = n % 16;
+        memcpy(samples.data(), source.data(), samples_per_packet*sizeof(source[0]));
+        p.body = samples.data();
+        zmq_msg_t msg;
+        zmq_msg_init_size(&msg, packet_size*4);
+        vrt_write_packet(&p, zmq_msg_data(&msg), packet_size, true);
+        zmq_msg_close(&msg);
+    }
+    double t_copy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < packets; n++) {
+        p.header.packet_count = n % 16;
+        vrt_tx_begin(pool, &tx);
+        memcpy(tx.samples, source.data(), samples_per_packet*sizeof(source[0]));
+        zmq_msg_t msg;
+        vrt_tx_finish(&p, &tx, samples_per_packet, &msg);
+        zmq_msg_close(&msg);
+    }
+    double t_pool = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("# Packet build benchmark (%lu packets of %u samples, %lu buffers allocated)\n",
+        (unsigned long)packets, samples_per_packet, (unsigned long)pool->allocations);
+    printf("%-22s %14s %10s\n", "builder", "packets/s", "ns/packet");
+    printf("%-22s %14.0f %10.1f\n", "vrt_write_packet", packets/t_copy, 1e9*t_copy/packets);
+    printf("%-22s %14.0f %10.1f\n", "vrt_tx_finish", packets/t_pool, 1e9*t_pool/packets);
+
+    vrt_tx_pool_destroy(pool);
+    return ok;
+}
+
+template <typename parse_fn>
+double bench_parse(parse_fn parse, std::vector<std::vector<uint32_t> >& packets, uint64_t iterations, uint64_t* checksum) {
+
+    context_type vrt_context;
+    init_context(&vrt_context);
+
+    packet_type vrt_packet;
+    vrt_packet.channel_filt = 1;
+    vrt_packet.first_frame = true;
+
+    uint64_t sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < iterations; n++) {
+        std::vector<uint32_t>& packet = packets[n % BENCH_PACKETS];
+        if (not parse(packet.data(), packet.size(), &vrt_context, &vrt_packet)) {
+            printf("Not a Vita49 packet?\n");
+            exit(1);
+        }
+        sum += vrt_packet.num_rx_samps + vrt_packet.offset + vrt_packet.fractional_seconds_timestamp
+             + vrt_packet.integer_seconds_timestamp + vrt_packet.lost_frame;
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    *checksum = sum;
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+// End-to-end stream benchmark. Synthetic data packets are published on an
+// XPUB socket with ZMQ_XPUB_NODROP, so a send that would exceed the HWM
+// fails instead of being dropped silently: a blocked send means the client
+// does not keep up. The first sample of every packet carries a sequence
+// number, which the in-process sink uses to look up the send time. With
+// --shm the packets are also published in shared memory, which the
+// in-process sink then reads instead; its losses show up as overruns.
+
+struct bench_stream_type {
+    std::string signal;
+    uint32_t channels;
+    uint32_t samples_per_packet;
+    double step_time;
+    // payloads per channel
+    std::vector<std::vector<std::complex<int16_t> > > payloads;
+    std::vector<std::atomic<int64_t> > sent_ns;
+    uint32_t seq;
+    uint32_t frame_count;
+    vrt_shm_writer_type* shm;    // NULL: ZMQ only
+
+    bench_stream_type() : sent_ns(BENCH_LATENCY_SLOTS) {}
+};
+
+struct bench_step_type {
+    double target;           // samples/s per channel, 0 for as fast as possible
+    double achieved;         // samples/s per channel
+    uint64_t sent;
+    uint64_t blocked;
+    uint64_t overruns;
+    double cpu;              // percent of one core, negative if unknown
+    std::vector<double> latencies;   // us
+};
+
+int64_t bench_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time of the calling thread and of the process, in seconds
+double bench_thread_cpu() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+double bench_process_cpu() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + 1e-6*usage.ru_utime.tv_usec + usage.ru_stime.tv_sec + 1e-6*usage.ru_stime.tv_usec;
+}
+
+void make_stream_payloads(bench_stream_type* stream) {
+
+    std::mt19937 generator(1);
+    std::normal_distribution<double> noise(0, 3000);
+
+    stream->payloads.resize(stream->channels*BENCH_PACKETS);
+    for (uint32_t ch = 0; ch < stream->channels; ch++) {
+        for (uint32_t n = 0; n < BENCH_PACKETS; n++) {
+            std::vector<std::complex<int16_t> >& payload = stream->payloads[ch*BENCH_PACKETS+n];
+            payload.resize(stream->samples_per_packet);
+            for (uint32_t i = 0; i < stream->samples_per_packet; i++) {
+                if (stream->signal == "noise") {
+                    payload[i] = std::complex<int16_t>(noise(generator), noise(generator));
+                } else {
+                    // one tone per channel, continuous over the packet cycle
+                    double phase = 2*M_PI*0.01*(ch+1)*(double)(n*stream->samples_per_packet+i);
+                    payload[i] = std::complex<int16_t>(10000*cos(phase), 10000*sin(phase));
+                }
+            }
+        }
+    }
+}
+
+void send_stream_context(void* socket, bench_stream_type* stream, double sample_rate) {
+
+    struct vrt_packet pc;
+    vrt_init_packet(&pc);
+    vrt_init_context_packet(&pc);
+
+    uint32_t buffer[ZMQ_BUFFER_SIZE];
+
+    for (uint32_t ch = 0; ch < stream->channels; ch++) {
+        pc.fields.stream_id = 1<<ch;
+        pc.if_context.bandwidth = 0.8*sample_rate;
+        pc.if_context.sample_rate = sample_rate;
+        pc.if_context.rf_reference_frequency = 100e6;
+        pc.if_context.rf_reference_frequency_offset = 0;
+        pc.if_context.if_reference_frequency = 0;
+        pc.if_context.if_band_offset = 0;
+        pc.if_context.gain.stage1 = 0;
+        pc.if_context.gain.stage2 = 0;
+        pc.if_context.state_and_event_indicators.reference_lock = false;
+        pc.if_context.state_and_event_indicators.calibrated_time = false;
+
+        int32_t rv = vrt_write_packet(&pc, buffer, ZMQ_BUFFER_SIZE, true);
+        if (rv < 0) {
+            fprintf(stderr, "Failed to write context packet: %s\n", vrt_string_error(rv));
+            continue;
+        }
+        zmq_send(socket, buffer, rv*4, ZMQ_DONTWAIT);
+        if (stream->shm)
+            vrt_shm_publish(stream->shm, buffer, rv*4);
+    }
+}
+
+// Publish for step_time seconds at step->target samples/s per channel
+void run_stream_step(void* socket, bench_stream_type* stream, vrt_tx_pool_type* pool, bench_step_type* step) {
+
+    struct vrt_packet p;
+    vrt_init_packet(&p);
+    vrt_init_data_packet(&p, stream->samples_per_packet);
+
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
+
+    // as fast as possible: block in the send instead of counting it as lost
+    int flags = (step->target > 0) ? ZMQ_DONTWAIT : 0;
+    double packet_time_ns = (step->target > 0) ? 1e9*stream->samples_per_packet/step->target : 0;
+
+    step->sent = 0;
+    step->blocked = 0;
+
+    int64_t start = bench_now_ns();
+    int64_t stop = start + (int64_t)(1e9*stream->step_time);
+    int64_t last_context = 0;
+    uint64_t frames = 0;
+    uint64_t timestamp_samples = 0;
+
+    while (not stop_signal_called) {
+
+        int64_t now = bench_now_ns();
+        if (now >= stop)
+            break;
+
+        if (now - last_context > 1000000LL*VRT_CONTEXT_INTERVAL) {
+            send_stream_context(socket, stream, step->target > 0 ? step->target : 1e6);
+            last_context = now;
+        }
+
+        if (step->target > 0) {
+            int64_t due = start + (int64_t)(frames*packet_time_ns);
+            if (due > now) {
+                if (due - now > 200000)
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(due - now - 100000));
+                else
+                    std::this_thread::yield();
+                continue;
+            }
+        }
+
+        double timestamp = 1700000000.0 + (step->target > 0 ? timestamp_samples/step->target : 0);
+        p.fields.integer_seconds_timestamp = (uint32_t)timestamp;
+        p.fields.fractional_seconds_timestamp = (uint64_t)(1e12*(timestamp - (uint32_t)timestamp));
+        p.header.packet_count = (uint8_t)stream->frame_count%16;
+
+        for (uint32_t ch = 0; ch < stream->channels; ch++) {
+            VRT_TRACE_SCOPE("publish");
+            const std::vector<std::complex<int16_t> >& payload = stream->payloads[ch*BENCH_PACKETS + stream->frame_count%BENCH_PACKETS];
+
+            vrt_tx_begin(pool, &tx);
+            memcpy(tx.samples, payload.data(), stream->samples_per_packet*sizeof(payload[0]));
+            tx.samples[0] = std::complex<int16_t>((int16_t)(stream->seq & 0xFFFF), (int16_t)(stream->seq >> 16));
+            p.fields.stream_id = 1<<ch;
+
+            zmq_msg_t msg;
+            if (not vrt_tx_finish(&p, &tx, stream->samples_per_packet, &msg))
+                continue;
+            stream->sent_ns[stream->seq % BENCH_LATENCY_SLOTS].store(bench_now_ns(), std::memory_order_release);
+            if (stream->shm)
+                vrt_shm_publish(stream->shm, &msg);
+            if (zmq_msg_send(&msg, socket, flags) < 0) {
+                step->blocked++;
+            } else {
+                step->sent++;
+                stream->seq++;
+            }
+            zmq_msg_close(&msg);
+        }
+
+        stream->frame_count++;
+        timestamp_samples += stream->samples_per_packet;
+        frames++;
+    }
+
+    vrt_tx_abort(&tx);
+
+    double elapsed = 1e-9*(bench_now_ns() - start);
+    step->achieved = (double)step->sent*stream->samples_per_packet/stream->channels/elapsed;
+}
+
+// In-process sink, the receive path of the tools: receiver thread and ring,
+// vrt_dispatch() to a handler per channel and optionally conversion to cf32.
+struct bench_sink_type {
+    bool convert;
+    vrt_receiver_type receiver;
+    vrt_streams_type streams;
+    bench_stream_type* stream;
+    std::vector<std::complex<float> > out;
+    std::atomic<bool> stop;
+    std::mutex lock;
+    std::vector<double> latencies;
+    std::thread thread;
+};
+
+void bench_sink_packet(vrt_stream_type*, uint32_t* buffer, packet_type* vrt_packet, void* arg) {
+
+    bench_sink_type* sink = (bench_sink_type*)arg;
+
+    if (not vrt_packet->data)
+        return;
+
+    const std::complex<int16_t>* samples = vrt_samples(buffer, vrt_packet);
+    uint32_t seq = (uint16_t)samples[0].real() | ((uint32_t)(uint16_t)samples[0].imag() << 16);
+
+    if (sink->convert) {
+        VRT_TRACE_SCOPE("convert");
+        if (sink->out.size() < vrt_packet->num_rx_samps)
+            sink->out.resize(vrt_packet->num_rx_samps);
+        vrt_convert_cf32(samples, sink->out.data(), vrt_packet->num_rx_samps);
+    }
+
+    int64_t sent = sink->stream->sent_ns[seq % BENCH_LATENCY_SLOTS].load(std::memory_order_acquire);
+    double latency = 1e-3*(bench_now_ns() - sent);
+
+    std::lock_guard<std::mutex> guard(sink->lock);
+    sink->latencies.push_back(latency);
+}
+
+void bench_sink_loop(bench_sink_type* sink) {
+
+    packet_type vrt_packet;
+    vrt_packet.channel_filt = 0xFFFFFFFF;
+
+    VRT_TRACE_THREAD("sink");
+
+    while (not sink->stop.load(std::memory_order_relaxed)) {
+
+        vrt_msg_type* vrt_msg;
+        if (vrt_receiver_recv(&sink->receiver, &vrt_msg) < 0)
+            continue;
+
+        vrt_dispatch(vrt_msg->buffer, vrt_msg->words, &sink->streams, &vrt_packet);
+    }
+}
+
+// External client tool, started through the shell with its output captured
+struct bench_client_type {
+    pid_t pid;
+    int fd;
+    std::string output;
+    std::mutex lock;
+    std::thread reader;
+};
+
+void bench_client_read(bench_client_type* client) {
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(client->fd, chunk, sizeof(chunk))) > 0) {
+        std::lock_guard<std::mutex> guard(client->lock);
+        client->output.append(chunk, n);
+    }
+}
+
+bool bench_client_start(bench_client_type* client, const std::string& command) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    client->pid = fork();
+    if (client->pid < 0)
+        return false;
+    if (client->pid == 0) {
+        dup2(fds[1], 1);
+        dup2(fds[1], 2);
+        close(fds[0]);
+        close(fds[1]);
+        std::string exec_command = "exec " + command;
+        execl("/bin/sh", "sh", "-c", exec_command.c_str(), (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    client->fd = fds[0];
+    client->reader = std::thread(bench_client_read, client);
+    return true;
+}
+
+bool bench_client_running(bench_client_type* client) {
+    int status;
+    return waitpid(client->pid, &status, WNOHANG) == 0;
+}
+
+// CPU time used by the client in seconds, negative if unknown
+double bench_client_cpu(bench_client_type* client) {
+#ifdef __linux__
+    std::string path = "/proc/" + std::to_string(client->pid) + "/stat";
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return -1;
+    char stat[1024];
+    size_t n = fread(stat, 1, sizeof(stat)-1, f);
+    fclose(f);
+    stat[n] = 0;
+    // fields after the command name, utime and stime are fields 14 and 15
+    const char* fields = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (fields == NULL or sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+    return (double)(utime + stime)/sysconf(_SC_CLK_TCK);
+#else
+    return -1;
+#endif
+}
+
+// Interrupt the client like Ctrl-C, so it prints its statistics. Returns
+// the overruns reported by its receiver thread, or -1.
+int64_t bench_client_stop(bench_client_type* client) {
+    kill(client->pid, SIGINT);
+    for (int i = 0; i < 200 and bench_client_running(client); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (bench_client_running(client))
+        kill(client->pid, SIGKILL);
+    waitpid(client->pid, NULL, 0);
+    client->reader.join();
+    close(client->fd);
+
+    int64_t overruns = -1;
+    std::string line;
+    std::istringstream lines(client->output);
+    while (std::getline(lines, line)) {
+        unsigned long packets, dropped;
+        if (sscanf(line.c_str(), "# Receiver: %lu packets, %lu overruns", &packets, &dropped) == 2)
+            overruns = dropped;
+    }
+    return overruns;
+}
+
+void print_stream_step(bench_step_type* step) {
+    std::vector<double>& l = step->latencies;
+    std::sort(l.begin(), l.end());
+
+    if (step->target > 0)
+        printf("%12.3f", 1e-6*step->target);
+    else
+        printf("%12s", "max");
+    printf(" %14.3f %9lu %9lu", 1e-6*step->achieved, (unsigned long)step->blocked, (unsigned long)step->overruns);
+    if (step->cpu >= 0)
+        printf(" %8.1f", step->cpu);
+    else
+        printf(" %8s", "-");
+    if (l.empty()) {
+        printf(" %9s %9s %9s %9s\n", "-", "-", "-", "-");
+    } else {
+        printf(" %9.1f %9.1f %9.1f %9.1f\n",
+            l[l.size()/2], l[(size_t)(0.99*(l.size()-1))], l[(size_t)(0.999*(l.size()-1))], l.back());
+    }
+    fflush(stdout);
+}
+
+// Ramp the rate from start_rate by rate_step until packets are lost, the
+// client exits or max_rate is reached. Rates in samples/s per channel, a
+// start_rate of 0 runs one step as fast as possible.
+bool bench_stream(bench_stream_type* stream, const std::string& client_command, const std::string& sink_type,
+    const std::string& bind, int hwm, double start_rate, double rate_step, double max_rate, bool shm) {
+
+    make_stream_payloads(stream);
+    stream->seq = 0;
+    stream->frame_count = 0;
+
+    void* context = zmq_ctx_new();
+    void* publisher = zmq_socket(context, ZMQ_XPUB);
+    int nodrop = 1;
+    zmq_setsockopt(publisher, ZMQ_SNDHWM, &hwm, sizeof hwm);
+    zmq_setsockopt(publisher, ZMQ_XPUB_NODROP, &nodrop, sizeof nodrop);
+    // a blocking send (as fast as possible) gives up if the client is gone
+    int timeout = 1000;
+    zmq_setsockopt(publisher, ZMQ_SNDTIMEO, &timeout, sizeof timeout);
+
+    bool external = not client_command.empty();
+    std::string endpoint = external ? bind : "inproc://vrt_bench";
+    if (zmq_bind(publisher, endpoint.c_str()) != 0) {
+        printf("Failed to bind %s: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
+        return false;
+    }
+
+    // shared memory is named after the port of the bind endpoint
+    stream->shm = NULL;
+    vrt_shm_reader_type* shm_reader = NULL;
+    if (shm) {
+        size_t colon = bind.rfind(':');
+        uint16_t port = (colon != std::string::npos) ? atoi(bind.c_str() + colon + 1) : DEFAULT_MAIN_PORT;
+        stream->shm = vrt_shm_create(port, stream->samples_per_packet);
+        if (stream->shm == NULL)
+            return false;
+        if (not external and (shm_reader = vrt_shm_attach(port)) == NULL)
+            return false;
+    }
+
+    bench_client_type client;
+    bench_sink_type sink;
+    void* subscriber = NULL;
+
+    if (external) {
+        if (not bench_client_start(&client, client_command)) {
+            printf("Failed to start client.\n");
+            return false;
+        }
+    } else {
+        if (not shm) {
+            subscriber = zmq_socket(context, ZMQ_SUB);
+            zmq_setsockopt(subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
+            zmq_connect(subscriber, endpoint.c_str());
+            zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+        }
+        sink.convert = (sink_type == "convert");
+        sink.stream = stream;
+        sink.stop = false;
+        init_streams(&sink.streams);
+        for (uint32_t ch = 0; ch < stream->channels; ch++)
+            vrt_stream_add(&sink.streams, 1<<ch, bench_sink_packet, &sink);
+        vrt_receiver_start(&sink.receiver, subscriber, NULL, NULL, shm_reader);
+        sink.thread = std::thread(bench_sink_loop, &sink);
+    }
+
+    // wait for the subscription, clients of the shared memory do not subscribe
+    zmq_pollitem_t items[] = { { publisher, 0, ZMQ_POLLIN, 0 } };
+    if (shm) {
+        if (external)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+    } else if (zmq_poll(items, 1, 10000) <= 0) {
+        printf("No subscriber within 10 s.\n");
+        stop_signal_called = true;
+    } else {
+        char subscription[256];
+        zmq_recv(publisher, subscription, sizeof(subscription), ZMQ_DONTWAIT);
+        // give a client time to start up
+        if (external)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    vrt_tx_pool_type* pool = vrt_tx_pool_create(stream->samples_per_packet);
+
+    printf("# Stream benchmark: %s, %u channel(s), %s, %u samples per packet, %.1f s per step\n",
+        external ? ("client '" + client_command + "'").c_str() : ("in-process sink '" + sink_type + "'").c_str(),
+        stream->channels, stream->signal.c_str(), stream->samples_per_packet, stream->step_time);
+    printf("%12s %14s %9s %9s %8s %9s %9s %9s %9s\n",
+        "rate(Msps)", "achieved(Msps)", "blocked", "overruns", "cpu(%)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+
+    double best = 0;
+    bool client_exited = false;
+    bool publisher_limited = false;
+    uint64_t overruns_before = 0;
+
+    for (double rate = start_rate; not stop_signal_called; rate *= rate_step) {
+
+        if (rate > max_rate)
+            break;
+
+        bench_step_type step;
+        step.target = rate;
+
+        double cpu_start = external ? bench_client_cpu(&client) : bench_process_cpu() - bench_thread_cpu();
+        auto start = std::chrono::steady_clock::now();
+
+        run_stream_step(publisher, stream, pool, &step);
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double cpu_stop = external ? bench_client_cpu(&client) : bench_process_cpu() - bench_thread_cpu();
+        step.cpu = (cpu_start >= 0 and cpu_stop >= 0) ? 100*(cpu_stop - cpu_start)/elapsed : -1;
+
+        if (external) {
+            // the receiver statistics of a client are only known when it exits
+            step.overruns = 0;
+            client_exited = not bench_client_running(&client);
+        } else {
+            uint64_t overruns = sink.receiver.overruns.load();
+            step.overruns = overruns - overruns_before;
+            overruns_before = overruns;
+            std::lock_guard<std::mutex> guard(sink.lock);
+            step.latencies.swap(sink.latencies);
+        }
+
+        print_stream_step(&step);
+
+        bool lossless = step.blocked == 0 and step.overruns == 0 and not client_exited;
+        if (not lossless or rate == 0) {
+            if (rate == 0 and lossless)
+                best = step.achieved;
+            break;
+        }
+        if (step.achieved < 0.98*rate) {
+            publisher_limited = true;
+            break;
+        }
+        best = rate;
+    }
+
+    int64_t client_overruns = -1;
+    if (external) {
+        client_overruns = bench_client_stop(&client);
+        if (client_exited) {
+            printf("# Client exited during the run, last output:\n");
+            size_t tail = client.output.size() > 1000 ? client.output.size() - 1000 : 0;
+            printf("%s\n", client.output.substr(tail).c_str());
+        }
+        if (client_overruns >= 0)
+            printf("# Client receiver overruns over the whole run: %li\n", (long)client_overruns);
+        if (client_overruns > 0)
+            printf("# Client dropped packets internally, the rates above are upper bounds.\n");
+    } else {
+        sink.stop = true;
+        sink.thread.join();
+        vrt_receiver_stop(&sink.receiver);
+        vrt_print_receiver_stats(&sink.receiver);
+        vrt_print_stream_stats(&sink.streams);
+        vrt_shm_detach(shm_reader);
+        if (subscriber)
+            zmq_close(subscriber);
+    }
+
+    if (publisher_limited)
+        printf("# Publisher could not reach the target rate, the client sustains at least the last rate.\n");
+    printf("# Maximum lossless rate: %.3f Msps per channel (%.3f Msps total)\n", 1e-6*best, 1e-6*best*stream->channels);
+
+    int linger = 0;
+    zmq_setsockopt(publisher, ZMQ_LINGER, &linger, sizeof linger);
+    zmq_close(publisher);
+    zmq_ctx_destroy(context);
+    vrt_tx_pool_destroy(pool);
+    vrt_shm_destroy(stream->shm);
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // variables to be set by po
+    uint64_t iterations;
+    uint32_t samples_per_packet, channels;
+    std::string client, sink, bind, signal, trace_file;
+    double rate, rate_step, max_rate, step_time;
+    int hwm;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+
+    desc.add_options()
+        ("help", "help message")
+        ("parse", "benchmark VRT packet parsing (vrt_process)")
+        ("kernels", "verify and benchmark the sample conversion, PFB, mixer and FIR kernels")
+        ("tx", "verify and benchmark building data packets in pooled messages")
+        ("iterations", po::value<uint64_t>(&iterations)->default_value(10000000), "number of packets per benchmark")
+        ("samples-per-packet", po::value<uint32_t>(&samples_per_packet)->default_value(VRT_SAMPLES_PER_PACKET), "samples per VRT data packet")
+        ("stream", "end-to-end benchmark: publish a synthetic stream and ramp its rate until the client loses packets")
+        ("client", po::value<std::string>(&client), "client tool command to attach to the stream, e.g. \"vrt_to_void --hwm 100\" (default: in-process sink)")
+        ("sink", po::value<std::string>(&sink)->default_value("void"), "in-process sink: void (parse only) or convert (parse and convert to cf32)")
+        ("bind", po::value<std::string>(&bind)->default_value("tcp://*:" + std::to_string(DEFAULT_MAIN_PORT)), "endpoint the stream is published on for --client")
+        ("signal", po::value<std::string>(&signal)->default_value("tone"), "synthetic signal: tone or noise")
+        ("channels", po::value<uint32_t>(&channels)->default_value(1), "number of channels (stream IDs 1, 2, 4, ...)")
+        ("rate", po::value<double>(&rate)->default_value(1), "start sample rate per channel in Msps, 0 for as fast as possible")
+        ("rate-step", po::value<double>(&rate_step)->default_value(2), "rate factor between steps")
+        ("max-rate", po::value<double>(&max_rate)->default_value(1000), "maximum sample rate per channel in Msps")
+        ("step-time", po::value<double>(&step_time)->default_value(2), "duration of each rate step in seconds")
+        ("hwm", po::value<int>(&hwm)->default_value(100), "ZMQ HWM of the benchmark stream")
+        ("shm", "also publish the stream in shared memory, read by the in-process sink")
+        ("trace", po::value<std::string>(&trace_file), "write a Chrome trace of the stream benchmark to this file (build with VRT_TRACE)")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help")) {
+        std::cout << boost::format("VRT benchmarks. %s") % desc << std::endl;
+        std::cout << std::endl
+                  << "This application measures the throughput of the VRT tools.\n"
+                  << std::endl;
+        return ~0;
+    }
+
+    bool parse = vm.count("parse") > 0;
+    bool kernels = vm.count("kernels") > 0;
+    bool tx = vm.count("tx") > 0;
+    bool stream = vm.count("stream") > 0;
+
+    if (not parse and not kernels and not tx and not stream) {
+        std::cout << "No benchmark selected, see --help." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (not vrt_check_samples_per_packet(samples_per_packet))
+        return EXIT_FAILURE;
+
+    if (parse) {
+        std::vector<std::vector<uint32_t> > packets;
+        make_data_packets(packets, samples_per_packet);
+
+        uint64_t sum_generic, sum_fixed, sum_auto;
+
+        double t_generic = bench_parse(vrt_process_generic, packets, iterations, &sum_generic);
+        double t_fixed = bench_parse(vrt_process_fixed<vrt_data_layout>, packets, iterations, &sum_fixed);
+        double t_auto = bench_parse(vrt_process, packets, iterations, &sum_auto);
+
+        if (sum_generic != sum_fixed or sum_generic != sum_auto) {
+            printf("Error: fast path and generic parser disagree.\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("# Parse benchmark (%lu packets of %u samples)\n", (unsigned long)iterations, samples_per_packet);
+        printf("%-22s %14s %10s\n", "parser", "packets/s", "ns/packet");
+        printf("%-22s %14.0f %10.1f\n", "vrt_process_generic", iterations/t_generic, 1e9*t_generic/iterations);
+        printf("%-22s %14.0f %10.1f\n", "vrt_process_fixed", iterations/t_fixed, 1e9*t_fixed/iterations);
+        printf("%-22s %14.0f %10.1f\n", "vrt_process", iterations/t_auto, 1e9*t_auto/iterations);
+        printf("# Speedup: %.1fx\n", t_generic/t_auto);
+    }
+
+    if (kernels) {
+        if (not bench_kernels(iterations, samples_per_packet))
+            return EXIT_FAILURE;
+    }
+
+    if (tx) {
+        if (not bench_tx(iterations, samples_per_packet))
+            return EXIT_FAILURE;
+    }
+
+    if (stream) {
+        if (channels < 1 or channels > 32 or rate < 0 or rate_step <= 1) {
+            printf("Channels need to be between 1 and 32, the rate step larger than 1.\n");
+            return EXIT_FAILURE;
+        }
+        if (signal != "tone" and signal != "noise") {
+            printf("Unknown signal %s.\n", signal.c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::signal(SIGINT, &sig_int_handler);
+        // a client that exits closes the pipe
+        std::signal(SIGPIPE, SIG_IGN);
+
+        bench_stream_type settings;
+        settings.signal = signal;
+        settings.channels = channels;
+        settings.samples_per_packet = samples_per_packet;
+        settings.step_time = step_time;
+
+        if (vm.count("trace")) {
+            vrt_trace_start(trace_file);
+            VRT_TRACE_THREAD("publisher");
+        }
+
+        bool ok = bench_stream(&settings, client, sink, bind, hwm, 1e6*rate, rate_step, 1e6*max_rate, vm.count("shm") > 0);
+        vrt_trace_stop();
+        if (not ok)
+            return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -33,6 +33,10 @@
 #include <complex>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
+#include "vrt-channelizer.h"
+#include "vrt-targets.h"
 #include "tracker-extended-context.h"
 
 const double pi = std::acos(-1.0);
@@ -61,37 +65,71 @@ inline float get_abs_val(std::complex<int8_t> t)
     return std::fabs(t.real());
 }
 
+// Stages of the decimator and their cost per input sample, against one FIR
+// of taps_per_decimation taps per unit of decimation
+void print_stages(const vrt_decimator_type* d, uint32_t taps_per_decimation)
+{
+    double multiply_adds = 0;
+    for (uint32_t s = 0; s < d->num_stages; s++) {
+        const vrt_stage_type* stage = &d->stages[s];
+        if (stage->kind == VRT_STAGE_CIC)
+            printf("# Stage %u: %s of order %u, decimation %u, %.2f additions/sample\n", s,
+                vrt_stage_name(stage->kind), stage->num_taps, stage->decimation, stage->additions);
+        else if (stage->kind == VRT_STAGE_RESAMPLER or stage->kind == VRT_STAGE_FARROW)
+            printf("# Stage %u: %s %u/%u of %u taps per phase, %.2f multiply-adds/sample\n", s,
+                vrt_stage_name(stage->kind), stage->interpolation, stage->decimation, stage->num_taps,
+                stage->multiply_adds);
+        else
+            printf("# Stage %u: %s of %u taps, decimation %u, %.2f multiply-adds/sample\n", s,
+                vrt_stage_name(stage->kind), stage->num_taps, stage->decimation, stage->multiply_adds);
+        multiply_adds += stage->multiply_adds;
+    }
+    printf("# Decimation %u: %.2f multiply-adds/sample (single stage: %u)\n", d->decimation, multiply_adds,
+        taps_per_decimation);
+}
+
+// Output stream of a sub-channel of the filterbank (--pfb)
+struct pfb_output_type {
+    int32_t channel;             // 0 at the center frequency
+    uint32_t bin;                // FFT bin of the channel
+    uint32_t stream_id;
+    void* responder;
+    vrt_tx_packet_type tx;
+};
+
 int main(int argc, char* argv[])
 {
 
     // variables to be set by po
-    std::string file, type, zmq_address;
+    std::string file, type, zmq_address, bind_address, pfb_channel_list;
+    std::vector<std::string> target_specs;
+    uint32_t target_threads;
     uint16_t pub_instance, instance, main_port, port, pub_port;
-    uint32_t channel;
+    uint32_t channel, samples_per_packet;
     int hwm;
+    vrt_rt_type rt;
+    uint16_t metrics_port;
+    std::string metrics_address;
     float freq_offset, bandwidth, doppler_rate;
     double frequency;
+    double rate;
     size_t num_requested_samples;
     double total_time;
 
     uint32_t decimation;
     uint32_t taps_per_decimation;
-    uint32_t num_taps;
-    double *taps;
-    float **poly_taps;
+    // resampling by interpolation/resample_decimation after the decimation (--rate)
+    uint64_t interpolation = 1;
+    uint64_t resample_decimation = 1;
+    double output_rate = 0;
 
     std::complex<double> f0;
     std::complex<double> alpha;
     std::complex<double> alpha_dop;
-    std::complex<float>  alpha2;
     std::complex<double> step;
     std::complex<double> step_dop;
     float polyfir_channel;
 
-    std::complex<float>*x;
-    std::complex<float>*y;
-    std::complex<float>*tmp_acc;
-
     // setup the program options
     po::options_description desc("Allowed options");
     // clang-format off
@@ -106,22 +144,39 @@ int main(int argc, char* argv[])
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
         ("channel-mode", "use frequency/offset to select channel")
+        ("pfb", "split the band into --decimation channels with a polyphase filterbank and an FFT, each published as its own stream")
+        ("oversample", "with --pfb, sample the channels at twice the channel spacing")
+        ("pfb-channels", po::value<std::string>(&pfb_channel_list), "with --pfb, channels to publish, e.g. \"-2,0,3\" (0 at the center frequency, default all)")
         ("tracking", "use VRT tracking data")
+        ("target", po::value<std::vector<std::string>>(&target_specs), "channel of a target, repeat for each: comma separated frequency, offset, bandwidth, doppler, tracking[=object] and port, e.g. \"frequency=437.8e6,bandwidth=25e3\" (default port --pub-port + n)")
+        ("target-threads", po::value<uint32_t>(&target_threads)->default_value(0), "with --target, run the targets on this many worker threads (0: on the processing thread)")
         ("decimation", po::value<uint32_t>(&decimation)->default_value(2), "decimation factor")
         ("taps-per-decimation", po::value<uint32_t>(&taps_per_decimation)->default_value(20), "taps per decimation")
+        ("multistage", "decimate in stages, half-band filters while the decimation is even, then the channel filter")
+        ("cic", "with --multistage, start with a CIC decimator and its compensation filter")
+        ("rate", po::value<double>(&rate)->default_value(0), "output sample rate in whole samples/s, resampled if it is not the sample rate over an integer decimation (default: by --bandwidth or --decimation)")
+        ("farrow", "resample with a Farrow stage between the filter phases, also used when the exact ratio needs too many phases")
         ("bandwidth", po::value<float>(&bandwidth)->default_value(0), "bandwidth")
         ("doppler", po::value<float>(&doppler_rate)->default_value(0), "doppler rate in Hz/s")
         ("freq-offset", po::value<float>(&freq_offset)->default_value(0), "frequency offset")
         ("frequency", po::value<double>(&frequency)->default_value(0), "center frequency")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
+        ("shm", "read the stream from shared memory, from a producer on this host started with --shm")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("pub-port", po::value<uint16_t>(&pub_port), "VRT ZMQ PUB port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
         ("pub-instance", po::value<uint16_t>(&pub_instance)->default_value(1), "VRT ZMQ instance")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("metrics-port", po::value<uint16_t>(&metrics_port)->default_value(0), "serve Prometheus metrics on this HTTP port (0: off)")
+        ("metrics-address", po::value<std::string>(&metrics_address)->default_value("127.0.0.1"), "interface to serve metrics on, * for all")
+        ("samples-per-packet", po::value<uint32_t>(&samples_per_packet)->default_value(VRT_SAMPLES_PER_PACKET), "samples per outgoing VRT data packet")
     ;
     // clang-format on
+    vrt_fft_options(desc);
+    init_rt(&rt);
+    vrt_rt_options(desc, &rt, 1<<VRT_RT_RX | 1<<VRT_RT_DSP | 1<<VRT_RT_IO);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -141,12 +196,70 @@ int main(int argc, char* argv[])
     bool continue_on_bad_packet = vm.count("continue") > 0;
     bool int_second             = (bool)vm.count("int-second");
     bool zmq_split              = vm.count("zmq-split") > 0;
+    bool multistage             = vm.count("multistage") > 0;
+    bool cic                    = vm.count("cic") > 0;
+    bool farrow                 = vm.count("farrow") > 0;
+    bool shm                    = vm.count("shm") > 0;
     bool channel_mode           = vm.count("channel-mode") > 0;
     bool tracking               = vm.count("tracking") > 0;
+    bool pfb                    = vm.count("pfb") > 0;
+    bool oversample             = vm.count("oversample") > 0;
+
+    if (not vrt_check_samples_per_packet(samples_per_packet))
+        return EXIT_FAILURE;
+
+    if (pfb and channel_mode) {
+        fprintf(stderr, "--pfb and --channel-mode can not be combined.\n");
+        return 1;
+    }
+    if ((oversample or vm.count("pfb-channels")) and not pfb) {
+        fprintf(stderr, "--oversample and --pfb-channels need --pfb.\n");
+        return 1;
+    }
+    if (cic and not multistage) {
+        fprintf(stderr, "--cic needs --multistage.\n");
+        return 1;
+    }
+    if (multistage and pfb) {
+        fprintf(stderr, "--multistage and --pfb can not be combined.\n");
+        return 1;
+    }
+    if (rate != 0 and rate < 1) {
+        fprintf(stderr, "--rate needs to be at least 1 sample/s.\n");
+        return 1;
+    }
+    if (rate != floor(rate)) {
+        fprintf(stderr, "--rate needs to be a whole number of samples/s.\n");
+        return 1;
+    }
+    if (rate > 0 and (pfb or not target_specs.empty())) {
+        fprintf(stderr, "--rate can not be combined with --pfb or --target (use the bandwidth of the target).\n");
+        return 1;
+    }
+
+    // channels of the targets (--target), each on its own port
+    std::vector<vrt_target_type> targets(target_specs.size());
+    for (size_t t = 0; t < target_specs.size(); t++) {
+        if (not vrt_target_parse(target_specs[t], &targets[t]))
+            return 1;
+    }
+    if (not targets.empty() and (pfb or channel_mode or tracking or frequency != 0 or freq_offset != 0
+        or doppler_rate != 0)) {
+        fprintf(stderr, "--target can not be combined with --pfb, --channel-mode, --tracking, --frequency, --freq-offset or --doppler.\n");
+        return 1;
+    }
+    bool track_targets = false;
+    for (const vrt_target_type& target : targets)
+        track_targets = track_targets or target.tracking;
+
+    if (pfb and not vrt_fft_planner_init())
+        return 1;
 
     context_type vrt_context;
     init_context(&vrt_context);
     tracker_ext_context_type tracker_ext_context;
+    // latest tracking data of the object of each target
+    std::vector<tracker_ext_context_type> target_trackers(targets.size());
 
     packet_type vrt_packet;
 
@@ -169,25 +282,41 @@ int main(int argc, char* argv[])
 
     // ZMQ
     void *context = zmq_ctx_new();
+    if (not vrt_rt_apply(&rt, context))
+        return 1;
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
-    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    vrt_shm_reader_type* shm_reader = NULL;
+    if (shm) {
+        shm_reader = vrt_shm_attach(main_port);
+        if (shm_reader == NULL)
+            return 1;
+    } else {
+        if (not vrt_connect(subscriber, zmq_address, main_port))
+            return 1;
+        zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    }
 
     void *responder = zmq_socket(context, ZMQ_PUB);
     rc = zmq_setsockopt (responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
     assert(rc == 0);
-    connect_string = "tcp://*:" + std::to_string(pub_port);
-    rc = zmq_bind(responder, connect_string.c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, pub_port))
+        return 1;
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t rx_buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ messages, received on their own thread and parsed in place
+    vrt_metrics_type metrics;
+    init_metrics(&metrics);
+    if (metrics_port > 0 and not vrt_metrics_start(&metrics, context, metrics_address, metrics_port, "vrt_channelizer", hwm))
+        return 1;
+
+    vrt_receiver_type receiver;
+    vrt_receiver_start(&receiver, subscriber, &rt, &metrics, shm_reader);
+    vrt_rt_thread(&rt, VRT_RT_DSP);
+    vrt_msg_type* vrt_msg;
     uint32_t tx_buffer[ZMQ_BUFFER_SIZE];
 
     unsigned long long num_total_samps = 0;
@@ -207,11 +336,27 @@ int main(int argc, char* argv[])
     /* VRT init */
     struct vrt_packet p;
     vrt_init_packet(&p);
-    vrt_init_data_packet(&p);
+    vrt_init_data_packet(&p, samples_per_packet);
     p.fields.stream_id = 1;
 
-    std::complex<int16_t> iq_buff[VRT_SAMPLES_PER_PACKET];
+    // output samples are written straight into the outgoing packet
+    vrt_tx_pool_type* tx_pool = vrt_tx_pool_create(samples_per_packet);
+    vrt_tx_packet_type tx;
+    init_tx_packet(&tx);
     uint32_t iq_counter = 0;
+
+    // filterbank and the streams of its channels (--pfb)
+    vrt_channelizer_type channelizer;
+    std::vector<pfb_output_type> outputs;
+
+    // targets and their worker threads (--target)
+    vrt_target_pool_type target_pool;
+
+    // decimating low-pass of the single stream, channel mode mixes the channel to DC first
+    vrt_decimator_type decimator;
+    vrt_nco_type nco;
+    std::vector<std::complex<float>> y;
+
     uint32_t fir_pointer = 0;
     uint32_t frame_count = 0;
     uint32_t t_samp = 0;
@@ -229,17 +374,26 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, rx_buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_receiver_recv(&receiver, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* rx_buffer = vrt_msg->buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(rx_buffer, sizeof(rx_buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(rx_buffer, vrt_msg->words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
 
-        if (not start_rx and vrt_packet.context
-            and not (tracking and not tracker_ext_context.tracker_ext_context_received)) {
+        vrt_metrics_packet(&metrics, &vrt_packet, &vrt_context);
+
+        // with tracking, wait for the tracking data (of the object of every target)
+        bool tracked = not tracking or tracker_ext_context.tracker_ext_context_received;
+        for (size_t t = 0; t < targets.size(); t++)
+            tracked = tracked and (not targets[t].tracking or target_trackers[t].tracker_ext_context_received);
+
+        if (not start_rx and vrt_packet.context and tracked) {
             vrt_print_context(&vrt_context);
             start_rx = true;
 
@@ -261,17 +415,25 @@ int main(int argc, char* argv[])
                 freq_offset = frequency-(double)vrt_context.rf_freq;
             }
 
-            if (bandwidth > 0) {
-                decimation = vrt_context.sample_rate/bandwidth;
-            } else {
-                bandwidth = vrt_context.sample_rate/decimation;
+            // a bandwidth that does not divide the sample rate is resampled to
+            if (bandwidth > 0 and rate == 0 and fmod((double)vrt_context.sample_rate, bandwidth) != 0) {
+                if (pfb) {
+                    printf("bandwidth needs to be a divisor of the sample rate (%u).\n", vrt_context.sample_rate);
+                    exit(1);
+                }
+                rate = bandwidth;
             }
 
-            // check for valid bandwidth
-            if ( fmod((float)vrt_context.sample_rate,bandwidth) != 0) {
-                printf("bandwidth needs to be a divisor of the sample rate (%u).\n", vrt_context.sample_rate);
-                exit(1);
+            if (rate > 0) {
+                vrt_resample_plan(vrt_context.sample_rate, (uint32_t)llround(rate), &decimation, &interpolation,
+                    &resample_decimation);
+                bandwidth = rate;
+            } else if (bandwidth > 0) {
+                decimation = vrt_context.sample_rate/bandwidth;
+            } else {
+                bandwidth = (double)vrt_context.sample_rate/decimation;
             }
+            output_rate = (double)vrt_context.sample_rate/decimation*interpolation/resample_decimation;
 
             // check for valid frequency offset
             if ( fabs(freq_offset) > vrt_context.sample_rate/2) {
@@ -279,61 +441,6 @@ int main(int argc, char* argv[])
                 exit(1);
             }
 
-            // check for valid decimation
-            if (VRT_SAMPLES_PER_PACKET % decimation != 0) {
-                printf("decimation needs to be a divisor of %u.\n", VRT_SAMPLES_PER_PACKET);
-                exit(1);
-            }
-            
-            // check for valid decimation
-            if ((uint64_t)vrt_context.sample_rate % decimation != 0) {
-                printf("decimation needs to be a divisor of the sample rate (%u).\n", vrt_context.sample_rate);
-                exit(1);
-            }
-
-            // create FIR filter
-            uint32_t fir_order = taps_per_decimation*decimation-1;
-            num_taps = fir_order+1;
-            taps = (double*)malloc(sizeof(double)*num_taps);
-
-            double K = 0.97*(fir_order/decimation);
-
-            // Blackman window
-            // double a0 = 0.42;
-            // double a1 = 0.50;
-            // double a2 = 0.08;
-            // double a3 = 0.00;
-
-            // Blackman-Harris window
-            double a0 = 0.35875;
-            double a1 = 0.48829;
-            double a2 = 0.14128;
-            double a3 = 0.01168;
-
-            for (int i=0;i<fir_order;i++) {
-                int j = -(i - fir_order/2);
-                double blackman_window = a0 - a1*cos(2*pi*(double)i/((double)fir_order-1)) +
-                                            a2*cos(4*pi*(double)i/((double)fir_order-1)) +
-                                            a3*cos(6*pi*(double)i/((double)fir_order-1));
-                if (j==0) {
-                    taps[i] = blackman_window*((double)K/(double)fir_order);
-                } else {
-                    taps[i] = blackman_window*(1.0/(double)fir_order)*sin(pi*(double)j*(double)K/(double)fir_order)/sin(pi*(double)j/(double)fir_order);
-                }
-            }
-            taps[fir_order] = 0;
-
-            // Create polyphase partitions of filter
-            // float poly_taps[decimation][taps_per_decimation];
-
-            poly_taps = (float **)malloc(sizeof(float *)*decimation);
-            for (size_t dec=0; dec < decimation; dec++)
-                poly_taps[dec] = (float*)malloc(sizeof(float)*taps_per_decimation);
-
-            for (uint32_t i=0; i<num_taps; i++) {
-                poly_taps[i%decimation][i/decimation] = (float)taps[i];
-            }
-
             if (channel_mode) {
                 polyfir_channel = round(freq_offset/bandwidth);
                 printf("# Selected channel: %.0f\n", polyfir_channel);
@@ -348,18 +455,121 @@ int main(int argc, char* argv[])
             alpha_dop = complexi*2.0*pi*(double)-doppler_rate;
             step = std::exp(alpha/(double)vrt_context.sample_rate);
             step_dop = std::exp(alpha_dop/pow((double)vrt_context.sample_rate,2));
-            alpha2 = (std::complex<float>)complexi*polyfir_channel*2.0f*(float)pi/(float(decimation));
 
-            int M = decimation;
-            int L = VRT_SAMPLES_PER_PACKET;
+            if (not pfb and targets.empty()) {
+                vrt_decimator_init(&decimator, decimation, taps_per_decimation, multistage, cic, VRT_SAMPLES_PER_PACKET);
+                if (interpolation != resample_decimation) {
+                    vrt_decimator_resample(&decimator, interpolation, resample_decimation, taps_per_decimation, farrow,
+                        VRT_SAMPLES_PER_PACKET);
+                    printf("# Resampling to %.3f samples/s\n", output_rate);
+                }
+                vrt_decimator_prefault(&decimator, &rt);
+                print_stages(&decimator, taps_per_decimation);
+                if (channel_mode)
+                    vrt_nco_init(&nco, freq_offset, vrt_context.sample_rate);
+            }
+
+            if (pfb) {
+                int32_t lowest = -(int32_t)(decimation/2);
+                int32_t highest = (int32_t)((decimation-1)/2);
+                std::vector<int32_t> channels;
+                if (pfb_channel_list.empty()) {
+                    for (int32_t c = lowest; c <= highest; c++)
+                        channels.push_back(c);
+                } else {
+                    std::vector<std::string> items;
+                    boost::split(items, pfb_channel_list, boost::is_any_of(","));
+                    for (const std::string& item : items) {
+                        char* end;
+                        long c = strtol(item.c_str(), &end, 10);
+                        if (item.empty() or *end != '\0' or c < lowest or c > highest) {
+                            fprintf(stderr, "Invalid channel \"%s\", channels are %i to %i.\n", item.c_str(), lowest, highest);
+                            exit(1);
+                        }
+                        channels.push_back(c);
+                    }
+                }
+                if (oversample and decimation % 2 != 0) {
+                    fprintf(stderr, "--oversample needs an even number of channels (decimation).\n");
+                    exit(1);
+                }
+                // one stream id bit per channel, or one port each with --zmq-split
+                if (not zmq_split and channels.size() > 32) {
+                    fprintf(stderr, "At most 32 channels share a port, use --pfb-channels or --zmq-split.\n");
+                    exit(1);
+                }
 
-            x = (std::complex<float>*)malloc(sizeof(std::complex<float>)*(M+L+num_taps));
-            y = (std::complex<float>*)malloc(sizeof(std::complex<float>)*(L/M));
-            tmp_acc = (std::complex<float>*)malloc(sizeof(std::complex<float>)*(L/M));
+                vrt_channelizer_init(&channelizer, decimation, taps_per_decimation, oversample, VRT_SAMPLES_PER_PACKET, &rt);
+                vrt_fft_planner_start();
+
+                double spacing = (double)vrt_context.sample_rate/decimation;
+                printf("# PFB: %u channels of %.0f Hz, %.0f samples/s each\n", decimation, spacing,
+                    oversample ? 2*spacing : spacing);
+                for (size_t o = 0; o < channels.size(); o++) {
+                    pfb_output_type output;
+                    output.channel = channels[o];
+                    output.bin = (channels[o] + decimation) % decimation;
+                    output.stream_id = zmq_split ? 1 : 1<<o;
+                    output.responder = responder;
+                    if (zmq_split and o > 0) {
+                        output.responder = zmq_socket(context, ZMQ_PUB);
+                        rc = zmq_setsockopt (output.responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
+                        assert(rc == 0);
+                        if (not vrt_bind(output.responder, bind_address, pub_port+o))
+                            exit(1);
+                    }
+                    init_tx_packet(&output.tx);
+                    outputs.push_back(output);
+                    if (zmq_split)
+                        printf("# Channel %i: %.0f Hz offset on port %zu\n", output.channel, output.channel*spacing, pub_port+o);
+                    else
+                        printf("# Channel %i: %.0f Hz offset as stream id 0x%x\n", output.channel, output.channel*spacing, output.stream_id);
+                }
+            }
+
+            if (not targets.empty()) {
+                std::vector<uint16_t> ports;
+                for (uint32_t t = 0; t < targets.size(); t++) {
+                    vrt_target_type& target = targets[t];
+                    if (not vrt_target_setup(&target, t, &vrt_context, &target_trackers[t], decimation))
+                        exit(1);
+                    uint16_t target_port = target.port ? target.port : pub_port + t;
+                    if (std::find(ports.begin(), ports.end(), target_port) != ports.end()) {
+                        fprintf(stderr, "Target %u: port %u is already used by another target.\n", t, target_port);
+                        exit(1);
+                    }
+                    ports.push_back(target_port);
+                    void* target_responder = responder;
+                    if (target_port != pub_port) {
+                        target_responder = zmq_socket(context, ZMQ_PUB);
+                        rc = zmq_setsockopt (target_responder, ZMQ_SNDHWM, &hwm, sizeof hwm);
+                        assert(rc == 0);
+                        if (not vrt_bind(target_responder, bind_address, target_port))
+                            exit(1);
+                    }
 
-            for (uint32_t i = 0; i < M+L+num_taps; i++)
-                x[i] = std::complex<float>(0,0);
-            
+                    vrt_target_start(&target, taps_per_decimation, multistage, cic, farrow, vrt_context.sample_rate,
+                        samples_per_packet, target_responder, &rt);
+
+                    printf("# Target %u: %.0f Hz offset, %.0f Hz (decimation %u", t, target.freq_offset,
+                        vrt_decimator_rate(&target.decimator, vrt_context.sample_rate), target.decimation);
+                    if (target.interpolation != target.resample_decimation)
+                        printf(", resampled by %lu/%lu", (unsigned long)target.interpolation,
+                            (unsigned long)target.resample_decimation);
+                    printf(")");
+                    if (target.tracking)
+                        printf(", tracking \"%.32s\" at %f Hz/s", target_trackers[t].object_name, target.doppler_rate);
+                    else if (target.doppler_rate != 0)
+                        printf(", %f Hz/s", target.doppler_rate);
+                    printf(" on port %u\n", target_port);
+                    if (multistage or target.interpolation != target.resample_decimation)
+                        print_stages(&target.decimator, taps_per_decimation);
+                }
+                vrt_targets_start(&target_pool, &targets, target_threads, vrt_context.sample_rate, samples_per_packet,
+                    tx_pool, &rt);
+                if (target_threads > 0)
+                    printf("# %u target worker threads\n", std::min(target_threads, (uint32_t)targets.size()));
+            }
         }
 
         if (start_rx and vrt_packet.context) {
@@ -373,10 +583,12 @@ int main(int argc, char* argv[])
             pc.fields.fractional_seconds_timestamp = vrt_context.fractional_seconds_timestamp;
 
             double doppler_offset = total_phase/(double)vrt_context.sample_rate;
+            double rf_reference_frequency;
             if (strcmp(tracker_ext_context.tracking_source, "LSR") == 0)
-                pc.if_context.rf_reference_frequency = (double)vrt_context.rf_freq;
+                rf_reference_frequency = (double)vrt_context.rf_freq;
             else
-                pc.if_context.rf_reference_frequency = (double)vrt_context.rf_freq+(double)freq_offset-doppler_offset;
+                rf_reference_frequency = (double)vrt_context.rf_freq+(double)freq_offset-doppler_offset;
+            pc.if_context.rf_reference_frequency = rf_reference_frequency;
 
             if (doppler_rate!=0 || first_context) {
                 pc.if_context.context_field_change_indicator = true;
@@ -386,7 +598,7 @@ int main(int argc, char* argv[])
                 pc.if_context.context_field_change_indicator = false;
 
             pc.if_context.bandwidth = vrt_context.bandwidth;
-            pc.if_context.sample_rate = vrt_context.sample_rate/decimation;
+            pc.if_context.sample_rate = output_rate;
             pc.if_context.rf_reference_frequency_offset = 0;
             pc.if_context.if_reference_frequency = 0;
             pc.if_context.if_band_offset = 0;
@@ -405,13 +617,36 @@ int main(int argc, char* argv[])
             pc.if_context.timestamp_calibration_time = vrt_context.timestamp_calibration_time;
 
 
-            int32_t rv = vrt_write_packet(&pc, tx_buffer, VRT_DATA_PACKET_SIZE, true);
-            if (rv < 0) {
-                fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
-            }
+            if (pfb) {
+                // one context per channel, on its stream
+                double spacing = (double)vrt_context.sample_rate/decimation;
+                pc.if_context.bandwidth = spacing;
+                pc.if_context.sample_rate = oversample ? 2*spacing : spacing;
+                for (pfb_output_type& output : outputs) {
+                    pc.fields.stream_id = output.stream_id;
+                    pc.if_context.rf_reference_frequency = rf_reference_frequency + output.channel*spacing;
+                    int32_t rv = vrt_write_packet(&pc, tx_buffer, VRT_DATA_PACKET_SIZE, true);
+                    if (rv < 0) {
+                        fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
+                        continue;
+                    }
+                    zmq_send (output.responder, tx_buffer, rv*4, 0);
+                }
+            } else if (not targets.empty()) {
+                // each target sends its own context
+                vrt_target_block_type* block = vrt_targets_next(&target_pool);
+                block->event = VRT_TARGET_CONTEXT;
+                block->context = vrt_context;
+                vrt_targets_publish(&target_pool, block);
+            } else {
+                int32_t rv = vrt_write_packet(&pc, tx_buffer, VRT_DATA_PACKET_SIZE, true);
+                if (rv < 0) {
+                    fprintf(stderr, "Failed to write packet: %s\n", vrt_string_error(rv));
+                }
 
-            // ZMQ
-            zmq_send (responder, tx_buffer, rv*4, 0);
+                // ZMQ
+                zmq_send (responder, tx_buffer, rv*4, 0);
+            }
 
         }
 
@@ -436,102 +671,138 @@ int main(int argc, char* argv[])
 
             // Assumes ci16_le
 
-            int M = decimation;
-            int L = vrt_packet.num_rx_samps;
-
-            for (uint32_t i = 0; i < L/M; i++)
-                y[i] = std::complex<float>(0,0);
-
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
-                int16_t re;
-                memcpy(&re, (char*)&rx_buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&rx_buffer[vrt_packet.offset+i]+2, 2);
-
-                x[M+i+num_taps] = std::complex<float>(re,img);
+            // time of the output packet starting at input sample offset of this packet
+            auto packet_time = [&](double offset) {
+                int64_t frac_seconds = vrt_packet.fractional_seconds_timestamp + offset*1e12/vrt_context.sample_rate;
+                next_integer_seconds_timestamp = vrt_packet.integer_seconds_timestamp;
+                if (frac_seconds < 0) {
+                    frac_seconds += 1e12;
+                    next_integer_seconds_timestamp--;
+                } else if (frac_seconds >= 1e12) {
+                    frac_seconds -= 1e12;
+                    next_integer_seconds_timestamp++;
+                }
+                next_fractional_seconds_timestamp = frac_seconds;
+            };
+
+            // input of the filter (bank), index of the first sample of this packet in it
+            std::complex<float>* in;
+            int64_t first_sample = 0;
+            vrt_target_block_type* target_block = NULL;
+
+            if (pfb) {
+                first_sample = channelizer.fir.fill;
+                in = vrt_channelizer_input(&channelizer, vrt_packet.num_rx_samps);
+            } else if (not targets.empty()) {
+                // converted once for all targets
+                target_block = vrt_targets_next(&target_pool);
+                target_block->event = VRT_TARGET_DATA;
+                target_block->integer_seconds_timestamp = vrt_packet.integer_seconds_timestamp;
+                target_block->fractional_seconds_timestamp = vrt_packet.fractional_seconds_timestamp;
+                in = vrt_targets_samples(&target_pool, target_block, vrt_packet.num_rx_samps);
+            } else {
+                first_sample = decimator.inputs;
+                in = vrt_decimator_input(&decimator, vrt_packet.num_rx_samps);
             }
 
+            vrt_convert_cf32(vrt_samples(rx_buffer, &vrt_packet), in, vrt_packet.num_rx_samps);
+
             // nomalize phasor and step (for doppler)
             phasor = phasor/std::abs(phasor);
             step = step/std::abs(step);
 
-            if (!channel_mode && doppler_rate!=0) {
+            if (target_block) {
+                // the targets mix and filter the block
+                vrt_targets_publish(&target_pool, target_block);
+                vrt_metrics_output(&metrics, vrt_targets_output_bytes(&target_pool));
+            } else if (!channel_mode && doppler_rate!=0) {
                 for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
                     total_phase -= doppler_rate;
                     step = step * step_dop;
                     phasor = phasor * step;
-                    x[M+i+num_taps] *= (std::complex<float>)phasor;
+                    in[i] *= (std::complex<float>)phasor;
                 }
             } else if (!channel_mode && freq_offset!=0 && doppler_rate==0) {
                 for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
                     phasor = phasor * step;
-                    x[M+i+num_taps] *= (std::complex<float>)phasor;
+                    in[i] *= (std::complex<float>)phasor;
                 }
+            } else if (channel_mode && freq_offset!=0) {
+                vrt_nco_mix(&nco, in, vrt_packet.num_rx_samps);
             }
 
-            for (uint32_t i = 0; i < M; i++) {
+            num_total_samps += vrt_packet.num_rx_samps;
 
-                for (uint32_t k = 0; k < L/M; k++) {
+            if (pfb) {
+                uint32_t outputs_ready = vrt_channelizer_outputs(&channelizer);
+                for (uint32_t k = 0; k < outputs_ready; k++) {
+                    const std::complex<float>* out = vrt_channelizer_output(&channelizer, k);
 
-                    tmp_acc[k] = std::complex<float>(0,0);
-
-                    for (uint32_t j = 0; j < taps_per_decimation; j++) {
-                        tmp_acc[k] += poly_taps[i][taps_per_decimation-j-1] * x[M-i+j*M+k*M];
+                    if (iq_counter == 0) {
+                        // time of the input sample at the center of the filter
+                        packet_time(vrt_channelizer_center(&channelizer, k) - first_sample);
+                        for (pfb_output_type& output : outputs)
+                            vrt_tx_begin(tx_pool, &output.tx);
                     }
-                }
 
-                if (channel_mode && polyfir_channel !=0) {
-                    std::complex<float> phase_rotation = std::exp(alpha2*(float)i );
-                    for (uint32_t k = 0; k < L/M; k++)
-                        y[k] += phase_rotation*tmp_acc[k];
-                } else {
-                    for (uint32_t k = 0; k < L/M; k++)
-                        y[k] += tmp_acc[k];
-                }
+                    for (pfb_output_type& output : outputs)
+                        output.tx.samples[iq_counter] = out[output.bin];
+                    iq_counter++;
 
-            }
+                    if (iq_counter == samples_per_packet) {
 
-            // overlap between blocks
-            for (uint32_t i = 0; i < num_taps; i++) {
-                x[M+i] = x[M+i+L];
-            }
-
-            for (uint32_t k = 0; k < L/M; k++) {
-                iq_buff[iq_counter] = y[k];
-                iq_counter++;
-            }
-
-            if (next_integer_seconds_timestamp == 0) {
-                next_integer_seconds_timestamp = vrt_packet.integer_seconds_timestamp;
-                next_fractional_seconds_timestamp = vrt_packet.fractional_seconds_timestamp;
-            }
+                        iq_counter = 0;
 
-            if (iq_counter==VRT_SAMPLES_PER_PACKET) {
+                        p.fields.integer_seconds_timestamp = next_integer_seconds_timestamp;
+                        p.fields.fractional_seconds_timestamp = next_fractional_seconds_timestamp;
+                        p.header.packet_count = (uint8_t)frame_count%16;
+                        frame_count++;
 
-                iq_counter = 0;
-                t_samp = 0;
+                        for (pfb_output_type& output : outputs) {
+                            p.fields.stream_id = output.stream_id;
+                            vrt_tx_send(&p, &output.tx, samples_per_packet, output.responder);
+                            vrt_metrics_output(&metrics, VRT_DATA_PACKET_SIZE_FOR(samples_per_packet)*sizeof(uint32_t));
+                        }
+                    }
+                }
+                vrt_channelizer_consume(&channelizer, outputs_ready);
+            } else if (targets.empty()) {
+                uint32_t K = vrt_decimator_prepare(&decimator);
+                if (K > y.size())
+                    y.resize(K);
+                vrt_decimator_run(&decimator, y.data());
+
+                for (uint32_t k = 0; k < K; k++) {
+
+                    if (iq_counter == 0) {
+                        // one output after the newest input sample of the filter (or the time of the resampled output)
+                        uint64_t index;
+                        double fraction;
+                        vrt_decimator_time(&decimator, k + 1, &index, &fraction);
+                        packet_time((int64_t)index - first_sample + fraction);
+                        vrt_tx_begin(tx_pool, &tx);
+                    }
 
-                p.fields.integer_seconds_timestamp = next_integer_seconds_timestamp;
-                p.fields.fractional_seconds_timestamp = next_fractional_seconds_timestamp;
-                p.header.packet_count = (uint8_t)frame_count%16;
-                frame_count++;
+                    tx.samples[iq_counter] = y[k];
+                    iq_counter++;
 
-                next_integer_seconds_timestamp = 0;
-                next_fractional_seconds_timestamp = 0;
+                    if (iq_counter == samples_per_packet) {
 
-                p.body = (char*)iq_buff;
-                p.fields.stream_id = 1;
+                        iq_counter = 0;
+                        t_samp = 0;
 
-                zmq_msg_t msg;
-                int rc = zmq_msg_init_size (&msg, VRT_DATA_PACKET_SIZE*4);
-                int32_t rv = vrt_write_packet(&p, zmq_msg_data(&msg), VRT_DATA_PACKET_SIZE, true);
+                        p.fields.integer_seconds_timestamp = next_integer_seconds_timestamp;
+                        p.fields.fractional_seconds_timestamp = next_fractional_seconds_timestamp;
+                        p.header.packet_count = (uint8_t)frame_count%16;
+                        frame_count++;
 
-                zmq_msg_send(&msg, responder, 0);
-                zmq_msg_close(&msg);
+                        p.fields.stream_id = 1;
 
-                num_total_samps += vrt_packet.num_rx_samps;
+                        vrt_tx_send(&p, &tx, samples_per_packet, responder);
+                        vrt_metrics_output(&metrics, VRT_DATA_PACKET_SIZE_FOR(samples_per_packet)*sizeof(uint32_t));
+                    }
+                }
             }
-
             if (start_rx and first_frame) {
                 std::cout << boost::format(
                                  "# First frame: %u samples, %u full secs, %.09f frac secs")
@@ -545,7 +816,7 @@ int main(int argc, char* argv[])
 
         if (vrt_packet.extended_context) {
             if (tracking) {
-                tracker_process(rx_buffer, sizeof(rx_buffer), &vrt_packet, &tracker_ext_context);
+                tracker_process(rx_buffer, vrt_msg->words, &vrt_packet, &tracker_ext_context);
                 if (!std::isnan(tracker_ext_context.doppler_rate)) {
                     doppler_rate = tracker_ext_context.doppler_rate;
                     alpha_dop = complexi*2.0*pi*(double)-doppler_rate;
@@ -553,11 +824,29 @@ int main(int argc, char* argv[])
                     // printf("# Doppler rate update (%s): %f\n", tracker_ext_context.object_name, doppler_rate);
                 }
             }
-            zmq_msg_t msg;
-            zmq_msg_init_size (&msg, len);
-            memcpy (zmq_msg_data(&msg), rx_buffer, len);
-            zmq_msg_send(&msg, responder, 0);
-            zmq_msg_close(&msg);
+            if (not targets.empty()) {
+                bool tracker_valid = track_targets
+                    and tracker_process(rx_buffer, vrt_msg->words, &vrt_packet, &tracker_ext_context);
+                for (size_t t = 0; tracker_valid and t < targets.size(); t++) {
+                    if (vrt_target_tracks(&targets[t], &tracker_ext_context))
+                        target_trackers[t] = tracker_ext_context;
+                }
+                if (start_rx) {
+                    // Doppler rate updates and forwarding on the workers of the targets
+                    vrt_target_block_type* block = vrt_targets_next(&target_pool);
+                    block->event = VRT_TARGET_EXTENDED;
+                    block->tracker_valid = tracker_valid;
+                    block->tracker = tracker_ext_context;
+                    for (size_t t = 0; t < targets.size(); t++)
+                        zmq_msg_copy(&block->forward[t], &vrt_msg->msg);
+                    vrt_targets_publish(&target_pool, block);
+                }
+            } else {
+                // forward as a reference to the received message
+                vrt_msg_send_copy(&vrt_msg->msg, responder);
+                for (size_t o = 1; zmq_split and o < outputs.size(); o++)
+                    vrt_msg_send_copy(&vrt_msg->msg, outputs[o].responder);
+            }
         }
 
         if (progress) {
@@ -595,9 +884,30 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_receiver_stop(&receiver);
+    vrt_tx_abort(&tx);
+    for (size_t o = 0; o < outputs.size(); o++) {
+        vrt_tx_abort(&outputs[o].tx);
+        if (outputs[o].responder != responder)
+            zmq_close(outputs[o].responder);
+    }
+    if (pfb and not outputs.empty())
+        vrt_channelizer_free(&channelizer);
+    else if (not targets.empty() and start_rx) {
+        vrt_targets_stop(&target_pool);
+        for (vrt_target_type& target : targets) {
+            if (target.responder != responder)
+                zmq_close(target.responder);
+        }
+    } else if (not pfb and start_rx)
+        vrt_decimator_free(&decimator);
+    vrt_print_receiver_stats(&receiver);
+    vrt_shm_detach(shm_reader);
+    vrt_metrics_stop(&metrics);
     zmq_close(subscriber);
     zmq_close(responder);
     zmq_ctx_destroy(context);
+    vrt_tx_pool_destroy(tx_pool);
 
     return 0;
 
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <chrono>
+#include <iostream>
+
+// VRT
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <fftw3.h>
+
+#include "vrt-tools.h"
+#include "vrt-fft.h"
+
+namespace po = boost::program_options;
+
+// Measure the plans of one size into the loaded wisdom
+double measure(uint32_t num_bins, bool single, unsigned rigor) {
+    auto start = std::chrono::steady_clock::now();
+    if (single) {
+        fftwf_complex* in = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * num_bins);
+        fftwf_complex* out = (fftwf_complex*)vrt_alloc(sizeof(fftwf_complex) * num_bins);
+        fftwf_plan plan = fftwf_plan_dft_1d(num_bins, in, out, FFTW_FORWARD, rigor);
+        fftwf_destroy_plan(plan);
+        vrt_free(in);
+        vrt_free(out);
+    } else {
+        fftw_complex* in = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * num_bins);
+        fftw_complex* out = (fftw_complex*)vrt_alloc(sizeof(fftw_complex) * num_bins);
+        fftw_plan plan = fftw_plan_dft_1d(num_bins, in, out, FFTW_FORWARD, rigor);
+        fftw_destroy_plan(plan);
+        vrt_free(in);
+        vrt_free(out);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string sizes, precision, wisdom, rigor_name;
+    double time_limit;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+
+    desc.add_options()
+        ("help", "help message")
+        ("sizes", po::value<std::string>(&sizes)->default_value("1000,1024,2048,4096,8192,10000,16384,65536,100000"), "FFT sizes (bins) to plan, comma separated")
+        ("precision", po::value<std::string>(&precision)->default_value("both"), "double, float or both")
+        ("wisdom", po::value<std::string>(&wisdom)->default_value(vrt_fft_wisdom_default()), "FFTW wisdom file, added to (default $VRT_FFTW_WISDOM or ~/.vrt_fftw_wisdom)")
+        ("fft-plan", po::value<std::string>(&rigor_name)->default_value("patient"), "FFTW planning: measure, patient or exhaustive")
+        ("time-limit", po::value<double>(&time_limit)->default_value(0), "seconds per plan at most (0: no limit)")
+    ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help")) {
+        std::cout << boost::format("VRT FFT wisdom. %s") % desc << std::endl;
+        std::cout << std::endl
+                  << "This application measures FFTW plans for the FFT tools in advance "
+                     "and saves them as wisdom, so the tools start with measured plans.\n"
+                  << std::endl;
+        return ~0;
+    }
+
+    bool plan_double            = precision == "double" or precision == "both";
+    bool plan_float             = precision == "float" or precision == "both";
+
+    if (not plan_double and not plan_float) {
+        fprintf(stderr, "Invalid precision \"%s\", use double, float or both.\n", precision.c_str());
+        return 1;
+    }
+    if (wisdom.empty()) {
+        fprintf(stderr, "No wisdom file, set --wisdom or $HOME.\n");
+        return 1;
+    }
+
+    std::vector<uint32_t> num_bins;
+    std::vector<std::string> items;
+    boost::split(items, sizes, boost::is_any_of(","));
+    for (const std::string& item : items) {
+        char* end;
+        unsigned long n = strtoul(item.c_str(), &end, 10);
+        if (item.empty() or *end != '\0' or n == 0 or n > UINT32_MAX) {
+            fprintf(stderr, "Invalid FFT size \"%s\".\n", item.c_str());
+            return 1;
+        }
+        num_bins.push_back(n);
+    }
+
+    // load the wisdom there is, so that it is kept
+    vrt_fft_planner_type& planner = vrt_fft_planner();
+    planner.wisdom = wisdom;
+    planner.rigor_name = rigor_name;
+    if (not vrt_fft_planner_init())
+        return 1;
+    if (planner.rigor == FFTW_ESTIMATE) {
+        fprintf(stderr, "Estimated plans are not saved as wisdom, use measure, patient or exhaustive.\n");
+        return 1;
+    }
+
+    if (time_limit > 0) {
+        fftw_set_timelimit(time_limit);
+        fftwf_set_timelimit(time_limit);
+    }
+
+    printf("# Planning (%s) into %s\n", rigor_name.c_str(), wisdom.c_str());
+    printf("bins, precision, seconds\n");
+    std::lock_guard<std::mutex> lock(planner.fftw);
+    for (uint32_t n : num_bins) {
+        if (plan_double) {
+            printf("%u, double, %.2f\n", n, measure(n, false, planner.rigor));
+            fflush(stdout);
+        }
+        if (plan_float) {
+            printf("%u, float, %.2f\n", n, measure(n, true, planner.rigor));
+            fflush(stdout);
+        }
+        // keep what is done if interrupted
+        if (not vrt_fft_save_wisdom(wisdom))
+            return 1;
+    }
+
+    return 0;
+}
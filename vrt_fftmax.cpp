@@ -33,6 +33,9 @@
 #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
+#include "vrt-dsp.h"
 
 namespace po = boost::program_options;
 
@@ -66,11 +69,17 @@ int main(int argc, char* argv[])
 {
 
     // FFTW
-    fftw_complex *signal, *result;
-    fftw_plan plan;
+    vrt_fft_type fft;
+    double* power;
     uint32_t num_points = 0;
     uint32_t fft_len = 1;
 
+    // zoom band front end, the points transformed per frame and the DC bin (-1: outside the band)
+    vrt_zoom_type zoom;
+    uint32_t frame_points;
+    int32_t dc_bin;
+    double band_center, band_rate;
+
     int32_t min_bin, max_bin;
 
     // variables to be set by po
@@ -91,6 +100,7 @@ int main(int argc, char* argv[])
         ("duration", po::value<double>(&total_time)->default_value(0), "total number of seconds to receive")
         ("min-offset", po::value<double>(&min_offset), "min. freq. offset to track")
         ("max-offset", po::value<double>(&max_offset), "max. freq. offset to track")
+        ("zoom", "transform only the span of --min-offset/--max-offset: mix it to DC and decimate")
         ("fft-duration", po::value<uint32_t>(&fft_len), "number of seconds to integrate")
         ("channel", po::value<uint32_t>(&channel)->default_value(0), "VRT channel")
         ("progress", "periodically display short-term bandwidth")
@@ -98,14 +108,16 @@ int main(int argc, char* argv[])
         ("int-second", "align start of reception to integer second")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
+        ("float", "single precision FFT")
         ("ignore-dc", "Ignore  DC bin")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
     // clang-format on
+    vrt_fft_options(desc);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -120,12 +132,22 @@ int main(int argc, char* argv[])
         return ~0;
     }
 
+    if (not vrt_fft_planner_init())
+        return 1;
+
     bool progress               = vm.count("progress") > 0;
     bool null                   = vm.count("null") > 0;
     bool continue_on_bad_packet = vm.count("continue") > 0;
     bool int_second             = (bool)vm.count("int-second");
     bool ignore_dc              = (bool)vm.count("ignore-dc");
     bool zmq_split              = vm.count("zmq-split") > 0;
+    bool single                 = vm.count("float") > 0;
+    bool zoom_band              = vm.count("zoom") > 0;
+
+    if (zoom_band and not (vm.count("min-offset") or vm.count("max-offset"))) {
+        fprintf(stderr, "--zoom requires --min-offset and/or --max-offset.\n");
+        return 1;
+    }
 
     context_type vrt_context;
     init_context(&vrt_context);
@@ -149,16 +171,17 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, main_port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -176,11 +199,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -199,20 +225,45 @@ int main(int argc, char* argv[])
             max_bin = num_points;
 
             if (vm.count("min-offset")) {
-                min_bin = min_offset+num_points/2;
+                min_bin = min_offset*fft_len+num_points/2;
                 min_bin = min_bin < 0 ? 0 : min_bin;
                 min_bin = min_bin > num_points ? num_points : min_bin;
             }
 
             if (vm.count("max-offset")) {
-                max_bin = max_offset+num_points/2;
+                max_bin = max_offset*fft_len+num_points/2;
                 max_bin = max_bin < 0 ? 0 : max_bin;
                 max_bin = max_bin > num_points ? num_points : max_bin;
             }
 
-            signal = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_points);
-            result = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_points);
-            plan = fftw_plan_dft_1d(num_points, signal, result, FFTW_FORWARD, FFTW_ESTIMATE);
+            frame_points = num_points;
+            dc_bin = num_points/2;
+            band_center = 0;
+            band_rate = vrt_context.sample_rate;
+
+            if (zoom_band) {
+                max_bin = max_bin > (int32_t)num_points-1 ? num_points-1 : max_bin;
+                if (min_bin > max_bin or
+                    not vrt_zoom_init(&zoom, num_points, min_bin, max_bin, vrt_context.sample_rate, VRT_SAMPLES_PER_PACKET)) {
+                    fprintf(stderr, "Span too wide to zoom, transforming the full band.\n");
+                    zoom_band = false;
+                } else {
+                    // same bin size, num_points/decimation bins around the span
+                    frame_points = zoom.num_bins;
+                    band_center = zoom.center;
+                    band_rate = zoom.sample_rate;
+                    min_bin -= zoom.first_bin;
+                    max_bin -= zoom.first_bin;
+                    dc_bin -= zoom.first_bin;
+                    if (dc_bin < 0 or dc_bin >= (int32_t)frame_points)
+                        dc_bin = -1;
+                    printf("# Zoom: decimation %u, %u bins\n", zoom.decimation, frame_points);
+                }
+            }
+
+            vrt_fft_init(&fft, frame_points, single);
+            vrt_fft_planner_start();
+            power = (double*) vrt_alloc(sizeof(double) * frame_points);
         }
 
         if (start_rx and vrt_packet.data) {
@@ -234,47 +285,62 @@ int main(int argc, char* argv[])
                 }
             }
 
-            int mult = 1;
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                signal[signal_pointer][REAL] = mult*re;
-                signal[signal_pointer][IMAG] = mult*img;
-                mult *= -1;
+            int mult = 1; // fftshift
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
 
-                signal_pointer++;
+            // zoom: the frames are filled from the decimated samples, the
+            // newest input of decimated sample i is samples[newest + i*decimation]
+            uint32_t num_samps = vrt_packet.num_rx_samps;
+            int64_t newest = 0;
+            if (zoom_band)
+                num_samps = vrt_zoom_process(&zoom, samples, vrt_packet.num_rx_samps, &newest);
 
-                if (signal_pointer >= num_points) {
+            for (uint32_t i = 0; i < num_samps; i++) {
+                // convert up to the end of the packet or the frame, i is the last sample converted
+                uint32_t n = std::min(num_samps - i, frame_points - signal_pointer);
+                if (zoom_band and single)
+                    vrt_zoom_frame(&zoom, i, n, fft.inf, signal_pointer);
+                else if (zoom_band)
+                    vrt_zoom_frame(&zoom, i, n, fft.in, signal_pointer);
+                else
+                    vrt_fft_convert(&fft, signal_pointer, &samples[i], n, &mult);
+
+                signal_pointer += n;
+                i += n - 1;
+
+                if (signal_pointer >= frame_points) {
 
                     signal_pointer = 0;
 
-                    fftw_execute(plan);
+                    vrt_fft_execute(&fft);
+                    vrt_fft_power(&fft, power);
 
                     double max = 0;
                     int32_t max_i = -1;
 
-                    uint32_t dc = num_points/2;
-
-                    for (uint32_t i = 0; i < num_points; ++i) {
-                        double mag = sqrt(result[i][REAL] * result[i][REAL] +
-                                  result[i][IMAG] * result[i][IMAG]);
-                        if ( (mag > max) and (i >= min_bin) and (i <= max_bin) and not (ignore_dc && i==dc)) {
+                    for (uint32_t i = 0; i < frame_points; ++i) {
+                        double mag = sqrt(power[i]);
+                        if ( (mag > max) and (i >= min_bin) and (i <= max_bin) and not (ignore_dc && i==dc_bin)) {
                             max = mag;
                             max_i = i;
                         }
                     }
 
+                    // the newest input sample of the frame, may be in an earlier packet when zoomed
+                    int64_t last = zoom_band ? newest + (int64_t)i*zoom.decimation : i;
                     uint64_t seconds = vrt_packet.integer_seconds_timestamp;
-                    uint64_t frac_seconds = vrt_packet.fractional_seconds_timestamp;
-                    frac_seconds += (i+1)*1e12/vrt_context.sample_rate;
+                    int64_t frac_seconds = vrt_packet.fractional_seconds_timestamp;
+                    frac_seconds += (last+1)*1e12/vrt_context.sample_rate;
                     if (frac_seconds > 1e12) {
                         frac_seconds -= 1e12;
                         seconds++;
+                    } else if (frac_seconds < 0) {
+                        frac_seconds += 1e12;
+                        seconds--;
                     }
 
-                    double peak_hz = vrt_context.rf_freq + (double)max_i/(double)fft_len - vrt_context.sample_rate/2;
+                    double peak_hz = vrt_context.rf_freq + band_center + (double)max_i/(double)fft_len - band_rate/2;
+                    // the zoom low-pass has a DC gain of decimation, so a zoomed bin scales as one of num_points
                     printf("%lu.%09li, %.2f, %.3f\n", static_cast<unsigned long>(seconds), static_cast<long>(frac_seconds/1e3), peak_hz, 20*log10(max/(double)num_points));
                     fflush(stdout);
                 }
@@ -331,6 +397,9 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (start_rx and zoom_band)
+        vrt_zoom_free(&zoom);
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
@@ -33,6 +33,8 @@
 #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
 
 namespace po = boost::program_options;
 
@@ -66,8 +68,8 @@ int main(int argc, char* argv[])
 {
 
     // FFTW
-    fftw_complex *signal, *result;
-    fftw_plan plan;
+    vrt_fft_type fft;
+    double* power;
     uint32_t num_points = 0;
 
     int32_t min_bin, max_bin;
@@ -97,12 +99,14 @@ int main(int argc, char* argv[])
         ("int-second", "align start of reception to integer second")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
+        ("float", "single precision FFT")
         // ("ignore-dc", "Ignore 10 perc. of bins around DC")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
     // clang-format on
+    vrt_fft_options(desc);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -117,12 +121,16 @@ int main(int argc, char* argv[])
         return ~0;
     }
 
+    if (not vrt_fft_planner_init())
+        return 1;
+
     bool progress               = vm.count("progress") > 0;
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
     bool continue_on_bad_packet = vm.count("continue") > 0;
     bool int_second             = (bool)vm.count("int-second");
     bool squared                = (bool)vm.count("squared");
+    bool single                 = vm.count("float") > 0;
     // bool ignore_dc              = (bool)vm.count("ignore-dc");
 
     context_type vrt_context;
@@ -136,16 +144,17 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -163,11 +172,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -192,9 +204,9 @@ int main(int argc, char* argv[])
                 max_bin = max_bin > num_points ? num_points : max_bin;
             }
 
-            signal = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_points);
-            result = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_points);
-            plan = fftw_plan_dft_1d(num_points, signal, result, FFTW_FORWARD, FFTW_ESTIMATE);
+            vrt_fft_init(&fft, num_points, single);
+            vrt_fft_planner_start();
+            power = (double*) vrt_alloc(sizeof(double) * num_points);
         }
 
         if (start_rx and vrt_packet.data) {
@@ -216,50 +228,29 @@ int main(int argc, char* argv[])
                 }
             }
 
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
             for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
 
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                signal[signal_pointer][REAL] = (float)re;
-                signal[signal_pointer][IMAG] = (float)img;
+                // convert up to the end of the packet or the frame, i is the last sample converted
+                uint32_t n = std::min(vrt_packet.num_rx_samps - i, num_points - signal_pointer);
+                vrt_fft_convert(&fft, signal_pointer, &samples[i], n);
 
-                signal_pointer++;
+                signal_pointer += n;
+                i += n - 1;
 
                 if (signal_pointer >= num_points) {
 
                     signal_pointer = 0;
 
-                    int mult = 1;
-                    // double square signal
-                    for (uint32_t i = 0; i < num_points; i++) {
-
-                        double real = signal[i][REAL];
-                        double imag = signal[i][IMAG];
-
-                        double real2 = real * real - imag * imag;
-                        double imag2 = 2 * real * imag;
-
-                        if (!squared) {
-                            signal[i][REAL] = mult * (real2 * real2 - imag2 * imag2);
-                            signal[i][IMAG] = mult * 2 * real2 * imag2;
-                        } else {
-                            signal[i][REAL] = mult * real2;
-                            signal[i][IMAG] = mult * imag2;
-                        }
-
-                        mult *= -1;
-                    }
-
-                    fftw_execute(plan);
+                    // square or double square the signal
+                    vrt_fft_execute(&fft, squared ? 2 : 4);
+                    vrt_fft_power(&fft, power);
 
                     double max = 0;
                     int32_t max_i = -1;
 
                     for (uint32_t i = 0; i < num_points; i++) {
-                        double mag = sqrt(result[i][REAL] * result[i][REAL] +
-                                  result[i][IMAG] * result[i][IMAG]);
+                        double mag = sqrt(power[i]);
                         // ignore 10% of bins around DC (exp.)
                         // if ( (mag > max) and (not ignore_dc or (abs((int32_t)i-(int32_t)num_points/2) ) > num_points/10)  ) {
                         if ( (mag > max) and (i >= min_bin) and (i <= max_bin)) {
@@ -336,6 +327,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
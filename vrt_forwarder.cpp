@@ -19,13 +19,15 @@
 
 #include <complex.h>
 
+#include "vrt-tools.h"
+
 namespace po = boost::program_options;
 
 int main(int argc, char* argv[])
 {
 
     // variables to be set by po
-    std::string zmq_address;
+    std::string zmq_address, bind_address;
     uint16_t port, pub_port;
     int hwm;
 
@@ -35,9 +37,10 @@ int main(int argc, char* argv[])
 
     desc.add_options()
         ("help", "help message")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "(VRT) ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "(VRT) ZMQ address or URI, e.g. ipc")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "(VRT) ZMQ SUB port")
         ("pub-port", po::value<uint16_t>(&pub_port)->default_value(50101), "VRT ZMQ PUB port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "VRT ZMQ bind address(es) or URI(s), e.g. \"*,ipc\"")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "(VRT) ZMQ HWM")
 
     ;
@@ -59,15 +62,13 @@ int main(int argc, char* argv[])
 
     void *subscriber = zmq_socket(context, ZMQ_XSUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
 
     void *publisher = zmq_socket(context, ZMQ_XPUB);
     rc = zmq_setsockopt (publisher, ZMQ_SNDHWM, &hwm, sizeof hwm);
-    connect_string = "tcp://*:" + std::to_string(pub_port);
-    rc = zmq_bind(publisher, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_bind(publisher, bind_address, pub_port))
+        return 1;
 
     zmq_proxy(subscriber, publisher, NULL);
 
@@ -105,7 +105,7 @@ int main(int argc, char* argv[])
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
         ("dt-trace", "use DT trace data in VRT stream")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
@@ -160,9 +160,8 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, main_port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     bool first_frame = true;
@@ -172,7 +171,9 @@ int main(int argc, char* argv[])
     auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     int64_t num_total_samps = 0;
     int64_t samples_per_update = 0;
@@ -189,11 +190,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -274,7 +278,7 @@ int main(int argc, char* argv[])
                 std::cerr << "# WARNING: DT metadata is present in the stream, but it is ignored. Did you forget --dt-trace?" << std::endl;
                 dt_trace_warning_given = true;
             }
-            dt_process(buffer, sizeof(buffer), &vrt_packet, &dt_ext_context);
+            dt_process(buffer, vrt_msg.words, &vrt_packet, &dt_ext_context);
         }
 
         if (start_rx and vrt_packet.data) {
@@ -376,6 +380,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
@@ -33,6 +33,8 @@
 #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
 
 #ifdef __APPLE__
 #define DEFAULT_GNUPLOT_TERMINAL "qt"
@@ -96,8 +98,8 @@ int main(int argc, char* argv[])
 {
 
     // FFTW
-    fftw_complex **signal, *result;
-    fftw_plan plan[2];
+    std::vector<vrt_fft_type> fft;
+    double *power;
 
     float **mean_freq;
     float **mean_time;
@@ -129,9 +131,11 @@ int main(int argc, char* argv[])
     uint16_t instance, main_port, port;
     uint32_t channel;
     int hwm;
+    vrt_rt_type rt;
+    uint16_t metrics_port;
+    std::string metrics_address;
+    std::string trace_file;
     float dm, period, agg_time;
-    uint64_t seqno[] = {0, 0};
-    float mean_block[] = {0, 0};
     int time_integrations;
     int buffer_size;
     float period_samples_float, amplitude;
@@ -159,21 +163,29 @@ int main(int argc, char* argv[])
         ("amplitude", po::value<float>(&amplitude)->default_value(1), "amplitude correction of second channel")
         ("term", po::value<std::string>(&gnuplot_terminal)->default_value(DEFAULT_GNUPLOT_TERMINAL), "Gnuplot terminal (x11 or qt)")
         ("quiet", "no data output")
-        ("sum", "sum polarizations")
+        ("sum", "sum channels (polarizations)")
         ("audio", "enable audio")
         ("squelch", "audio squelch")
         ("gain", po::value<int>(&gain)->default_value(8), "audio gain")
         ("gnuplot", "enable gnuplot mode")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("float", "single precision FFT")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
+        ("shm", "read the stream from shared memory, from a producer on this host started with --shm")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("metrics-port", po::value<uint16_t>(&metrics_port)->default_value(0), "serve Prometheus metrics on this HTTP port (0: off)")
+        ("metrics-address", po::value<std::string>(&metrics_address)->default_value("127.0.0.1"), "interface to serve metrics on, * for all")
+        ("trace", po::value<std::string>(&trace_file), "write a Chrome trace of the processing stages to this file on exit and on SIGUSR1 (build with VRT_TRACE)")
 
     ;
     // clang-format on
+    init_rt(&rt);
+    vrt_rt_options(desc, &rt, 1<<VRT_RT_RX | 1<<VRT_RT_DSP | 1<<VRT_RT_IO);
+    vrt_fft_options(desc);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -188,6 +200,9 @@ int main(int argc, char* argv[])
         return ~0;
     }
 
+    if (not vrt_fft_planner_init())
+        return 1;
+
     bool progress               = vm.count("progress") > 0;
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
@@ -199,9 +214,8 @@ int main(int argc, char* argv[])
     bool squelch                = vm.count("squelch") > 0;
     bool int_second             = (bool)vm.count("int-second");
     bool zmq_split              = vm.count("zmq-split") > 0;
-
-    context_type vrt_context;
-    init_context(&vrt_context);
+    bool shm                    = vm.count("shm") > 0;
+    bool single                 = vm.count("float") > 0;
 
     packet_type vrt_packet;
 
@@ -223,11 +237,6 @@ int main(int argc, char* argv[])
         vrt_packet.channel_filt |= 1<<std::stoi(channel_strings[ch]);
     }
 
-    if (channel_nums.size() > 2) {
-        printf("More than 2 channels not supported.\n");
-        exit(1);
-    }
-
     if (zmq_split) {
         if (channel_nums.size()>1) {
             printf("Multiple channels with --zmq-split is not supported.\n");
@@ -238,18 +247,37 @@ int main(int argc, char* argv[])
         vrt_packet.channel_filt = 1;
     }
 
+    // state per channel, in the order given by --channel
+    size_t num_channels = channel_nums.size();
+    vrt_streams_type streams;
+    init_streams(&streams);
+    for (size_t ch = 0; ch < num_channels; ch++)
+        vrt_stream_add(&streams, 1<<channel_nums[ch]);
+
+    fft.resize(num_channels);
+    std::vector<uint64_t> seqno(num_channels, 0);
+    std::vector<float> mean_block(num_channels, 0);
+
     // FILE *write_ptr;
     // write_ptr = fopen("dedisp.fc32","wb");  // w for write, b for binary
 
     // ZMQ
 
     void *context = zmq_ctx_new();
+    if (not vrt_rt_apply(&rt, context))
+        return 1;
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
-    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    vrt_shm_reader_type* shm_reader = NULL;
+    if (shm) {
+        shm_reader = vrt_shm_attach(main_port);
+        if (shm_reader == NULL)
+            return 1;
+    } else {
+        if (not vrt_connect(subscriber, zmq_address, main_port))
+            return 1;
+        zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    }
 
     bool first_frame = true;
 
@@ -258,7 +286,21 @@ int main(int argc, char* argv[])
     auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ messages, received on their own thread and parsed in place
+    vrt_metrics_type metrics;
+    init_metrics(&metrics);
+    if (metrics_port > 0 and not vrt_metrics_start(&metrics, context, metrics_address, metrics_port, "vrt_pulsar", hwm))
+        return 1;
+
+    if (vm.count("trace")) {
+        vrt_trace_start(trace_file);
+        VRT_TRACE_THREAD("main");
+    }
+
+    vrt_receiver_type receiver;
+    vrt_receiver_start(&receiver, subscriber, &rt, &metrics, shm_reader);
+    vrt_rt_thread(&rt, VRT_RT_DSP);
+    vrt_msg_type* vrt_msg;
 
     unsigned long long num_total_samps = 0;
 
@@ -269,33 +311,34 @@ int main(int argc, char* argv[])
     bool start_rx = false;
     uint64_t last_fractional_seconds_timestamp = 0;
 
-    uint32_t signal_pointer[] = {0, 0};
-    uint32_t block_counter[] = {0, 0};
-    uint32_t integration_counter[] = {0, 0};
+    std::vector<uint32_t> signal_pointer(num_channels, 0);
+    std::vector<uint32_t> block_counter(num_channels, 0);
 
     bool first_block = true;
 
     while (not stop_signal_called
            and (num_requested_samples > num_total_samps or num_requested_samples == 0) ) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_receiver_recv(&receiver, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg->buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        vrt_stream_type* stream;
+        if (not vrt_process_stream(buffer, vrt_msg->words, &streams, &vrt_packet, &stream)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
 
-        if (not vrt_packet.context and not vrt_packet.data)
-            continue;
+        vrt_metrics_packet(&metrics, &vrt_packet, stream ? &stream->context : &streams.other);
 
-        uint32_t ch = 0;
-        for(ch = 0; ch<channel_nums.size(); ch++)
-            if (vrt_packet.stream_id & (1 << channel_nums[ch]) )
-                break;
+        if (stream == NULL or stream->index < 0 or (not vrt_packet.context and not vrt_packet.data))
+            continue;
 
-        uint32_t channel = channel_nums[ch];
+        uint32_t ch = stream->index;
+        context_type& vrt_context = stream->context;
 
         if (not start_rx and vrt_packet.context) {
             vrt_print_context(&vrt_context);
@@ -308,23 +351,23 @@ int main(int argc, char* argv[])
 
             time_integrations = agg_time*(vrt_context.sample_rate/num_bins)/1000;
 
-            signal = (fftw_complex **)malloc(sizeof(fftw_complex*)*channel_nums.size());
-
             for (size_t ch=0; ch < channel_nums.size(); ch++)
-                signal[ch] = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
-
-            result = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
+                vrt_fft_init(&fft[ch], num_bins, single, &rt);
+            vrt_fft_planner_start();
 
-            for (size_t ch=0; ch < channel_nums.size(); ch++)
-                plan[ch] = fftw_plan_dft_1d(num_bins, signal[ch], result, FFTW_FORWARD, FFTW_ESTIMATE);
+            power = (double*) vrt_alloc(sizeof(double) * num_bins);
+            vrt_rt_prefault(&rt, power, sizeof(double) * num_bins);
 
             data_block = (float ***)malloc(sizeof(float *)*channel_nums.size());
 
+            // one buffer per channel, with the rows of all bins back to back
             for (size_t ch=0; ch < channel_nums.size(); ch++) {
                 data_block[ch] = (float **)malloc(sizeof(float *)*num_bins);
+                float* rows = (float *)vrt_alloc(num_bins * 2 * sizeof(float)*block_size);
+                vrt_rt_prefault(&rt, rows, num_bins * 2 * sizeof(float)*block_size);
 
                 for(size_t i=0; i < num_bins; i++) {
-                    data_block[ch][i] = (float *)malloc( 2 * sizeof(float)*block_size);
+                    data_block[ch][i] = rows + i * 2 * block_size;
                 }
             }
 
@@ -333,11 +376,13 @@ int main(int argc, char* argv[])
 
             for (size_t ch=0; ch < channel_nums.size(); ch++) {
                 mean_freq[ch] = (float*)malloc(num_bins * sizeof(float));
-                mean_time[ch] = (float*)malloc(block_size * sizeof(float));
+                mean_time[ch] = (float*)vrt_alloc(block_size * sizeof(float));
+                vrt_rt_prefault(&rt, mean_time[ch], block_size * sizeof(float));
             }
 
             median_freq = (float*)malloc(num_bins * sizeof(float));
-            median_time = (float*)malloc(block_size * sizeof(float));
+            median_time = (float*)vrt_alloc(block_size * sizeof(float));
+            vrt_rt_prefault(&rt, median_time, block_size * sizeof(float));
 
             dedisp = (float **)malloc(sizeof(float *)*channel_nums.size());
 
@@ -396,6 +441,8 @@ int main(int argc, char* argv[])
                 if (!audio_pipe)
                 {
                   printf("Error starting Sox play.\n");
+                  vrt_receiver_stop(&receiver);
+                  vrt_metrics_stop(&metrics);
                   return EXIT_FAILURE;
                 }
             }
@@ -425,29 +472,32 @@ int main(int argc, char* argv[])
                 first_block = false;
             }
 
-            int mult = 1;
+            int mult = 1; // fftshift
+            std::complex<double> gain(amplitude, 0);
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
             for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
 
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                if (ch==1) {
-                    signal[ch][signal_pointer[ch]][REAL] = amplitude*mult*re;
-                    signal[ch][signal_pointer[ch]][IMAG] = amplitude*mult*img;
-                } else {
-                    signal[ch][signal_pointer[ch]][REAL] = mult*re;
-                    signal[ch][signal_pointer[ch]][IMAG] = mult*img;
+                // convert up to the end of the packet or the frame, i is the last sample converted
+                uint32_t n = std::min(vrt_packet.num_rx_samps - i, num_bins - signal_pointer[ch]);
+                {
+                    VRT_TRACE_SCOPE("convert");
+                    vrt_fft_convert(&fft[ch], signal_pointer[ch], &samples[i], n,
+                                    &mult, (ch==1) ? &gain : NULL);
                 }
-                mult *= -1; // fftshift
 
-                signal_pointer[ch]++;
+                signal_pointer[ch] += n;
+                i += n - 1;
 
                 if (signal_pointer[ch] >= num_bins) {
 
                     signal_pointer[ch] = 0;
 
-                    fftw_execute(plan[ch]);
+                    {
+                        VRT_TRACE_SCOPE("fftw_execute");
+                        auto fft_start = std::chrono::steady_clock::now();
+                        vrt_fft_execute(&fft[ch]);
+                        vrt_metrics_observe_since(&metrics, &metrics.fft, fft_start);
+                    }
 
                     uint64_t seconds = vrt_packet.integer_seconds_timestamp;
                     uint64_t frac_seconds = vrt_packet.fractional_seconds_timestamp;
@@ -457,58 +507,67 @@ int main(int argc, char* argv[])
                         seconds++;
                     }
 
-                    float sum_channels = 0;
-                    for (uint32_t i = 0; i < num_bins; ++i) {
-                        float mag = sqrt(result[i][REAL] * result[i][REAL] +
-                                            result[i][IMAG] * result[i][IMAG]);
-                        data_block[ch][i][block_size+block_counter[ch]] = mag;
-                        mean_freq[ch][i] += mag/(float)block_size;
-                        sum_channels += mag;
-                    }
+                    {
+                        VRT_TRACE_SCOPE("detect");
+                        vrt_fft_power(&fft[ch], power);
+                        float sum_channels = 0;
+                        for (uint32_t i = 0; i < num_bins; ++i) {
+                            float mag = sqrt(power[i]);
+                            data_block[ch][i][block_size+block_counter[ch]] = mag;
+                            mean_freq[ch][i] += mag/(float)block_size;
+                            sum_channels += mag;
+                        }
 
-                    mean_time[ch][block_counter[ch]] = sum_channels/(float)num_bins;
+                        mean_time[ch][block_counter[ch]] = sum_channels/(float)num_bins;
+                    }
 
                     block_counter[ch]++;
 
                     if (block_counter[ch] == block_size) {
-                        // mow the lawn!
-                        memcpy(median_freq, mean_freq[ch], num_bins * sizeof(float));
-                        memcpy(median_time, mean_time[ch], block_size * sizeof(float));
-                        sort(median_freq,num_bins);
-                        sort(median_time,block_size);
-
-                        float thresh_freq = f_threshold*median_freq[(num_bins+1)/2-1];
-                        float thresh_time = t_threshold*median_time[(block_size+1)/2-1];
-
-                        float freq_med = median_freq[(num_bins+1)/2-1];
-                        float time_med = median_time[(block_size+1)/2-1];
-
-                        int clean = 0;
-
-                        for (size_t chan = 0; chan < num_bins; chan++)
-                            for (size_t block = 0; block < block_size; block++) {
-                                if ( mean_freq[ch][chan] > thresh_freq ) {
-                                    data_block[ch][chan][block_size+block] = freq_med;
-                                    clean++;
-                                    continue;
-                                }
-                                if ( mean_time[ch][block] > thresh_time) {
-                                    data_block[ch][chan][block_size+block] = time_med;
-                                    clean++;
+                        {
+                            VRT_TRACE_SCOPE("rfi");
+                            // mow the lawn!
+                            memcpy(median_freq, mean_freq[ch], num_bins * sizeof(float));
+                            memcpy(median_time, mean_time[ch], block_size * sizeof(float));
+                            sort(median_freq,num_bins);
+                            sort(median_time,block_size);
+
+                            float thresh_freq = f_threshold*median_freq[(num_bins+1)/2-1];
+                            float thresh_time = t_threshold*median_time[(block_size+1)/2-1];
+
+                            float freq_med = median_freq[(num_bins+1)/2-1];
+                            float time_med = median_time[(block_size+1)/2-1];
+
+                            int clean = 0;
+
+                            for (size_t chan = 0; chan < num_bins; chan++)
+                                for (size_t block = 0; block < block_size; block++) {
+                                    if ( mean_freq[ch][chan] > thresh_freq ) {
+                                        data_block[ch][chan][block_size+block] = freq_med;
+                                        clean++;
+                                        continue;
+                                    }
+                                    if ( mean_time[ch][block] > thresh_time) {
+                                        data_block[ch][chan][block_size+block] = time_med;
+                                        clean++;
+                                    }
                                 }
-                            }
+                        }
 
                         // now what?
                         // dedisperse and aggregate
 
-                        for (size_t index = 0; index < block_size/time_integrations; index++) {
-                            dedisp[ch][index] = 0;
-                        }
-
-                        for(size_t chan=0; chan < num_bins; chan++) {
+                        {
+                            VRT_TRACE_SCOPE("dedisperse");
                             for (size_t index = 0; index < block_size/time_integrations; index++) {
-                                for (size_t j=0; j<time_integrations; j++) {
-                                     dedisp[ch][index] += data_block[ch][chan][block_size+index*time_integrations+j+dispersion[chan]];
+                                dedisp[ch][index] = 0;
+                            }
+
+                            for(size_t chan=0; chan < num_bins; chan++) {
+                                for (size_t index = 0; index < block_size/time_integrations; index++) {
+                                    for (size_t j=0; j<time_integrations; j++) {
+                                         dedisp[ch][index] += data_block[ch][chan][block_size+index*time_integrations+j+dispersion[chan]];
+                                    }
                                 }
                             }
                         }
@@ -529,42 +588,51 @@ int main(int argc, char* argv[])
                         }
                         mean_block[ch] = mean_block[ch]/(block_size/time_integrations);
 
+                        VRT_TRACE_SCOPE("output");
+
                         // if (!first_block) {
                             for (size_t index = 0; index < block_size/time_integrations; index++) {
                                 plotbuffer[ch][seqno[ch] % buffer_size] = dedisp[ch][index];
+                                // with several channels, output once the last channel has its block
                                 if (!gnuplot and !quiet) {
-                                    if (channel_nums.size()==2) {
-                                        if (ch==1) {
+                                    if (num_channels > 1) {
+                                        if (ch == num_channels-1) {
+                                            printf("%i %i",period_samples_int,(int)floor(fmod(seqno[ch],period_samples_float)));
                                             if (sum) {
-                                                printf("%i %i %f\n",period_samples_int,(int)floor(fmod(seqno[ch],period_samples_float)), dedisp[0][index] + dedisp[1][index]);
+                                                float total = 0;
+                                                for (size_t c = 0; c < num_channels; c++)
+                                                    total += dedisp[c][index];
+                                                printf(" %f", total);
                                             } else {
-                                                printf("%i %i %f %f\n",period_samples_int,(int)floor(fmod(seqno[ch],period_samples_float)), dedisp[0][index], dedisp[1][index]);
+                                                for (size_t c = 0; c < num_channels; c++)
+                                                    printf(" %f", dedisp[c][index]);
                                             }
+                                            printf("\n");
                                         }
                                     } else {
                                         printf("%i %i %f\n",period_samples_int,(int)floor(fmod(seqno[ch],period_samples_float)), dedisp[ch][index]);
                                     }
                                 }
                                 if (audio){
-                                    if (channel_nums.size()==2) {
-                                        if (ch==1) {
+                                    if (num_channels > 1) {
+                                        if (ch == num_channels-1) {
                                             if (sum) {
                                                 // write sum on single channel
-                                                int16_t sample = 32768.0*(dedisp[0][index]-mean_block[0])/mean_block[0] +
-                                                                 32768.0*(dedisp[1][index]-mean_block[1])/mean_block[1];
-                                                if (squelch and sample < 2*SQUELCH_THRESHOLD*32768.0)
+                                                float total = 0;
+                                                for (size_t c = 0; c < num_channels; c++)
+                                                    total += 32768.0*(dedisp[c][index]-mean_block[c])/mean_block[c];
+                                                int16_t sample = total;
+                                                if (squelch and sample < num_channels*SQUELCH_THRESHOLD*32768.0)
                                                     sample = 0;
-                                                fwrite(&sample, sizeof(sample), 1, audio_pipe);
+                                                vrt_metrics_output(&metrics, fwrite(&sample, sizeof(sample), 1, audio_pipe)*sizeof(sample));
                                             } else {
-                                                // write 2 channels
-                                                int16_t sample = 32768.0*(dedisp[0][index]-mean_block[0])/mean_block[0];
-                                                if (squelch and sample < SQUELCH_THRESHOLD*32768.0)
-                                                    sample = 0;
-                                                fwrite(&sample, sizeof(sample), 1, audio_pipe);
-                                                sample = 32768.0*(dedisp[1][index]-mean_block[1])/mean_block[1];
-                                                if (squelch and sample < SQUELCH_THRESHOLD*32768.0)
-                                                    sample = 0;
-                                                fwrite(&sample, sizeof(sample), 1, audio_pipe);
+                                                // write all channels
+                                                for (size_t c = 0; c < num_channels; c++) {
+                                                    int16_t sample = 32768.0*(dedisp[c][index]-mean_block[c])/mean_block[c];
+                                                    if (squelch and sample < SQUELCH_THRESHOLD*32768.0)
+                                                        sample = 0;
+                                                    vrt_metrics_output(&metrics, fwrite(&sample, sizeof(sample), 1, audio_pipe)*sizeof(sample));
+                                                }
                                             }
                                         }
                                     } else {
@@ -572,7 +640,7 @@ int main(int argc, char* argv[])
                                         int16_t sample = 32768.0* (dedisp[ch][index]-mean_block[ch])/mean_block[ch];
                                         if (squelch and sample < SQUELCH_THRESHOLD*32768.0)
                                                     sample = 0;
-                                        fwrite(&sample, sizeof(sample), 1, audio_pipe);
+                                        vrt_metrics_output(&metrics, fwrite(&sample, sizeof(sample), 1, audio_pipe)*sizeof(sample));
                                     }
                                 }
                                 seqno[ch]++;
@@ -593,30 +661,30 @@ int main(int argc, char* argv[])
                         if (gnuplot) {
 
                             float mean_plot_buffer = 0;
-                            for (i = 0; i< buffer_size; i++) {
-                                mean_plot_buffer += plotbuffer[ch][i];
+                            for (int k = 0; k < buffer_size; k++) {
+                                mean_plot_buffer += plotbuffer[ch][k];
                             }
                             mean_plot_buffer /= buffer_size;
 
                             float time_per_sample = vrt_context.sample_rate/(num_bins*time_integrations);
 
-                            if (channel_nums.size()==2) {
-                                if (seqno[0] == seqno[1]) {
-                                    printf("set xrange [%.2lf:%.2lf];\n", seqno[0]/time_per_sample, (seqno[0] + buffer_size)/time_per_sample);
-                                    printf("set yrange [%.2lf:%.2lf];\n", mean_plot_buffer*0.97, mean_plot_buffer*1.5);
-                                    printf("plot '-' u 1:2 notitle w l, '-' u 1:3 notitle w l\n");
-                                    for (i = 0; i< buffer_size; i++) {
-                                        printf("%lf\t%lf\t%lf\n",(seqno[0]+i)/time_per_sample, plotbuffer[0][(seqno[0]+i)%buffer_size], plotbuffer[1][(seqno[1]+i)%buffer_size] );
-                                    }
+                            // plot when all channels are at the same sample, one curve per channel
+                            bool aligned = true;
+                            for (size_t c = 1; c < num_channels; c++)
+                                aligned = aligned and (seqno[c] == seqno[0]);
+
+                            if (aligned and ch == num_channels-1) {
+                                printf("set xrange [%.2lf:%.2lf];\n", seqno[0]/time_per_sample, (seqno[0] + buffer_size)/time_per_sample);
+                                printf("set yrange [%.2lf:%.2lf];\n", mean_plot_buffer*0.97, mean_plot_buffer*1.5);
+                                printf("plot '-' u 1:2 notitle w l");
+                                for (size_t c = 1; c < num_channels; c++)
+                                    printf(", '-' u 1:2 notitle w l");
+                                printf("\n");
+                                for (size_t c = 0; c < num_channels; c++) {
+                                    for (int k = 0; k < buffer_size; k++)
+                                        printf("%lf\t%lf\n",(seqno[c]+k)/time_per_sample, plotbuffer[c][(seqno[c]+k)%buffer_size]);
                                     printf("e\n");
                                 }
-                            } else {
-                                printf("set xrange [%.2lf:%.2lf];\n",seqno[ch]/time_per_sample, (seqno[ch] + buffer_size)/time_per_sample);
-                                printf("set yrange [%.2lf:%.2lf];\n", mean_plot_buffer*0.97, mean_plot_buffer*1.5);
-                                printf("plot '-' u 1:2 notitle w l\n");
-                                for (i = 0; i< buffer_size; i++)
-                                    printf("%lf\t%lf\n",(seqno[ch]+i)/time_per_sample, plotbuffer[ch][(seqno[ch]+i)%buffer_size]);
-                                printf("e\n");
                             }
                         }
 
@@ -667,6 +735,12 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_receiver_stop(&receiver);
+    vrt_print_receiver_stats(&receiver);
+    vrt_shm_detach(shm_reader);
+    vrt_print_stream_stats(&streams);
+    vrt_metrics_stop(&metrics);
+    vrt_trace_stop();
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
@@ -39,6 +39,9 @@
 #include <complex.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
+#include "vrt-pfb.h"
 
 namespace po = boost::program_options;
 
@@ -96,7 +99,8 @@ int main(int argc, char* argv[])
 {
   int i,j,k,l,nchan,m=0,nint=1,nsub=60,flag,nuse=1,imin,imax,partial=0;
   fftwf_complex *c,*d;
-  fftwf_plan fft;
+  vrt_fft_plan_type *fft;
+  vrt_pfb_type pfb;
   FILE *outfile;
   char outfname[128]="",prefix[32]="";
   char outformat='f';
@@ -107,12 +111,12 @@ int main(int argc, char* argv[])
   double freq,samp_rate,mjd,freqmin=-1,freqmax=-1;
   struct timeval start,end;
   char tbuf[30],nfd[32],header[256]="";
-  int sign=1,fac=1;
+  int fac=1;
 
   // variables to be set by po
   std::string zmq_address, path, output;
   uint16_t port;
-  uint32_t channel;
+  uint32_t channel, wola_partitions;
   int hwm;
   size_t num_requested_samples;
   double total_time;
@@ -137,14 +141,17 @@ int main(int argc, char* argv[])
       ("progress", "periodically display short-term bandwidth")
       ("two", "square signal before processing (to detect BPSK signals)")
       ("four", "square-square signal before processing (to detect QPSK signals")
+      ("wola", "apply Weighted OverLap Add method (polyphase filterbank) instead of the Hamming window")
+      ("wola-partitions", po::value<uint32_t>(&wola_partitions)->default_value(4), "number of WOLA partitions")
       ("int-second", "align start of reception to integer second")
       ("quiet", "Quiet mode, no output")
       ("continue", "don't abort on a bad packet")
-      ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+      ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
       ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
       ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
   ;
   // clang-format on
+  vrt_fft_options(desc);
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
   po::notify(vm);
@@ -159,6 +166,9 @@ int main(int argc, char* argv[])
       return ~0;
   }
 
+  if (not vrt_fft_planner_init())
+    return 1;
+
   bool progress               = vm.count("progress") > 0;
   bool continue_on_bad_packet = vm.count("continue") > 0;
   bool int_second             = vm.count("int-second") > 0;
@@ -166,6 +176,12 @@ int main(int argc, char* argv[])
   bool quiet                  = vm.count("quiet") > 0;
   bool flag_x2                = vm.count("two") > 0;
   bool flag_x4                = vm.count("four") > 0;
+  bool wola                   = vm.count("wola") > 0;
+
+  if (wola and wola_partitions == 0) {
+    fprintf(stderr, "--wola-partitions must be at least 1.\n");
+    return 1;
+  }
 
   context_type vrt_context;
   init_context(&vrt_context);
@@ -178,16 +194,17 @@ int main(int argc, char* argv[])
   void *context = zmq_ctx_new();
   void *subscriber = zmq_socket(context, ZMQ_SUB);
   int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-  std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-  rc = zmq_connect(subscriber, connect_string.c_str());
-  assert(rc == 0);
+  if (not vrt_connect(subscriber, zmq_address, port))
+      return 1;
   zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
   // time keeping
   auto start_time = std::chrono::steady_clock::now();
   auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-  uint32_t buffer[ZMQ_BUFFER_SIZE];
+  // ZMQ message, parsed in place
+  vrt_msg_type vrt_msg;
+  init_msg(&vrt_msg);
 
   unsigned long long num_total_samps = 0;
 
@@ -209,11 +226,14 @@ int main(int argc, char* argv[])
          and (num_requested_samples > num_total_samps or num_requested_samples == 0)
          and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-      int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+      int len = vrt_recv(subscriber, &vrt_msg);
+      if (len < 0)
+          continue;
+      uint32_t* buffer = vrt_msg.buffer;
 
       const auto now = std::chrono::steady_clock::now();
 
-      if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+      if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
           printf("Not a Vita49 packet?\n");
           continue;
       }
@@ -250,6 +270,8 @@ int main(int argc, char* argv[])
           printf(" Bandwidth: %f MHz\n",samp_rate*1e-6);
           printf(" Sampling time: %f us\n",1e6/samp_rate);
           printf(" Number of channels: %d\n",nchan);
+          if (wola)
+            printf(" WOLA partitions: %u\n",wola_partitions);
           printf(" Channel size: %.2f Hz\n",samp_rate/(float) nchan);
           printf(" Integration time: %.2f s\n",tint);
           printf(" Number of averaged spectra: %d\n",nint);
@@ -257,20 +279,25 @@ int main(int argc, char* argv[])
           printf(" Starting index: %d\n",m);
 
           // Allocate
-          c=(fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*nchan);
-          d=(fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex)*nchan);
+          c=(fftwf_complex *)vrt_alloc(sizeof(fftwf_complex)*nchan);
+          d=(fftwf_complex *)vrt_alloc(sizeof(fftwf_complex)*nchan);
           cbuf=(char *) malloc(sizeof(char)*2*nchan);
-          fbuf=(float *) malloc(sizeof(float)*2*nchan);
-          z=(float *) malloc(sizeof(float)*nchan);
+          fbuf=(float *) vrt_alloc(sizeof(float)*2*nchan);
+          z=(float *) vrt_alloc(sizeof(float)*nchan);
           cz=(char *) malloc(sizeof(char)*nchan);
-          zw=(float *) malloc(sizeof(float)*nchan);
+          zw=(float *) vrt_alloc(sizeof(float)*nchan);
 
-          // Compute window
+          // Compute window, including the ci16 scaling
           for (i=0;i<nchan;i++)
-            zw[i]=0.54-0.46*cos(2.0*M_PI*i/(nchan-1));
+            zw[i]=(0.54-0.46*cos(2.0*M_PI*i/(nchan-1)))/SCALE_MAX;
+
+          // or the WOLA taps, with the same scaling
+          if (wola)
+            vrt_pfb_init(&pfb,nchan,wola_partitions,1.0/SCALE_MAX);
 
           // Plan
-          fft=fftwf_plan_dft_1d(nchan,c,d,FFTW_FORWARD,FFTW_ESTIMATE);
+          fft=vrt_fft_plan(nchan,true,c,d);
+          vrt_fft_planner_start();
 
       }
 
@@ -315,7 +342,7 @@ int main(int argc, char* argv[])
               outfile=fopen(outfname,"w");
           }
 
-          // int mult = 1;
+          const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
           for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
 
               if (signal_pointer==0 and nint_counter==0) {
@@ -331,20 +358,23 @@ int main(int argc, char* argv[])
                 start.tv_usec = frac_seconds/1e6;
               }
 
-              int16_t re;
-              memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-              int16_t img;
-              memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-              c[signal_pointer][REAL]=(float)(re/32768.0)*zw[signal_pointer];
-              c[signal_pointer][IMAG]=(float)(img/32768.0)*zw[signal_pointer]*sign;
-              // mult *= -1;
+              // convert up to the end of the packet or the frame, i is the last sample converted
+              uint32_t n = std::min(vrt_packet.num_rx_samps - i, (uint32_t)nchan - signal_pointer);
+              if (wola)
+                vrt_pfb_convert(&pfb, signal_pointer, &samples[i], n);
+              else
+                vrt_convert_cf32(&samples[i], (std::complex<float>*)&c[signal_pointer], n, NULL, &zw[signal_pointer]);
 
-              signal_pointer++;
+              signal_pointer += n;
+              i += n - 1;
 
               if (signal_pointer >= nchan) {
                   float square_real, square_imag;
                   signal_pointer = 0;
 
+                  if (wola)
+                    vrt_pfb_frame(&pfb,c);
+
                   // Square once
                   if (flag_x2 || flag_x4) {
                     for (uint32_t i = 0; i < nchan; i++) {
@@ -366,7 +396,7 @@ int main(int argc, char* argv[])
                   }
 
                   // Execute
-                  fftwf_execute(fft);
+                  vrt_fft_execute_dft(fft,c,d);
 
                   // Shift/Integrate
                   for (j=0;j<nchan;j++) {
@@ -507,17 +537,21 @@ int main(int argc, char* argv[])
   // Close file
   fclose(outfile);
 
+  vrt_msg_close(&vrt_msg);
+
   // Destroy plan
-  fftwf_destroy_plan(fft);
+  vrt_fft_plan_destroy(fft);
 
   // Deallocate
   free(cbuf);
-  free(fbuf);
-  fftwf_free(c);
-  fftwf_free(d);
-  free(z);
+  vrt_free(fbuf);
+  vrt_free(c);
+  vrt_free(d);
+  vrt_free(z);
   free(cz);
-  free(zw);
+  vrt_free(zw);
+  if (wola)
+    vrt_pfb_free(&pfb);
 
   return 0;
 }
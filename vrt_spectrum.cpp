@@ -36,6 +36,11 @@
 #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
+#include "vrt-pfb.h"
+#include "vrt-dsp.h"
+#include "vrt-spectrum-file.h"
 #include "dt-extended-context.h"
 #include "tracker-extended-context.h"
 
@@ -51,7 +56,6 @@ namespace po = boost::program_options;
 #define REAL 0
 #define IMAG 1
 
-const double pi = std::acos(-1.0);
 
 static bool stop_signal_called = false;
 void sig_int_handler(int)
@@ -95,16 +99,18 @@ int main(int argc, char* argv[])
 {
 
     // FFTW
-    fftw_complex *signal, *result;
-    fftw_plan plan;
+    vrt_fft_engine_type fft;
+    fftw_complex *signal;            // frame being filled
+    fftwf_complex *signalf;          // frame being filled, single precision
     double *magnitudes, *filter_out;
 
-    std::complex<float> *wola_buffer;
-    float *wola_taps;
+    vrt_pfb_type pfb;                // WOLA front end
+    vrt_zoom_type zoom;              // zoom band front end
 
     uint32_t num_points = 0;
     uint32_t num_bins = 0;
     uint32_t wola_partitions;
+    uint32_t fft_threads, fft_batch;
 
     bool power2;
     float bin_size, integration_time = 0.0;
@@ -113,6 +119,10 @@ int main(int argc, char* argv[])
     double min_offset, max_offset;
     uint32_t output_counter = 0;
     int32_t min_bin, max_bin;
+    // bins output, the DC bin (-1: outside the band), offset (Hz) and rate of the transformed band
+    uint32_t out_first, out_last;
+    int32_t dc_bin;
+    double band_center, band_rate;
 
     // variables to be set by po
     std::string file, type, zmq_address, gnuplot_terminal, gnuplot_commands, source;
@@ -123,6 +133,10 @@ int main(int argc, char* argv[])
     uint16_t instance, main_port, port;
     uint32_t channel;
     int hwm;
+    vrt_rt_type rt;
+    uint16_t metrics_port;
+    std::string metrics_address;
+    std::string trace_file;
 
     bool dt_trace_warning_given = false;
 
@@ -130,6 +144,10 @@ int main(int argc, char* argv[])
     float max_y = -1e10;
 
     FILE *outfile;
+    vrt_specfile_type specfile;      // --spectrum-file writer
+    std::string specfile_name, specfile_format;
+    std::vector<double> record_columns;
+    std::vector<float> record_values;
 
     std::vector<double> poly;
 
@@ -163,8 +181,12 @@ int main(int argc, char* argv[])
         ("four", "square-square signal before processing (to detect QPSK signals")
         ("wola", "apply Weighted OverLap Add method")
         ("wola-partitions", po::value<uint32_t>(&wola_partitions)->default_value(4), "number of WOLA partitions")
+        ("fft-threads", po::value<uint32_t>(&fft_threads)->default_value(0), "transform batches of frames on this many worker threads (0: on the processing thread)")
+        ("fft-batch", po::value<uint32_t>(&fft_batch)->default_value(0), "frames per batch with --fft-threads (0: automatic)")
+        ("float", "single precision FFT and accumulation")
         ("min-offset", po::value<double>(&min_offset), "min. freq. offset to track (Hz)")
         ("max-offset", po::value<double>(&max_offset), "max. freq. offset to track (Hz)")
+        ("zoom", "transform only the span of --min-offset/--max-offset: mix it to DC, decimate and output its bins")
         ("gnuplot-commands", po::value<std::string>(&gnuplot_commands)->default_value(""), "Extra gnuplot commands like \"set yr [ymin:ymax];\"")
         ("term", po::value<std::string>(&gnuplot_terminal)->default_value(DEFAULT_GNUPLOT_TERMINAL), "Gnuplot terminal (x11 or qt)")
         ("minmax", "min/max hold for y-axis scale (gnuplot)")
@@ -172,18 +194,27 @@ int main(int argc, char* argv[])
         ("dc", "suppress DC peak")
         ("ecsv", "output in ECSV format (Astropy)")
         ("bin-file", po::value<std::string>(&file), "output binary data to file")
+        ("spectrum-file", po::value<std::string>(&specfile_name), "write the spectra to this compact binary file, with the ECSV header (see vrt_spectrum_to_ecsv)")
+        ("spectrum-format", po::value<std::string>(&specfile_format)->default_value("float32"), "values in the --spectrum-file: float32 or float16")
         ("center-freq", "output center frequency")
         ("temperature", "output temperature")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
         ("dt-trace", "use DT trace data in VRT stream")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
+        ("shm", "read the stream from shared memory, from a producer on this host started with --shm")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("metrics-port", po::value<uint16_t>(&metrics_port)->default_value(0), "serve Prometheus metrics on this HTTP port (0: off)")
+        ("metrics-address", po::value<std::string>(&metrics_address)->default_value("127.0.0.1"), "interface to serve metrics on, * for all")
+        ("trace", po::value<std::string>(&trace_file), "write a Chrome trace of the processing stages to this file on exit and on SIGUSR1 (build with VRT_TRACE)")
     ;
     // clang-format on
+    init_rt(&rt);
+    vrt_rt_options(desc, &rt, 1<<VRT_RT_RX | 1<<VRT_RT_DSP | 1<<VRT_RT_WRITER | 1<<VRT_RT_IO);
+    vrt_fft_options(desc);
     po::variables_map vm;
     // po::store(po::parse_command_line(argc, argv, desc), vm);
     auto parsed = po::command_line_parser(argc, argv).options(desc).positional({}).style(po::command_line_style::unix_style ^ po::command_line_style::allow_short).run();
@@ -199,6 +230,9 @@ int main(int argc, char* argv[])
     }
     po::notify(vm);
 
+    if (not vrt_fft_planner_init())
+        return 1;
+
     bool progress               = vm.count("progress") > 0;
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
@@ -215,13 +249,18 @@ int main(int argc, char* argv[])
     bool iir                    = vm.count("tau") > 0;
     bool minmax                 = vm.count("minmax") > 0;
     bool ecsv                   = vm.count("ecsv") > 0;
-    bool binary                 = vm.count("bin-file") > 0;
+    bool bin_file               = vm.count("bin-file") > 0;
+    bool spectrum_file          = vm.count("spectrum-file") > 0;
+    bool binary                 = bin_file or spectrum_file;
     bool dc                     = vm.count("dc") > 0;
     bool has_source             = vm.count("source") > 0;
     bool zmq_split              = vm.count("zmq-split") > 0;
+    bool shm                    = vm.count("shm") > 0;
     bool wola                   = vm.count("wola") > 0;
     bool flag_x2                = vm.count("two") > 0;
     bool flag_x4                = vm.count("four") > 0;  
+    bool single                 = vm.count("float") > 0;
+    bool zoom_band              = vm.count("zoom") > 0;
 
     if (iir) {
         alpha = (1.0 - exp(-1/(tau/integration_time)));
@@ -231,6 +270,31 @@ int main(int argc, char* argv[])
         throw(std::runtime_error("--int-interval requires --integration_time > 1"));
     }
 
+    if (wola and wola_partitions == 0) {
+        fprintf(stderr, "--wola-partitions must be at least 1.\n");
+        return 1;
+    }
+
+    if (spectrum_file and (bin_file or gnuplot or fftmax)) {
+        fprintf(stderr, "--spectrum-file can not be combined with --bin-file, --gnuplot or --fftmax.\n");
+        return 1;
+    }
+
+    if (specfile_format != "float32" and specfile_format != "float16") {
+        fprintf(stderr, "Invalid --spectrum-format \"%s\", use float32 or float16.\n", specfile_format.c_str());
+        return 1;
+    }
+
+    if (zoom_band and not (vm.count("min-offset") or vm.count("max-offset"))) {
+        fprintf(stderr, "--zoom requires --min-offset and/or --max-offset.\n");
+        return 1;
+    }
+
+    if (zoom_band and (wola or flag_x2 or flag_x4)) {
+        fprintf(stderr, "--zoom can not be combined with --wola, --two or --four.\n");
+        return 1;
+    }
+
     double freq_div;
 
     if (flag_x2 || flag_x4) {
@@ -262,12 +326,20 @@ int main(int argc, char* argv[])
     // ZMQ
 
     void *context = zmq_ctx_new();
+    if (not vrt_rt_apply(&rt, context))
+        return 1;
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
-    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    vrt_shm_reader_type* shm_reader = NULL;
+    if (shm) {
+        shm_reader = vrt_shm_attach(main_port);
+        if (shm_reader == NULL)
+            return 1;
+    } else {
+        if (not vrt_connect(subscriber, zmq_address, main_port))
+            return 1;
+        zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    }
 
     bool first_frame = true;
 
@@ -276,7 +348,21 @@ int main(int argc, char* argv[])
     auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    vrt_metrics_type metrics;
+    init_metrics(&metrics);
+    if (metrics_port > 0 and not vrt_metrics_start(&metrics, context, metrics_address, metrics_port, "vrt_spectrum", hwm))
+        return 1;
+
+    if (vm.count("trace")) {
+        vrt_trace_start(trace_file);
+        VRT_TRACE_THREAD("main");
+    }
+
+    // ZMQ messages, received on their own thread and parsed in place
+    vrt_receiver_type receiver;
+    vrt_receiver_start(&receiver, subscriber, &rt, &metrics, shm_reader);
+    vrt_rt_thread(&rt, VRT_RT_DSP);
+    vrt_msg_type* vrt_msg;
 
     unsigned long long num_total_samps = 0;
 
@@ -290,8 +376,9 @@ int main(int argc, char* argv[])
     uint32_t signal_pointer = 0;
     uint32_t integration_counter = 0;
     uint32_t num_integrations_counter = 0;
+    uint64_t output_bytes = 0;
 
-    if (binary) {
+    if (bin_file) {
         outfile=fopen(file.c_str(),"w");
     }
 
@@ -299,15 +386,20 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_receiver_recv(&receiver, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg->buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg->words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
 
+        vrt_metrics_packet(&metrics, &vrt_packet, &vrt_context);
+
         if (not start_rx and vrt_packet.context) {
             if (!ecsv)
                 vrt_print_context(&vrt_context);
@@ -347,138 +439,178 @@ int main(int argc, char* argv[])
                 max_bin = max_bin > num_bins ? num_bins : max_bin;
             }
 
-            signal = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
-            result = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
-            plan = fftw_plan_dft_1d(num_bins, signal, result, FFTW_FORWARD, FFTW_ESTIMATE);
-            magnitudes = (double*)malloc(num_bins * sizeof(double));
+            out_first = 0;
+            out_last = num_bins;
+            dc_bin = num_bins/2;
+            band_center = 0;
+            band_rate = vrt_context.sample_rate;
+
+            if (zoom_band) {
+                max_bin = max_bin > (int32_t)num_bins-1 ? num_bins-1 : max_bin;
+                if (min_bin > max_bin or
+                    not vrt_zoom_init(&zoom, num_bins, min_bin, max_bin, vrt_context.sample_rate, VRT_SAMPLES_PER_PACKET)) {
+                    fprintf(stderr, "Span too wide to zoom, transforming the full band.\n");
+                    zoom_band = false;
+                } else {
+                    // same bin size, num_bins/decimation bins around the span
+                    num_bins = zoom.num_bins;
+                    band_center = zoom.center;
+                    band_rate = zoom.sample_rate;
+                    min_bin -= zoom.first_bin;
+                    max_bin -= zoom.first_bin;
+                    dc_bin -= zoom.first_bin;
+                    out_first = min_bin;
+                    out_last = max_bin + 1;
+                }
+                if (dc_bin < 1 or dc_bin > (int32_t)num_bins-2)
+                    dc_bin = -1;
+            }
+
+            magnitudes = (double*)vrt_alloc(num_bins * sizeof(double));
             memset(magnitudes, 0, num_bins*sizeof(double));
-            filter_out = (double*)malloc(num_bins * sizeof(double));
+            filter_out = (double*)vrt_alloc(num_bins * sizeof(double));
             memset(filter_out, 0, num_bins*sizeof(double));
 
-            if (wola) {
-                int wola_len = wola_partitions*num_bins;
-                wola_buffer = (std::complex<float>*)malloc(sizeof(std::complex<float>) * wola_len);
-                wola_taps = (float*)malloc(sizeof(float) * wola_len);
-
-                for (uint32_t i = 0; i < wola_len; i++)
-                    wola_buffer[i] = std::complex<float>(0,0);
-
-                // Blackman-Harris window
-                double a0 = 0.35875;
-                double a1 = 0.48829;
-                double a2 = 0.14128;
-                double a3 = 0.01168;
-
-                for (int i=0;i<wola_len;i++) {
-                    int j = i - (wola_len)/2;
-
-                    double blackman_window = a0 - a1*cos(2*pi*(double)i/((double)wola_len-1)) + 
-                                                a2*cos(4*pi*(double)i/((double)wola_len-1)) + 
-                                                a3*cos(6*pi*(double)i/((double)wola_len-1));
-                 
-                    double x = ((double)wola_partitions*pi)*((double)j/(double)wola_len);
-                    if (x!=0)
-                        wola_taps[i] = blackman_window*sin(x)/(x);
-                    else
-                        wola_taps[i] = blackman_window*1.0;
-                }
-            }
+            // squaring never applied to WOLA frames, which are windowed after it
+            int square = (wola or not (flag_x2 || flag_x4)) ? 0 : (flag_x4 ? 4 : 2);
+            vrt_fft_start(&fft, num_bins, magnitudes, square, single, fft_threads, fft_batch, &rt, &metrics);
+            vrt_fft_planner_start();
+            signal = vrt_fft_frame(&fft);
+            signalf = vrt_fft_framef(&fft);
+
+            if (wola)
+                vrt_pfb_init(&pfb, num_bins, wola_partitions, 1, &rt);
 
             if (!ecsv) {
                 printf("# Spectrum parameters:\n");
                 printf("#    Bins: %u\n", num_bins);
                 printf("#    Bin size [Hz]: %.2f\n", binsize);
                 printf("#    Integrations: %u\n", integrations);
-                printf("#    Integration Time [sec]: %.2f\n", (double)integrations*(double)num_bins/(double)vrt_context.sample_rate);
-            } else {
+                printf("#    Integration Time [sec]: %.2f\n", (double)integrations*(double)num_bins/band_rate);
+                printf("#    Precision: %s\n", single ? "single" : "double");
+                if (zoom_band)
+                    printf("#    Zoom: decimation %u, %u of %u bins\n", zoom.decimation, out_last - out_first, num_bins);
+            }
+
+            // the ECSV header and the column names go to stdout, or into the spectrum file
+            FILE* header_out = stdout;
+            char* meta = NULL;
+            size_t meta_size = 0;
+            if (spectrum_file)
+                header_out = open_memstream(&meta, &meta_size);
+
+            if (ecsv or spectrum_file) {
                 uint32_t first_col = 1;
                 if (log_freq) first_col++;
                 if (log_temp) first_col++;
                 if (dt_trace) first_col += 15;
 
-                printf("# %%ECSV 1.0\n");
-                printf("# ---\n");
+                fprintf(header_out, "# %%ECSV 1.0\n");
+                fprintf(header_out, "# ---\n");
 
                 uint32_t ch=0;
                 while(not (vrt_context.stream_id & (1 << ch) ) )
                     ch++;
-                printf("# delimiter: \',\'\n");
-                printf("# meta: !!omap\n");
-                printf("# - vrt: !!omap\n");
-                printf("#   - {stream_id: %u}\n", vrt_context.stream_id);
-                printf("#   - {channel: %u}\n", ch);
-                printf("#   - {sample_rate: %.1f}\n", (float)vrt_context.sample_rate);
-                printf("#   - {frequency: %.1f}\n", (double)vrt_context.rf_freq);
-                printf("#   - {bandwidth: %.1f}\n", (float)vrt_context.bandwidth);
-                printf("#   - {rx_gain: %.1f}\n", (float)vrt_context.gain);
-                printf("#   - {reference: %s}\n", vrt_context.reflock == 1 ? "external" : "internal");
-                printf("#   - {time_source: %s}\n", vrt_context.time_cal == 1? "pps" : "internal");
-                printf("# - spectrum: !!omap\n");
-                printf("#   - {db: %s}\n", db ? "True" : "False");
-                printf("#   - {bins: %u}\n", num_bins);
-                printf("#   - {col_first_bin: %u}\n", first_col);
-                printf("#   - {bin_size: %.2f}\n", ((double)vrt_context.sample_rate)/((double)num_bins));
-                printf("#   - {integrations: %u}\n", integrations);
-                printf("#   - {integration_time: %.2f}\n", (double)integrations*(double)num_bins/(double)vrt_context.sample_rate);
+                fprintf(header_out, "# delimiter: \',\'\n");
+                fprintf(header_out, "# meta: !!omap\n");
+                fprintf(header_out, "# - vrt: !!omap\n");
+                fprintf(header_out, "#   - {stream_id: %u}\n", vrt_context.stream_id);
+                fprintf(header_out, "#   - {channel: %u}\n", ch);
+                fprintf(header_out, "#   - {sample_rate: %.1f}\n", (float)vrt_context.sample_rate);
+                fprintf(header_out, "#   - {frequency: %.1f}\n", (double)vrt_context.rf_freq);
+                fprintf(header_out, "#   - {bandwidth: %.1f}\n", (float)vrt_context.bandwidth);
+                fprintf(header_out, "#   - {rx_gain: %.1f}\n", (float)vrt_context.gain);
+                fprintf(header_out, "#   - {reference: %s}\n", vrt_context.reflock == 1 ? "external" : "internal");
+                fprintf(header_out, "#   - {time_source: %s}\n", vrt_context.time_cal == 1? "pps" : "internal");
+                fprintf(header_out, "# - spectrum: !!omap\n");
+                fprintf(header_out, "#   - {db: %s}\n", db ? "True" : "False");
+                fprintf(header_out, "#   - {bins: %u}\n", out_last - out_first);
+                fprintf(header_out, "#   - {col_first_bin: %u}\n", first_col);
+                fprintf(header_out, "#   - {bin_size: %.2f}\n", band_rate/((double)num_bins));
+                fprintf(header_out, "#   - {integrations: %u}\n", integrations);
+                fprintf(header_out, "#   - {integration_time: %.2f}\n", (double)integrations*(double)num_bins/band_rate);
+                if (zoom_band)
+                    fprintf(header_out, "#   - {zoom_decimation: %u}\n", zoom.decimation);
                 if (has_source) {
-                    printf("# - description: !!omap\n");
-                    printf("#   - {source: %s}\n", source.c_str());
+                    fprintf(header_out, "# - description: !!omap\n");
+                    fprintf(header_out, "#   - {source: %s}\n", source.c_str());
                 }
 
-                printf("# datatype:\n");
-                printf("# - {name: timestamp, datatype: float64}\n");
+                fprintf(header_out, "# datatype:\n");
+                fprintf(header_out, "# - {name: timestamp, datatype: float64}\n");
                 if (log_freq) {
-                    printf("# - {name: center_freq_hz, unit: Hz, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: center_freq_hz, unit: Hz, datatype: float64}\n");
                 }
                 if (log_temp) {
-                    printf("# - {name: temperature_deg_c, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: temperature_deg_c, datatype: float64}\n");
                 }
                 if (dt_trace) {
-                    printf("# - {name: current_az_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_el_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_az_error_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_el_error_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_az_speed_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_el_speed_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_az_offset_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_el_offset_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: current_ra_h, unit: h, datatype: float64}\n");
-                    printf("# - {name: current_dec_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: setpoint_ra_h, unit: deg, datatype: float64}\n");
-                    printf("# - {name: setpoint_dec_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: radec_error_angle_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: radec_error_bearing_deg, unit: deg, datatype: float64}\n");
-                    printf("# - {name: focusbox_mm, unit: mm, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_az_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_el_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_az_error_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_el_error_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_az_speed_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_el_speed_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_az_offset_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_el_offset_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_ra_h, unit: h, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: current_dec_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: setpoint_ra_h, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: setpoint_dec_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: radec_error_angle_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: radec_error_bearing_deg, unit: deg, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: focusbox_mm, unit: mm, datatype: float64}\n");
                 }
                 if (fftmax) {
-                    printf("# - {name: max_frequency, unit: Hz, datatype: float64}\n");
-                    printf("# - {name: max_power, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: max_frequency, unit: Hz, datatype: float64}\n");
+                    fprintf(header_out, "# - {name: max_power, datatype: float64}\n");
                 } else {
-                    for (uint32_t i = 0; i < num_bins; ++i) {
-                            printf("# - {name: \'%.0f\', datatype: float64}\n", (double)((double)vrt_context.rf_freq + (i*binsize - vrt_context.sample_rate/2)/freq_div));
+                    for (uint32_t i = out_first; i < out_last; ++i) {
+                            fprintf(header_out, "# - {name: \'%.0f\', datatype: float64}\n", (double)((double)vrt_context.rf_freq + (band_center + i*binsize - band_rate/2)/freq_div));
                     }
                 }
-                printf("# schema: astropy-2.0\n");
+                fprintf(header_out, "# schema: astropy-2.0\n");
             }
 
             // Header
             if (!gnuplot) {
-                printf("timestamp");
+                fprintf(header_out, "timestamp");
                 if (log_freq)
-                    printf(", center_freq_hz");
+                    fprintf(header_out, ", center_freq_hz");
                 if (log_temp)
-                    printf(", temperature_deg_c");
+                    fprintf(header_out, ", temperature_deg_c");
                 if (dt_trace)
-                    printf(", current_az_deg, current_el_deg, current_az_error_deg, current_el_error_deg, current_az_speed_deg, current_el_speed_deg, current_az_offset_deg, current_el_offset_deg, current_ra_h, current_dec_deg, setpoint_ra_h, setpoint_dec_deg, radec_error_angle_deg, radec_error_bearing_deg, focusbox_mm");
+                    fprintf(header_out, ", current_az_deg, current_el_deg, current_az_error_deg, current_el_error_deg, current_az_speed_deg, current_el_speed_deg, current_az_offset_deg, current_el_offset_deg, current_ra_h, current_dec_deg, setpoint_ra_h, setpoint_dec_deg, radec_error_angle_deg, radec_error_bearing_deg, focusbox_mm");
                 if (fftmax) {
-                    printf(", max_frequency, max_power");
+                    fprintf(header_out, ", max_frequency, max_power");
                 } else {
-                    for (uint32_t i = 0; i < num_bins; ++i) {
-                            printf(", %.0f", (double)((double)vrt_context.rf_freq + (i*binsize - vrt_context.sample_rate/2)/freq_div));
+                    for (uint32_t i = out_first; i < out_last; ++i) {
+                            fprintf(header_out, ", %.0f", (double)((double)vrt_context.rf_freq + (band_center + i*binsize - band_rate/2)/freq_div));
                     }
                 }
-                printf("\n");
-                fflush(stdout);
+                fprintf(header_out, "\n");
+                fflush(header_out);
+            }
+
+            if (spectrum_file) {
+                fclose(header_out);
+                // decimals of the columns and of the values as printed
+                std::vector<uint32_t> decimals;
+                if (log_freq)
+                    decimals.push_back(0);
+                if (log_temp)
+                    decimals.push_back(2);
+                if (dt_trace)
+                    decimals.insert(decimals.end(), 15, 3);
+                record_columns.reserve(decimals.size());
+                record_values.reserve(out_last - out_first);
+                decimals.push_back(3);
+                bool ok = vrt_specfile_open(&specfile, specfile_name,
+                    specfile_format == "float16" ? VRT_SPECFILE_FLOAT16 : VRT_SPECFILE_FLOAT32,
+                    out_last - out_first, decimals.size() - 1, decimals.data(), std::string(meta, meta_size), &rt);
+                free(meta);
+                if (not ok)
+                    return 1;
             }
         }
 
@@ -503,124 +635,118 @@ int main(int argc, char* argv[])
                 }
             }
 
-            int mult = 1;
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
+            int mult = 1; // fftshift
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
 
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
+            // zoom: the frames are filled from the decimated samples, the
+            // newest input of decimated sample i is samples[newest + i*decimation]
+            uint32_t num_samps = vrt_packet.num_rx_samps;
+            int64_t newest = 0;
+            if (zoom_band) {
+                VRT_TRACE_SCOPE("zoom");
+                num_samps = vrt_zoom_process(&zoom, samples, vrt_packet.num_rx_samps, &newest);
+            }
 
-                if (wola) {
-                    wola_buffer[signal_pointer+((wola_partitions-1)*num_bins)] = std::complex<float>(mult*re,mult*img);
-                    mult *= -1;
-                } else {
-                    signal[signal_pointer][REAL] = mult*re;
-                    signal[signal_pointer][IMAG] = mult*img;
-                    mult *= -1;
+            for (uint32_t i = 0; i < num_samps; i++) {
+
+                // convert up to the end of the packet or the frame, i is the last sample converted
+                uint32_t n = std::min(num_samps - i, num_bins - signal_pointer);
+                {
+                    VRT_TRACE_SCOPE("convert");
+                    if (zoom_band and single)
+                        vrt_zoom_frame(&zoom, i, n, signalf, signal_pointer);
+                    else if (zoom_band)
+                        vrt_zoom_frame(&zoom, i, n, signal, signal_pointer);
+                    else if (wola)
+                        vrt_pfb_convert(&pfb, signal_pointer, &samples[i], n, &mult);
+                    else if (single)
+                        vrt_convert_cf32(&samples[i], (std::complex<float>*)&signalf[signal_pointer], n, &mult);
+                    else
+                        vrt_convert_cf64(&samples[i], (std::complex<double>*)&signal[signal_pointer], n, &mult);
                 }
 
-                signal_pointer++;
+                signal_pointer += n;
+                i += n - 1;
 
                 if (signal_pointer >= num_bins) {
 
                     signal_pointer = 0;
 
+                    // the newest input sample of the frame, may be in an earlier packet when zoomed
+                    int64_t last = zoom_band ? newest + (int64_t)i*zoom.decimation : i;
                     uint64_t seconds = vrt_packet.integer_seconds_timestamp;
-                    uint64_t frac_seconds = vrt_packet.fractional_seconds_timestamp;
-                    frac_seconds += (i+1)*1e12/vrt_context.sample_rate;
+                    int64_t frac_seconds = vrt_packet.fractional_seconds_timestamp;
+                    frac_seconds += (last+1)*1e12/vrt_context.sample_rate;
                     if (frac_seconds > 1e12) {
                         frac_seconds -= 1e12;
                         seconds++;
+                    } else if (frac_seconds < 0) {
+                        frac_seconds += 1e12;
+                        seconds--;
                     }
 
-                    // (double) square signal
-                    if (flag_x2 || flag_x4) {
-                        int mult = 1;
-                        for (uint32_t i = 0; i < num_bins; i++) {
-
-                            double real = signal[i][REAL];
-                            double imag = signal[i][IMAG];
-
-                            double real2 = real * real - imag * imag;
-                            double imag2 = 2 * real * imag;
-
-                            if (flag_x4) {
-                                signal[i][REAL] = mult*(real2 * real2 - imag2 * imag2);
-                                signal[i][IMAG] = mult*(2 * real2 * imag2);
-                            } else {
-                                signal[i][REAL] = mult*real2;
-                                signal[i][IMAG] = mult*imag2;
-                            }
-                            mult *= -1;
-                        }
+                    if (num_bins > 1 and wola) {
+                        VRT_TRACE_SCOPE("wola");
+                        if (single)
+                            vrt_pfb_frame(&pfb, signalf);
+                        else
+                            vrt_pfb_frame(&pfb, signal);
                     }
 
-                    if (num_bins > 1) {
-                        if (wola) {
-                            for (int j=0; j < num_bins; j++) {
-                                signal[j][REAL] = 0;
-                                signal[j][IMAG] = 0;
-                            }
-                            for (int p=0; p<wola_partitions; p++) {
-                                for (int j=0; j < num_bins; j++) {
-                                    signal[j][REAL] += wola_taps[p*num_bins+j] * wola_buffer[p*num_bins+j].real();
-                                    signal[j][IMAG] += wola_taps[p*num_bins+j] * wola_buffer[p*num_bins+j].imag();
-                                }
-                            }
-                            fftw_execute(plan);
-
-                            // shift wola buffer
-                            memcpy(&wola_buffer[0], &wola_buffer[num_bins], (wola_partitions-1)*num_bins*sizeof(std::complex<float>));
+                    // square, transform and accumulate, on the FFT threads if any
+                    vrt_fft_frame_done(&fft);
+                    signal = vrt_fft_frame(&fft);
+                    signalf = vrt_fft_framef(&fft);
 
-                        } else {
-                            fftw_execute(plan);
-                        }
+                    integration_counter++;
+                    if (integration_counter == integrations) {
+                        vrt_fft_flush(&fft);
 
-                        for (uint32_t i = 0; i < num_bins; ++i) {
-                            magnitudes[i] += (result[i][REAL] * result[i][REAL] +
-                                      result[i][IMAG] * result[i][IMAG]);
+                        if (dc and dc_bin >= 0) {
+                            size_t dcbin = dc_bin;
+                            magnitudes[dcbin] = (magnitudes[dcbin-1]+magnitudes[dcbin+1])/2;
                         }
-                    } else {
-                        magnitudes[0] += (signal[0][REAL] * signal[0][REAL] +
-                                      signal[0][IMAG] * signal[0][IMAG]);
-                    }
 
-                    if (dc) {
-                        size_t dcbin = num_bins/2;
-                        magnitudes[dcbin] = (magnitudes[dcbin-1]+magnitudes[dcbin+1])/2;
-                    }
-
-                    integration_counter++;
-                    if (integration_counter == integrations) {
+                        VRT_TRACE_SCOPE("output");
                         num_integrations_counter++;
                         if (!gnuplot) {
-                            if (binary) {
+                            // binary: doubles to the --bin-file, or the columns of a --spectrum-file record
+                            auto write_binary = [&](const double* values, size_t n) -> size_t {
+                                if (spectrum_file) {
+                                    record_columns.insert(record_columns.end(), values, values + n);
+                                    return 0;
+                                }
+                                return fwrite(values, sizeof(double), n, outfile)*sizeof(double);
+                            };
+                            if (spectrum_file) {
+                                record_columns.clear();
+                                record_values.clear();
+                            } else if (binary) {
                                 double timestamp = (double)seconds + (double)(frac_seconds/1e12);
-                                fwrite(&timestamp,sizeof(double),1,outfile);
+                                output_bytes += fwrite(&timestamp,sizeof(double),1,outfile)*sizeof(double);
                             } else {
-                                printf("%lu.%09li", static_cast<unsigned long>(seconds), static_cast<long>(frac_seconds/1e3));
+                                output_bytes += printf("%lu.%09li", static_cast<unsigned long>(seconds), static_cast<long>(frac_seconds/1e3));
                             }
                             if (log_freq) {
                                 if (not binary) {
-                                    printf(", %li", static_cast<long>(vrt_context.rf_freq));
+                                    output_bytes += printf(", %li", static_cast<long>(vrt_context.rf_freq));
                                 }
                                 else {
                                     double freq = vrt_context.rf_freq;
-                                    fwrite(&freq,sizeof(double),1,outfile);
+                                    output_bytes += write_binary(&freq, 1);
                                 }
                             }
                             if (log_temp) {
                                 if (not binary) {
-                                    printf(", %.2f", vrt_context.temperature);
+                                    output_bytes += printf(", %.2f", vrt_context.temperature);
                                 } else {
                                     double temp = vrt_context.temperature;
-                                    fwrite(&temp,sizeof(double),1,outfile);
+                                    output_bytes += write_binary(&temp, 1);
                                 }
                             }
                             if (dt_trace) {
                                 if (not binary) {
-                                    printf(", %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f",
+                                    output_bytes += printf(", %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f, %.3f",
                                         ((180.0/M_PI)*dt_ext_context.azimuth),
                                         ((180.0/M_PI)*dt_ext_context.elevation),
                                         ((180.0/M_PI)*dt_ext_context.azimuth_error),
@@ -653,7 +779,7 @@ int main(int argc, char* argv[])
                                     trace_values[12] = ((180.0/M_PI)*haversine(dt_ext_context.dec_setpoint, dt_ext_context.dec_current, dt_ext_context.ra_setpoint, dt_ext_context.ra_current));
                                     trace_values[13] = ((180.0/M_PI)*bearing(dt_ext_context.dec_setpoint, dt_ext_context.dec_current, dt_ext_context.ra_setpoint, dt_ext_context.ra_current));
                                     trace_values[14] = dt_ext_context.focusbox;
-                                    fwrite(&trace_values,15*sizeof(double),1,outfile);
+                                    output_bytes += write_binary(trace_values, 15);
                                 }
                             }
 
@@ -666,7 +792,7 @@ int main(int argc, char* argv[])
                             double value;
                             // uint32_t dc = num_points/2;
 
-                            for (uint32_t i = 0; i < num_bins; ++i) {
+                            for (uint32_t i = out_first; i < out_last; ++i) {
                                 magnitudes[i] /= (double)integrations;
 
                                 if (iir) {
@@ -676,7 +802,7 @@ int main(int argc, char* argv[])
                                     filter_out[i] = magnitudes[i];
                                 }
 
-                                double offset = i*binsize - vrt_context.sample_rate/2;
+                                double offset = band_center + i*binsize - band_rate/2;
 
                                 double correction = 1;
 
@@ -690,17 +816,21 @@ int main(int argc, char* argv[])
                                     if (db) {
                                         correction = 10*log10(correction);
                                         value = 10*log10(filter_out[i])-correction;
-                                        if (not binary) {
-                                            printf(", %.3f", value);
+                                        if (spectrum_file) {
+                                            record_values.push_back(value);
+                                        } else if (not binary) {
+                                            output_bytes += printf(", %.3f", value);
                                         } else {
-                                            fwrite(&value,sizeof(double),1,outfile);
+                                            output_bytes += fwrite(&value,sizeof(double),1,outfile)*sizeof(double);
                                         }
                                     } else {
                                         value = filter_out[i]/correction;
-                                        if (not binary) {
-                                            printf(", %.3f", value);
+                                        if (spectrum_file) {
+                                            record_values.push_back(value);
+                                        } else if (not binary) {
+                                            output_bytes += printf(", %.3f", value);
                                         } else {
-                                            fwrite(&value,sizeof(double),1,outfile);
+                                            output_bytes += fwrite(&value,sizeof(double),1,outfile)*sizeof(double);
                                         }
                                     }
                                 } else {
@@ -710,7 +840,7 @@ int main(int argc, char* argv[])
                                     } else {
                                         value = filter_out[i]/correction;
                                     }
-                                    if ( (value > max_power) and (i >= min_bin) and (i <= max_bin) and not (dc && i==num_bins/2)) {
+                                    if ( (value > max_power) and (i >= min_bin) and (i <= max_bin) and not (dc && i==dc_bin)) {
                                         max_power = value;
                                         max_i = i;
                                     }
@@ -718,11 +848,16 @@ int main(int argc, char* argv[])
                                 }
                             }
                             if (fftmax) {
-                                printf(", %.2f", (double)vrt_context.rf_freq + (max_i*binsize - vrt_context.sample_rate/2)/freq_div);
-                                printf(", %.3f", max_power);
+                                output_bytes += printf(", %.2f", (double)vrt_context.rf_freq + (band_center + max_i*binsize - band_rate/2)/freq_div);
+                                output_bytes += printf(", %.3f", max_power);
+                            }
+                            if (spectrum_file) {
+                                if (not vrt_specfile_write(&specfile, seconds, frac_seconds, record_columns.data(), record_values.data()))
+                                    stop_signal_called = true;
+                                output_bytes += specfile.record_size;
+                            } else if (not binary) {
+                                output_bytes += printf("\n");
                             }
-                            if (not binary)
-                                printf("\n");
                         } else {
                             // gnuplot
                             double max_power = -1e10; // change this to minimal double
@@ -730,7 +865,7 @@ int main(int argc, char* argv[])
 
                             float scale = 1e6; // MHz
 
-                            float ticks = (vrt_context.sample_rate/freq_div)/(4*scale);
+                            float ticks = ((out_last - out_first)*binsize/freq_div)/(4*scale);
                             printf("set term %s 1 noraise; set xtics %f; set xlabel \"Frequency (MHz)\"; set ylabel \"Power (dB)\"; ", gnuplot_terminal.c_str(), ticks);
                             printf("%s; ", gnuplot_commands.c_str());
                             if (has_source) {
@@ -741,7 +876,7 @@ int main(int argc, char* argv[])
                                     boost::posix_time::to_iso_extended_string(boost::posix_time::from_time_t(seconds)).c_str());
                             }
                                 
-                            if (vrt_context.sample_rate <= 100e3)
+                            if ((out_last - out_first)*binsize <= 100e3)
                                 printf("set format x \"%%.4f\";\n");
                             else
                                 printf("set format x \"%%.3f\";\n");
@@ -757,7 +892,7 @@ int main(int argc, char* argv[])
                             int N = poly.size();
                             output_counter++;
 
-                            for (uint32_t i = 0; i < num_bins; ++i) {
+                            for (uint32_t i = out_first; i < out_last; ++i) {
                                 magnitudes[i] /= (double)integrations;
 
                                 if (iir) {
@@ -766,7 +901,7 @@ int main(int argc, char* argv[])
                                 } else {
                                     filter_out[i] = magnitudes[i];
                                 }
-                                double offset = i*binsize - vrt_context.sample_rate/2;
+                                double offset = band_center + i*binsize - band_rate/2;
                                 double freq = ((double)vrt_context.rf_freq + offset/freq_div)/scale;
 
                                 double correction = 0;
@@ -783,7 +918,7 @@ int main(int argc, char* argv[])
                                     max_y = (value > max_y) ? value : max_y;
                                 }
                                 printf("%.6f, %.6f\n", freq, value);
-                                if ( (value > max_power) and (i >= min_bin) and (i <= max_bin) and not (dc && i==num_bins/2)) {
+                                if ( (value > max_power) and (i >= min_bin) and (i <= max_bin) and not (dc && i==dc_bin)) {
                                         max_power = value;
                                         max_freq = freq;
                                 }
@@ -803,9 +938,11 @@ int main(int argc, char* argv[])
 
                         integration_counter = 0;
                         memset(magnitudes, 0, num_bins*sizeof(double));
-                        if (binary)
+                        vrt_metrics_output(&metrics, output_bytes);
+                        output_bytes = 0;
+                        if (bin_file)
                             fflush(outfile);
-                        else
+                        else if (not spectrum_file)
                             fflush(stdout);
                     }
                     if ( (num_integrations > 0) && (num_integrations_counter == num_integrations))
@@ -822,8 +959,8 @@ int main(int argc, char* argv[])
                 std::cerr << "WARNING: DT metadata is present in the stream, but it is ignored. Did you forget --dt-trace?" << std::endl;
                 dt_trace_warning_given = true;
             }
-            dt_process(buffer, sizeof(buffer), &vrt_packet, &dt_ext_context);
-            tracker_process(buffer, sizeof(buffer), &vrt_packet, &tracker_ext_context);   
+            dt_process(buffer, vrt_msg->words, &vrt_packet, &dt_ext_context);
+            tracker_process(buffer, vrt_msg->words, &vrt_packet, &tracker_ext_context);   
         }
 
         if (progress) {
@@ -861,9 +998,22 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (binary)
+    if (bin_file)
         fclose(outfile);
-
+    if (start_rx and spectrum_file and not vrt_specfile_close(&specfile))
+        fprintf(stderr, "The spectrum file is incomplete.\n");
+
+    if (start_rx)
+        vrt_fft_stop(&fft);
+    if (start_rx and wola)
+        vrt_pfb_free(&pfb);
+    if (start_rx and zoom_band)
+        vrt_zoom_free(&zoom);
+    vrt_receiver_stop(&receiver);
+    vrt_print_receiver_stats(&receiver);
+    vrt_shm_detach(shm_reader);
+    vrt_metrics_stop(&metrics);
+    vrt_trace_stop();
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
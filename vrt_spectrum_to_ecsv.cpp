@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+// VRT
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vrt-tools.h"
+#include "vrt-spectrum-file.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+    // variables to be set by po
+    std::string file;
+
+    // setup the program options
+    po::options_description desc("Allowed options");
+    // clang-format off
+
+    desc.add_options()
+        ("help", "help message")
+        ("file", po::value<std::string>(&file), "spectrum file written by vrt_spectrum --spectrum-file")
+    ;
+    // clang-format on
+    po::positional_options_description pos;
+    pos.add("file", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+
+    // print the help message
+    if (vm.count("help") or not vm.count("file")) {
+        std::cout << boost::format("VRT spectrum file to ECSV. %s") % desc << std::endl;
+        std::cout << std::endl
+                  << "This application converts a binary spectrum file of vrt_spectrum "
+                     "to the ECSV (or CSV) output of vrt_spectrum.\n"
+                  << std::endl;
+        return ~0;
+    }
+
+    FILE* in = fopen(file.c_str(), "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open %s: %s.\n", file.c_str(), strerror(errno));
+        return 1;
+    }
+
+    vrt_specfile_header_type header;
+    std::vector<uint32_t> decimals;
+    std::string meta;
+    if (not vrt_specfile_read_header(in, &header, decimals, meta)) {
+        fprintf(stderr, "%s is not a spectrum file.\n", file.c_str());
+        fclose(in);
+        return 1;
+    }
+
+    // the ECSV header and the column names, as vrt_spectrum prints them
+    fputs(meta.c_str(), stdout);
+
+    std::vector<uint8_t> record(header.record_size);
+    std::vector<double> columns(header.num_columns);
+    uint64_t records = 0;
+    size_t n;
+    while ((n = fread(record.data(), 1, record.size(), in)) == record.size()) {
+        uint64_t seconds, picoseconds;
+        memcpy(&seconds, record.data(), 8);
+        memcpy(&picoseconds, record.data() + 8, 8);
+        memcpy(columns.data(), record.data() + 16, 8*header.num_columns);
+        const uint8_t* values = record.data() + 16 + 8*header.num_columns;
+
+        printf("%lu.%09li", static_cast<unsigned long>(seconds), static_cast<long>(picoseconds/1000));
+        for (uint32_t c = 0; c < header.num_columns; c++)
+            printf(", %.*f", (int)decimals[c], columns[c]);
+        int value_decimals = decimals[header.num_columns];
+        for (uint32_t i = 0; i < header.num_bins; i++) {
+            float value;
+            if (header.format == VRT_SPECFILE_FLOAT16) {
+                uint16_t half;
+                memcpy(&half, values + 2*i, 2);
+                value = vrt_half_to_float(half);
+            } else {
+                memcpy(&value, values + 4*i, 4);
+            }
+            printf(", %.*f", value_decimals, value);
+        }
+        printf("\n");
+        records++;
+    }
+    if (n > 0)
+        fprintf(stderr, "Ignoring an incomplete last record (%lu of %u bytes).\n", (unsigned long)n, header.record_size);
+
+    fclose(in);
+    fprintf(stderr, "# %lu spectra of %u bins\n", (unsigned long)records, header.num_bins);
+    return 0;
+}
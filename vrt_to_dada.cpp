@@ -16,6 +16,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 #include <complex>
 
 // VRT
@@ -41,6 +42,7 @@
 // END DADA
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
 #include "dt-extended-context.h"
 
 namespace po = boost::program_options;
@@ -96,7 +98,7 @@ int main(int argc, char* argv[])
         ("channel", po::value<std::string>(&channel_list)->default_value("0"), "which VRT channel(s) to use (specify \"0\", \"1\", \"0,1\", etc)")
         ("continue", "don't abort on a bad packet")
         ("dt-trace", "add DT trace data")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
@@ -127,9 +129,7 @@ int main(int argc, char* argv[])
     std::complex<float> a(amplitude,0);
     std::complex<float> correction = a*exp(z);
 
-    context_type vrt_context;
     dt_ext_context_type dt_ext_context;
-    init_context(&vrt_context);
 
     packet_type vrt_packet;
 
@@ -161,6 +161,12 @@ int main(int argc, char* argv[])
         vrt_packet.channel_filt = 1;
     }
 
+    // context and packet counter per channel, in the order given by --channel
+    vrt_streams_type streams;
+    init_streams(&streams);
+    for (size_t ch = 0; ch < channel_nums.size(); ch++)
+        vrt_stream_add(&streams, 1<<channel_nums[ch]);
+
     // DADA
     dada_hdu_t *dada_hdu;
     multilog_t *dada_log;
@@ -169,22 +175,25 @@ int main(int argc, char* argv[])
 
     dadakey = std::stoul(dadakey_str, nullptr, 16);
 
-    std::complex<float> dadabuffer[VRT_SAMPLES_PER_PACKET*MAX_CHANNELS] __attribute((aligned(32)));
+    // sized from the incoming packets
+    std::vector<std::complex<float> > dadabuffer;
+    std::vector<std::complex<float> > channelbuffer;
 
     // ZMQ
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, main_port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -208,28 +217,30 @@ int main(int argc, char* argv[])
     while (not stop_signal_called
            and (num_requested_samples*channel_nums.size() > num_total_samps or num_requested_samples == 0)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        vrt_stream_type* stream;
+        if (not vrt_process_stream(buffer, vrt_msg.words, &streams, &vrt_packet, &stream)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
 
-        uint32_t ch = 0;
-        for(ch = 0; ch<channel_nums.size(); ch++)
-            if (vrt_packet.stream_id & (1 << channel_nums[ch]) )
-                break;
-
-        uint32_t channel = channel_nums[ch];
+        // packets of other streams only carry extended context
+        bool tracked = stream != NULL and stream->index >= 0;
+        context_type& vrt_context = tracked ? stream->context : streams.other;
+        uint32_t ch = tracked ? stream->index : 0;
 
         if (vrt_packet.extended_context) {
             if (not dt_trace_warning_given and dt_ext_context.dt_ext_context_received and not dt_trace) {
                 std::cerr << "WARNING: DT metadata is present in the stream, but it is ignored. Did you forget --dt-trace?" << std::endl;
                 dt_trace_warning_given = true;
             }
-            dt_process(buffer, sizeof(buffer), &vrt_packet, &dt_ext_context);
+            dt_process(buffer, vrt_msg.words, &vrt_packet, &dt_ext_context);
         }
 
         if (not start_rx and vrt_packet.context and (dt_ext_context.dt_ext_context_received or not dt_trace)) {
@@ -311,26 +322,23 @@ int main(int argc, char* argv[])
             // Process data here
             // Assumes ci16_le
 
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                // Convert ci16_le to float
-                std::complex<float>sample(re,img);
-                if (channel_nums.size() > 1) {
-                    if (ch==1)
-                        dadabuffer[i*channel_nums.size()+ch] = correction*sample;
-                    else
-                        dadabuffer[i*channel_nums.size()+ch] = sample;
-                } else {
-                    dadabuffer[i] = sample;
-                }
+            // Convert ci16_le to float
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
+            if (dadabuffer.size() < channel_nums.size()*vrt_packet.num_rx_samps) {
+                dadabuffer.resize(channel_nums.size()*vrt_packet.num_rx_samps);
+                channelbuffer.resize(vrt_packet.num_rx_samps);
+            }
+            if (channel_nums.size() > 1) {
+                vrt_convert_cf32(samples, channelbuffer.data(), vrt_packet.num_rx_samps, NULL, NULL, (ch==1) ? &correction : NULL);
+                for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++)
+                    dadabuffer[i*channel_nums.size()+ch] = channelbuffer[i];
+            } else {
+                vrt_convert_cf32(samples, dadabuffer.data(), vrt_packet.num_rx_samps);
             }
 
             // send when all channels have been received
             if (ch == channel_nums.size()-1) {
-                if (ipcio_write(dada_hdu->data_block, (char*)dadabuffer, channel_nums.size()*vrt_packet.num_rx_samps*sizeof(std::complex<float>)) < 0) {
+                if (ipcio_write(dada_hdu->data_block, (char*)dadabuffer.data(), channel_nums.size()*vrt_packet.num_rx_samps*sizeof(std::complex<float>)) < 0) {
                     if (stop_signal_called) {
                         break;
                     }
@@ -419,6 +427,8 @@ int main(int argc, char* argv[])
     if (dada_hdu_disconnect (dada_hdu) < 0)
         throw std::runtime_error("could not unlock write on DADA hdu");
 
+    vrt_print_stream_stats(&streams);
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
     std::cout<<"vrt_to_dada cleaned up properly after SIGINT\n";
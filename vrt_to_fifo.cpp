@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 // VRT
 #include <stdbool.h>
@@ -35,6 +36,7 @@
 #include <complex.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
 
 #define SCALE_MAX 32768.0
 
@@ -91,7 +93,7 @@ int main(int argc, char* argv[])
         ("delete", "delete fifo on exit")
         // ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
@@ -135,7 +137,8 @@ int main(int argc, char* argv[])
 
     write_ptr = fdopen(fd, "wb");
 
-    std::complex<float> fifobuffer[VRT_SAMPLES_PER_PACKET];
+    // sized from the received packets
+    std::vector<std::complex<float> > fifobuffer;
 
     context_type vrt_context;
     init_context(&vrt_context);
@@ -148,16 +151,17 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -180,11 +184,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -218,17 +225,13 @@ int main(int argc, char* argv[])
             // Process data here
             // Assumes ci16_le
 
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                // Do something
-                std::complex<float>sample((float)re/SCALE_MAX,(float)img/SCALE_MAX);
-                fifobuffer[i] = sample;
-            }
+            if (fifobuffer.size() < vrt_packet.num_rx_samps)
+                fifobuffer.resize(vrt_packet.num_rx_samps);
+
+            std::complex<float> scale(1.0/SCALE_MAX, 0);
+            vrt_convert_cf32(vrt_samples(buffer, &vrt_packet), fifobuffer.data(), vrt_packet.num_rx_samps, NULL, NULL, &scale);
 
-            fwrite(fifobuffer, vrt_packet.num_rx_samps*sizeof(std::complex<float>), 1, write_ptr);
+            fwrite(fifobuffer.data(), vrt_packet.num_rx_samps*sizeof(std::complex<float>), 1, write_ptr);
 
             // data: (const char*)&buffer[vrt_packet.offset]
             // size (bytes): sizeof(uint32_t)*vrt_packet.num_rx_samps
@@ -281,6 +284,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
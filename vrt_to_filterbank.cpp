@@ -36,6 +36,9 @@
 #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
+#include "vrt-fft.h"
+#include "vrt-pfb.h"
 #include "dt-extended-context.h"
 
 namespace po = boost::program_options;
@@ -70,8 +73,16 @@ int main(int argc, char* argv[])
 {
 
     // FFTW
-    fftw_complex *signal, *result;
-    fftw_plan plan;
+    vrt_fft_type fft;
+    double *power;
+
+    // single precision: float power summed into double, see vrt_fft_sum_type
+    vrt_fft_sum_type sum;
+    float *powerf;
+    double *sums;
+
+    // WOLA front end
+    vrt_pfb_type pfb;
 
     float *magnitudes;
 
@@ -84,6 +95,7 @@ int main(int argc, char* argv[])
     uint32_t integrations;
     uint32_t num_bins = 0;
     uint32_t threads = 1;
+    uint32_t wola_partitions;
     int32_t machine_id, telescope_id, data_type;
     int hwm;
     bool power2;
@@ -112,6 +124,9 @@ int main(int argc, char* argv[])
         ("integrations", po::value<uint32_t>(&integrations)->default_value(1), "number of integrations")
         ("integration-time", po::value<float>(&integration_time), "integration time (seconds)")
         ("threads", po::value<uint32_t>(&threads)->default_value(1), "enable multi-threading")
+        ("float", "single precision FFT and accumulation")
+        ("wola", "apply Weighted OverLap Add method (polyphase filterbank)")
+        ("wola-partitions", po::value<uint32_t>(&wola_partitions)->default_value(4), "number of WOLA partitions")
         ("machine-id", po::value<int32_t>(&machine_id)->default_value(0), "set filterbank machine_id (0=FAKE)")
         ("telescope-id", po::value<int32_t>(&telescope_id)->default_value(0), "set filterbank telescope_id (0=FAKE)")
         ("data-type", po::value<int32_t>(&data_type)->default_value(1), "set filterbank data_type (1=filterbank)")
@@ -124,13 +139,14 @@ int main(int argc, char* argv[])
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
         // ("ignore-dc", "Ignore  DC bin")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
     // clang-format on
+    vrt_fft_options(desc);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -145,6 +161,9 @@ int main(int argc, char* argv[])
         return ~0;
     }
 
+    if (not vrt_fft_planner_init())
+        return 1;
+
     bool progress               = vm.count("progress") > 0;
     bool stats                  = vm.count("stats") > 0;
     bool null                   = vm.count("null") > 0;
@@ -154,8 +173,15 @@ int main(int argc, char* argv[])
     bool dt_trace               = vm.count("dt-trace") > 0;
     bool zmq_split              = vm.count("zmq-split") > 0;
     bool start_at_timestamp     = vm.count("start-time") > 0;
+    bool single                 = vm.count("float") > 0;
+    bool wola                   = vm.count("wola") > 0;
     // bool ignore_dc              = (bool)vm.count("ignore-dc");
 
+    if (wola and wola_partitions == 0) {
+        fprintf(stderr, "--wola-partitions must be at least 1.\n");
+        return 1;
+    }
+
     boost::posix_time::ptime utc_time;
     if (start_at_timestamp) {
         // Check for unix time
@@ -225,15 +251,16 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, main_port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -252,11 +279,14 @@ int main(int argc, char* argv[])
     while (not stop_signal_called
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -282,12 +312,24 @@ int main(int argc, char* argv[])
             if (total_time > 0)
                 num_requested_samples = total_time * vrt_context.sample_rate;
 
-            fftw_plan_with_nthreads(threads);
-
-            signal = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
-            result = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * num_bins);
-            plan = fftw_plan_dft_1d(num_bins, signal, result, FFTW_FORWARD, FFTW_ESTIMATE);
-            magnitudes = (float*)malloc(num_bins * sizeof(float));
+            if (single)
+                fftwf_plan_with_nthreads(threads);
+            else
+                fftw_plan_with_nthreads(threads);
+
+            vrt_fft_init(&fft, num_bins, single);
+            vrt_fft_planner_start();
+            if (wola)
+                vrt_pfb_init(&pfb, num_bins, wola_partitions);
+            if (single) {
+                powerf = (float*)vrt_alloc(num_bins * sizeof(float));
+                sums = (double*)vrt_alloc(num_bins * sizeof(double));
+                memset(sums, 0, num_bins*sizeof(double));
+                vrt_fft_sum_init(&sum, num_bins, sums);
+            } else {
+                power = (double*)vrt_alloc(num_bins * sizeof(double));
+            }
+            magnitudes = (float*)vrt_alloc(num_bins * sizeof(float));
             memset(magnitudes, 0, num_bins*sizeof(float));
 
             printf("# Filterbank parameters:\n");
@@ -295,6 +337,8 @@ int main(int argc, char* argv[])
             printf("#    Bin size [Hz]: %.0f\n", ((double)vrt_context.sample_rate)/((double)num_bins));
             printf("#    Integrations: %u\n", integrations);
             printf("#    Integration Time [sec]: %.4f\n", (double)integrations*(double)num_bins/(double)vrt_context.sample_rate);
+            if (wola)
+                printf("#    WOLA partitions: %u\n", wola_partitions);
         }
 
         if (start_rx and vrt_packet.data and (dt_ext_context.dt_ext_context_received or not dt_trace)) {
@@ -523,36 +567,59 @@ int main(int argc, char* argv[])
                 // end header
             }
 
-            int mult = 1;
+            int mult = 1; // fftshift
+            const std::complex<int16_t>* samples = vrt_samples(buffer, &vrt_packet);
             for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
 
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                signal[signal_pointer][REAL] = mult*re;
-                signal[signal_pointer][IMAG] = mult*img;
-                mult *= -1;
+                // convert up to the end of the packet or the frame, i is the last sample converted
+                uint32_t n = std::min(vrt_packet.num_rx_samps - i, num_bins - signal_pointer);
+                if (wola)
+                    vrt_pfb_convert(&pfb, signal_pointer, &samples[i], n, &mult);
+                else
+                    vrt_fft_convert(&fft, signal_pointer, &samples[i], n, &mult);
 
-                signal_pointer++;
+                signal_pointer += n;
+                i += n - 1;
 
                 if (signal_pointer >= num_bins) {
 
                     signal_pointer = 0;
 
-                    fftw_execute(plan);
-
-                    for (uint32_t i = 0; i < num_bins; ++i) {
-                        size_t index;
-                        if (neg_foff)
-                            index = num_bins-1-i;
-                        else
-                            index = i;
-                        magnitudes[index] += (result[i][REAL] * result[i][REAL] +
-                                  result[i][IMAG] * result[i][IMAG]);
+                    if (wola and single)
+                        vrt_pfb_frame(&pfb, fft.inf);
+                    else if (wola)
+                        vrt_pfb_frame(&pfb, fft.in);
+
+                    vrt_fft_execute(&fft);
+
+                    if (single) {
+                        vrt_fft_power(&fft, powerf);
+                        vrt_fft_sum_add(&sum, powerf);
+                    } else {
+                        vrt_fft_power(&fft, power);
+                        for (uint32_t i = 0; i < num_bins; ++i) {
+                            size_t index;
+                            if (neg_foff)
+                                index = num_bins-1-i;
+                            else
+                                index = i;
+                            magnitudes[index] += power[i];
+                        }
                     }
                     integration_counter++;
                     if (integration_counter == integrations) {
+                        if (single) {
+                            vrt_fft_sum_fold(&sum);
+                            for (uint32_t i = 0; i < num_bins; ++i) {
+                                size_t index;
+                                if (neg_foff)
+                                    index = num_bins-1-i;
+                                else
+                                    index = i;
+                                magnitudes[index] = sums[i];
+                                sums[i] = 0;
+                            }
+                        }
                         for (uint32_t i = 0; i < num_bins; ++i)
                             magnitudes[i] /= (float)integrations;
                         fwrite(magnitudes, num_bins*sizeof(float), 1, write_ptr);
@@ -573,7 +640,7 @@ int main(int argc, char* argv[])
                 std::cerr << "WARNING: DT metadata is present in the stream, but it is ignored. Did you forget --dt-trace?" << std::endl;
                 dt_trace_warning_given = true;
             }
-            dt_process(buffer, sizeof(buffer), &vrt_packet, &dt_ext_context);
+            dt_process(buffer, vrt_msg.words, &vrt_packet, &dt_ext_context);
         }
 
         if (progress) {
@@ -611,6 +678,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
@@ -76,7 +76,7 @@ int main(int argc, char* argv[])
 {
 
     // variables to be set by po
-    std::string file, type, zmq_address;
+    std::string file, type, zmq_address, bind_address;
     size_t num_requested_samples;
     double total_time;
     uint16_t instance, main_port, port, gnuradioport;
@@ -99,11 +99,12 @@ int main(int argc, char* argv[])
         // ("int-second", "align start of reception to integer second")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("gnuradioport", po::value<uint16_t>(&gnuradioport)->default_value(0), "GNURadio ZMQ port")
+        ("bind", po::value<std::string>(&bind_address)->default_value("*"), "GNURadio ZMQ bind address(es) or URI(s)")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
 
     ;
@@ -155,9 +156,8 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, main_port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
     if (gnuradioport == 0) {
         gnuradioport = DEFAULT_GNURADIO_PORT + channel;
@@ -168,18 +168,18 @@ int main(int argc, char* argv[])
     void *zmq_gr_rate;
 
     void *responder = zmq_socket(context, ZMQ_PUB);
-    rc = zmq_bind(responder, ("tcp://*:" + std::to_string(gnuradioport)).c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, gnuradioport))
+        return 1;
     zmq_gr_data = responder;
 
     responder = zmq_socket(context, ZMQ_PUB);
-    rc = zmq_bind(responder, ("tcp://*:" + std::to_string(gnuradioport + 10)).c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, gnuradioport + 10))
+        return 1;
     zmq_gr_freq = responder;
 
     responder = zmq_socket(context, ZMQ_PUB);
-    rc = zmq_bind(responder, ("tcp://*:" + std::to_string(gnuradioport + 20)).c_str());
-    assert (rc == 0);
+    if (not vrt_bind(responder, bind_address, gnuradioport + 20))
+        return 1;
     zmq_gr_rate = responder;
 
     bool first_frame = true;
@@ -189,7 +189,9 @@ int main(int argc, char* argv[])
     auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -206,11 +208,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -299,6 +304,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_close(zmq_gr_data);
     zmq_close(zmq_gr_rate);
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 // VRT
 #include <stdbool.h>
@@ -162,7 +163,7 @@ int main(int argc, char* argv[])
         ("continue", "don't abort on a bad packet")
         ("control", "enable SDR control (freq.)")
         ("scale", po::value<float>(&scale)->default_value(1.0), "scaling factor for 16 to 8 bit conversion (default 1)")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("rtl-address", po::value<std::string>(&rtl_address)->default_value("0.0.0.0"), "RTL-TCP address (default 0.0.0.0)")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
         ("rtl-port", po::value<uint16_t>(&rtl_port)->default_value(1234), "RTL-TCP port (default 1234)")
@@ -295,9 +296,8 @@ int main(int argc, char* argv[])
         void *context = zmq_ctx_new();
         void *subscriber = zmq_socket(context, ZMQ_SUB);
         int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-        std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-        rc = zmq_connect(subscriber, connect_string.c_str());
-        assert(rc == 0);
+        if (not vrt_connect(subscriber, zmq_address, port))
+            return 1;
         zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
         // Vita49 and ZMQ control
@@ -306,9 +306,8 @@ int main(int argc, char* argv[])
 
         if (ctrl) {
             control = zmq_socket(context, ZMQ_PUB);
-            std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(ctrl_port);
-            int rc = zmq_connect(control, connect_string.c_str());
-            assert(rc == 0);
+            if (not vrt_connect(control, zmq_address, ctrl_port))
+                return 1;
 
             // Vita49
             vrt_init_packet(&pc);
@@ -340,9 +339,12 @@ int main(int argc, char* argv[])
         auto start_time = std::chrono::steady_clock::now();
         auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-        uint32_t buffer[ZMQ_BUFFER_SIZE];
+        // ZMQ message, parsed in place
+        vrt_msg_type vrt_msg;
+        init_msg(&vrt_msg);
 
-        uint8_t rtlbuffer[VRT_SAMPLES_PER_PACKET*2];
+        // sized from the received packets
+        std::vector<uint8_t> rtlbuffer;
 
         unsigned long long num_total_samps = 0;
 
@@ -362,11 +364,14 @@ int main(int argc, char* argv[])
                and (num_requested_samples > num_total_samps or num_requested_samples == 0)
                and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-            int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+            int len = vrt_recv(subscriber, &vrt_msg);
+            if (len < 0)
+                continue;
+            uint32_t* buffer = vrt_msg.buffer;
 
             const auto now = std::chrono::steady_clock::now();
 
-            if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+            if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
                 printf("Not a Vita49 packet?\n");
                 continue;
             }
@@ -459,6 +464,9 @@ int main(int argc, char* argv[])
                 // Process data here
                 // Assumes ci16_le
 
+                if (rtlbuffer.size() < vrt_packet.num_rx_samps*2)
+                    rtlbuffer.resize(vrt_packet.num_rx_samps*2);
+
                 for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
 
                     int16_t re;
@@ -492,7 +500,7 @@ int main(int argc, char* argv[])
                 FD_SET(s, &writefds);
                 r = select(s+1, NULL, &writefds, NULL, &tv);
                 if(r) {
-                    bytessent = send(s,  (char*)rtlbuffer, bytesleft, 0);
+                    bytessent = send(s,  (char*)rtlbuffer.data(), bytesleft, 0);
                 }
                 if(bytessent == SOCKET_ERROR) {
                         printf("worker socket bye\n");
@@ -550,6 +558,7 @@ int main(int argc, char* argv[])
             }
         }
         zmq_close(control);
+        vrt_msg_close(&vrt_msg);
         zmq_close(subscriber);
         zmq_ctx_destroy(context);
     }
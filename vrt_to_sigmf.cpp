@@ -95,6 +95,9 @@ int main(int argc, char* argv[])
     size_t num_requested_samples, total_time;
     uint16_t instance, main_port, port;
     int hwm;
+    vrt_rt_type rt;
+    uint16_t metrics_port;
+    std::string metrics_address;
 
     bool dt_trace_warning_given = false;
 
@@ -124,13 +127,18 @@ int main(int argc, char* argv[])
         ("dt-trace", "add DT trace data")
         ("tracking", "add tracking context data")
         ("vrt", "write VRT stream to file")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("zmq-split", "create a ZeroMQ stream per VRT channel, increasing port number for additional streams")
+        ("shm", "read the stream from shared memory, from a producer on this host started with --shm")
         ("instance", po::value<uint16_t>(&instance)->default_value(0), "VRT ZMQ instance")
         ("port", po::value<uint16_t>(&port), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
+        ("metrics-port", po::value<uint16_t>(&metrics_port)->default_value(0), "serve Prometheus metrics on this HTTP port (0: off)")
+        ("metrics-address", po::value<std::string>(&metrics_address)->default_value("127.0.0.1"), "interface to serve metrics on, * for all")
     ;
     // clang-format on
+    init_rt(&rt);
+    vrt_rt_options(desc, &rt, 1<<VRT_RT_RX | 1<<VRT_RT_WRITER | 1<<VRT_RT_IO);
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -159,6 +167,7 @@ int main(int argc, char* argv[])
     bool has_desc               = vm.count("description") > 0;
     bool vrt                    = vm.count("vrt") > 0;
     bool zmq_split              = vm.count("zmq-split") > 0;
+    bool shm                    = vm.count("shm") > 0;
 
     boost::posix_time::ptime utc_time;
     if (start_at_timestamp) {
@@ -191,10 +200,8 @@ int main(int argc, char* argv[])
         std::cout << "UTC start time: " << utc_time << std::endl;
     }
 
-    context_type vrt_context;
     dt_ext_context_type dt_ext_context;
     tracker_ext_context_type tracker_ext_context;
-    init_context(&vrt_context);
 
     packet_type vrt_packet;
 
@@ -226,6 +233,12 @@ int main(int argc, char* argv[])
         vrt_packet.channel_filt = 1;
     }
 
+    // context and packet counter per channel, in the order given by --channel
+    vrt_streams_type streams;
+    init_streams(&streams);
+    for (size_t ch = 0; ch < channel_nums.size(); ch++)
+        vrt_stream_add(&streams, 1<<channel_nums[ch]);
+
     std::vector<std::string> data_filenames;
     std::vector<std::shared_ptr<std::ofstream>> datafiles;
     std::vector<std::string> meta_filenames;
@@ -260,18 +273,34 @@ int main(int argc, char* argv[])
 
     // ZMQ
     void *context = zmq_ctx_new();
+    if (not vrt_rt_apply(&rt, context))
+        return 1;
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(main_port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
-    zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    vrt_shm_reader_type* shm_reader = NULL;
+    if (shm) {
+        shm_reader = vrt_shm_attach(main_port);
+        if (shm_reader == NULL)
+            return 1;
+    } else {
+        if (not vrt_connect(subscriber, zmq_address, main_port))
+            return 1;
+        zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
+    }
 
     // time keeping
     auto start_time = std::chrono::steady_clock::now();
 
-    // ZMQ buffer
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ messages, received on their own thread and parsed in place
+    vrt_metrics_type metrics;
+    init_metrics(&metrics);
+    if (metrics_port > 0 and not vrt_metrics_start(&metrics, context, metrics_address, metrics_port, "vrt_to_sigmf", hwm))
+        return 1;
+
+    vrt_receiver_type receiver;
+    vrt_receiver_start(&receiver, subscriber, &rt, &metrics, shm_reader);
+    vrt_rt_thread(&rt, VRT_RT_WRITER);
+    vrt_msg_type* vrt_msg;
 
     unsigned long long num_total_samps = 0;
 
@@ -298,35 +327,43 @@ int main(int argc, char* argv[])
     while (not stop_signal_called
            and ( num_requested_samples*channel_nums.size() > num_total_samps or num_requested_samples == 0)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_receiver_recv(&receiver, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg->buffer;
 
         if (stop_signal_called)
             break;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        vrt_stream_type* stream;
+        if (not vrt_process_stream(buffer, vrt_msg->words, &streams, &vrt_packet, &stream)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
 
+        // packets of other streams only carry extended context or are written as is
+        bool tracked = stream != NULL and stream->index >= 0;
+        context_type& vrt_context = tracked ? stream->context : streams.other;
+        uint32_t ch = tracked ? stream->index : 0;
+
+        vrt_metrics_packet(&metrics, &vrt_packet, &vrt_context);
+
         if (vrt_packet.context and not first_frame and not continue_on_bad_packet and vrt_context.context_changed) {
             printf("Context changed, exiting.\n");
             break;
         }
 
-        uint32_t ch = 0;
-        for(ch = 0; ch<channel_nums.size(); ch++)
-            if (vrt_packet.stream_id & (1 << channel_nums[ch]) )
-                break;
-
         std::string channel = std::to_string(channel_nums[ch]);
         if (vrt) {
             channel = channel_list;
         }
 
-        if (vrt and not null and not meta_only)
-            datafiles[0]->write((const char*)&buffer, len);
+        if (vrt and not null and not meta_only) {
+            datafiles[0]->write((const char*)buffer, len);
+            vrt_metrics_output(&metrics, len);
+        }
 
         if ( not (context_recv & vrt_packet.stream_id) and vrt_packet.context
              and not first_frame and not (dt_trace and not dt_ext_context.dt_ext_context_received)
@@ -504,9 +541,9 @@ int main(int argc, char* argv[])
                 std::cerr << "WARNING: DT metadata is present in the stream, but it is ignored. Did you forget --dt-trace?" << std::endl;
                 dt_trace_warning_given = true;
             }
-            dt_process(buffer, sizeof(buffer), &vrt_packet, &dt_ext_context);
+            dt_process(buffer, vrt_msg->words, &vrt_packet, &dt_ext_context);
             if (tracking)
-                tracker_process(buffer, sizeof(buffer), &vrt_packet, &tracker_ext_context);
+                tracker_process(buffer, vrt_msg->words, &vrt_packet, &tracker_ext_context);
         }
 
         if (vrt_packet.data) {
@@ -559,6 +596,7 @@ int main(int argc, char* argv[])
             if (not vrt and not null and not meta_only) {
                 datafiles[ch]->write(
                     (const char*)&buffer[vrt_packet.offset], sizeof(uint32_t)*vrt_packet.num_rx_samps);
+                vrt_metrics_output(&metrics, sizeof(uint32_t)*vrt_packet.num_rx_samps);
             }
 
             num_total_samps += vrt_packet.num_rx_samps;
@@ -581,6 +619,7 @@ int main(int argc, char* argv[])
 
     // Auto file
     if (context_recv and do_auto_file) {
+        const context_type& vrt_context = streams.streams[0].context;
         boost::format auto_format;
         boost::posix_time::ptime starttime = boost::posix_time::from_time_t(vrt_context.starttime_integer);
         std::string timestring = boost::posix_time::to_iso_extended_string(starttime);
@@ -625,6 +664,11 @@ int main(int argc, char* argv[])
             boost::filesystem::remove(data_filename);
     }
 
+    vrt_receiver_stop(&receiver);
+    vrt_print_receiver_stats(&receiver);
+    vrt_shm_detach(shm_reader);
+    vrt_print_stream_stats(&streams);
+    vrt_metrics_stop(&metrics);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 
@@ -17,6 +17,8 @@
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <vector>
+#include <algorithm>
 
 // VRT
 #include <stdbool.h>
@@ -38,6 +40,7 @@
 // #include <fftw3.h>
 
 #include "vrt-tools.h"
+#include "vrt-kernels.h"
 
 namespace po = boost::program_options;
 
@@ -73,7 +76,8 @@ int main(int argc, char* argv[])
     size_t num_requested_samples;
     double total_time;
 
-    float float_data[VRT_SAMPLES_PER_PACKET*2];
+    // sized from the received packets
+    std::vector<float> float_data;
 
     // setup the program options
     po::options_description desc("Allowed options");
@@ -92,7 +96,7 @@ int main(int argc, char* argv[])
         ("int-second", "align start of reception to integer second")
         ("null", "run without writing to file")
         ("continue", "don't abort on a bad packet")
-        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address")
+        ("address", po::value<std::string>(&zmq_address)->default_value("localhost"), "VRT ZMQ address or URI, e.g. ipc")
         ("port", po::value<uint16_t>(&port)->default_value(50100), "VRT ZMQ port")
         ("hwm", po::value<int>(&hwm)->default_value(10000), "VRT ZMQ HWM")
     ;
@@ -128,9 +132,8 @@ int main(int argc, char* argv[])
     void *context = zmq_ctx_new();
     void *subscriber = zmq_socket(context, ZMQ_SUB);
     int rc = zmq_setsockopt (subscriber, ZMQ_RCVHWM, &hwm, sizeof hwm);
-    std::string connect_string = "tcp://" + zmq_address + ":" + std::to_string(port);
-    rc = zmq_connect(subscriber, connect_string.c_str());
-    assert(rc == 0);
+    if (not vrt_connect(subscriber, zmq_address, port))
+        return 1;
     zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0);
 
     int sockfd;
@@ -156,7 +159,9 @@ int main(int argc, char* argv[])
     auto start_time = std::chrono::steady_clock::now();
     auto stop_time = start_time + std::chrono::milliseconds(int64_t(1000 * total_time));
 
-    uint32_t buffer[ZMQ_BUFFER_SIZE];
+    // ZMQ message, parsed in place
+    vrt_msg_type vrt_msg;
+    init_msg(&vrt_msg);
 
     unsigned long long num_total_samps = 0;
 
@@ -176,11 +181,14 @@ int main(int argc, char* argv[])
            and (num_requested_samples > num_total_samps or num_requested_samples == 0)
            and (total_time == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
 
-        int len = zmq_recv(subscriber, buffer, ZMQ_BUFFER_SIZE, 0);
+        int len = vrt_recv(subscriber, &vrt_msg);
+        if (len < 0)
+            continue;
+        uint32_t* buffer = vrt_msg.buffer;
 
         const auto now = std::chrono::steady_clock::now();
 
-        if (not vrt_process(buffer, sizeof(buffer), &vrt_context, &vrt_packet)) {
+        if (not vrt_process(buffer, vrt_msg.words, &vrt_context, &vrt_packet)) {
             printf("Not a Vita49 packet?\n");
             continue;
         }
@@ -211,20 +219,17 @@ int main(int argc, char* argv[])
                 }
             }
 
-            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i++) {
-                int16_t re;
-                memcpy(&re, (char*)&buffer[vrt_packet.offset+i], 2);
-                int16_t img;
-                memcpy(&img, (char*)&buffer[vrt_packet.offset+i]+2, 2);
-                // convert to float32
-                float_data[2*i] = (float)re / 65535;
-                float_data[2*i+1] = (float)img / 65535;
-            }
+            if (float_data.size() < 2*vrt_packet.num_rx_samps)
+                float_data.resize(2*vrt_packet.num_rx_samps);
 
-            uint32_t blocks = VRT_SAMPLES_PER_PACKET/1000;
+            // convert to float32
+            std::complex<float> scale(1.0/65535, 0);
+            vrt_convert_cf32(vrt_samples(buffer, &vrt_packet), (std::complex<float>*)float_data.data(), vrt_packet.num_rx_samps, NULL, NULL, &scale);
 
-            for (uint32_t i = 0; i < blocks; i++) {
-                if (sendto(sockfd, (char*)&float_data[i*1000*2], 1000*2*sizeof(float), 0,
+            // datagrams of up to 1000 samples
+            for (uint32_t i = 0; i < vrt_packet.num_rx_samps; i += 1000) {
+                uint32_t block = std::min(vrt_packet.num_rx_samps - i, (uint32_t)1000);
+                if (sendto(sockfd, (char*)&float_data[i*2], block*2*sizeof(float), 0,
                     (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
                 {
                     printf("UDP fail\n");
@@ -279,6 +284,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    vrt_msg_close(&vrt_msg);
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
 